@@ -105,6 +105,22 @@ rm -rf %{buildroot}
 %{_mandir}/man3/ping_iterator_get_info.3*
 %{_mandir}/man3/ping_send.3*
 %{_mandir}/man3/ping_setopt.3*
+%{_mandir}/man3/ping_iterator_get_window.3*
+%{_mandir}/man3/ping_iterator_get_history.3*
+%{_mandir}/man3/ping_get_results.3*
+%{_mandir}/man3/ping_iterator_get_changed.3*
+%{_mandir}/man3/ping_get_top.3*
+%{_mandir}/man3/ping_snapshot_foreach.3*
+%{_mandir}/man3/ping_event_read.3*
+%{_mandir}/man3/ping_shm_attach.3*
+%{_mandir}/man3/ping_transport_create.3*
+%{_mandir}/man3/ping_get_socket_drops.3*
+%{_mandir}/man3/ping_host_setopt.3*
+%{_mandir}/man3/ping_trace.3*
+%{_mandir}/man3/ping_iterator_get_responders.3*
+%{_mandir}/man3/ping_sweep.3*
+%{_mandir}/man3/ping_host_add_range.3*
+%{_mandir}/man3/ping_sketch_create.3*
 
 %files perl
 %defattr(-,root,root,-)
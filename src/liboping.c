@@ -32,6 +32,7 @@
 # include <inttypes.h>
 # include <errno.h>
 # include <assert.h>
+# include <limits.h>
 #else
 # error "You don't have the standard C99 header files installed"
 #endif /* STDC_HEADERS */
@@ -79,6 +80,9 @@
 #if HAVE_NETINET_IN_H
 # include <netinet/in.h>
 #endif
+#if HAVE_ARPA_INET_H
+# include <arpa/inet.h>
+#endif
 #if HAVE_NETINET_IP_H
 # include <netinet/ip.h>
 #endif
@@ -95,6 +99,63 @@
 # include <netinet/icmp6.h>
 #endif
 
+#if HAVE_MATH_H
+# include <math.h>
+#endif
+
+#if HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#if HAVE_NET_IF_H
+# include <net/if.h>
+#endif
+#if HAVE_LINUX_IF_PACKET_H
+# include <linux/if_packet.h>
+# include <linux/if_ether.h>
+#endif
+#if HAVE_LINUX_FILTER_H
+# include <linux/filter.h>
+#endif
+
+#if HAVE_SYS_IOCTL_H
+# include <sys/ioctl.h>
+#endif
+#if HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
+#if HAVE_NET_IF_ARP_H
+# include <net/if_arp.h>
+#endif
+#if HAVE_LINUX_IF_XDP_H
+# include <linux/if_xdp.h>
+#endif
+#if HAVE_LINUX_BPF_H
+# include <linux/bpf.h>
+# include <linux/if_link.h>
+#endif
+
+#if HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+/* Replies can be read from a packet ring, see PING_OPT_PACKET_RING. */
+#if HAVE_SYS_MMAN_H && HAVE_NET_IF_H && HAVE_LINUX_IF_PACKET_H \
+	&& HAVE_LINUX_FILTER_H && defined(TPACKET3_HDRLEN)
+# define HAVE_PACKET_RING 1
+#else
+# define HAVE_PACKET_RING 0
+#endif
+
+/* Echo requests can be sent with AF_XDP, see PING_OPT_XDP. */
+#if HAVE_PACKET_RING && HAVE_SYS_IOCTL_H && HAVE_SYS_SYSCALL_H \
+	&& HAVE_NET_IF_ARP_H && HAVE_LINUX_IF_XDP_H && HAVE_LINUX_BPF_H \
+	&& defined(__NR_bpf)
+# define HAVE_XDP 1
+#else
+# define HAVE_XDP 0
+#endif
+
 #include "oping.h"
 
 #if WITH_DEBUG
@@ -105,6 +166,308 @@
 
 #define PING_ERRMSG_LEN 256
 #define PING_TABLE_LEN 5381
+/* Large enough for a numeric IPv6 address with scope ID. */
+#define PING_ADDRSTR_LEN 64
+
+/* Upper bounds for the work done by ping_send() per wakeup: at most
+ * PING_RECV_BATCH replies are read from each socket before up to
+ * PING_SEND_BATCH echo requests are sent. */
+#ifdef MSG_DONTWAIT
+# define PING_RECV_BATCH 64
+#else
+# define MSG_DONTWAIT 0
+# define PING_RECV_BATCH 1
+#endif
+#define PING_SEND_BATCH 16
+
+/* Receive buffer space needed for one reply besides its payload: the ICMP and
+ * IP headers and the kernel's per-packet overhead. See ping_set_recvbuf(). */
+#define PING_RECVBUF_PER_HOST 1024
+
+/* Bytes read of each reply with PING_OPT_HEADERS_ONLY: an IPv4 header with all
+ * options and the ICMP header. */
+#define PING_RECV_HEADER_LEN (60 + ICMP_MINLEN)
+
+/* Bytes read of each packet by ping_trace(). Time exceeded messages quote the
+ * echo request after the IP and ICMP headers; the rest is not needed. */
+#define PING_TRACE_RECV_LEN 512
+
+/* Ranges added with ping_host_add_range() hold at most 2^PING_RANGE_BITS
+ * addresses. Each takes a pinghost_t and its timer, less than 400 bytes on
+ * 64 bit systems, so a range takes at most about 400 MB. Larger networks are
+ * left to ping_sweep(). */
+#define PING_RANGE_BITS 20
+
+/* Geometry of the packet ring, see PING_OPT_PACKET_RING. The kernel hands a
+ * block to user space when it is full or PING_RING_BLOCK_TIMEOUT milliseconds
+ * after its first packet. Packets are time stamped by the kernel, so the
+ * timeout delays reading, but does not change the measured latency. If there
+ * are more than PING_RING_FILTER_MAX hosts, the ring's filter accepts all
+ * echo replies instead of checking the identifiers. */
+#define PING_RING_BLOCK_SIZE    (1 << 16)
+#define PING_RING_BLOCK_NUM     32
+#define PING_RING_FRAME_SIZE    2048
+#define PING_RING_BLOCK_TIMEOUT 1
+#define PING_RING_FILTER_MAX    200
+
+/* Size and number of the frames of the AF_XDP UMEM, see PING_OPT_XDP, and
+ * the number of entries of each of its rings. Half of the frames are used for
+ * receiving, half for sending. */
+#define PING_XDP_FRAME_SIZE 2048
+#define PING_XDP_FRAME_NUM  4096
+#define PING_XDP_RING_SIZE  2048
+/* Offset of the Ethernet header in a frame, which aligns the IP header. */
+#define PING_XDP_HEADROOM   2
+
+/* From <linux/icmp.h>, which conflicts with <netinet/ip_icmp.h>. */
+#if HAVE_PACKET_RING && !defined(ICMP_FILTER)
+# define ICMP_FILTER 1
+#endif
+
+/* Latency sketches use logarithmically sized buckets, so that every quantile
+ * is returned with a relative error of at most PING_SKETCH_ACCURACY. Values
+ * below PING_SKETCH_MIN_VALUE (in milliseconds) are counted as zero. If more
+ * than PING_SKETCH_MAX_BUCKETS buckets would be needed, the lowest buckets
+ * are collapsed. */
+#define PING_SKETCH_ACCURACY    0.01
+#define PING_SKETCH_MIN_VALUE   0.001
+#define PING_SKETCH_MAX_BUCKETS 2048
+#define PING_SKETCH_GAMMA ((1.0 + PING_SKETCH_ACCURACY) / (1.0 - PING_SKETCH_ACCURACY))
+
+/* Windowed statistics are kept in a ring of PING_WINDOW_BUCKETS buckets,
+ * each covering PING_WINDOW_BUCKET_SECS seconds of wall clock time. */
+#define PING_WINDOW_BUCKETS     15
+#define PING_WINDOW_BUCKET_SECS 60
+
+struct ping_window_bucket
+{
+	/* Number of the time slot this bucket holds, i.e. time divided by
+	 * PING_WINDOW_BUCKET_SECS. */
+	time_t                   slot;
+	uint32_t                 received;
+	uint32_t                 dropped;
+	double                   latency_sum;
+	double                   latency_max;
+};
+typedef struct ping_window_bucket ping_window_bucket_t;
+
+/* Latencies in the history are stored as 8 bit codes on a logarithmic
+ * scale between PING_HISTORY_MIN_VALUE and PING_HISTORY_MAX_VALUE (in
+ * milliseconds). Neighbouring codes are 7.5% apart, so rounding to the
+ * nearest code keeps the relative error below 3.7%. That is enough for
+ * graphs; exact percentiles come from the sketch. Code zero stands for a
+ * timeout. */
+#define PING_HISTORY_MIN_VALUE 0.001
+#define PING_HISTORY_MAX_VALUE 100000.0
+#define PING_HISTORY_TIMEOUT   0
+#define PING_HISTORY_CODE_MAX  255
+#define PING_HISTORY_STEP \
+	(log (PING_HISTORY_MAX_VALUE / PING_HISTORY_MIN_VALUE) \
+	 / ((double) (PING_HISTORY_CODE_MAX - 1)))
+
+/* Ring of the last "size" results of a host, allocated in one block so a
+ * host without a history only pays for the pointer. */
+struct ping_history
+{
+	size_t                   size;
+	size_t                   num;
+	size_t                   index;
+	uint8_t                  codes[];
+};
+
+/* Number of attempts ping_shm_read() makes to read a consistent record
+ * before it gives up. */
+#define PING_SHM_READ_TRIES 1000
+
+/* Indexed binary heap of hosts, see ping_get_top(). The position of each
+ * host is kept in its top_index member, so that the heap can be updated
+ * whenever a result is recorded. */
+#define PING_TOP_NUM 3
+struct ping_heap
+{
+	struct pinghost        **hosts;
+	size_t                   hosts_num;
+	size_t                   hosts_size;
+};
+typedef struct ping_heap ping_heap_t;
+
+/* List of hosts as seen by ping_snapshot_foreach(). A new list is published
+ * whenever hosts were added or removed; old lists and removed hosts are
+ * freed once no reader may still use them. */
+struct ping_snapshot
+{
+	struct ping_snapshot    *next;
+	size_t                   hosts_num;
+	struct pinghost         *hosts[];
+};
+
+/* Snapshots and hosts which are no longer published, but may still be used
+ * by readers, see ping_snapshot_publish(). Hosts are linked with their "next"
+ * member. */
+struct ping_retired
+{
+	struct ping_snapshot    *snapshots;
+	struct pinghost         *hosts;
+};
+
+/* Sockets shared by several objects, see PING_OPT_TRANSPORT. The transport
+ * is freed when the last reference, held by the creator and by each attached
+ * object, is dropped. The attached objects may be used by different threads,
+ * so all members are accessed atomically or under "lock". */
+struct ping_transport
+{
+	int                      fd4;
+	int                      fd6;
+	/* idents: object owning each ICMP identifier. Replies are matched to
+	 * hosts by identifier, so every host of the attached objects claims
+	 * its own. The table is only touched where identifiers are used. */
+	struct pingobj         **idents;
+	/* lock: held for reading while a reply is passed on to the owner of
+	 * its identifier, and for writing while an object releases its
+	 * identifiers to detach, so that it is not freed under a forwarder. */
+	pthread_rwlock_t         lock;
+	unsigned int             refcount;
+};
+
+/* Echo reply read by an object sharing a transport for a host of another
+ * object, see ping_transport_forward(). "data" points to the "data_len"
+ * bytes of the payload that were read, of "payload_len" in total. */
+struct ping_reply
+{
+	struct ping_reply       *next;
+	int                      family;
+	uint16_t                 ident;
+	uint16_t                 seq;
+	struct timeval           time;
+	unsigned char            from[16];
+	int                      recv_ttl;
+	uint8_t                  recv_qos;
+	const char              *data;
+	size_t                   data_len;
+	size_t                   payload_len;
+};
+
+#if HAVE_XDP
+/* One of the rings shared with the kernel by an AF_XDP socket. */
+struct ping_xdp_ring
+{
+	uint32_t                *producer;
+	uint32_t                *consumer;
+	void                    *descs;
+	uint32_t                 size;
+	void                    *map;
+	size_t                   map_size;
+};
+
+/* AF_XDP socket with its UMEM and XDP program, see PING_OPT_XDP. */
+struct ping_xdp
+{
+	int                      fd;
+	/* ctl_fd: socket for interface and ARP requests */
+	int                      ctl_fd;
+	int                      prog_fd;
+	int                      link_fd;
+	int                      xsks_fd;
+	int                      idents_fd;
+	/* idents: identifiers currently redirected by the program */
+	uint8_t                 *idents;
+
+	char                     ifname[IFNAMSIZ];
+	int                      ifindex;
+	unsigned char            src_mac[ETH_ALEN];
+	struct in_addr           src_addr;
+	struct in_addr           netmask;
+	struct in_addr           gateway;
+
+	char                    *umem;
+	struct ping_xdp_ring     fill;
+	struct ping_xdp_ring     comp;
+	struct ping_xdp_ring     rx;
+	struct ping_xdp_ring     tx;
+	/* Frames available for sending */
+	uint64_t                 tx_free[PING_XDP_FRAME_NUM - PING_XDP_RING_SIZE];
+	size_t                   tx_free_num;
+	/* kick: frames were queued since the kernel was last woken up */
+	_Bool                    kick;
+};
+#endif /* HAVE_XDP */
+
+/* Host addition or removal queued by another thread, applied by the next
+ * call to ping_send(). Exactly one of "add" and "remove" is set. */
+struct ping_queue_entry
+{
+	struct ping_queue_entry *next;
+	struct pinghost         *add;
+	char                    *remove;
+};
+
+/* Payload of echo requests, see PING_OPT_DATA. It is shared by all hosts
+ * added while it was set and sent from where it is, without copying it. "sum"
+ * is the partial checksum of "data", see ping_checksum_add(). "data" is
+ * followed by a null byte. */
+struct ping_payload
+{
+	unsigned int             refcount;
+	size_t                   len;
+	uint32_t                 sum;
+	char                     data[];
+};
+typedef struct ping_payload ping_payload_t;
+
+struct ping_sketch
+{
+	/* counts[i] is the number of values v for which
+	 * gamma^(offset + i - 1) < v <= gamma^(offset + i). */
+	uint32_t                *counts;
+	int                      counts_num;
+	int                      offset;
+
+	uint64_t                 zero_count;
+	uint64_t                 count;
+	double                   min;
+	double                   max;
+};
+
+/* One probe of ping_trace(). */
+struct ping_trace_hop
+{
+	struct timeval           sent;
+	ping_hop_t               hop;
+};
+
+/* Path discovery state of a host, see ping_trace(). The probe with TTL t has
+ * the sequence number "sequence" + t - 1. "length" is the lowest TTL the host
+ * itself replied to, or zero if it did not reply. */
+struct ping_trace
+{
+	int                      sequence;
+	int                      hops_num;
+	int                      hops_size;
+	int                      length;
+	struct ping_trace_hop    hops[];
+};
+
+/* Source addresses of replies to echo requests to a group, see
+ * PING_OPT_RESPONDERS. */
+struct ping_responder_entry
+{
+	int                      family;
+	unsigned char            addr[16];
+	double                   latency;
+};
+
+struct ping_responders
+{
+	size_t                   num;
+	size_t                   size;
+	struct ping_responder_entry *entries;
+	/* Hash table of the entries, holding the number of an entry plus one
+	 * or zero for a free slot. Anybody on the segment can reply, so the
+	 * hash is keyed, see ping_responders_slot(). */
+	uint32_t                *index;
+	size_t                   index_size;
+	uint64_t                 key[2];
+};
 
 struct pinghost
 {
@@ -112,34 +475,171 @@ struct pinghost
 	char                    *username;
 	/* hostname: name returned by the reverse lookup */
 	char                    *hostname;
+	/* addr: NULL for hosts of a range, see ping_host_addr() */
 	struct sockaddr_storage *addr;
 	socklen_t                addrlen;
 	int                      addrfamily;
+	/* addrstr: numeric form of addr, see ping_host_name() */
+	char                    *addrstr;
 	int                      ident;
 	int                      sequence;
+	/* index: position in the list of hosts, set by ping_send() */
+	int                      index;
 	struct timeval          *timer;
 	double                   latency;
 	uint32_t                 dropped;
 	int                      recv_ttl;
 	uint8_t                  recv_qos;
-	char                    *data;
+	ping_payload_t          *payload;
+	/* Per host TTL and QoS, see ping_host_setopt(). -1 if the socket's
+	 * setting is used. */
+	int                      ttl;
+	int                      qos;
+	/* Per host source address and outgoing interface, see
+	 * ping_host_setopt(). NULL and zero if the socket's are used. */
+	struct sockaddr_storage *srcaddr;
+	unsigned int             srcif;
+
+	/* Result of the last ping_trace(), NULL if there was none. */
+	struct ping_trace       *trace;
+
+	/* Responders of the last round if the host is a multicast or
+	 * broadcast group, see PING_OPT_RESPONDERS. NULL otherwise. */
+	struct ping_responders  *responders;
+
+	/* Running statistics over all echo replies received from this host,
+	 * see ping_host_reply(). */
+	uint32_t                 received;
+	double                   latency_min;
+	double                   latency_max;
+	double                   latency_mean;
+	double                   latency_m2;
+	double                   latency_prev;
+	double                   jitter;
+	ping_sketch_t           *sketch;
+	ping_window_bucket_t    *window;
+
+	/* Ring of the last results, see PING_OPT_HISTORY. */
+	struct ping_history     *history;
+
+	/* reachable: 1 if the last result was a reply, 0 if it was a timeout
+	 * and -1 if there was no result yet */
+	int                      reachable;
+	_Bool                    latency_above;
+	/* changes: PING_CHANGE_* flags since the list was last read */
+	uint32_t                 changes;
+	struct pinghost         *changed_next;
+
+	/* Position of the host in the heaps of obj->top. */
+	uint32_t                 top_index[PING_TOP_NUM];
+
+	/* Result of the last round for ping_snapshot_foreach(), protected by
+	 * the sequence counter snap_seq, which is odd while it is written. */
+	unsigned int             snap_seq;
+	ping_result_t            snap;
+
+	/* Link layer address of the next hop, see PING_OPT_XDP. */
+	unsigned char            xdp_mac[6];
+	_Bool                    xdp_mac_valid;
 
 	void                    *context;
 
+	/* Block the host was allocated in, see ping_host_add_range(). NULL if
+	 * the host was allocated by itself. */
+	struct ping_range       *range;
+
 	struct pinghost         *next;
 	struct pinghost         *table_next;
 };
 
+/*
+ * A network given as address/prefix length, see ping_network_parse(). Only
+ * the last 32 bits of an address are counted, so that the addresses are
+ * numbered with a uint32_t.
+ */
+struct ping_network
+{
+	int                      family;
+	/* First address of the network, in network byte order. */
+	union
+	{
+		struct in_addr   addr4;
+		struct in6_addr  addr6;
+	} base;
+	/* Number of addresses in the network. */
+	uint64_t                 size;
+};
+
+/*
+ * Hosts added with ping_host_add_range() are allocated with a single call,
+ * followed by their timers and a bitmap of the hosts that have been removed.
+ * The network is stored once: the address of a host is derived from its
+ * index, see ping_host_addr(), and its name is only formatted when it is
+ * needed, see ping_host_name(). All hosts of a range share one identifier
+ * and are not entered into obj->table, replies are matched to them by their
+ * source address, see ping_range_lookup(). The block is freed once all of
+ * its hosts have been freed and the caller has released it with
+ * ping_range_release().
+ */
+struct ping_range
+{
+	/* Hosts of the block that have not been freed yet, plus one for the
+	 * caller until it releases the range. */
+	uint32_t                 refcount;
+	uint32_t                 hosts_num;
+	/* Hosts that have not been removed yet. Once there are none left, the
+	 * range is taken off obj->ranges and its identifier is released. */
+	uint32_t                 hosts_linked;
+	int                      ident;
+	struct ping_network      network;
+	struct ping_range       *next;
+	/* removed: bit i is set once host i has been removed. Accessed
+	 * atomically, see ping_range_get_host(). */
+	uint8_t                 *removed;
+	pinghost_t               hosts[];
+};
+
+/* The names of the hosts of a range point here until they are formatted,
+ * see ping_host_name(). */
+static char ping_range_unnamed[1];
+
+/*
+ * Table of the names of the hosts without a source of their own, to find
+ * duplicates of added hosts, see ping_host_find(). Open addressing with
+ * linear probing; removed hosts leave PING_NAMES_REMOVED behind, so that
+ * probing continues past them. Slots that have been used count towards the
+ * load, which is kept below one half: once it would be exceeded, the table
+ * is dropped and built again, with room to grow, when it is next used.
+ */
+struct ping_names
+{
+	pinghost_t             **slots;
+	size_t                   size;
+	/* used: slots that are not NULL, including removed hosts */
+	size_t                   used;
+};
+
 struct pingobj
 {
 	double                   timeout;
 	int                      ttl;
 	int                      addrfamily;
 	uint8_t                  qos;
-	char                    *data;
+	ping_payload_t          *payload;
+	/* Buffer for one reply, large enough for the largest payload. */
+	char                    *recv_buf;
+	size_t                   recv_buf_size;
 
 	int                      fd4;
 	int                      fd6;
+	/* transport: shared sockets, see PING_OPT_TRANSPORT. If set, fd4 and
+	 * fd6 are copies of the transport's sockets. */
+	ping_transport_t        *transport;
+	/* replies: echo replies for our hosts read by other objects sharing
+	 * the transport, pushed by their threads. A byte is written to
+	 * wake_fd[1] for each, to wake up ping_send(). */
+	struct ping_reply       *replies;
+	int                      wake_fd[2];
 
 	struct sockaddr         *srcaddr;
 	socklen_t                srcaddrlen;
@@ -149,10 +649,102 @@ struct pingobj
 	char                    set_mark;
 	int                     mark;
 
+	/* Receive buffer size, see PING_OPT_RECVBUF; zero sizes the buffer
+	 * from the number of hosts. recvbuf_hosts* is the number of hosts the
+	 * buffer of a socket was last sized for, zero if it has not been
+	 * sized yet. */
+	int                      recvbuf;
+	size_t                   recvbuf_hosts4;
+	size_t                   recvbuf_hosts6;
+	/* Packets dropped by the sockets because their receive buffer was
+	 * full, as last reported with SO_RXQ_OVFL. */
+	uint32_t                 drops4;
+	uint32_t                 drops6;
+
+	/* Busy polling, see PING_OPT_BUSY_POLL: microseconds the kernel may
+	 * spin on the device queue per receive call. Zero disables it. */
+	int                      busy_poll;
+
+	/* Only the headers of replies are read, see PING_OPT_HEADERS_ONLY.
+	 * With verify_payload, see PING_OPT_VERIFY_PAYLOAD, replies are read
+	 * in full and their payload is compared to the one sent. */
+	_Bool                    headers_only;
+	_Bool                    verify_payload;
+
+	/* Set once an IPv4 host is a group, see PING_OPT_RESPONDERS. */
+	_Bool                    broadcast;
+	/* Seconds replies from groups are waited for, see
+	 * PING_OPT_RESPONDER_WINDOW. */
+	double                   responder_window;
+
+	/* Probes sent per second by ping_sweep(), see PING_OPT_SWEEP_RATE. */
+	double                   sweep_rate;
+
+	/* Packet ring replies are read from instead of the raw sockets, see
+	 * PING_OPT_PACKET_RING. ring_block is the next block to read. */
+	int                      ring_fd;
+	char                    *ring;
+	size_t                   ring_block;
+	/* ring_stale: the identifiers changed since the filters of the ring
+	 * and the XDP program were last updated */
+	_Bool                    ring_stale;
+
+	/* AF_XDP transport for IPv4 hosts, see PING_OPT_XDP. */
+	struct ping_xdp         *xdp;
+
+	size_t                   history_size;
+
+	/* Hosts whose state changed, see ping_iterator_get_changed(). */
+	double                   latency_threshold;
+	pinghost_t              *changed_head;
+	pinghost_t              *changed_tail;
+	_Bool                    changed_read;
+
+	/* Heaps of all hosts, worst host first, see ping_get_top(). A heap is
+	 * built by the first query for its metric. */
+	ping_heap_t              top[PING_TOP_NUM];
+
+	/* Hosts visible to ping_snapshot_foreach() and hosts added or removed
+	 * with ping_host_queue_add() and ping_host_queue_remove(), see
+	 * ping_snapshot_publish(). */
+	struct ping_snapshot    *snapshot;
+	struct ping_retired      retired;
+	struct ping_retired      retired_wait;
+	unsigned int             snapshot_epoch;
+	unsigned int             snapshot_readers[2];
+	_Bool                    snapshot_stale;
+	struct ping_queue_entry *queue;
+
+	/* Single producer, single consumer ring of events, see
+	 * PING_OPT_EVENT_RING. The producer is ping_send(), the consumer
+	 * ping_event_read(). Both positions only ever grow; the ring size is
+	 * a power of two. */
+	ping_event_t            *events;
+	size_t                   events_size;
+	size_t                   events_head;
+	size_t                   events_tail;
+	uint64_t                 events_overflow;
+	/* Start of the current round, the send time of events of hosts whose
+	 * echo request could not be sent. */
+	struct timeval           events_round;
+
+	/* Shared memory table, see PING_OPT_SHM and ping_shm_publish(). */
+	char                    *shm_path;
+	ping_shm_header_t       *shm;
+	size_t                   shm_size;
+	_Bool                    shm_stale;
+
 	char                     errmsg[PING_ERRMSG_LEN];
 
+	/* List of hosts; tail is its last host, NULL if it is empty. */
 	pinghost_t              *head;
+	pinghost_t              *tail;
 	pinghost_t              *table[PING_TABLE_LEN];
+	/* Ranges with hosts left, see ping_range_lookup(). */
+	struct ping_range       *ranges;
+	/* Names of the hosts, see ping_host_find(). slots is NULL until the
+	 * table is first used. */
+	struct ping_names        names;
 };
 
 /*
@@ -250,33 +842,237 @@ static int ping_timeval_sub (struct timeval *tv1, struct timeval *tv2,
 	return (0);
 }
 
-static uint16_t ping_icmp4_checksum (char *buf, size_t len)
+/* ping_checksum_add adds the 16 bit words of "buf" to the partial checksum
+ * "sum". "buf" must start at an even offset of the checksummed data. */
+static uint32_t ping_checksum_add (uint32_t sum, const char *buf, size_t len)
 {
-	uint32_t sum = 0;
-	uint16_t ret = 0;
-
-	uint16_t *ptr;
+	uint16_t last = 0;
+	const uint16_t *ptr;
 
-	for (ptr = (uint16_t *) buf; len > 1; ptr++, len -= 2)
+	for (ptr = (const uint16_t *) buf; len > 1; ptr++, len -= 2)
+	{
 		sum += *ptr;
+		/* Fold early, so that large payloads do not overflow. */
+		if (sum & 0x80000000)
+			sum = (sum >> 16) + (sum & 0xFFFF);
+	}
 
 	if (len == 1)
 	{
-		*(char *) &ret = *(char *) ptr;
-		sum += ret;
+		*(char *) &last = *(const char *) ptr;
+		sum += last;
 	}
 
+	return (sum);
+}
+
+/* ping_checksum_fold returns the checksum for the partial checksum "sum". */
+static uint16_t ping_checksum_fold (uint32_t sum)
+{
 	/* Do this twice to get all possible carries.. */
 	sum = (sum >> 16) + (sum & 0xFFFF);
 	sum = (sum >> 16) + (sum & 0xFFFF);
 
-	ret = ~sum;
+	return ((uint16_t) ~sum);
+}
 
-	return (ret);
+static uint16_t ping_icmp4_checksum (char *buf, size_t len)
+{
+	return (ping_checksum_fold (ping_checksum_add (0, buf, len)));
+}
+
+/* ping_payload_create returns a payload holding a copy of "data", or NULL if
+ * no memory could be allocated. */
+static ping_payload_t *ping_payload_create (const void *data, size_t len)
+{
+	ping_payload_t *payload;
+
+	payload = malloc (sizeof (*payload) + len + 1);
+	if (payload == NULL)
+		return (NULL);
+
+	payload->refcount = 1;
+	payload->len = len;
+	memcpy (payload->data, data, len);
+	payload->data[len] = 0;
+	payload->sum = ping_checksum_add (0, payload->data, len);
+
+	return (payload);
+}
+
+/* Hosts may be resolved in other threads, see ping_host_queue_add(), so
+ * references are counted atomically. */
+static ping_payload_t *ping_payload_ref (ping_payload_t *payload)
+{
+	__atomic_add_fetch (&payload->refcount, 1, __ATOMIC_RELAXED);
+	return (payload);
+}
+
+static void ping_payload_unref (ping_payload_t *payload)
+{
+	if (payload == NULL)
+		return;
+	if (__atomic_sub_fetch (&payload->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+		free (payload);
+}
+
+/* ping_network_address fills "sa" with address number "index" of "net". */
+static socklen_t ping_network_address (const struct ping_network *net,
+		uint32_t index, struct sockaddr_storage *sa)
+{
+	if (net->family == AF_INET)
+	{
+		struct sockaddr_in *sa4 = (struct sockaddr_in *) sa;
+
+		memset (sa4, 0, sizeof (*sa4));
+		sa4->sin_family = AF_INET;
+		sa4->sin_addr.s_addr = htonl (ntohl (net->base.addr4.s_addr)
+				+ index);
+		return (sizeof (*sa4));
+	}
+	else
+	{
+		struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *) sa;
+		uint32_t last;
+
+		memset (sa6, 0, sizeof (*sa6));
+		sa6->sin6_family = AF_INET6;
+		sa6->sin6_addr = net->base.addr6;
+		memcpy (&last, sa6->sin6_addr.s6_addr + 12, sizeof (last));
+		last = htonl (ntohl (last) + index);
+		memcpy (sa6->sin6_addr.s6_addr + 12, &last, sizeof (last));
+		return (sizeof (*sa6));
+	}
+} /* socklen_t ping_network_address */
+
+/* ping_network_index sets "index" to the number of "addr", an in_addr or
+ * in6_addr of the family of "net", in "net". Returns zero if the address is
+ * part of the network. */
+static int ping_network_index (const struct ping_network *net,
+		const void *addr, uint32_t *index)
+{
+	uint32_t base;
+	uint32_t last;
+
+	if (net->family == AF_INET)
+	{
+		base = ntohl (net->base.addr4.s_addr);
+		last = ntohl (((const struct in_addr *) addr)->s_addr);
+	}
+	else
+	{
+		const struct in6_addr *addr6 = addr;
+
+		if (memcmp (addr6->s6_addr, net->base.addr6.s6_addr, 12) != 0)
+			return (-1);
+		memcpy (&base, net->base.addr6.s6_addr + 12, sizeof (base));
+		memcpy (&last, addr6->s6_addr + 12, sizeof (last));
+		base = ntohl (base);
+		last = ntohl (last);
+	}
+
+	if ((uint64_t) (last - base) >= net->size)
+		return (-1);
+
+	*index = last - base;
+	return (0);
+} /* int ping_network_index */
+
+/* ping_host_addr returns the address of "ph". Hosts of a range have no copy
+ * of their own, theirs is derived from their index into "buffer". */
+static const struct sockaddr *ping_host_addr (const pinghost_t *ph,
+		struct sockaddr_storage *buffer)
+{
+	if (ph->range == NULL)
+		return ((const struct sockaddr *) ph->addr);
+
+	ping_network_address (&ph->range->network,
+			(uint32_t) (ph - ph->range->hosts), buffer);
+	return ((const struct sockaddr *) buffer);
+}
+
+/* ping_range_removed returns non-zero if host "index" of "range" has been
+ * removed, see ping_range_remove(). */
+static _Bool ping_range_removed (const struct ping_range *range,
+		uint32_t index)
+{
+	return ((__atomic_load_n (range->removed + (index / 8),
+					__ATOMIC_ACQUIRE) & (1 << (index % 8))) != 0);
+}
+
+/* ping_range_lookup returns the host of a range with identifier "ident" and
+ * the address "addr", an in_addr or in6_addr of family "family". Returns
+ * NULL if there is no such host. */
+static pinghost_t *ping_range_lookup (const pingobj_t *obj, int family,
+		uint16_t ident, const void *addr)
+{
+	struct ping_range *range;
+
+	for (range = obj->ranges; range != NULL; range = range->next)
+	{
+		uint32_t index;
+
+		if ((range->ident != ident) || (range->network.family != family))
+			continue;
+
+		if ((ping_network_index (&range->network, addr, &index) != 0)
+				|| ping_range_removed (range, index))
+			continue;
+
+		return (range->hosts + index);
+	}
+
+	return (NULL);
+} /* pinghost_t *ping_range_lookup */
+
+/* ping_range_match returns the host of a range that an echo reply with
+ * identifier "ident" and sequence number "seq" from "addr" answers, or NULL
+ * if there is none. */
+static pinghost_t *ping_range_match (const pingobj_t *obj, int family,
+		uint16_t ident, uint16_t seq, const void *addr)
+{
+	pinghost_t *ph;
+
+	ph = ping_range_lookup (obj, family, ident, addr);
+	if ((ph == NULL) || !timerisset (ph->timer)
+			|| (((ph->sequence - 1) & 0xFFFF) != seq))
+		return (NULL);
+
+	return (ph);
+}
+
+/* ping_receive_verify checks the payload of a reply from "ph" if
+ * PING_OPT_VERIFY_PAYLOAD is set. "data_len" bytes of the payload were read,
+ * of "payload_len" in total. Returns zero if the reply is acceptable. */
+static int ping_receive_verify (pingobj_t *obj, pinghost_t *ph,
+		const char *data, size_t data_len, size_t payload_len)
+{
+	if (!obj->verify_payload)
+		return (0);
+
+	if ((data_len != payload_len) || (data_len != ph->payload->len))
+	{
+		dprintf ("Payload length mismatch: Got %zu of %zu bytes, "
+				"sent %zu\n", data_len, payload_len, ph->payload->len);
+		return (-1);
+	}
+
+	if (memcmp (data, ph->payload->data, data_len) != 0)
+	{
+		dprintf ("Payload mismatch for %s\n", ph->hostname);
+		return (-1);
+	}
+
+	return (0);
 }
 
+/* ping_receive_ipv4 parses a reply of "packet_len" bytes, of which the first
+ * "buffer_len" bytes are in "buffer". The checksum is only verified if the
+ * whole packet was read. If the reply is valid but not for one of our hosts,
+ * it is described in "unmatched", unless that is NULL, so that it can be
+ * passed on to the object it is for, see ping_transport_forward(). */
 static pinghost_t *ping_receive_ipv4 (pingobj_t *obj, char *buffer,
-		size_t buffer_len)
+		size_t buffer_len, size_t packet_len, struct ping_reply *unmatched)
 {
 	struct ip *ip_hdr;
 	struct icmp *icmp_hdr;
@@ -302,6 +1098,7 @@ static pinghost_t *ping_receive_ipv4 (pingobj_t *obj, char *buffer,
 
 	buffer     += ip_hdr_len;
 	buffer_len -= ip_hdr_len;
+	packet_len -= ip_hdr_len;
 
 	if (buffer_len < ICMP_MINLEN)
 		return (NULL);
@@ -313,17 +1110,20 @@ static pinghost_t *ping_receive_ipv4 (pingobj_t *obj, char *buffer,
 		return (NULL);
 	}
 
-	recv_checksum = icmp_hdr->icmp_cksum;
-	/* This writes to buffer. */
-	icmp_hdr->icmp_cksum = 0;
-	calc_checksum = ping_icmp4_checksum (buffer, buffer_len);
-
-	if (recv_checksum != calc_checksum)
+	if (buffer_len == packet_len)
 	{
-		dprintf ("Checksum missmatch: Got 0x%04"PRIx16", "
-				"calculated 0x%04"PRIx16"\n",
-				recv_checksum, calc_checksum);
-		return (NULL);
+		recv_checksum = icmp_hdr->icmp_cksum;
+		/* This writes to buffer. */
+		icmp_hdr->icmp_cksum = 0;
+		calc_checksum = ping_icmp4_checksum (buffer, buffer_len);
+
+		if (recv_checksum != calc_checksum)
+		{
+			dprintf ("Checksum missmatch: Got 0x%04"PRIx16", "
+					"calculated 0x%04"PRIx16"\n",
+					recv_checksum, calc_checksum);
+			return (NULL);
+		}
 	}
 
 	ident = ntohs (icmp_hdr->icmp_id);
@@ -354,12 +1154,31 @@ static pinghost_t *ping_receive_ipv4 (pingobj_t *obj, char *buffer,
 		break;
 	}
 
+	if (ptr == NULL)
+		ptr = ping_range_match (obj, AF_INET, ident, seq, &ip_hdr->ip_src);
+
 	if (ptr == NULL)
 	{
 		dprintf ("No match found for ident = 0x%04"PRIx16", seq = %"PRIu16"\n",
 				ident, seq);
+		if (unmatched != NULL)
+		{
+			unmatched->family      = AF_INET;
+			unmatched->ident       = ident;
+			unmatched->seq         = seq;
+			unmatched->recv_ttl    = (int)     ip_hdr->ip_ttl;
+			unmatched->recv_qos    = (uint8_t) ip_hdr->ip_tos;
+			unmatched->data        = buffer + ICMP_MINLEN;
+			unmatched->data_len    = buffer_len - ICMP_MINLEN;
+			unmatched->payload_len = packet_len - ICMP_MINLEN;
+		}
 	}
 
+	if ((ptr != NULL) && (ping_receive_verify (obj, ptr,
+					buffer + ICMP_MINLEN, buffer_len - ICMP_MINLEN,
+					packet_len - ICMP_MINLEN) != 0))
+		return (NULL);
+
 	if (ptr != NULL){
 		ptr->recv_ttl = (int)     ip_hdr->ip_ttl;
 		ptr->recv_qos = (uint8_t) ip_hdr->ip_tos;
@@ -383,8 +1202,15 @@ static pinghost_t *ping_receive_ipv4 (pingobj_t *obj, char *buffer,
 # endif
 #endif
 
+#ifndef ICMP6_TIME_EXCEEDED
+# define ICMP6_TIME_EXCEEDED 3
+#endif
+
+/* ping_receive_ipv6 parses a reply like ping_receive_ipv4(). The kernel
+ * verifies ICMPv6 checksums. "src" is the source address of the reply. */
 static pinghost_t *ping_receive_ipv6 (pingobj_t *obj, char *buffer,
-		size_t buffer_len)
+		size_t buffer_len, size_t packet_len, const struct in6_addr *src,
+		struct ping_reply *unmatched)
 {
 	struct icmp6_hdr *icmp_hdr;
 
@@ -399,6 +1225,7 @@ static pinghost_t *ping_receive_ipv6 (pingobj_t *obj, char *buffer,
 	icmp_hdr = (struct icmp6_hdr *) buffer;
 	buffer     += ICMP_MINLEN;
 	buffer_len -= ICMP_MINLEN;
+	packet_len -= ICMP_MINLEN;
 
 	if (icmp_hdr->icmp6_type != ICMP6_ECHO_REPLY)
 	{
@@ -415,9 +1242,8 @@ static pinghost_t *ping_receive_ipv6 (pingobj_t *obj, char *buffer,
 	ident = ntohs (icmp_hdr->icmp6_id);
 	seq   = ntohs (icmp_hdr->icmp6_seq);
 
-	/* We have to iterate over all hosts, since ICMPv6 packets may
-	 * be received on any raw v6 socket. */
-	for (ptr = obj->head; ptr != NULL; ptr = ptr->next)
+	for (ptr = obj->table[ident % PING_TABLE_LEN];
+			ptr != NULL; ptr = ptr->table_next)
 	{
 		dprintf ("hostname = %s, ident = 0x%04x, seq = %i\n",
 				ptr->hostname, ptr->ident, ((ptr->sequence - 1) & 0xFFFF));
@@ -441,1508 +1267,7502 @@ static pinghost_t *ping_receive_ipv6 (pingobj_t *obj, char *buffer,
 		break;
 	}
 
+	if (ptr == NULL)
+		ptr = ping_range_match (obj, AF_INET6, ident, seq, src);
+
 	if (ptr == NULL)
 	{
 		dprintf ("No match found for ident = 0x%04"PRIx16", "
 				"seq = %"PRIu16"\n",
 				ident, seq);
+		if (unmatched != NULL)
+		{
+			unmatched->family      = AF_INET6;
+			unmatched->ident       = ident;
+			unmatched->seq         = seq;
+			unmatched->recv_ttl    = -1;
+			unmatched->recv_qos    = 0;
+			unmatched->data        = buffer;
+			unmatched->data_len    = buffer_len;
+			unmatched->payload_len = packet_len;
+		}
 	}
 
+	if ((ptr != NULL) && (ping_receive_verify (obj, ptr,
+					buffer, buffer_len, packet_len) != 0))
+		return (NULL);
+
 	return (ptr);
 }
 
-static int ping_receive_one (pingobj_t *obj, struct timeval *now, int addrfam)
+static int ping_sketch_index (double value)
 {
-	int fd = addrfam == AF_INET6 ? obj->fd6 : obj->fd4;
-	struct timeval diff, pkt_now = *now;
-	pinghost_t *host = NULL;
-	int recv_ttl;
-	uint8_t recv_qos;
+	return ((int) ceil (log (value) / log (PING_SKETCH_GAMMA)));
+}
 
-	/*
-	 * Set up the receive buffer..
-	 */
-	struct msghdr msghdr;
-	struct cmsghdr *cmsg;
-	char payload_buffer[4096];
-	ssize_t payload_buffer_len;
-	char control_buffer[4096];
-	struct iovec payload_iovec;
+static double ping_sketch_value (int index)
+{
+	return (2.0 * pow (PING_SKETCH_GAMMA, (double) index)
+			/ (PING_SKETCH_GAMMA + 1.0));
+}
 
-	memset (&payload_iovec, 0, sizeof (payload_iovec));
-	payload_iovec.iov_base = payload_buffer;
-	payload_iovec.iov_len = sizeof (payload_buffer);
+/* ping_sketch_grow makes sure that buckets first to last can be counted. If
+ * that would exceed PING_SKETCH_MAX_BUCKETS, the lowest buckets are merged.
+ * Returns ENOMEM if allocating memory fails. */
+static int ping_sketch_grow (ping_sketch_t *sk, int first, int last)
+{
+	uint32_t *counts;
+	int counts_num;
+	int offset;
+	int i;
 
-	memset (&msghdr, 0, sizeof (msghdr));
-	/* unspecified source address */
-	msghdr.msg_name = NULL;
-	msghdr.msg_namelen = 0;
-	/* output buffer vector, see readv(2) */
-	msghdr.msg_iov = &payload_iovec;
-	msghdr.msg_iovlen = 1;
-	/* output buffer for control messages */
-	msghdr.msg_control = control_buffer;
-	msghdr.msg_controllen = sizeof (control_buffer);
-	/* flags; this is an output only field.. */
-	msghdr.msg_flags = 0;
-#ifdef MSG_XPG4_2
-	msghdr.msg_flags |= MSG_XPG4_2;
-#endif
+	if (sk->counts_num > 0)
+	{
+		if ((first >= sk->offset)
+				&& (last < sk->offset + sk->counts_num))
+			return (0);
 
-	payload_buffer_len = recvmsg (fd, &msghdr, /* flags = */ 0);
-	if (payload_buffer_len < 0)
+		if (first > sk->offset)
+			first = sk->offset;
+		if (last < sk->offset + sk->counts_num - 1)
+			last = sk->offset + sk->counts_num - 1;
+	}
+
+	offset = first;
+	counts_num = last - first + 1;
+	if (counts_num > PING_SKETCH_MAX_BUCKETS)
 	{
-#if WITH_DEBUG
-		char errbuf[PING_ERRMSG_LEN];
-		dprintf ("recvfrom: %s\n",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-#endif
-		return (-1);
+		offset = last - PING_SKETCH_MAX_BUCKETS + 1;
+		counts_num = PING_SKETCH_MAX_BUCKETS;
 	}
-	dprintf ("Read %zi bytes from fd = %i\n", payload_buffer_len, fd);
 
-	/* Iterate over all auxiliary data in msghdr */
-	recv_ttl = -1;
-	recv_qos = 0;
-	for (cmsg = CMSG_FIRSTHDR (&msghdr); /* {{{ */
-			cmsg != NULL;
-			cmsg = CMSG_NXTHDR (&msghdr, cmsg))
+	counts = calloc ((size_t) counts_num, sizeof (*counts));
+	if (counts == NULL)
+		return (ENOMEM);
+
+	for (i = 0; i < sk->counts_num; i++)
 	{
-		if (cmsg->cmsg_level == SOL_SOCKET)
-		{
-#ifdef SO_TIMESTAMP
-			if (cmsg->cmsg_type == SO_TIMESTAMP)
-				memcpy (&pkt_now, CMSG_DATA (cmsg), sizeof (pkt_now));
-#endif /* SO_TIMESTAMP */
-		}
-		else if (addrfam == AF_INET) /* {{{ */
-		{
-			if (cmsg->cmsg_level != IPPROTO_IP)
-				continue;
+		int index = sk->offset + i;
 
-			if (cmsg->cmsg_type == IP_TOS)
-			{
-				memcpy (&recv_qos, CMSG_DATA (cmsg),
-						sizeof (recv_qos));
-				dprintf ("TOSv4 = 0x%02"PRIx8";\n", recv_qos);
-			} else
-			if (cmsg->cmsg_type == IP_TTL)
-			{
-				memcpy (&recv_ttl, CMSG_DATA (cmsg),
-						sizeof (recv_ttl));
-				dprintf ("TTLv4 = %i;\n", recv_ttl);
-			}
-			else
-			{
-				dprintf ("Not handling option %i.\n",
-						cmsg->cmsg_type);
-			}
-		} /* }}} */
-		else if (addrfam == AF_INET6) /* {{{ */
-		{
-			if (cmsg->cmsg_level != IPPROTO_IPV6)
-				continue;
+		if (index < offset)
+			index = offset;
+		counts[index - offset] += sk->counts[i];
+	}
 
-			if (cmsg->cmsg_type == IPV6_TCLASS)
-			{
-				memcpy (&recv_qos, CMSG_DATA (cmsg),
-						sizeof (recv_qos));
-				dprintf ("TOSv6 = 0x%02"PRIx8";\n", recv_qos);
-			} else
-#ifdef IPV6_HOPLIMIT
-			if (cmsg->cmsg_type == IPV6_HOPLIMIT)
-			{
-				memcpy (&recv_ttl, CMSG_DATA (cmsg),
-						sizeof (recv_ttl));
-				dprintf ("TTLv6 = %i;\n", recv_ttl);
-			}
-			else
-#endif
-#ifdef IPV6_UNICAST_HOPS
-			if (cmsg->cmsg_type == IPV6_UNICAST_HOPS)
-			{
-				memcpy (&recv_ttl, CMSG_DATA (cmsg),
-						sizeof (recv_ttl));
-				dprintf ("TTLv6 = %i;\n", recv_ttl);
-			}
-			else
-#endif
-#ifdef IPV6_MULTICAST_HOPS
-			if (cmsg->cmsg_type == IPV6_MULTICAST_HOPS)
-			{
-				memcpy (&recv_ttl, CMSG_DATA (cmsg),
-						sizeof (recv_ttl));
-				dprintf ("TTLv6 = %i;\n", recv_ttl);
-			}
-			else
-#endif
-			{
-				dprintf ("Not handling option %i.\n",
-						cmsg->cmsg_type);
-			}
-		} /* }}} */
-		else
-		{
-			dprintf ("Don't know how to handle "
-					"unknown protocol %i.\n",
-					cmsg->cmsg_level);
-		}
-	} /* }}} for (cmsg) */
+	free (sk->counts);
+	sk->counts = counts;
+	sk->counts_num = counts_num;
+	sk->offset = offset;
 
-	if (addrfam == AF_INET)
-	{
-		host = ping_receive_ipv4 (obj, payload_buffer, payload_buffer_len);
-		if (host == NULL)
-			return (-1);
-	}
-	else if (addrfam == AF_INET6)
-	{
-		host = ping_receive_ipv6 (obj, payload_buffer, payload_buffer_len);
-		if (host == NULL)
-			return (-1);
-	}
-	else
-	{
-		dprintf ("ping_receive_one: Unknown address family %i.\n",
-				addrfam);
-		return (-1);
-	}
+	return (0);
+}
 
-	dprintf ("rcvd: %12i.%06i\n",
-			(int) pkt_now.tv_sec,
-			(int) pkt_now.tv_usec);
-	dprintf ("sent: %12i.%06i\n",
-			(int) host->timer->tv_sec,
-			(int) host->timer->tv_usec);
+/* ping_host_name returns the name "ph" was added with. Hosts added by address
+ * without a name are named by their numeric address, addrstr, which is only
+ * formatted when it is first needed. Hosts of a range share an empty addrstr
+ * until then and get one of their own, so that no room is set aside for the
+ * names of hosts whose names are never used. */
+static const char *ping_host_name (pinghost_t *ph)
+{
+	struct sockaddr_storage ss;
+	char buffer[PING_ADDRSTR_LEN];
+	char *addrstr;
 
-	if (ping_timeval_sub (&pkt_now, host->timer, &diff) < 0)
-	{
-		timerclear (host->timer);
-		return (-1);
-	}
+	if (ph->addrstr[0] != 0)
+		return (ph->username);
 
-	dprintf ("diff: %12i.%06i\n",
-			(int) diff.tv_sec,
-			(int) diff.tv_usec);
+	if (getnameinfo (ping_host_addr (ph, &ss), ph->addrlen,
+				buffer, sizeof (buffer), NULL, 0,
+				NI_NUMERICHOST) != 0)
+		return (ph->username);
 
-	if (recv_ttl >= 0)
-		host->recv_ttl = recv_ttl;
-	host->recv_qos = recv_qos;
+	if (ph->range == NULL)
+	{
+		memcpy (ph->addrstr, buffer, strlen (buffer) + 1);
+		return (ph->username);
+	}
 
-	host->latency  = ((double) diff.tv_usec) / 1000.0;
-	host->latency += ((double) diff.tv_sec)  * 1000.0;
+	if ((addrstr = strdup (buffer)) == NULL)
+		return (ph->username);
 
-	timerclear (host->timer);
+	if (ph->hostname == ph->addrstr)
+		ph->hostname = addrstr;
+	if (ph->username == ph->addrstr)
+		ph->username = addrstr;
+	ph->addrstr = addrstr;
 
-	return (0);
+	return (ph->username);
 }
 
-/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
- * Sending functions:                                                        *
- *                                                                           *
- * ping_send_all                                                             *
- * +-> ping_send_one_ipv4                                                    *
- * `-> ping_send_one_ipv6                                                    *
- * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-static ssize_t ping_sendto (pingobj_t *obj, pinghost_t *ph,
-		const void *buf, size_t buflen, int fd)
+/* ping_host_window returns the bucket of the window ring that counts events
+ * happening at time "now". The ring is allocated on first use and stale
+ * buckets are reset when they are reused. Returns NULL if allocating memory
+ * fails. */
+static ping_window_bucket_t *ping_host_window (pinghost_t *ph,
+		const struct timeval *now)
 {
-	ssize_t ret;
+	ping_window_bucket_t *b;
+	time_t slot = now->tv_sec / PING_WINDOW_BUCKET_SECS;
 
-	if (gettimeofday (ph->timer, NULL) == -1)
+	if (ph->window == NULL)
 	{
-		timerclear (ph->timer);
-		return (-1);
+		ph->window = calloc (PING_WINDOW_BUCKETS, sizeof (*ph->window));
+		if (ph->window == NULL)
+			return (NULL);
 	}
 
-	ret = sendto (fd, buf, buflen, 0,
-			(struct sockaddr *) ph->addr, ph->addrlen);
-
-	if (ret < 0)
+	b = ph->window + (slot % PING_WINDOW_BUCKETS);
+	if (b->slot != slot)
 	{
-#if defined(EHOSTUNREACH)
-		if (errno == EHOSTUNREACH)
-			return (0);
-#endif
-#if defined(ENETUNREACH)
-		if (errno == ENETUNREACH)
-			return (0);
-#endif
-		ping_set_errno (obj, errno);
+		memset (b, 0, sizeof (*b));
+		b->slot = slot;
 	}
 
-	return (ret);
+	return (b);
 }
 
-static int ping_send_one_ipv4 (pingobj_t *obj, pinghost_t *ph, int fd)
+static uint8_t ping_history_encode (double latency)
 {
-	struct icmp *icmp4;
-	int status;
-
-	char   buf[4096] = {0};
-	size_t buflen;
+	double code;
 
-	char *data;
-	size_t datalen;
+	if (latency < 0.0)
+		return (PING_HISTORY_TIMEOUT);
+	else if (latency <= PING_HISTORY_MIN_VALUE)
+		return (1);
 
-	dprintf ("ph->hostname = %s\n", ph->hostname);
-
-	icmp4 = (struct icmp *) buf;
-	*icmp4 = (struct icmp) {
-		.icmp_type = ICMP_ECHO,
-		.icmp_id   = htons (ph->ident),
-		.icmp_seq  = htons (ph->sequence),
-	};
+	code = 1.0 + log (latency / PING_HISTORY_MIN_VALUE) / PING_HISTORY_STEP;
+	if (code >= (double) PING_HISTORY_CODE_MAX)
+		return (PING_HISTORY_CODE_MAX);
+	return ((uint8_t) (code + 0.5));
+}
 
-	datalen = strlen (ph->data);
-	buflen = ICMP_MINLEN + datalen;
-	if (sizeof (buf) < buflen)
-		return (EINVAL);
+static double ping_history_decode (uint8_t code)
+{
+	if (code == PING_HISTORY_TIMEOUT)
+		return (-1.0);
+	return (PING_HISTORY_MIN_VALUE
+			* exp (((double) (code - 1)) * PING_HISTORY_STEP));
+}
 
-	data  = buf + ICMP_MINLEN;
-	memcpy (data, ph->data, datalen);
+/* ping_host_history_add appends the result of the last ping_send() call to
+ * the history of the host. If the size of the history has been changed with
+ * PING_OPT_HISTORY, the old history is discarded. */
+static void ping_host_history_add (pingobj_t *obj, pinghost_t *ph)
+{
+	struct ping_history *h = ph->history;
 
-	icmp4->icmp_cksum = ping_icmp4_checksum (buf, buflen);
+	if ((h != NULL) && (h->size != obj->history_size))
+	{
+		free (h);
+		h = ph->history = NULL;
+	}
 
-	dprintf ("Sending ICMPv4 package with ID 0x%04x\n", ph->ident);
+	if (obj->history_size == 0)
+		return;
 
-	status = ping_sendto (obj, ph, buf, buflen, fd);
-	if (status < 0)
+	if (h == NULL)
 	{
-		perror ("ping_sendto");
-		return (-1);
+		h = calloc (1, sizeof (*h) + obj->history_size);
+		if (h == NULL)
+			return;
+		h->size = obj->history_size;
+		ph->history = h;
 	}
 
-	dprintf ("sendto: status = %i\n", status);
-
-	return (0);
+	h->codes[h->index] = ping_history_encode (ph->latency);
+	h->index = (h->index + 1) % h->size;
+	if (h->num < h->size)
+		h->num++;
 }
 
-static int ping_send_one_ipv6 (pingobj_t *obj, pinghost_t *ph, int fd)
+#if HAVE_SYS_MMAN_H
+/* ping_shm_records returns the records following the header of a table. */
+static ping_shm_record_t *ping_shm_records (ping_shm_header_t *shm)
 {
-	struct icmp6_hdr *icmp6;
-	int status;
-
-	char buf[4096] = {0};
-	int  buflen;
-
-	char *data;
-	int   datalen;
-
-	dprintf ("ph->hostname = %s\n", ph->hostname);
-
-	icmp6 = (struct icmp6_hdr *) buf;
-	*icmp6 = (struct icmp6_hdr) {
-		.icmp6_type  = ICMP6_ECHO_REQUEST,
-		.icmp6_id    = htons (ph->ident),
-		.icmp6_seq   = htons (ph->sequence),
-	};
+	return ((ping_shm_record_t *) (((char *) shm) + shm->header_size));
+}
 
-	datalen = strlen (ph->data);
-	buflen = sizeof (*icmp6) + datalen;
-	if (sizeof (buf) < buflen)
-		return (EINVAL);
+/* ping_shm_unmap marks the current table as obsolete, so that readers attach
+ * to the new one, and unmaps it. */
+static void ping_shm_unmap (pingobj_t *obj)
+{
+	if (obj->shm == NULL)
+		return;
 
-	data  = buf + ICMP_MINLEN;
-	memcpy (data, ph->data, datalen);
+	__atomic_store_n (&obj->shm->obsolete, 1, __ATOMIC_RELEASE);
+	munmap (obj->shm, obj->shm_size);
+	obj->shm = NULL;
+	obj->shm_size = 0;
+}
 
-	/* The checksum will be calculated by the TCP/IP stack. */
+/* ping_shm_create creates a new table with room for at least "num" records.
+ * The file is created under a temporary name and renamed, so readers never
+ * see a partially initialized table. */
+static int ping_shm_create (pingobj_t *obj, size_t num)
+{
+	char *tmp_path;
+	size_t tmp_path_size;
+	ping_shm_header_t *shm;
+	size_t records_size = 16;
+	size_t size;
+	int fd;
 
-	dprintf ("Sending ICMPv6 package with ID 0x%04x\n", ph->ident);
+	while (records_size < num)
+		records_size *= 2;
+	size = sizeof (*shm) + records_size * sizeof (ping_shm_record_t);
 
-	status = ping_sendto (obj, ph, buf, buflen, fd);
-	if (status < 0)
+	tmp_path_size = strlen (obj->shm_path) + 16;
+	if ((tmp_path = malloc (tmp_path_size)) == NULL)
 	{
-		perror ("ping_sendto");
+		ping_set_errno (obj, errno);
 		return (-1);
 	}
+	snprintf (tmp_path, tmp_path_size, "%s.%i", obj->shm_path,
+			(int) getpid ());
 
-	dprintf ("sendto: status = %i\n", status);
-
-	return (0);
-}
-
-static int ping_send_one (pingobj_t *obj, pinghost_t *ptr, int fd)
-{
-	if (gettimeofday (ptr->timer, NULL) == -1)
+	fd = open (tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
 	{
-		/* start timer.. The GNU `ping6' starts the timer before
-		 * sending the packet, so I will do that too */
-#if WITH_DEBUG
-		char errbuf[PING_ERRMSG_LEN];
-		dprintf ("gettimeofday: %s\n",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-#endif
-		timerclear (ptr->timer);
+		ping_set_errno (obj, errno);
+		free (tmp_path);
 		return (-1);
 	}
-	else
-	{
-		dprintf ("timer set for hostname = %s\n", ptr->hostname);
-	}
 
-	if (ptr->addrfamily == AF_INET6)
+	if (ftruncate (fd, (off_t) size) != 0)
 	{
-		dprintf ("Sending ICMPv6 echo request to `%s'\n", ptr->hostname);
-		if (ping_send_one_ipv6 (obj, ptr, fd) != 0)
-		{
-			timerclear (ptr->timer);
-			return (-1);
-		}
+		ping_set_errno (obj, errno);
+		close (fd);
+		unlink (tmp_path);
+		free (tmp_path);
+		return (-1);
 	}
-	else if (ptr->addrfamily == AF_INET)
+
+	shm = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close (fd);
+	if (shm == MAP_FAILED)
 	{
-		dprintf ("Sending ICMPv4 echo request to `%s'\n", ptr->hostname);
-		if (ping_send_one_ipv4 (obj, ptr, fd) != 0)
-		{
-			timerclear (ptr->timer);
-			return (-1);
-		}
+		ping_set_errno (obj, errno);
+		unlink (tmp_path);
+		free (tmp_path);
+		return (-1);
 	}
-	else /* this should not happen */
+
+	/* The file is zeroed by ftruncate(), so all records start out
+	 * unused with an even sequence counter. */
+	shm->magic        = PING_SHM_MAGIC;
+	shm->version      = PING_SHM_VERSION;
+	shm->header_size  = (uint32_t) sizeof (*shm);
+	shm->record_size  = (uint32_t) sizeof (ping_shm_record_t);
+	shm->records_size = (uint32_t) records_size;
+	shm->records_num  = 0;
+	shm->obsolete     = 0;
+
+	if (rename (tmp_path, obj->shm_path) != 0)
 	{
-		dprintf ("Unknown address family: %i\n", ptr->addrfamily);
-		timerclear (ptr->timer);
+		ping_set_errno (obj, errno);
+		munmap (shm, size);
+		unlink (tmp_path);
+		free (tmp_path);
 		return (-1);
 	}
+	free (tmp_path);
 
-	ptr->sequence++;
-
+	ping_shm_unmap (obj);
+	obj->shm = shm;
+	obj->shm_size = size;
 	return (0);
 }
 
-/*
- * Set the TTL of a socket protocol independently.
- */
-static int ping_set_ttl (pingobj_t *obj, int ttl)
+/* ping_shm_publish writes the result of the last round of each host to the
+ * shared memory table. Each record is protected by a sequence lock like the
+ * results read by ping_snapshot_foreach(), see ping_host_publish(). If hosts
+ * were added or removed, the names are rewritten as well and the table is
+ * replaced if it is too small. Returns zero upon success and -1 if the
+ * table could not be created, in which case the error is set. */
+static int ping_shm_publish (pingobj_t *obj)
 {
-	int ret = 0;
-	char errbuf[PING_ERRMSG_LEN];
+	ping_shm_record_t *records;
+	pinghost_t *ph;
+	struct timeval now;
+	double time;
+	size_t num = 0;
+	size_t i;
 
-	if (obj->fd4 != -1)
+	if (obj->shm_path == NULL)
+		return (0);
+
+	for (ph = obj->head; ph != NULL; ph = ph->next)
+		num++;
+
+	if ((obj->shm == NULL) || (num > obj->shm->records_size))
 	{
-		if (setsockopt (obj->fd4, IPPROTO_IP, IP_TTL,
-				&ttl, sizeof (ttl)))
-		{
-			ret = errno;
-			ping_set_error (obj, "ping_set_ttl",
-					sstrerror (ret, errbuf, sizeof (errbuf)));
-			dprintf ("Setting TTLv4 failed: %s\n", errbuf);
-		}
+		if (ping_shm_create (obj, num) != 0)
+			return (-1);
+		obj->shm_stale = 1;
 	}
 
-	if (obj->fd6 != -1)
+	gettimeofday (&now, NULL);
+	time = ((double) now.tv_sec) + (((double) now.tv_usec) / 1000000.0);
+
+	records = ping_shm_records (obj->shm);
+	for (ph = obj->head, i = 0; ph != NULL; ph = ph->next, i++)
 	{
-		dprintf ("Setting TTLv6 to %i\n", ttl);
-		if (setsockopt (obj->fd6, IPPROTO_IPV6, IPV6_UNICAST_HOPS,
-				&ttl, sizeof (ttl)))
+		ping_shm_record_t *r = records + i;
+		uint32_t seq = r->seq;
+
+		__atomic_store_n (&r->seq, seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence (__ATOMIC_RELEASE);
+
+		if (obj->shm_stale)
 		{
-			ret = errno;
-			ping_set_error (obj, "ping_set_ttl",
-					sstrerror (ret, errbuf, sizeof (errbuf)));
-			dprintf ("Setting TTLv6 failed: %s\n", errbuf);
+			snprintf (r->hostname, sizeof (r->hostname), "%s",
+					ping_host_name (ph));
+			snprintf (r->address, sizeof (r->address), "%s",
+					ph->addrstr);
+			r->family = ph->addrfamily;
 		}
+		r->status       = ph->snap.status;
+		r->sequence     = (uint32_t) ph->sequence;
+		r->received     = ph->received;
+		r->dropped      = ph->dropped;
+		r->latency      = ph->latency;
+		r->latency_mean = (ph->received > 0) ? ph->latency_mean : -1.0;
+		r->time         = time;
+
+		__atomic_store_n (&r->seq, seq + 2, __ATOMIC_RELEASE);
 	}
 
-	return (ret);
+	__atomic_store_n (&obj->shm->records_num, (uint32_t) num,
+			__ATOMIC_RELEASE);
+	obj->shm_stale = 0;
+	return (0);
 }
+#endif /* HAVE_SYS_MMAN_H */
 
-/*
- * Set the TOS of a socket protocol independently.
- *
- * Using SOL_SOCKET / SO_PRIORITY might be a protocol independent way to
- * set this. See socket(7) for details.
- */
-static int ping_set_qos (pingobj_t *obj, uint8_t qos)
+/* ping_event_push appends an event for the host's last echo request to the
+ * event ring, if enabled. A negative latency denotes a timeout. If the ring
+ * is full, the event is dropped and counted. */
+static void ping_event_push (pingobj_t *obj, const pinghost_t *ph,
+		double latency)
 {
-	int ret = 0;
-	char errbuf[PING_ERRMSG_LEN];
+	ping_event_t *ev;
+	size_t head;
 
-	if (obj->fd4 != -1)
+	if (obj->events == NULL)
+		return;
+
+	head = obj->events_head;
+	if ((head - __atomic_load_n (&obj->events_tail, __ATOMIC_ACQUIRE))
+			>= obj->events_size)
 	{
-		dprintf ("Setting TP_TOS to %#04"PRIx8"\n", qos);
-		if (setsockopt (obj->fd4, IPPROTO_IP, IP_TOS,
-				&qos, sizeof (qos)))
-		{
-			ret = errno;
-			ping_set_error (obj, "ping_set_qos",
-					sstrerror (ret, errbuf, sizeof (errbuf)));
-			dprintf ("Setting TP_TOS failed: %s\n", errbuf);
-		}
+		__atomic_add_fetch (&obj->events_overflow, 1, __ATOMIC_RELAXED);
+		return;
 	}
 
-	if (obj->fd6 != -1)
-	{
-		/* IPV6_TCLASS requires an "int". */
-		int tmp = (int) qos;
+	ev = obj->events + (head & (obj->events_size - 1));
+	ev->index     = ph->index;
+	ev->sequence  = (unsigned int) ph->sequence;
+	/* The timer is cleared if sending failed, and when the responder
+	 * window of a group closed. */
+	ev->send_time = timerisset (ph->timer) ? *ph->timer : obj->events_round;
+	ev->latency   = latency;
+	ev->context   = ph->context;
 
-		dprintf ("Setting IPV6_TCLASS to %#04"PRIx8" (%i)\n", qos, tmp);
-		if (setsockopt (obj->fd6, IPPROTO_IPV6, IPV6_TCLASS,
-			&tmp, sizeof (tmp)))
-		{
-			ret = errno;
-			ping_set_error (obj, "ping_set_qos",
-					sstrerror (ret, errbuf, sizeof (errbuf)));
-			dprintf ("Setting IPV6_TCLASS failed: %s\n", errbuf);
-		}
+	__atomic_store_n (&obj->events_head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* ping_top_key returns the value a host is ranked by in the heap of the
+ * given metric, or a negative value if there is no data yet. A host whose
+ * last echo request timed out has an infinite latency, so that it does not
+ * keep the rank of its last reply. */
+static double ping_top_key (const pinghost_t *ph, int metric)
+{
+	switch (metric)
+	{
+		case PING_TOP_LATENCY:
+			if (ph->reachable == 0)
+				return (HUGE_VAL);
+			return ((ph->received > 0) ? ph->latency_prev : -1.0);
+		case PING_TOP_LOSS:
+			if ((ph->received + ph->dropped) == 0)
+				return (-1.0);
+			return (((double) ph->dropped)
+					/ ((double) (ph->received + ph->dropped)));
+		case PING_TOP_JITTER:
+			return ((ph->received > 1) ? ph->jitter : -1.0);
 	}
 
-	return (ret);
+	return (-1.0);
 }
 
-static int ping_get_ident (void)
+static void ping_heap_set (ping_heap_t *heap, int metric, size_t i,
+		pinghost_t *ph)
 {
-	int fd;
-	static int did_seed = 0;
+	heap->hosts[i] = ph;
+	ph->top_index[metric] = (uint32_t) i;
+}
 
-	int retval;
+static void ping_heap_up (ping_heap_t *heap, int metric, size_t i)
+{
+	pinghost_t *ph = heap->hosts[i];
+	double key = ping_top_key (ph, metric);
 
-	if (did_seed == 0)
+	while (i > 0)
 	{
-		if ((fd = open ("/dev/urandom", O_RDONLY)) != -1)
-		{
-			unsigned int seed;
+		size_t parent = (i - 1) / 2;
 
-			if (read (fd, &seed, sizeof (seed)) != -1)
-			{
-				did_seed = 1;
-				dprintf ("Random seed:   %#x\n", seed);
-				srandom (seed);
-			}
+		if (ping_top_key (heap->hosts[parent], metric) >= key)
+			break;
 
-			close (fd);
-		}
-#if WITH_DEBUG
-		else
+		ping_heap_set (heap, metric, i, heap->hosts[parent]);
+		i = parent;
+	}
+
+	ping_heap_set (heap, metric, i, ph);
+}
+
+static void ping_heap_down (ping_heap_t *heap, int metric, size_t i)
+{
+	pinghost_t *ph = heap->hosts[i];
+	double key = ping_top_key (ph, metric);
+
+	while (42)
+	{
+		size_t child = (2 * i) + 1;
+		double child_key;
+
+		if (child >= heap->hosts_num)
+			break;
+
+		child_key = ping_top_key (heap->hosts[child], metric);
+		if ((child + 1) < heap->hosts_num)
 		{
-			char errbuf[PING_ERRMSG_LEN];
-			dprintf ("open (/dev/urandom): %s\n",
-					sstrerror (errno, errbuf, sizeof (errbuf)));
+			double right_key = ping_top_key (heap->hosts[child + 1], metric);
+			if (right_key > child_key)
+			{
+				child++;
+				child_key = right_key;
+			}
 		}
-#endif
-	}
 
-	retval = (int) random ();
+		if (key >= child_key)
+			break;
 
-	dprintf ("Random number: %#x\n", retval);
+		ping_heap_set (heap, metric, i, heap->hosts[child]);
+		i = child;
+	}
 
-	return (retval);
+	ping_heap_set (heap, metric, i, ph);
 }
 
-static pinghost_t *ping_alloc (void)
+static void ping_heap_free (ping_heap_t *heap)
 {
-	pinghost_t *ph;
-	size_t      ph_size;
+	free (heap->hosts);
+	heap->hosts = NULL;
+	heap->hosts_num = 0;
+	heap->hosts_size = 0;
+}
 
-	ph_size = sizeof (pinghost_t)
-		+ sizeof (struct sockaddr_storage)
-		+ sizeof (struct timeval);
+/* ping_heap_insert adds a host to all heaps that have been built. If memory
+ * runs out, the heap is dropped and built again by the next query. */
+static void ping_heap_insert (pingobj_t *obj, pinghost_t *ph)
+{
+	int metric;
 
-	ph = (pinghost_t *) malloc (ph_size);
-	if (ph == NULL)
-		return (NULL);
+	for (metric = 0; metric < PING_TOP_NUM; metric++)
+	{
+		ping_heap_t *heap = obj->top + metric;
 
-	memset (ph, '\0', ph_size);
+		if (heap->hosts == NULL)
+			continue;
 
-	ph->timer   = (struct timeval *) (ph + 1);
-	ph->addr    = (struct sockaddr_storage *) (ph->timer + 1);
+		if (heap->hosts_num >= heap->hosts_size)
+		{
+			size_t size = 2 * heap->hosts_size;
+			pinghost_t **tmp;
 
-	ph->addrlen = sizeof (struct sockaddr_storage);
-	ph->latency = -1.0;
-	ph->dropped = 0;
-	ph->ident   = ping_get_ident () & 0xFFFF;
+			tmp = realloc (heap->hosts, size * sizeof (*tmp));
+			if (tmp == NULL)
+			{
+				ping_heap_free (heap);
+				continue;
+			}
+			heap->hosts = tmp;
+			heap->hosts_size = size;
+		}
 
-	return (ph);
+		heap->hosts[heap->hosts_num] = ph;
+		heap->hosts_num++;
+		ping_heap_up (heap, metric, heap->hosts_num - 1);
+	}
 }
 
-static void ping_free (pinghost_t *ph)
+static void ping_heap_remove (pingobj_t *obj, pinghost_t *ph)
 {
-	if (ph == NULL)
-		return;
+	int metric;
+
+	for (metric = 0; metric < PING_TOP_NUM; metric++)
+	{
+		ping_heap_t *heap = obj->top + metric;
+		size_t i = ph->top_index[metric];
+
+		if (heap->hosts == NULL)
+			continue;
 
-	free (ph->username);
-	free (ph->hostname);
-	free (ph->data);
+		assert (heap->hosts[i] == ph);
+		heap->hosts_num--;
+		if (i == heap->hosts_num)
+			continue;
 
-	free (ph);
+		ping_heap_set (heap, metric, i, heap->hosts[heap->hosts_num]);
+		ping_heap_up (heap, metric, i);
+		ping_heap_down (heap, metric, heap->hosts[i]->top_index[metric]);
+	}
 }
 
-/* ping_open_socket opens, initializes and returns a new raw socket to use for
- * ICMPv4 or ICMPv6 packets. addrfam must be either AF_INET or AF_INET6. On
- * error, -1 is returned and obj->errmsg is set appropriately. */
-static int ping_open_socket(pingobj_t *obj, int addrfam)
+/* ping_heap_update restores the heap order after a result of the host has
+ * been recorded. */
+static void ping_heap_update (pingobj_t *obj, pinghost_t *ph)
 {
-	int fd;
-	if (addrfam == AF_INET6)
-	{
-		fd = socket(addrfam, SOCK_RAW, IPPROTO_ICMPV6);
-	}
-	else if (addrfam == AF_INET)
-	{
-		fd = socket(addrfam, SOCK_RAW, IPPROTO_ICMP);
-	}
-	else /* this should not happen */
+	int metric;
+
+	for (metric = 0; metric < PING_TOP_NUM; metric++)
 	{
-		ping_set_error (obj, "ping_open_socket", "Unknown address family");
-		dprintf ("Unknown address family: %i\n", addrfam);
-		return -1;
+		ping_heap_t *heap = obj->top + metric;
+
+		if (heap->hosts == NULL)
+			continue;
+
+		ping_heap_up (heap, metric, ph->top_index[metric]);
+		ping_heap_down (heap, metric, ph->top_index[metric]);
 	}
+}
 
-	if (fd == -1)
+/* ping_changed_clear discards the list of changed hosts. Only the hosts on
+ * the list are touched, so this does not depend on the number of hosts. */
+static void ping_changed_clear (pingobj_t *obj)
+{
+	pinghost_t *ptr = obj->changed_head;
+
+	while (ptr != NULL)
 	{
-		ping_set_errno (obj, errno);
-#if WITH_DEBUG
-		char errbuf[PING_ERRMSG_LEN];
-		dprintf ("socket: %s\n",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-#endif
-		return -1;
+		pinghost_t *next = ptr->changed_next;
+
+		ptr->changes = 0;
+		ptr->changed_next = NULL;
+		ptr = next;
 	}
-	else if (fd >= FD_SETSIZE)
+
+	obj->changed_head = NULL;
+	obj->changed_tail = NULL;
+	obj->changed_read = 0;
+}
+
+/* ping_host_changed flags a change of the host's state and appends the host
+ * to the object's list of changed hosts, unless it is already on it. */
+static void ping_host_changed (pingobj_t *obj, pinghost_t *ph,
+		uint32_t changes)
+{
+	if (ph->changes == 0)
 	{
-		ping_set_errno (obj, EMFILE);
-		dprintf ("socket(2) returned file descriptor %d, which is above the file "
-			 "descriptor limit for select(2) (FD_SETSIZE = %d)\n",
-			 fd, FD_SETSIZE);
-		close (fd);
-		return -1;
+		if (obj->changed_tail == NULL)
+			obj->changed_head = ph;
+		else
+			obj->changed_tail->changed_next = ph;
+		obj->changed_tail = ph;
 	}
 
-	if (obj->srcaddr != NULL)
-	{
-		assert (obj->srcaddrlen > 0);
-		assert (obj->srcaddrlen <= sizeof (struct sockaddr_storage));
+	ph->changes |= changes;
+}
 
-		if (bind (fd, obj->srcaddr, obj->srcaddrlen) == -1)
-		{
-			ping_set_errno (obj, errno);
-#if WITH_DEBUG
-			char errbuf[PING_ERRMSG_LEN];
-			dprintf ("bind: %s\n",
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-#endif
-			close (fd);
-			return -1;
-		}
-	}
+/* ping_host_reply records an echo reply with the given latency (in
+ * milliseconds), received at time "now". The variance is kept using Welford's
+ * online algorithm and the jitter is the interarrival jitter defined in
+ * RFC 3550, section 6.4.1, so the memory used does not grow with the number
+ * of replies. */
+static void ping_host_reply (pingobj_t *obj, pinghost_t *ph, double latency,
+		const struct timeval *now)
+{
+	ping_window_bucket_t *b;
+	double delta;
+	uint32_t changes = 0;
 
-#ifdef SO_BINDTODEVICE
-	if (obj->device != NULL)
+	ph->latency = latency;
+	ph->received++;
+
+	if (ph->reachable != 1)
+		changes |= PING_CHANGE_UP;
+	ph->reachable = 1;
+
+	if ((obj->latency_threshold > 0.0)
+			&& ((latency > obj->latency_threshold) != ph->latency_above))
 	{
-		if (setsockopt (fd, SOL_SOCKET, SO_BINDTODEVICE,
-				obj->device, strlen (obj->device) + 1) != 0)
-		{
-			ping_set_errno (obj, errno);
-#if WITH_DEBUG
-			char errbuf[PING_ERRMSG_LEN];
-			dprintf ("setsockopt (SO_BINDTODEVICE): %s\n",
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-#endif
-			close (fd);
-			return -1;
-		}
+		ph->latency_above = !ph->latency_above;
+		changes |= PING_CHANGE_LATENCY;
 	}
-#endif /* SO_BINDTODEVICE */
-#ifdef SO_MARK
-	if (obj->set_mark)
+
+	if (changes != 0)
+		ping_host_changed (obj, ph, changes);
+
+	ping_event_push (obj, ph, latency);
+
+	if ((ph->received == 1) || (ph->latency_min > latency))
+		ph->latency_min = latency;
+	if ((ph->received == 1) || (ph->latency_max < latency))
+		ph->latency_max = latency;
+
+	delta = latency - ph->latency_mean;
+	ph->latency_mean += delta / ((double) ph->received);
+	ph->latency_m2 += delta * (latency - ph->latency_mean);
+
+	if (ph->received > 1)
 	{
-		if (setsockopt(fd, SOL_SOCKET, SO_MARK,
-				&obj->mark, sizeof(obj->mark)) != 0)
-		{
-			ping_set_errno (obj, errno);
-#if WITH_DEBUG
-			char errbuf[PING_ERRMSG_LEN];
-			dprintf ("setsockopt (SO_MARK): %s\n",
-				 sstrerror (errno, errbuf, sizeof (errbuf)));
-#endif
-			close (fd);
-			return -1;
-		}
+		delta = latency - ph->latency_prev;
+		if (delta < 0.0)
+			delta = -delta;
+		ph->jitter += (delta - ph->jitter) / 16.0;
 	}
-#endif
-#ifdef SO_TIMESTAMP
-	if (1) /* {{{ */
-	{
-		int status = setsockopt (fd, SOL_SOCKET, SO_TIMESTAMP,
-		                         &(int){1}, sizeof(int));
-		if (status != 0)
-		{
-			ping_set_errno (obj, errno);
-#if WITH_DEBUG
-			char errbuf[PING_ERRMSG_LEN];
-			dprintf ("setsockopt (SO_TIMESTAMP): %s\n",
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-#endif
-			close (fd);
-			return -1;
-		}
-	} /* }}} if (1) */
-#endif /* SO_TIMESTAMP */
+	ph->latency_prev = latency;
 
-	if (addrfam == AF_INET)
-	{
-#ifdef IP_RECVTOS
-		/* Enable receiving the TOS field */
-		setsockopt (fd, IPPROTO_IP, IP_RECVTOS, &(int){1}, sizeof(int));
-#endif /* IP_RECVTOS */
+	/* The sketch is allocated lazily, so that hosts which never reply do
+	 * not use any memory for it. Failing to allocate it is not fatal. */
+	if (ph->sketch == NULL)
+		ph->sketch = ping_sketch_create ();
+	if (ph->sketch != NULL)
+		ping_sketch_add (ph->sketch, latency);
 
-		/* Enable receiving the TTL field */
-		setsockopt (fd, IPPROTO_IP, IP_RECVTTL, &(int){1}, sizeof(int));
-	}
-#if defined(IPV6_RECVHOPLIMIT) || defined(IPV6_RECVTCLASS)
-	else if (addrfam == AF_INET6)
+	if ((b = ping_host_window (ph, now)) != NULL)
 	{
-# if defined(IPV6_RECVHOPLIMIT)
-		/* For details see RFC 3542, section 6.3. */
-		setsockopt (fd, IPPROTO_IPV6, IPV6_RECVHOPLIMIT,
-		            &(int){1}, sizeof(int));
-# endif /* IPV6_RECVHOPLIMIT */
-
-# if defined(IPV6_RECVTCLASS)
-		/* For details see RFC 3542, section 6.5. */
-		setsockopt (fd, IPPROTO_IPV6, IPV6_RECVTCLASS,
-		            &(int){1}, sizeof(int));
-# endif /* IPV6_RECVTCLASS */
+		b->received++;
+		b->latency_sum += latency;
+		if (b->latency_max < latency)
+			b->latency_max = latency;
 	}
-#endif /* IPV6_RECVHOPLIMIT || IPV6_RECVTCLASS */
 
-	return fd;
+	ping_heap_update (obj, ph);
 }
 
-/*
- * public methods
- */
-const char *ping_get_error (pingobj_t *obj)
+/* ping_host_timeout records that no echo reply was received from the host
+ * within the timeout, which expired at time "now". Only the first timeout is
+ * a change; hosts which stay down are not put on the changed list again, their
+ * loss is counted in "dropped". */
+static void ping_host_timeout (pingobj_t *obj, pinghost_t *ph,
+		const struct timeval *now)
 {
-	if (obj == NULL)
-		return (NULL);
-	return (obj->errmsg);
-}
+	ping_window_bucket_t *b;
 
-pingobj_t *ping_construct (void)
-{
-	pingobj_t *obj;
+	ph->dropped++;
+	/* The next hop may have changed, see ping_xdp_neighbor(). */
+	ph->xdp_mac_valid = 0;
 
-	if ((obj = malloc (sizeof (*obj))) == NULL)
-		return (NULL);
-	memset (obj, 0, sizeof (*obj));
+	if (ph->reachable == 1)
+		ping_host_changed (obj, ph,
+				PING_CHANGE_DOWN | PING_CHANGE_TIMEOUT);
+	else if (ph->reachable == -1)
+		ping_host_changed (obj, ph, PING_CHANGE_DOWN);
+	ph->reachable = 0;
 
-	obj->timeout    = PING_DEF_TIMEOUT;
-	obj->ttl        = PING_DEF_TTL;
-	obj->addrfamily = PING_DEF_AF;
-	obj->data       = strdup (PING_DEF_DATA);
-	obj->qos        = 0;
-	obj->fd4        = -1;
-	obj->fd6        = -1;
+	ping_event_push (obj, ph, -1.0);
 
-	return (obj);
+	if ((b = ping_host_window (ph, now)) != NULL)
+		b->dropped++;
+
+	ping_heap_update (obj, ph);
 }
 
-void ping_destroy (pingobj_t *obj)
+static uint64_t ping_siphash24 (const uint64_t key[2], const uint64_t m[2]);
+static void ping_sweep_key (uint64_t key[2]);
+
+/* ping_responders_create returns an empty list of responders, or NULL if no
+ * memory could be allocated. */
+static struct ping_responders *ping_responders_create (void)
 {
-	pinghost_t *current;
+	struct ping_responders *r;
 
-	if (obj == NULL)
-		return;
+	if ((r = calloc (1, sizeof (*r))) == NULL)
+		return (NULL);
+	ping_sweep_key (r->key);
 
-	current = obj->head;
+	return (r);
+}
 
-	while (current != NULL)
-	{
-		pinghost_t *next = current->next;
-		ping_free (current);
-		current = next;
-	}
+static void ping_responders_free (struct ping_responders *r)
+{
+	if (r == NULL)
+		return;
+	free (r->entries);
+	free (r->index);
+	free (r);
+}
 
-	free (obj->data);
-	free (obj->srcaddr);
-	free (obj->device);
+/* ping_responders_clear empties the list for the next round. */
+static void ping_responders_clear (struct ping_responders *r)
+{
+	r->num = 0;
+	if (r->index != NULL)
+		memset (r->index, 0, r->index_size * sizeof (r->index[0]));
+}
 
-	if (obj->fd4 != -1)
-		close(obj->fd4);
+/* ping_responders_slot returns the slot of the index holding the entry with
+ * address "addr" of "addr_len" bytes, or the free slot it would go to. */
+static size_t ping_responders_slot (const struct ping_responders *r,
+		int family, const void *addr, size_t addr_len)
+{
+	uint64_t m[2] = { 0, 0 };
+	size_t i;
 
-	if (obj->fd6 != -1)
-		close(obj->fd6);
+	memcpy (m, addr, addr_len);
+	i = (size_t) ping_siphash24 (r->key, m) & (r->index_size - 1);
+	while (r->index[i] != 0)
+	{
+		const struct ping_responder_entry *e =
+			r->entries + (r->index[i] - 1);
 
-	free (obj);
+		if ((e->family == family)
+				&& (memcmp (e->addr, addr, addr_len) == 0))
+			break;
+		i = (i + 1) & (r->index_size - 1);
+	}
 
-	return;
+	return (i);
 }
 
-int ping_setopt (pingobj_t *obj, int option, void *value)
+/* ping_responders_grow doubles the index, keeping it at most half full. */
+static int ping_responders_grow (struct ping_responders *r)
 {
-	int ret = 0;
+	size_t size = (r->index_size == 0) ? 32 : 2 * r->index_size;
+	uint32_t *index;
+	size_t i;
 
-	if ((obj == NULL) || (value == NULL))
+	if ((index = calloc (size, sizeof (*index))) == NULL)
 		return (-1);
+	free (r->index);
+	r->index = index;
+	r->index_size = size;
 
-	switch (option)
+	for (i = 0; i < r->num; i++)
 	{
-		case PING_OPT_QOS:
-		{
-			obj->qos = *((uint8_t *) value);
-			ret = ping_set_qos (obj, obj->qos);
-			break;
-		}
+		const struct ping_responder_entry *e = r->entries + i;
 
-		case PING_OPT_TIMEOUT:
-			obj->timeout = *((double *) value);
-			if (obj->timeout < 0.0)
-			{
-				obj->timeout = PING_DEF_TIMEOUT;
-				ret = -1;
-			}
-			break;
+		r->index[ping_responders_slot (r, e->family, e->addr,
+				(e->family == AF_INET6)
+				? sizeof (struct in6_addr)
+				: sizeof (struct in_addr))] = (uint32_t) (i + 1);
+	}
 
-		case PING_OPT_TTL:
-			ret = *((int *) value);
-			if ((ret < 1) || (ret > 255))
-			{
-				obj->ttl = PING_DEF_TTL;
-				ret = -1;
-			}
-			else
-			{
-				obj->ttl = ret;
-				ret = ping_set_ttl (obj, obj->ttl);
-			}
-			break;
+	return (0);
+}
 
-		case PING_OPT_AF:
-			obj->addrfamily = *((int *) value);
-			if ((obj->addrfamily != AF_UNSPEC)
-					&& (obj->addrfamily != AF_INET)
-					&& (obj->addrfamily != AF_INET6))
-			{
-				obj->addrfamily = PING_DEF_AF;
-				ret = -1;
-			}
-			if (obj->srcaddr != NULL)
-			{
-				free (obj->srcaddr);
-				obj->srcaddr = NULL;
-			}
-			break;
+/*
+ * ping_responders_add records "addr", the source address of a reply to an
+ * echo request to a group, unless a reply from it has been recorded before.
+ * Large segments may have many responders, so addresses are looked up in a
+ * hash table.
+ */
+static void ping_responders_add (pinghost_t *ph, int family,
+		const void *addr, double latency)
+{
+	struct ping_responders *r = ph->responders;
+	size_t addr_len;
+	size_t slot;
 
-		case PING_OPT_DATA:
-			if (obj->data != NULL)
-			{
-				free (obj->data);
-				obj->data = NULL;
-			}
-			obj->data = strdup ((const char *) value);
-			break;
+	if (addr == NULL)
+		return;
+	addr_len = (family == AF_INET6)
+		? sizeof (struct in6_addr) : sizeof (struct in_addr);
 
-		case PING_OPT_SOURCE:
-		{
-			char            *hostname = (char *) value;
-			struct addrinfo  ai_hints;
-			struct addrinfo *ai_list;
-			int              status;
-#if WITH_DEBUG
-			if (obj->addrfamily != AF_UNSPEC)
-			{
-				dprintf ("Resetting obj->addrfamily to AF_UNSPEC.\n");
-			}
-#endif
-			memset ((void *) &ai_hints, '\0', sizeof (ai_hints));
-			ai_hints.ai_family = obj->addrfamily = AF_UNSPEC;
-#if defined(AI_ADDRCONFIG)
-			ai_hints.ai_flags = AI_ADDRCONFIG;
-#endif
-			status = getaddrinfo (hostname, NULL, &ai_hints, &ai_list);
-			if (status != 0)
-			{
-#if defined(EAI_SYSTEM)
-				char errbuf[PING_ERRMSG_LEN];
-#endif
-				ping_set_error (obj, "getaddrinfo",
-#if defined(EAI_SYSTEM)
-						(status == EAI_SYSTEM)
-						? sstrerror (errno, errbuf, sizeof (errbuf)) :
-#endif
-						gai_strerror (status));
-				ret = -1;
-				break;
-			}
-#if WITH_DEBUG
-			if (ai_list->ai_next != NULL)
-			{
-				dprintf ("hostname = `%s' is ambiguous.\n", hostname);
-			}
-#endif
-			if (obj->srcaddr == NULL)
-			{
-				obj->srcaddrlen = 0;
-				obj->srcaddr = malloc (sizeof (struct sockaddr_storage));
-				if (obj->srcaddr == NULL)
-				{
-					ping_set_errno (obj, errno);
-					ret = -1;
-					freeaddrinfo (ai_list);
-					break;
-				}
-			}
-			memset ((void *) obj->srcaddr, 0, sizeof (struct sockaddr_storage));
-			assert (ai_list->ai_addrlen <= sizeof (struct sockaddr_storage));
-			memcpy ((void *) obj->srcaddr, (const void *) ai_list->ai_addr,
-					ai_list->ai_addrlen);
-			obj->srcaddrlen = ai_list->ai_addrlen;
-			obj->addrfamily = ai_list->ai_family;
+	if ((2 * (r->num + 1) > r->index_size)
+			&& (ping_responders_grow (r) != 0))
+		return;
 
-			freeaddrinfo (ai_list);
-		} /* case PING_OPT_SOURCE */
-		break;
+	slot = ping_responders_slot (r, family, addr, addr_len);
+	if (r->index[slot] != 0)
+		return;
 
-		case PING_OPT_DEVICE:
-		{
-#ifdef SO_BINDTODEVICE
-			char *device = strdup ((char *) value);
+	if (r->num >= r->size)
+	{
+		size_t size = (r->size == 0) ? 16 : 2 * r->size;
+		struct ping_responder_entry *tmp;
+
+		tmp = realloc (r->entries, size * sizeof (*tmp));
+		if (tmp == NULL)
+			return;
+		r->entries = tmp;
+		r->size = size;
+	}
 
-			if (device == NULL)
-			{
-				ping_set_errno (obj, errno);
-				ret = -1;
-				break;
-			}
+	memset (&r->entries[r->num], 0, sizeof (r->entries[r->num]));
+	r->entries[r->num].family = family;
+	memcpy (r->entries[r->num].addr, addr, addr_len);
+	r->entries[r->num].latency = latency;
+	r->num++;
+	r->index[slot] = (uint32_t) r->num;
+}
 
-			if (obj->device != NULL)
-				free (obj->device);
-			obj->device = device;
-#else /* ! SO_BINDTODEVICE */
-			ping_set_errno (obj, ENOTSUP);
-			ret = -1;
-#endif /* ! SO_BINDTODEVICE */
-		} /* case PING_OPT_DEVICE */
-		break;
+/*
+ * ping_receive_match records the reply from "host" received at "pkt_now".
+ * "from" is the binary source address of the reply, of family "family", or
+ * NULL if it is not known. Returns zero if the reply was counted, one if it
+ * arrived before the request was sent, i.e. the clock has been set back, or
+ * if it was a further reply to a request to a group.
+ */
+static int ping_receive_match (pingobj_t *obj, pinghost_t *host,
+		struct timeval *pkt_now, int family, const void *from)
+{
+	struct timeval diff;
+	double latency;
 
-		case PING_OPT_MARK:
-		{
-#ifdef SO_MARK
-			obj->mark     = *(int*)(value);
-			obj->set_mark = 1;
-#else /* SO_MARK */
-			ping_set_errno (obj, ENOTSUP);
-			ret = -1;
-#endif /* !SO_MARK */
+	dprintf ("rcvd: %12i.%06i\n",
+			(int) pkt_now->tv_sec,
+			(int) pkt_now->tv_usec);
+	dprintf ("sent: %12i.%06i\n",
+			(int) host->timer->tv_sec,
+			(int) host->timer->tv_usec);
 
-		} /* case PING_OPT_MARK */
-		break;
+	if (ping_timeval_sub (pkt_now, host->timer, &diff) < 0)
+	{
+		timerclear (host->timer);
+		return (1);
+	}
 
-		default:
-			ret = -2;
-	} /* switch (option) */
+	dprintf ("diff: %12i.%06i\n",
+			(int) diff.tv_sec,
+			(int) diff.tv_usec);
 
-	return (ret);
-} /* int ping_setopt */
+	latency = (((double) diff.tv_usec) / 1000.0)
+		+ (((double) diff.tv_sec) * 1000.0);
 
-int ping_send (pingobj_t *obj)
-{
-	pinghost_t *ptr;
+	/* Requests to a group may be answered many times, so the timer keeps
+	 * running. The first reply counts as the host's. */
+	if (host->responders != NULL)
+	{
+		ping_responders_add (host, family, from, latency);
+		if (host->latency >= 0.0)
+			return (1);
+		ping_host_reply (obj, host, latency, pkt_now);
+		return (0);
+	}
 
-	struct timeval endtime;
-	struct timeval nowtime;
-	struct timeval timeout;
+	ping_host_reply (obj, host, latency, pkt_now);
 
-	_Bool need_ipv4_socket = 0;
-	_Bool need_ipv6_socket = 0;
+	timerclear (host->timer);
 
-	for (ptr = obj->head; ptr != NULL; ptr = ptr->next)
-	{
-		ptr->latency  = -1.0;
-		ptr->recv_ttl = -1;
+	return (0);
+} /* int ping_receive_match */
+
+/* ping_transport_forward passes a reply read from a shared socket that is
+ * not for one of our hosts on to the attached object whose host uses the
+ * identifier, if any. The reply is copied, since "reply" and its data are
+ * reused for the next packet. */
+static void ping_transport_forward (pingobj_t *obj,
+		const struct ping_reply *reply)
+{
+	ping_transport_t *t = obj->transport;
+	pingobj_t *owner;
+	struct ping_reply *copy;
 
-		if (ptr->addrfamily == AF_INET)
-			need_ipv4_socket = 1;
-		else if (ptr->addrfamily == AF_INET6)
-			need_ipv6_socket = 1;
-	}
+	/* The owner cannot detach, and so neither free its list of replies
+	 * nor close its pipe, while the lock is held. */
+	pthread_rwlock_rdlock (&t->lock);
 
-	if (!need_ipv4_socket && !need_ipv6_socket)
+	owner = __atomic_load_n (t->idents + reply->ident, __ATOMIC_ACQUIRE);
+	if ((owner == NULL) || (owner == obj))
 	{
-		ping_set_error (obj, "ping_send", "No hosts to ping");
-		return (-1);
+		pthread_rwlock_unlock (&t->lock);
+		return;
 	}
 
-	if (need_ipv4_socket && obj->fd4 == -1)
+	copy = malloc (sizeof (*copy) + reply->data_len);
+	if (copy == NULL)
 	{
-		obj->fd4 = ping_open_socket(obj, AF_INET);
-		if (obj->fd4 == -1)
-			return (-1);
-		ping_set_ttl (obj, obj->ttl);
-		ping_set_qos (obj, obj->qos);
+		pthread_rwlock_unlock (&t->lock);
+		return;
 	}
-	if (need_ipv6_socket && obj->fd6 == -1)
+	memcpy (copy, reply, sizeof (*copy));
+	memcpy (copy + 1, reply->data, reply->data_len);
+	copy->data = (const char *) (copy + 1);
+
+	copy->next = __atomic_load_n (&owner->replies, __ATOMIC_RELAXED);
+	do
 	{
-		obj->fd6 = ping_open_socket(obj, AF_INET6);
-		if (obj->fd6 == -1)
-			return (-1);
-		ping_set_ttl (obj, obj->ttl);
-		ping_set_qos (obj, obj->qos);
+		/* copy->next is updated if the list has changed */
+	} while (!__atomic_compare_exchange_n (&owner->replies, &copy->next,
+				copy, /* weak = */ 1,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	/* If the pipe is full, the owner has not caught up yet and will
+	 * read this reply with the others. */
+	if (write (owner->wake_fd[1], "", 1) < 0)
+	{
+		dprintf ("ping_transport_forward: write failed\n");
 	}
 
-	if (gettimeofday (&nowtime, NULL) == -1)
+	pthread_rwlock_unlock (&t->lock);
+}
+
+/* ping_transport_replies_free frees a list of forwarded replies. */
+static void ping_transport_replies_free (struct ping_reply *reply)
+{
+	while (reply != NULL)
 	{
-		ping_set_errno (obj, errno);
-		return (-1);
+		struct ping_reply *next = reply->next;
+
+		free (reply);
+		reply = next;
 	}
+}
 
-	/* Set up timeout */
-	timeout.tv_sec = (time_t) obj->timeout;
-	timeout.tv_usec = (suseconds_t) (1000000 * (obj->timeout - ((double) timeout.tv_sec)));
+/* ping_transport_read records the replies forwarded to us by other objects
+ * sharing the transport, see ping_transport_forward(). Returns the number of
+ * replies counted, like ping_receive_match() would. */
+static int ping_transport_read (pingobj_t *obj)
+{
+	struct ping_reply *replies;
+	struct ping_reply *reply;
+	char buffer[64];
+	int count = 0;
+
+	while (read (obj->wake_fd[0], buffer, sizeof (buffer)) > 0)
+		/* the pipe is non-blocking */;
+
+	replies = __atomic_exchange_n (&obj->replies, NULL, __ATOMIC_ACQUIRE);
+	for (reply = replies; reply != NULL; reply = reply->next)
+	{
+		pinghost_t *ph;
+
+		for (ph = obj->table[reply->ident % PING_TABLE_LEN];
+				ph != NULL; ph = ph->table_next)
+			if ((ph->ident == reply->ident)
+					&& (ph->addrfamily == reply->family)
+					&& timerisset (ph->timer)
+					&& (((ph->sequence - 1) & 0xFFFF)
+						== reply->seq))
+				break;
+		if (ph == NULL)
+			ph = ping_range_match (obj, reply->family, reply->ident,
+					reply->seq, reply->from);
+
+		if ((ph == NULL) || (ping_receive_verify (obj, ph, reply->data,
+						reply->data_len,
+						reply->payload_len) != 0))
+			continue;
+
+		if (reply->recv_ttl >= 0)
+			ph->recv_ttl = reply->recv_ttl;
+		ph->recv_qos = reply->recv_qos;
+
+		if (ping_receive_match (obj, ph, &reply->time, reply->family,
+					reply->from) == 0)
+			count++;
+	}
+	ping_transport_replies_free (replies);
+
+	return (count);
+}
+
+/* ping_receive_control reads the control messages of a packet received on the
+ * socket of address family "addrfam": the kernel timestamp, which is stored
+ * in "pkt_now" and flagged in "have_timestamp", the TTL or hop limit and the
+ * TOS or traffic class of the reply, and the number of packets the socket
+ * dropped. "recv_ttl" is -1 if the TTL is not known. */
+static void ping_receive_control (pingobj_t *obj, struct msghdr *msghdr,
+		int addrfam, struct timeval *pkt_now, _Bool *have_timestamp,
+		int *recv_ttl, uint8_t *recv_qos)
+{
+	struct cmsghdr *cmsg;
+
+	*recv_ttl = -1;
+	*recv_qos = 0;
+	for (cmsg = CMSG_FIRSTHDR (msghdr); /* {{{ */
+			cmsg != NULL;
+			cmsg = CMSG_NXTHDR (msghdr, cmsg))
+	{
+		if (cmsg->cmsg_level == SOL_SOCKET)
+		{
+#ifdef SO_TIMESTAMP
+			if (cmsg->cmsg_type == SO_TIMESTAMP)
+			{
+				memcpy (pkt_now, CMSG_DATA (cmsg), sizeof (*pkt_now));
+				*have_timestamp = 1;
+			}
+#endif /* SO_TIMESTAMP */
+#ifdef SO_RXQ_OVFL
+			if (cmsg->cmsg_type == SO_RXQ_OVFL)
+			{
+				uint32_t drops;
+
+				/* The counter is cumulative since the socket
+				 * was opened. */
+				memcpy (&drops, CMSG_DATA (cmsg), sizeof (drops));
+				if (addrfam == AF_INET6)
+					obj->drops6 = drops;
+				else
+					obj->drops4 = drops;
+				dprintf ("Socket drops = %"PRIu32";\n", drops);
+			}
+#endif /* SO_RXQ_OVFL */
+		}
+		else if (addrfam == AF_INET) /* {{{ */
+		{
+			if (cmsg->cmsg_level != IPPROTO_IP)
+				continue;
+
+			if (cmsg->cmsg_type == IP_TOS)
+			{
+				memcpy (recv_qos, CMSG_DATA (cmsg),
+						sizeof (*recv_qos));
+				dprintf ("TOSv4 = 0x%02"PRIx8";\n", *recv_qos);
+			} else
+			if (cmsg->cmsg_type == IP_TTL)
+			{
+				memcpy (recv_ttl, CMSG_DATA (cmsg),
+						sizeof (*recv_ttl));
+				dprintf ("TTLv4 = %i;\n", *recv_ttl);
+			}
+			else
+			{
+				dprintf ("Not handling option %i.\n",
+						cmsg->cmsg_type);
+			}
+		} /* }}} */
+		else if (addrfam == AF_INET6) /* {{{ */
+		{
+			if (cmsg->cmsg_level != IPPROTO_IPV6)
+				continue;
+
+			if (cmsg->cmsg_type == IPV6_TCLASS)
+			{
+				int tclass;
+
+				/* Unlike IP_TOS, this is an int, see RFC 3542,
+				 * section 6.5. */
+				memcpy (&tclass, CMSG_DATA (cmsg),
+						sizeof (tclass));
+				*recv_qos = (uint8_t) tclass;
+				dprintf ("TOSv6 = 0x%02"PRIx8";\n", *recv_qos);
+			} else
+#ifdef IPV6_HOPLIMIT
+			if (cmsg->cmsg_type == IPV6_HOPLIMIT)
+			{
+				memcpy (recv_ttl, CMSG_DATA (cmsg),
+						sizeof (*recv_ttl));
+				dprintf ("TTLv6 = %i;\n", *recv_ttl);
+			}
+			else
+#endif
+#ifdef IPV6_UNICAST_HOPS
+			if (cmsg->cmsg_type == IPV6_UNICAST_HOPS)
+			{
+				memcpy (recv_ttl, CMSG_DATA (cmsg),
+						sizeof (*recv_ttl));
+				dprintf ("TTLv6 = %i;\n", *recv_ttl);
+			}
+			else
+#endif
+#ifdef IPV6_MULTICAST_HOPS
+			if (cmsg->cmsg_type == IPV6_MULTICAST_HOPS)
+			{
+				memcpy (recv_ttl, CMSG_DATA (cmsg),
+						sizeof (*recv_ttl));
+				dprintf ("TTLv6 = %i;\n", *recv_ttl);
+			}
+			else
+#endif
+			{
+				dprintf ("Not handling option %i.\n",
+						cmsg->cmsg_type);
+			}
+		} /* }}} */
+		else
+		{
+			dprintf ("Don't know how to handle "
+					"unknown protocol %i.\n",
+					cmsg->cmsg_level);
+		}
+	} /* }}} for (cmsg) */
+} /* void ping_receive_control */
+
+/* ping_receive_one reads one packet from the socket of the given address
+ * family without blocking. Returns zero if the packet was an echo reply to
+ * one of our requests, greater than zero if a packet was read but discarded
+ * and less than zero if no packet could be read, e.g. because the socket has
+ * been drained. */
+
+static int ping_receive_one (pingobj_t *obj, int addrfam)
+{
+	int fd = addrfam == AF_INET6 ? obj->fd6 : obj->fd4;
+	struct timeval pkt_now;
+	_Bool have_timestamp = 0;
+	pinghost_t *host = NULL;
+	int recv_ttl;
+	uint8_t recv_qos;
+	struct sockaddr_storage from;
+	const void *from_addr;
+	struct ping_reply unmatched;
+
+	/*
+	 * Set up the receive buffer..
+	 */
+	struct msghdr msghdr;
+	char *payload_buffer = obj->recv_buf;
+	ssize_t payload_buffer_len;
+	size_t packet_len;
+	char control_buffer[4096];
+	struct iovec payload_iovec;
+	int flags = MSG_DONTWAIT;
+
+	memset (&payload_iovec, 0, sizeof (payload_iovec));
+	payload_iovec.iov_base = payload_buffer;
+	payload_iovec.iov_len = obj->recv_buf_size;
+	/* With MSG_TRUNC the length of the whole packet is returned, although
+	 * only the headers are copied. */
+	if (obj->headers_only && !obj->verify_payload)
+	{
+		payload_iovec.iov_len = PING_RECV_HEADER_LEN;
+		flags |= MSG_TRUNC;
+	}
+
+	memset (&msghdr, 0, sizeof (msghdr));
+	/* source address, recorded for requests to groups */
+	msghdr.msg_name = &from;
+	msghdr.msg_namelen = sizeof (from);
+	/* output buffer vector, see readv(2) */
+	msghdr.msg_iov = &payload_iovec;
+	msghdr.msg_iovlen = 1;
+	/* output buffer for control messages */
+	msghdr.msg_control = control_buffer;
+	msghdr.msg_controllen = sizeof (control_buffer);
+	/* flags; this is an output only field.. */
+	msghdr.msg_flags = 0;
+#ifdef MSG_XPG4_2
+	msghdr.msg_flags |= MSG_XPG4_2;
+#endif
+
+	payload_buffer_len = recvmsg (fd, &msghdr, flags);
+	if (payload_buffer_len < 0)
+	{
+#if WITH_DEBUG
+		char errbuf[PING_ERRMSG_LEN];
+		dprintf ("recvfrom: %s\n",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+#endif
+		return (-1);
+	}
+	dprintf ("Read %zi bytes from fd = %i\n", payload_buffer_len, fd);
+
+	packet_len = (size_t) payload_buffer_len;
+	if (packet_len > payload_iovec.iov_len)
+		payload_buffer_len = (ssize_t) payload_iovec.iov_len;
+	else if (msghdr.msg_flags & MSG_TRUNC)
+		/* The real length is unknown, only that it is larger. */
+		packet_len++;
+
+	ping_receive_control (obj, &msghdr, addrfam, &pkt_now, &have_timestamp,
+			&recv_ttl, &recv_qos);
+
+	/* Several packets may be read per wakeup, so without a kernel
+	 * timestamp the time has to be taken for each packet. */
+	if (!have_timestamp && (gettimeofday (&pkt_now, NULL) == -1))
+		return (1);
+
+	memset (&unmatched, 0, sizeof (unmatched));
+	if (addrfam == AF_INET)
+	{
+		host = ping_receive_ipv4 (obj, payload_buffer,
+				(size_t) payload_buffer_len, packet_len,
+				(obj->transport != NULL) ? &unmatched : NULL);
+	}
+	else if (addrfam == AF_INET6)
+	{
+		host = ping_receive_ipv6 (obj, payload_buffer,
+				(size_t) payload_buffer_len, packet_len,
+				&((struct sockaddr_in6 *) &from)->sin6_addr,
+				(obj->transport != NULL) ? &unmatched : NULL);
+	}
+	else
+	{
+		dprintf ("ping_receive_one: Unknown address family %i.\n",
+				addrfam);
+		return (1);
+	}
+
+	if (addrfam == AF_INET6)
+		from_addr = &((struct sockaddr_in6 *) &from)->sin6_addr;
+	else
+		from_addr = &((struct sockaddr_in *) &from)->sin_addr;
+
+	if (host == NULL)
+	{
+		/* The reply may be for a host of another object sharing
+		 * the transport. */
+		if (unmatched.family != 0)
+		{
+			unmatched.time = pkt_now;
+			memcpy (unmatched.from, from_addr, (addrfam == AF_INET6)
+					? sizeof (struct in6_addr)
+					: sizeof (struct in_addr));
+			if (recv_ttl >= 0)
+				unmatched.recv_ttl = recv_ttl;
+			unmatched.recv_qos = recv_qos;
+			ping_transport_forward (obj, &unmatched);
+		}
+		return (1);
+	}
+
+	if (recv_ttl >= 0)
+		host->recv_ttl = recv_ttl;
+	host->recv_qos = recv_qos;
+
+	return (ping_receive_match (obj, host, &pkt_now, addrfam, from_addr));
+}
+
+#if HAVE_PACKET_RING
+/*
+ * ping_ring_filter attaches a filter to the packet ring that only accepts
+ * echo replies carrying the identifier of one of the hosts. Offsets are
+ * relative to the network header. IPv6 replies behind extension headers are
+ * not accepted.
+ */
+static int ping_ring_filter (pingobj_t *obj)
+{
+	struct sock_filter code[18 + PING_RING_FILTER_MAX + 2];
+	struct sock_fprog prog;
+	pinghost_t *ph;
+	size_t hosts_num = 0;
+	size_t n;
+
+	for (ph = obj->head; ph != NULL; ph = ph->next)
+		hosts_num++;
+
+	/* The jump targets below depend on these positions. */
+	code[0]  = (struct sock_filter) BPF_STMT (BPF_LD | BPF_B | BPF_ABS, 0);
+	code[1]  = (struct sock_filter) BPF_STMT (BPF_ALU | BPF_RSH | BPF_K, 4);
+	code[2]  = (struct sock_filter) BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, 4, 0, 7);
+	/* IPv4 */
+	code[3]  = (struct sock_filter) BPF_STMT (BPF_LD | BPF_B | BPF_ABS, 9);
+	code[4]  = (struct sock_filter) BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_ICMP, 0, 12);
+	code[5]  = (struct sock_filter) BPF_STMT (BPF_LDX | BPF_B | BPF_MSH, 0);
+	code[6]  = (struct sock_filter) BPF_STMT (BPF_LD | BPF_B | BPF_IND, 0);
+	code[7]  = (struct sock_filter) BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHOREPLY, 0, 9);
+	code[8]  = (struct sock_filter) BPF_STMT (BPF_LD | BPF_H | BPF_IND, 4);
+	code[9]  = (struct sock_filter) BPF_STMT (BPF_JMP | BPF_JA, 8);
+	/* IPv6 */
+	code[10] = (struct sock_filter) BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, 6, 0, 6);
+	code[11] = (struct sock_filter) BPF_STMT (BPF_LD | BPF_B | BPF_ABS, 6);
+	code[12] = (struct sock_filter) BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_ICMPV6, 0, 4);
+	code[13] = (struct sock_filter) BPF_STMT (BPF_LD | BPF_B | BPF_ABS, 40);
+	code[14] = (struct sock_filter) BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ICMP6_ECHO_REPLY, 0, 2);
+	code[15] = (struct sock_filter) BPF_STMT (BPF_LD | BPF_H | BPF_ABS, 44);
+	code[16] = (struct sock_filter) BPF_STMT (BPF_JMP | BPF_JA, 1);
+	code[17] = (struct sock_filter) BPF_STMT (BPF_RET | BPF_K, 0);
+	n = 18;
+
+	/* The identifier is in the accumulator: jump to the final "accept"
+	 * if it is one of ours. */
+	if (hosts_num <= PING_RING_FILTER_MAX)
+	{
+		size_t i = 0;
+
+		for (ph = obj->head; ph != NULL; ph = ph->next)
+		{
+			code[n] = (struct sock_filter) BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K,
+					ph->ident, (uint8_t) (hosts_num - i), 0);
+			n++;
+			i++;
+		}
+		code[n++] = (struct sock_filter) BPF_STMT (BPF_RET | BPF_K, 0);
+	}
+	code[n++] = (struct sock_filter) BPF_STMT (BPF_RET | BPF_K, 0xFFFFFFFF);
+
+	prog.len = (unsigned short) n;
+	prog.filter = code;
+
+	if (setsockopt (obj->ring_fd, SOL_SOCKET, SO_ATTACH_FILTER,
+				&prog, sizeof (prog)) != 0)
+	{
+		ping_set_errno (obj, errno);
+		return (-1);
+	}
+
+	return (0);
+} /* int ping_ring_filter */
+
+static void ping_ring_close (pingobj_t *obj)
+{
+	if (obj->ring != NULL)
+		munmap (obj->ring, PING_RING_BLOCK_SIZE * PING_RING_BLOCK_NUM);
+	if (obj->ring_fd != -1)
+		close (obj->ring_fd);
+
+	obj->ring = NULL;
+	obj->ring_fd = -1;
+	obj->ring_block = 0;
+} /* void ping_ring_close */
+
+/*
+ * ping_ring_open maps a TPACKET_V3 receive ring capturing the echo replies
+ * received by "device". Packets are captured above the link layer, so they
+ * start with the IP header, as on a raw IPv4 socket.
+ */
+static int ping_ring_open (pingobj_t *obj, const char *device)
+{
+	struct tpacket_req3 req;
+	struct sockaddr_ll sll;
+	unsigned int ifindex;
+	void *ring;
+
+	ifindex = if_nametoindex (device);
+	if (ifindex == 0)
+	{
+		ping_set_errno (obj, errno);
+		return (-1);
+	}
+
+	/* Nothing is captured until the socket is bound below, after the
+	 * filter has been attached. */
+	obj->ring_fd = socket (AF_PACKET, SOCK_DGRAM, 0);
+	if (obj->ring_fd == -1)
+	{
+		ping_set_errno (obj, errno);
+		return (-1);
+	}
+	else if (obj->ring_fd >= FD_SETSIZE)
+	{
+		ping_set_errno (obj, EMFILE);
+		ping_ring_close (obj);
+		return (-1);
+	}
+
+	if (ping_ring_filter (obj) != 0)
+	{
+		ping_ring_close (obj);
+		return (-1);
+	}
+
+	if (setsockopt (obj->ring_fd, SOL_PACKET, PACKET_VERSION,
+				&(int){TPACKET_V3}, sizeof (int)) != 0)
+	{
+		ping_set_errno (obj, errno);
+		ping_ring_close (obj);
+		return (-1);
+	}
+
+	memset (&req, 0, sizeof (req));
+	req.tp_block_size = PING_RING_BLOCK_SIZE;
+	req.tp_block_nr = PING_RING_BLOCK_NUM;
+	req.tp_frame_size = PING_RING_FRAME_SIZE;
+	req.tp_frame_nr = (PING_RING_BLOCK_SIZE / PING_RING_FRAME_SIZE)
+		* PING_RING_BLOCK_NUM;
+	req.tp_retire_blk_tov = PING_RING_BLOCK_TIMEOUT;
+	if (setsockopt (obj->ring_fd, SOL_PACKET, PACKET_RX_RING,
+				&req, sizeof (req)) != 0)
+	{
+		ping_set_errno (obj, errno);
+		ping_ring_close (obj);
+		return (-1);
+	}
+
+	ring = mmap (NULL, PING_RING_BLOCK_SIZE * PING_RING_BLOCK_NUM,
+			PROT_READ | PROT_WRITE, MAP_SHARED, obj->ring_fd, 0);
+	if (ring == MAP_FAILED)
+	{
+		ping_set_errno (obj, errno);
+		ping_ring_close (obj);
+		return (-1);
+	}
+	obj->ring = ring;
+
+	memset (&sll, 0, sizeof (sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons (ETH_P_ALL);
+	sll.sll_ifindex = (int) ifindex;
+	if (bind (obj->ring_fd, (struct sockaddr *) &sll, sizeof (sll)) != 0)
+	{
+		ping_set_errno (obj, errno);
+		ping_ring_close (obj);
+		return (-1);
+	}
+
+	obj->ring_stale = 0;
+	return (0);
+} /* int ping_ring_open */
+
+/*
+ * ping_ring_packet hands one packet of the ring to the IPv4 or IPv6 parser,
+ * in place. Returns zero if it was a reply from one of the hosts.
+ */
+static int ping_ring_packet (pingobj_t *obj, struct tpacket3_hdr *hdr)
+{
+	struct sockaddr_ll *sll;
+	struct timeval pkt_now;
+	pinghost_t *host;
+	char *buffer;
+	size_t buffer_len;
+	size_t packet_len;
+	int family;
+	const void *from;
+
+	/* On the loopback device, requests and replies are also seen when
+	 * they are sent. */
+	sll = (struct sockaddr_ll *) (((char *) hdr)
+			+ TPACKET_ALIGN (sizeof (*hdr)));
+	if (sll->sll_pkttype == PACKET_OUTGOING)
+		return (1);
+
+	buffer = ((char *) hdr) + hdr->tp_net;
+	buffer_len = hdr->tp_snaplen;
+	/* Replies larger than a frame are truncated, like with
+	 * PING_OPT_HEADERS_ONLY. */
+	packet_len = hdr->tp_len;
+	pkt_now.tv_sec = (time_t) hdr->tp_sec;
+	pkt_now.tv_usec = (suseconds_t) (hdr->tp_nsec / 1000);
+
+	if (ntohs (sll->sll_protocol) == ETH_P_IP)
+	{
+		host = ping_receive_ipv4 (obj, buffer, buffer_len, packet_len,
+				NULL);
+		family = AF_INET;
+		from = &((struct ip *) buffer)->ip_src;
+	}
+	else if (ntohs (sll->sll_protocol) == ETH_P_IPV6)
+	{
+		struct ip6_hdr *ip6_hdr = (struct ip6_hdr *) buffer;
+
+		if (buffer_len < sizeof (*ip6_hdr))
+			return (1);
+
+		host = ping_receive_ipv6 (obj, buffer + sizeof (*ip6_hdr),
+				buffer_len - sizeof (*ip6_hdr),
+				packet_len - sizeof (*ip6_hdr), &ip6_hdr->ip6_src,
+				NULL);
+		if (host != NULL)
+		{
+			host->recv_ttl = (int) ip6_hdr->ip6_hlim;
+			host->recv_qos = (uint8_t) (ntohl (ip6_hdr->ip6_flow) >> 20);
+		}
+		family = AF_INET6;
+		from = &ip6_hdr->ip6_src;
+	}
+	else
+	{
+		return (1);
+	}
+
+	if (host == NULL)
+		return (1);
+
+	return (ping_receive_match (obj, host, &pkt_now, family, from));
+} /* int ping_ring_packet */
+
+/*
+ * ping_ring_read reads all blocks the kernel has handed over and returns them
+ * to the kernel. Returns the number of replies from the hosts.
+ */
+static int ping_ring_read (pingobj_t *obj)
+{
+	int replies = 0;
+	size_t i;
+
+	for (i = 0; i < PING_RING_BLOCK_NUM; i++)
+	{
+		struct tpacket_block_desc *bd;
+		struct tpacket3_hdr *hdr;
+		uint32_t j;
+
+		bd = (struct tpacket_block_desc *) (obj->ring
+				+ obj->ring_block * PING_RING_BLOCK_SIZE);
+		if ((__atomic_load_n (&bd->hdr.bh1.block_status,
+						__ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0)
+			break;
+
+		hdr = (struct tpacket3_hdr *) (((char *) bd)
+				+ bd->hdr.bh1.offset_to_first_pkt);
+		for (j = 0; j < bd->hdr.bh1.num_pkts; j++)
+		{
+			if (ping_ring_packet (obj, hdr) == 0)
+				replies++;
+			hdr = (struct tpacket3_hdr *) (((char *) hdr)
+					+ hdr->tp_next_offset);
+		}
+
+		__atomic_store_n (&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+				__ATOMIC_RELEASE);
+		obj->ring_block = (obj->ring_block + 1) % PING_RING_BLOCK_NUM;
+	}
+
+	return (replies);
+} /* int ping_ring_read */
+
+/*
+ * While the ring is used, echo replies are blocked on the raw sockets so that
+ * they are not copied to user space a second time. Shared sockets are left
+ * alone, the other objects still read from them.
+ */
+static void ping_ring_block_raw (pingobj_t *obj)
+{
+	_Bool block = (obj->ring_fd != -1) && (obj->transport == NULL);
+
+	if (obj->fd4 != -1)
+	{
+		uint32_t mask = block ? (1U << ICMP_ECHOREPLY) : 0;
+
+		setsockopt (obj->fd4, SOL_RAW, ICMP_FILTER,
+				&mask, sizeof (mask));
+	}
+	if (obj->fd6 != -1)
+	{
+		struct icmp6_filter filter;
+
+		ICMP6_FILTER_SETPASSALL (&filter);
+		if (block)
+			ICMP6_FILTER_SETBLOCK (ICMP6_ECHO_REPLY, &filter);
+		setsockopt (obj->fd6, IPPROTO_ICMPV6, ICMP6_FILTER,
+				&filter, sizeof (filter));
+	}
+} /* void ping_ring_block_raw */
+#endif /* HAVE_PACKET_RING */
+
+#if HAVE_XDP
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * AF_XDP transport, see PING_OPT_XDP:                                       *
+ *                                                                           *
+ * Echo requests to IPv4 hosts are written as Ethernet frames into a UMEM   *
+ * and sent through the XDP TX ring. A small XDP program redirects echo      *
+ * replies carrying one of our identifiers to the AF_XDP socket. The first  *
+ * PING_XDP_RING_SIZE frames of the UMEM are used for receiving, the others *
+ * for sending.                                                              *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+#define PING_BPF_INSN(c, d, s, o, i) \
+	((struct bpf_insn) { .code = (c), .dst_reg = (d), .src_reg = (s), \
+	                     .off = (o), .imm = (i) })
+
+static int ping_bpf (int cmd, union bpf_attr *attr)
+{
+	return ((int) syscall (__NR_bpf, cmd, attr, sizeof (*attr)));
+}
+
+static int ping_bpf_map_create (uint32_t type, uint32_t entries)
+{
+	union bpf_attr attr;
+
+	memset (&attr, 0, sizeof (attr));
+	attr.map_type = type;
+	attr.key_size = sizeof (uint32_t);
+	attr.value_size = sizeof (uint32_t);
+	attr.max_entries = entries;
+
+	return (ping_bpf (BPF_MAP_CREATE, &attr));
+}
+
+static int ping_bpf_map_update (int fd, uint32_t key, uint32_t value)
+{
+	union bpf_attr attr;
+
+	memset (&attr, 0, sizeof (attr));
+	attr.map_fd = (uint32_t) fd;
+	attr.key = (uint64_t) (uintptr_t) &key;
+	attr.value = (uint64_t) (uintptr_t) &value;
+
+	return (ping_bpf (BPF_MAP_UPDATE_ELEM, &attr));
+}
+
+/*
+ * ping_xdp_prog_load loads the XDP program: IPv4 echo replies without IP
+ * options whose identifier is set in the "idents" map are redirected to the
+ * socket in the "xsks" map for the receive queue, everything else is passed
+ * to the network stack.
+ */
+static int ping_xdp_prog_load (int idents_fd, int xsks_fd)
+{
+	struct bpf_insn insns[] = {
+		/* r7 = ctx->rx_queue_index, r2 = data, r3 = data_end */
+		PING_BPF_INSN (BPF_LDX | BPF_W | BPF_MEM, 7, 1, 16, 0),
+		PING_BPF_INSN (BPF_LDX | BPF_W | BPF_MEM, 2, 1, 0, 0),
+		PING_BPF_INSN (BPF_LDX | BPF_W | BPF_MEM, 3, 1, 4, 0),
+		/* Ethernet, IPv4 and ICMP headers must be there. */
+		PING_BPF_INSN (BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),
+		PING_BPF_INSN (BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, 42),
+		PING_BPF_INSN (BPF_JMP | BPF_JGT | BPF_X, 4, 3, 24, 0),
+		PING_BPF_INSN (BPF_LDX | BPF_H | BPF_MEM, 5, 2, 12, 0),
+		PING_BPF_INSN (BPF_JMP | BPF_JNE | BPF_K, 5, 0, 22, htons (ETH_P_IP)),
+		PING_BPF_INSN (BPF_LDX | BPF_B | BPF_MEM, 5, 2, 14, 0),
+		PING_BPF_INSN (BPF_JMP | BPF_JNE | BPF_K, 5, 0, 20, 0x45),
+		PING_BPF_INSN (BPF_LDX | BPF_B | BPF_MEM, 5, 2, 23, 0),
+		PING_BPF_INSN (BPF_JMP | BPF_JNE | BPF_K, 5, 0, 18, IPPROTO_ICMP),
+		PING_BPF_INSN (BPF_LDX | BPF_B | BPF_MEM, 5, 2, 34, 0),
+		PING_BPF_INSN (BPF_JMP | BPF_JNE | BPF_K, 5, 0, 16, ICMP_ECHOREPLY),
+		/* Look up the identifier, in network byte order. */
+		PING_BPF_INSN (BPF_LDX | BPF_H | BPF_MEM, 5, 2, 38, 0),
+		PING_BPF_INSN (BPF_STX | BPF_W | BPF_MEM, 10, 5, -4, 0),
+		PING_BPF_INSN (BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0),
+		PING_BPF_INSN (BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, -4),
+		PING_BPF_INSN (BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, idents_fd),
+		PING_BPF_INSN (0, 0, 0, 0, 0),
+		PING_BPF_INSN (BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem),
+		PING_BPF_INSN (BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 8, 0),
+		PING_BPF_INSN (BPF_LDX | BPF_W | BPF_MEM, 5, 0, 0, 0),
+		PING_BPF_INSN (BPF_JMP | BPF_JEQ | BPF_K, 5, 0, 6, 0),
+		/* return bpf_redirect_map (xsks, rx_queue_index, XDP_PASS) */
+		PING_BPF_INSN (BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, xsks_fd),
+		PING_BPF_INSN (0, 0, 0, 0, 0),
+		PING_BPF_INSN (BPF_ALU64 | BPF_MOV | BPF_X, 2, 7, 0, 0),
+		PING_BPF_INSN (BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS),
+		PING_BPF_INSN (BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+		PING_BPF_INSN (BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+		/* pass: */
+		PING_BPF_INSN (BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS),
+		PING_BPF_INSN (BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+	};
+	union bpf_attr attr;
+
+	memset (&attr, 0, sizeof (attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uint64_t) (uintptr_t) insns;
+	attr.insn_cnt = sizeof (insns) / sizeof (insns[0]);
+	attr.license = (uint64_t) (uintptr_t) "LGPL-2.1";
+
+	return (ping_bpf (BPF_PROG_LOAD, &attr));
+} /* int ping_xdp_prog_load */
+
+static int ping_xdp_ring_map (struct ping_xdp_ring *ring, int fd,
+		const struct xdp_ring_offset *off, size_t desc_size, off_t pgoff)
+{
+	char *map;
+
+	ring->size = PING_XDP_RING_SIZE;
+	ring->map_size = off->desc + PING_XDP_RING_SIZE * desc_size;
+	map = mmap (NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, pgoff);
+	if (map == MAP_FAILED)
+	{
+		ring->map = NULL;
+		return (-1);
+	}
+
+	ring->map = map;
+	ring->producer = (uint32_t *) (map + off->producer);
+	ring->consumer = (uint32_t *) (map + off->consumer);
+	ring->descs = map + off->desc;
+	return (0);
+} /* int ping_xdp_ring_map */
+
+static void ping_xdp_close (pingobj_t *obj)
+{
+	struct ping_xdp *xdp = obj->xdp;
+
+	if (xdp == NULL)
+		return;
+
+	/* Closing the link detaches the program from the interface. */
+	if (xdp->link_fd != -1)
+		close (xdp->link_fd);
+	if (xdp->prog_fd != -1)
+		close (xdp->prog_fd);
+	if (xdp->xsks_fd != -1)
+		close (xdp->xsks_fd);
+	if (xdp->idents_fd != -1)
+		close (xdp->idents_fd);
+	if (xdp->fill.map != NULL)
+		munmap (xdp->fill.map, xdp->fill.map_size);
+	if (xdp->comp.map != NULL)
+		munmap (xdp->comp.map, xdp->comp.map_size);
+	if (xdp->rx.map != NULL)
+		munmap (xdp->rx.map, xdp->rx.map_size);
+	if (xdp->tx.map != NULL)
+		munmap (xdp->tx.map, xdp->tx.map_size);
+	if (xdp->fd != -1)
+		close (xdp->fd);
+	if (xdp->ctl_fd != -1)
+		close (xdp->ctl_fd);
+	if (xdp->umem != NULL)
+		munmap (xdp->umem, PING_XDP_FRAME_SIZE * PING_XDP_FRAME_NUM);
+	free (xdp->idents);
+	free (xdp);
+
+	obj->xdp = NULL;
+} /* void ping_xdp_close */
+
+/* ping_xdp_gateway returns the default gateway of "ifname" from the routing
+ * table in /proc, in network byte order, or zero. */
+static uint32_t ping_xdp_gateway (const char *ifname)
+{
+	char line[256];
+	char iface[IFNAMSIZ + 1];
+	unsigned long dest;
+	unsigned long gateway;
+	uint32_t ret = 0;
+	FILE *fh;
+
+	fh = fopen ("/proc/net/route", "r");
+	if (fh == NULL)
+		return (0);
+
+	while (fgets (line, sizeof (line), fh) != NULL)
+	{
+		if (sscanf (line, "%16s %lx %lx", iface, &dest, &gateway) != 3)
+			continue;
+		if ((strcmp (iface, ifname) == 0) && (dest == 0))
+		{
+			/* The table shows addresses in network byte order. */
+			ret = (uint32_t) gateway;
+			break;
+		}
+	}
+
+	fclose (fh);
+	return (ret);
+} /* uint32_t ping_xdp_gateway */
+
+/* ping_xdp_ioctl issues an interface request for the interface of "xdp". */
+static int ping_xdp_ioctl (struct ping_xdp *xdp, unsigned long request,
+		struct ifreq *ifr)
+{
+	memset (ifr, 0, sizeof (*ifr));
+	memcpy (ifr->ifr_name, xdp->ifname, sizeof (xdp->ifname));
+	return (ioctl (xdp->ctl_fd, request, ifr));
+}
+
+static int ping_xdp_open (pingobj_t *obj, const char *ifname)
+{
+	struct ping_xdp *xdp;
+	struct xdp_umem_reg umem_reg;
+	struct xdp_mmap_offsets off;
+	socklen_t off_len = sizeof (off);
+	struct sockaddr_xdp sxdp;
+	struct ifreq ifr;
+	union bpf_attr attr;
+	pinghost_t *ph;
+	uint32_t i;
+
+	if (strlen (ifname) >= IFNAMSIZ)
+	{
+		ping_set_errno (obj, ENAMETOOLONG);
+		return (-1);
+	}
+
+	xdp = calloc (1, sizeof (*xdp));
+	if (xdp == NULL)
+	{
+		ping_set_errno (obj, errno);
+		return (-1);
+	}
+	xdp->fd = -1;
+	xdp->ctl_fd = -1;
+	xdp->prog_fd = -1;
+	xdp->link_fd = -1;
+	xdp->xsks_fd = -1;
+	xdp->idents_fd = -1;
+	memcpy (xdp->ifname, ifname, strlen (ifname) + 1);
+	obj->xdp = xdp;
+
+	/* Next hops are looked up again on this interface. */
+	for (ph = obj->head; ph != NULL; ph = ph->next)
+		ph->xdp_mac_valid = 0;
+
+	xdp->idents = calloc (1, 65536);
+	if (xdp->idents == NULL)
+		goto fail;
+
+	/* Addresses of the interface */
+	xdp->ctl_fd = socket (AF_INET, SOCK_DGRAM, 0);
+	if (xdp->ctl_fd == -1)
+		goto fail;
+	xdp->ifindex = (int) if_nametoindex (ifname);
+	if (xdp->ifindex == 0)
+		goto fail;
+	if (ping_xdp_ioctl (xdp, SIOCGIFHWADDR, &ifr) != 0)
+		goto fail;
+	memcpy (xdp->src_mac, ifr.ifr_hwaddr.sa_data, sizeof (xdp->src_mac));
+	if ((obj->srcaddr != NULL) && (obj->srcaddr->sa_family == AF_INET))
+	{
+		xdp->src_addr = ((struct sockaddr_in *) obj->srcaddr)->sin_addr;
+	}
+	else
+	{
+		if (ping_xdp_ioctl (xdp, SIOCGIFADDR, &ifr) != 0)
+			goto fail;
+		xdp->src_addr = ((struct sockaddr_in *) &ifr.ifr_addr)->sin_addr;
+	}
+	if (ping_xdp_ioctl (xdp, SIOCGIFNETMASK, &ifr) != 0)
+		goto fail;
+	xdp->netmask = ((struct sockaddr_in *) &ifr.ifr_netmask)->sin_addr;
+	xdp->gateway.s_addr = ping_xdp_gateway (ifname);
+
+	/* Socket, UMEM and rings */
+	xdp->fd = socket (AF_XDP, SOCK_RAW, 0);
+	if (xdp->fd == -1)
+		goto fail;
+	if (xdp->fd >= FD_SETSIZE)
+	{
+		errno = EMFILE;
+		goto fail;
+	}
+
+	xdp->umem = mmap (NULL, PING_XDP_FRAME_SIZE * PING_XDP_FRAME_NUM,
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (xdp->umem == MAP_FAILED)
+	{
+		xdp->umem = NULL;
+		goto fail;
+	}
+
+	memset (&umem_reg, 0, sizeof (umem_reg));
+	umem_reg.addr = (uint64_t) (uintptr_t) xdp->umem;
+	umem_reg.len = PING_XDP_FRAME_SIZE * PING_XDP_FRAME_NUM;
+	umem_reg.chunk_size = PING_XDP_FRAME_SIZE;
+	umem_reg.headroom = PING_XDP_HEADROOM;
+	if ((setsockopt (xdp->fd, SOL_XDP, XDP_UMEM_REG,
+					&umem_reg, sizeof (umem_reg)) != 0)
+			|| (setsockopt (xdp->fd, SOL_XDP, XDP_UMEM_FILL_RING,
+					&(int){PING_XDP_RING_SIZE}, sizeof (int)) != 0)
+			|| (setsockopt (xdp->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING,
+					&(int){PING_XDP_RING_SIZE}, sizeof (int)) != 0)
+			|| (setsockopt (xdp->fd, SOL_XDP, XDP_RX_RING,
+					&(int){PING_XDP_RING_SIZE}, sizeof (int)) != 0)
+			|| (setsockopt (xdp->fd, SOL_XDP, XDP_TX_RING,
+					&(int){PING_XDP_RING_SIZE}, sizeof (int)) != 0)
+			|| (getsockopt (xdp->fd, SOL_XDP, XDP_MMAP_OFFSETS,
+					&off, &off_len) != 0))
+		goto fail;
+
+	if ((ping_xdp_ring_map (&xdp->fill, xdp->fd, &off.fr,
+					sizeof (uint64_t), XDP_UMEM_PGOFF_FILL_RING) != 0)
+			|| (ping_xdp_ring_map (&xdp->comp, xdp->fd, &off.cr,
+					sizeof (uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) != 0)
+			|| (ping_xdp_ring_map (&xdp->rx, xdp->fd, &off.rx,
+					sizeof (struct xdp_desc), XDP_PGOFF_RX_RING) != 0)
+			|| (ping_xdp_ring_map (&xdp->tx, xdp->fd, &off.tx,
+					sizeof (struct xdp_desc), XDP_PGOFF_TX_RING) != 0))
+		goto fail;
+
+	/* Hand the receive frames to the kernel, keep the others for
+	 * sending. */
+	for (i = 0; i < PING_XDP_RING_SIZE; i++)
+		((uint64_t *) xdp->fill.descs)[i] =
+			(uint64_t) i * PING_XDP_FRAME_SIZE;
+	__atomic_store_n (xdp->fill.producer, PING_XDP_RING_SIZE,
+			__ATOMIC_RELEASE);
+	for (i = PING_XDP_RING_SIZE; i < PING_XDP_FRAME_NUM; i++)
+		xdp->tx_free[xdp->tx_free_num++] =
+			(uint64_t) i * PING_XDP_FRAME_SIZE;
+
+	memset (&sxdp, 0, sizeof (sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = (uint32_t) xdp->ifindex;
+	sxdp.sxdp_queue_id = 0;
+	sxdp.sxdp_flags = XDP_COPY;
+	if (bind (xdp->fd, (struct sockaddr *) &sxdp, sizeof (sxdp)) != 0)
+		goto fail;
+
+	/* XDP program */
+	xdp->idents_fd = ping_bpf_map_create (BPF_MAP_TYPE_ARRAY, 65536);
+	if (xdp->idents_fd == -1)
+		goto fail;
+	xdp->xsks_fd = ping_bpf_map_create (BPF_MAP_TYPE_XSKMAP, 1);
+	if (xdp->xsks_fd == -1)
+		goto fail;
+	if (ping_bpf_map_update (xdp->xsks_fd, 0, (uint32_t) xdp->fd) != 0)
+		goto fail;
+	xdp->prog_fd = ping_xdp_prog_load (xdp->idents_fd, xdp->xsks_fd);
+	if (xdp->prog_fd == -1)
+		goto fail;
+
+	/* Generic mode works with any driver, e.g. on veth pairs. */
+	memset (&attr, 0, sizeof (attr));
+	attr.link_create.prog_fd = (uint32_t) xdp->prog_fd;
+	attr.link_create.target_ifindex = (uint32_t) xdp->ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+	xdp->link_fd = ping_bpf (BPF_LINK_CREATE, &attr);
+	if (xdp->link_fd == -1)
+		goto fail;
+
+	obj->ring_stale = 1;
+	return (0);
+
+fail:
+	ping_set_errno (obj, errno);
+	ping_xdp_close (obj);
+	return (-1);
+} /* int ping_xdp_open */
+
+/* ping_xdp_filter sets the identifiers redirected by the XDP program to those
+ * of the IPv4 hosts. Only identifiers that changed are updated. */
+static int ping_xdp_filter (pingobj_t *obj)
+{
+	struct ping_xdp *xdp = obj->xdp;
+	uint8_t *idents;
+	pinghost_t *ph;
+	uint32_t i;
+
+	idents = calloc (1, 65536);
+	if (idents == NULL)
+	{
+		ping_set_errno (obj, errno);
+		return (-1);
+	}
+
+	for (ph = obj->head; ph != NULL; ph = ph->next)
+		if (ph->addrfamily == AF_INET)
+			idents[ph->ident & 0xFFFF] = 1;
+
+	for (i = 0; i < 65536; i++)
+	{
+		if (idents[i] == xdp->idents[i])
+			continue;
+		if (ping_bpf_map_update (xdp->idents_fd,
+					(uint32_t) htons ((uint16_t) i),
+					(uint32_t) idents[i]) != 0)
+		{
+			ping_set_errno (obj, errno);
+			free (idents);
+			return (-1);
+		}
+		xdp->idents[i] = idents[i];
+	}
+
+	free (idents);
+	return (0);
+} /* int ping_xdp_filter */
+
+/* ping_xdp_neighbor looks up the link layer address of the next hop to
+ * "ph" in the ARP cache. Fails if the address is not known yet, e.g. before
+ * the first packet to an address on the local network has been sent. */
+static int ping_xdp_neighbor (pingobj_t *obj, pinghost_t *ph)
+{
+	struct ping_xdp *xdp = obj->xdp;
+	struct sockaddr_storage ss;
+	struct sockaddr_in *sin;
+	struct arpreq req;
+
+	memset (&req, 0, sizeof (req));
+	sin = (struct sockaddr_in *) &req.arp_pa;
+	sin->sin_family = AF_INET;
+	sin->sin_addr = ((const struct sockaddr_in *)
+			ping_host_addr (ph, &ss))->sin_addr;
+	if ((sin->sin_addr.s_addr & xdp->netmask.s_addr)
+			!= (xdp->src_addr.s_addr & xdp->netmask.s_addr))
+	{
+		if (xdp->gateway.s_addr == 0)
+			return (-1);
+		sin->sin_addr = xdp->gateway;
+	}
+	memcpy (req.arp_dev, xdp->ifname, sizeof (xdp->ifname));
+
+	if ((ioctl (xdp->ctl_fd, SIOCGARP, &req) != 0)
+			|| ((req.arp_flags & ATF_COM) == 0))
+		return (-1);
+
+	memcpy (ph->xdp_mac, req.arp_ha.sa_data, sizeof (ph->xdp_mac));
+	ph->xdp_mac_valid = 1;
+	return (0);
+} /* int ping_xdp_neighbor */
+
+/* ping_xdp_frame builds an Ethernet frame of "len" bytes in "frame", holding
+ * an echo request to "ph". The frame bypasses the sockets, so the TTL and QoS
+ * of the object apply unless the host has its own. */
+static void ping_xdp_frame (const pingobj_t *obj, const pinghost_t *ph,
+		char *frame, size_t len)
+{
+	const struct ping_xdp *xdp = obj->xdp;
+	struct sockaddr_storage ss;
+	struct ip *ip_hdr;
+	struct icmp *icmp4;
+
+	memcpy (frame, ph->xdp_mac, ETH_ALEN);
+	memcpy (frame + ETH_ALEN, xdp->src_mac, ETH_ALEN);
+	frame[2 * ETH_ALEN] = (char) (ETH_P_IP >> 8);
+	frame[2 * ETH_ALEN + 1] = (char) (ETH_P_IP & 0xFF);
+
+	ip_hdr = (struct ip *) (frame + ETH_HLEN);
+	memset (ip_hdr, 0, sizeof (*ip_hdr));
+	ip_hdr->ip_v = 4;
+	ip_hdr->ip_hl = sizeof (*ip_hdr) >> 2;
+	ip_hdr->ip_tos = (ph->qos >= 0) ? (uint8_t) ph->qos : obj->qos;
+	ip_hdr->ip_len = htons ((uint16_t) (len - ETH_HLEN));
+	ip_hdr->ip_id = htons ((uint16_t) ph->sequence);
+	ip_hdr->ip_ttl = (uint8_t) ((ph->ttl >= 0) ? ph->ttl : obj->ttl);
+	ip_hdr->ip_p = IPPROTO_ICMP;
+	ip_hdr->ip_src = xdp->src_addr;
+	ip_hdr->ip_dst = ((const struct sockaddr_in *)
+			ping_host_addr (ph, &ss))->sin_addr;
+	ip_hdr->ip_sum = ping_icmp4_checksum ((char *) ip_hdr, sizeof (*ip_hdr));
+
+	icmp4 = (struct icmp *) (ip_hdr + 1);
+	*icmp4 = (struct icmp) {
+		.icmp_type = ICMP_ECHO,
+		.icmp_id   = htons (ph->ident),
+		.icmp_seq  = htons (ph->sequence),
+	};
+	memcpy (((char *) icmp4) + ICMP_MINLEN, ph->payload->data,
+			ph->payload->len);
+	icmp4->icmp_cksum = ping_checksum_fold (ping_checksum_add (
+				ph->payload->sum, (char *) icmp4, ICMP_MINLEN));
+}
+
+/*
+ * ping_xdp_send_one writes an echo request to "ph" into the TX ring. The ring
+ * is flushed by ping_xdp_kick(). Returns non-zero if the request can not be
+ * sent this way, in which case the caller falls back to the raw socket.
+ */
+static int ping_xdp_send_one (pingobj_t *obj, pinghost_t *ph)
+{
+	struct ping_xdp *xdp = obj->xdp;
+	struct xdp_desc *desc;
+	uint32_t prod;
+	uint64_t addr;
+	size_t len;
+	char *frame;
+
+	/* Other sources and interfaces are left to the raw socket. */
+	if ((ph->srcaddr != NULL) || (ph->srcif != 0))
+		return (-1);
+
+	if (!ph->xdp_mac_valid && (ping_xdp_neighbor (obj, ph) != 0))
+		return (-1);
+
+	/* Reclaim the frames that have been sent. */
+	while (*xdp->comp.consumer
+			!= __atomic_load_n (xdp->comp.producer, __ATOMIC_ACQUIRE))
+	{
+		uint32_t cons = *xdp->comp.consumer;
+
+		xdp->tx_free[xdp->tx_free_num++] = ((uint64_t *) xdp->comp.descs)
+			[cons & (xdp->comp.size - 1)]
+			& ~((uint64_t) PING_XDP_FRAME_SIZE - 1);
+		__atomic_store_n (xdp->comp.consumer, cons + 1, __ATOMIC_RELEASE);
+	}
+
+	prod = *xdp->tx.producer;
+	if ((xdp->tx_free_num == 0) || (prod - __atomic_load_n (xdp->tx.consumer,
+					__ATOMIC_ACQUIRE) >= xdp->tx.size))
+		return (-1);
+
+	len = ETH_HLEN + sizeof (struct ip) + ICMP_MINLEN + ph->payload->len;
+	if (len > PING_XDP_FRAME_SIZE - PING_XDP_HEADROOM)
+		return (-1);
+
+	addr = xdp->tx_free[--xdp->tx_free_num] + PING_XDP_HEADROOM;
+	frame = xdp->umem + addr;
+
+	ping_xdp_frame (obj, ph, frame, len);
+
+	if (gettimeofday (ph->timer, NULL) == -1)
+	{
+		timerclear (ph->timer);
+		xdp->tx_free[xdp->tx_free_num++] = addr - PING_XDP_HEADROOM;
+		return (-1);
+	}
+
+	desc = ((struct xdp_desc *) xdp->tx.descs) + (prod & (xdp->tx.size - 1));
+	desc->addr = addr;
+	desc->len = (uint32_t) len;
+	desc->options = 0;
+	__atomic_store_n (xdp->tx.producer, prod + 1, __ATOMIC_RELEASE);
+	xdp->kick = 1;
+
+	ph->sequence++;
+	return (0);
+} /* int ping_xdp_send_one */
+
+/* ping_xdp_kick makes the kernel send the frames in the TX ring. */
+static void ping_xdp_kick (pingobj_t *obj)
+{
+	if (!obj->xdp->kick)
+		return;
+
+	sendto (obj->xdp->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+	obj->xdp->kick = 0;
+}
+
+/* ping_xdp_receive handles a frame of "len" bytes received at "pkt_now".
+ * Returns zero if it was an echo reply to one of our requests, like
+ * ping_receive_match(). */
+static int ping_xdp_receive (pingobj_t *obj, char *frame, size_t len,
+		struct timeval *pkt_now)
+{
+	pinghost_t *host;
+
+	if (len <= ETH_HLEN)
+		return (1);
+
+	host = ping_receive_ipv4 (obj, frame + ETH_HLEN, len - ETH_HLEN,
+			len - ETH_HLEN, NULL);
+	if (host == NULL)
+		return (1);
+
+	return (ping_receive_match (obj, host, pkt_now, AF_INET,
+				&((struct ip *) (frame + ETH_HLEN))->ip_src));
+}
+
+/*
+ * ping_xdp_read parses the replies in the RX ring and returns their frames to
+ * the fill ring. Returns the number of replies from the hosts. AF_XDP has no
+ * receive time stamps, so all replies read at once share the same time.
+ */
+static int ping_xdp_read (pingobj_t *obj)
+{
+	struct ping_xdp *xdp = obj->xdp;
+	struct timeval pkt_now;
+	uint32_t cons;
+	uint32_t prod;
+	uint32_t fill;
+	int replies = 0;
+
+	cons = *xdp->rx.consumer;
+	prod = __atomic_load_n (xdp->rx.producer, __ATOMIC_ACQUIRE);
+	if (cons == prod)
+		return (0);
+
+	if (gettimeofday (&pkt_now, NULL) == -1)
+		return (0);
+
+	fill = *xdp->fill.producer;
+	for (; cons != prod; cons++)
+	{
+		struct xdp_desc *desc;
+
+		desc = ((struct xdp_desc *) xdp->rx.descs)
+			+ (cons & (xdp->rx.size - 1));
+		if (ping_xdp_receive (obj, xdp->umem + desc->addr, desc->len,
+					&pkt_now) == 0)
+			replies++;
+
+		/* There is always room: the fill ring can hold all receive
+		 * frames. */
+		((uint64_t *) xdp->fill.descs)[fill & (xdp->fill.size - 1)] =
+			desc->addr & ~((uint64_t) PING_XDP_FRAME_SIZE - 1);
+		fill++;
+	}
+
+	__atomic_store_n (xdp->fill.producer, fill, __ATOMIC_RELEASE);
+	__atomic_store_n (xdp->rx.consumer, cons, __ATOMIC_RELEASE);
+
+	return (replies);
+} /* int ping_xdp_read */
+#endif /* HAVE_XDP */
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Sending functions:                                                        *
+ *                                                                           *
+ * ping_send_all                                                             *
+ * +-> ping_send_one_ipv4                                                    *
+ * `-> ping_send_one_ipv6                                                    *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* ping_sendto_cmsg appends a control message holding "data" to "msghdr". */
+static void ping_sendto_cmsg (struct msghdr *msghdr, int level, int type,
+		const void *data, size_t len)
+{
+	struct cmsghdr *cmsg;
+
+	cmsg = (struct cmsghdr *) (((char *) msghdr->msg_control)
+			+ msghdr->msg_controllen);
+	cmsg->cmsg_level = level;
+	cmsg->cmsg_type = type;
+	cmsg->cmsg_len = CMSG_LEN (len);
+	memcpy (CMSG_DATA (cmsg), data, len);
+	msghdr->msg_controllen += CMSG_SPACE (len);
+}
+
+/* Buffer for the control messages of an echo request, aligned for struct
+ * cmsghdr. */
+union ping_sendto_buffer
+{
+	char buf[2 * CMSG_SPACE (sizeof (int))
+#if defined(IP_PKTINFO) && defined(IPV6_PKTINFO)
+		+ CMSG_SPACE (sizeof (struct in6_pktinfo))
+#endif
+		];
+	struct cmsghdr align;
+};
+
+/* ping_sendto_control sets up the control messages of "msghdr", held in
+ * "control", for an echo request to "ph". If there are none, msg_control is
+ * left alone. */
+static void ping_sendto_control (pingobj_t *obj, const pinghost_t *ph,
+		struct msghdr *msghdr, union ping_sendto_buffer *control)
+{
+	int ttl = ph->ttl;
+	int qos = ph->qos;
+
+	if (obj->transport != NULL)
+	{
+		if (ttl < 0)
+			ttl = obj->ttl;
+		if (qos < 0)
+			qos = (int) obj->qos;
+	}
+
+	if ((ttl >= 0) || (qos >= 0)
+			|| (ph->srcaddr != NULL) || (ph->srcif != 0))
+	{
+		memset (control, 0, sizeof (*control));
+		msghdr->msg_control = control->buf;
+		msghdr->msg_controllen = 0;
+	}
+	if (ttl >= 0)
+	{
+		if (ph->addrfamily == AF_INET)
+			ping_sendto_cmsg (msghdr, IPPROTO_IP, IP_TTL,
+					&ttl, sizeof (ttl));
+		else
+			ping_sendto_cmsg (msghdr, IPPROTO_IPV6, IPV6_HOPLIMIT,
+					&ttl, sizeof (ttl));
+	}
+	if (qos >= 0)
+	{
+		if (ph->addrfamily == AF_INET)
+			ping_sendto_cmsg (msghdr, IPPROTO_IP, IP_TOS,
+					&qos, sizeof (qos));
+		else
+			ping_sendto_cmsg (msghdr, IPPROTO_IPV6, IPV6_TCLASS,
+					&qos, sizeof (qos));
+	}
+#if defined(IP_PKTINFO) && defined(IPV6_PKTINFO)
+	if ((ph->srcaddr != NULL) || (ph->srcif != 0))
+	{
+		if (ph->addrfamily == AF_INET)
+		{
+			struct in_pktinfo pi;
+
+			memset (&pi, 0, sizeof (pi));
+			pi.ipi_ifindex = (int) ph->srcif;
+			if (ph->srcaddr != NULL)
+				pi.ipi_spec_dst = ((struct sockaddr_in *)
+						ph->srcaddr)->sin_addr;
+			ping_sendto_cmsg (msghdr, IPPROTO_IP, IP_PKTINFO,
+					&pi, sizeof (pi));
+		}
+		else
+		{
+			struct in6_pktinfo pi6;
+
+			memset (&pi6, 0, sizeof (pi6));
+			pi6.ipi6_ifindex = ph->srcif;
+			if (ph->srcaddr != NULL)
+				pi6.ipi6_addr = ((struct sockaddr_in6 *)
+						ph->srcaddr)->sin6_addr;
+			ping_sendto_cmsg (msghdr, IPPROTO_IPV6, IPV6_PKTINFO,
+					&pi6, sizeof (pi6));
+		}
+	}
+#endif
+}
+
+/* ping_sendto sends the ICMP header "buf" followed by the payload of the
+ * host, which is not copied. The TTL, QoS and source of the host, if set, are
+ * passed as control messages and apply to this packet only. Sockets shared
+ * with other objects are used concurrently, so the TTL and QoS of the object
+ * are passed the same way instead of being set on them. */
+static ssize_t ping_sendto (pingobj_t *obj, pinghost_t *ph,
+		const void *buf, size_t buflen, int fd)
+{
+	struct sockaddr_storage ss;
+	struct iovec iov[2];
+	struct msghdr msghdr;
+	union ping_sendto_buffer control;
+	ssize_t ret;
+
+	if (gettimeofday (ph->timer, NULL) == -1)
+	{
+		timerclear (ph->timer);
+		return (-1);
+	}
+
+	iov[0].iov_base = (void *) buf;
+	iov[0].iov_len = buflen;
+	iov[1].iov_base = ph->payload->data;
+	iov[1].iov_len = ph->payload->len;
+
+	memset (&msghdr, 0, sizeof (msghdr));
+	msghdr.msg_name = (void *) ping_host_addr (ph, &ss);
+	msghdr.msg_namelen = ph->addrlen;
+	msghdr.msg_iov = iov;
+	msghdr.msg_iovlen = 2;
+
+	ping_sendto_control (obj, ph, &msghdr, &control);
+
+	ret = sendmsg (fd, &msghdr, 0);
+
+	if (ret < 0)
+	{
+#if defined(EHOSTUNREACH)
+		if (errno == EHOSTUNREACH)
+			return (0);
+#endif
+#if defined(ENETUNREACH)
+		if (errno == ENETUNREACH)
+			return (0);
+#endif
+		ping_set_errno (obj, errno);
+	}
+
+	return (ret);
+}
+
+static int ping_send_one_ipv4 (pingobj_t *obj, pinghost_t *ph, int fd)
+{
+	struct icmp *icmp4;
+	int status;
+
+	/* Only the first ICMP_MINLEN bytes are sent. */
+	char buf[sizeof (struct icmp)] = {0};
+
+	dprintf ("ph->hostname = %s\n", ph->hostname);
+
+	icmp4 = (struct icmp *) buf;
+	*icmp4 = (struct icmp) {
+		.icmp_type = ICMP_ECHO,
+		.icmp_id   = htons (ph->ident),
+		.icmp_seq  = htons (ph->sequence),
+	};
+
+	/* The payload's part of the checksum is only calculated once. */
+	icmp4->icmp_cksum = ping_checksum_fold (ping_checksum_add (
+				ph->payload->sum, buf, ICMP_MINLEN));
+
+	dprintf ("Sending ICMPv4 package with ID 0x%04x\n", ph->ident);
+
+	status = ping_sendto (obj, ph, buf, ICMP_MINLEN, fd);
+	if (status < 0)
+	{
+		perror ("ping_sendto");
+		return (-1);
+	}
+
+	dprintf ("sendto: status = %i\n", status);
+
+	return (0);
+}
+
+static int ping_send_one_ipv6 (pingobj_t *obj, pinghost_t *ph, int fd)
+{
+	struct icmp6_hdr *icmp6;
+	int status;
+
+	char buf[sizeof (*icmp6)] = {0};
+
+	dprintf ("ph->hostname = %s\n", ph->hostname);
+
+	icmp6 = (struct icmp6_hdr *) buf;
+	*icmp6 = (struct icmp6_hdr) {
+		.icmp6_type  = ICMP6_ECHO_REQUEST,
+		.icmp6_id    = htons (ph->ident),
+		.icmp6_seq   = htons (ph->sequence),
+	};
+
+	/* The checksum will be calculated by the TCP/IP stack. */
+
+	dprintf ("Sending ICMPv6 package with ID 0x%04x\n", ph->ident);
+
+	status = ping_sendto (obj, ph, buf, sizeof (buf), fd);
+	if (status < 0)
+	{
+		perror ("ping_sendto");
+		return (-1);
+	}
+
+	dprintf ("sendto: status = %i\n", status);
+
+	return (0);
+}
+
+static int ping_send_one (pingobj_t *obj, pinghost_t *ptr, int fd)
+{
+	if (gettimeofday (ptr->timer, NULL) == -1)
+	{
+		/* start timer.. The GNU `ping6' starts the timer before
+		 * sending the packet, so I will do that too */
+#if WITH_DEBUG
+		char errbuf[PING_ERRMSG_LEN];
+		dprintf ("gettimeofday: %s\n",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+#endif
+		timerclear (ptr->timer);
+		return (-1);
+	}
+	else
+	{
+		dprintf ("timer set for hostname = %s\n", ptr->hostname);
+	}
+
+	if (ptr->addrfamily == AF_INET6)
+	{
+		dprintf ("Sending ICMPv6 echo request to `%s'\n", ptr->hostname);
+		if (ping_send_one_ipv6 (obj, ptr, fd) != 0)
+		{
+			timerclear (ptr->timer);
+			return (-1);
+		}
+	}
+	else if (ptr->addrfamily == AF_INET)
+	{
+		dprintf ("Sending ICMPv4 echo request to `%s'\n", ptr->hostname);
+		if (ping_send_one_ipv4 (obj, ptr, fd) != 0)
+		{
+			timerclear (ptr->timer);
+			return (-1);
+		}
+	}
+	else /* this should not happen */
+	{
+		dprintf ("Unknown address family: %i\n", ptr->addrfamily);
+		timerclear (ptr->timer);
+		return (-1);
+	}
+
+	ptr->sequence++;
+
+	return (0);
+}
+
+/*
+ * Set the TTL of a socket protocol independently.
+ */
+static int ping_set_ttl (pingobj_t *obj, int ttl)
+{
+	int ret = 0;
+	char errbuf[PING_ERRMSG_LEN];
+
+	if (obj->fd4 != -1)
+	{
+		if (setsockopt (obj->fd4, IPPROTO_IP, IP_TTL,
+				&ttl, sizeof (ttl)))
+		{
+			ret = errno;
+			ping_set_error (obj, "ping_set_ttl",
+					sstrerror (ret, errbuf, sizeof (errbuf)));
+			dprintf ("Setting TTLv4 failed: %s\n", errbuf);
+		}
+	}
+
+	if (obj->fd6 != -1)
+	{
+		dprintf ("Setting TTLv6 to %i\n", ttl);
+		if (setsockopt (obj->fd6, IPPROTO_IPV6, IPV6_UNICAST_HOPS,
+				&ttl, sizeof (ttl)))
+		{
+			ret = errno;
+			ping_set_error (obj, "ping_set_ttl",
+					sstrerror (ret, errbuf, sizeof (errbuf)));
+			dprintf ("Setting TTLv6 failed: %s\n", errbuf);
+		}
+	}
+
+	return (ret);
+}
+
+/*
+ * Set the TOS of a socket protocol independently.
+ *
+ * Using SOL_SOCKET / SO_PRIORITY might be a protocol independent way to
+ * set this. See socket(7) for details.
+ */
+static int ping_set_qos (pingobj_t *obj, uint8_t qos)
+{
+	int ret = 0;
+	char errbuf[PING_ERRMSG_LEN];
+
+	if (obj->fd4 != -1)
+	{
+		dprintf ("Setting TP_TOS to %#04"PRIx8"\n", qos);
+		if (setsockopt (obj->fd4, IPPROTO_IP, IP_TOS,
+				&qos, sizeof (qos)))
+		{
+			ret = errno;
+			ping_set_error (obj, "ping_set_qos",
+					sstrerror (ret, errbuf, sizeof (errbuf)));
+			dprintf ("Setting TP_TOS failed: %s\n", errbuf);
+		}
+	}
+
+	if (obj->fd6 != -1)
+	{
+		/* IPV6_TCLASS requires an "int". */
+		int tmp = (int) qos;
+
+		dprintf ("Setting IPV6_TCLASS to %#04"PRIx8" (%i)\n", qos, tmp);
+		if (setsockopt (obj->fd6, IPPROTO_IPV6, IPV6_TCLASS,
+			&tmp, sizeof (tmp)))
+		{
+			ret = errno;
+			ping_set_error (obj, "ping_set_qos",
+					sstrerror (ret, errbuf, sizeof (errbuf)));
+			dprintf ("Setting IPV6_TCLASS failed: %s\n", errbuf);
+		}
+	}
+
+	return (ret);
+}
+
+static int ping_get_ident (void)
+{
+	int fd;
+	static int did_seed = 0;
+
+	int retval;
+
+	if (did_seed == 0)
+	{
+		if ((fd = open ("/dev/urandom", O_RDONLY)) != -1)
+		{
+			unsigned int seed;
+
+			if (read (fd, &seed, sizeof (seed)) != -1)
+			{
+				did_seed = 1;
+				dprintf ("Random seed:   %#x\n", seed);
+				srandom (seed);
+			}
+
+			close (fd);
+		}
+#if WITH_DEBUG
+		else
+		{
+			char errbuf[PING_ERRMSG_LEN];
+			dprintf ("open (/dev/urandom): %s\n",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+		}
+#endif
+	}
+
+	retval = (int) random ();
+
+	dprintf ("Random number: %#x\n", retval);
+
+	return (retval);
+}
+
+/* ping_host_init sets up a zeroed host whose timer and address are stored at
+ * "timer" and "addr". */
+static void ping_host_init (pinghost_t *ph, struct timeval *timer,
+		struct sockaddr_storage *addr)
+{
+	ph->timer   = timer;
+	ph->addr    = addr;
+
+	ph->addrlen = sizeof (struct sockaddr_storage);
+	ph->latency = -1.0;
+	ph->dropped = 0;
+	ph->ident   = ping_get_ident () & 0xFFFF;
+	ph->reachable = -1;
+	ph->ttl     = -1;
+	ph->qos     = -1;
+}
+
+static pinghost_t *ping_alloc (void)
+{
+	pinghost_t *ph;
+	size_t      ph_size;
+
+	ph_size = sizeof (pinghost_t)
+		+ sizeof (struct sockaddr_storage)
+		+ sizeof (struct timeval)
+		+ PING_ADDRSTR_LEN;
+
+	ph = (pinghost_t *) malloc (ph_size);
+	if (ph == NULL)
+		return (NULL);
+
+	memset (ph, '\0', ph_size);
+
+	ping_host_init (ph, (struct timeval *) (ph + 1),
+			(struct sockaddr_storage *) (((struct timeval *) (ph + 1)) + 1));
+	ph->addrstr = (char *) (ph->addr + 1);
+
+	return (ph);
+}
+
+/* ping_range_unref drops a reference to the block of a range. */
+static void ping_range_unref (struct ping_range *range)
+{
+	if (__atomic_sub_fetch (&range->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+		free (range);
+}
+
+/* ping_range_remove marks a host of a range as removed, so that
+ * ping_range_get_host() no longer returns it. That may be called by other
+ * threads while hosts are removed, so the bitmap is updated atomically. */
+static void ping_range_remove (const pinghost_t *ph)
+{
+	size_t i = (size_t) (ph - ph->range->hosts);
+
+	__atomic_or_fetch (ph->range->removed + (i / 8), (uint8_t) (1 << (i % 8)),
+			__ATOMIC_RELEASE);
+}
+
+static void ping_free (pinghost_t *ph)
+{
+	if (ph == NULL)
+		return;
+
+	/* The names may point to addrstr or share one copy. */
+	if (ph->hostname != ph->username)
+		free (ph->hostname);
+	if (ph->username != ph->addrstr)
+		free (ph->username);
+	if ((ph->range != NULL) && (ph->addrstr != ping_range_unnamed))
+		free (ph->addrstr);
+	ping_payload_unref (ph->payload);
+	free (ph->srcaddr);
+	free (ph->trace);
+	ping_responders_free (ph->responders);
+	ping_sketch_destroy (ph->sketch);
+	free (ph->window);
+	free (ph->history);
+
+	if (ph->range == NULL)
+		free (ph);
+	else
+	{
+		ping_range_remove (ph);
+		ping_range_unref (ph->range);
+	}
+}
+
+/*
+ * Size the receive buffer of a socket for "hosts_num" hosts. Each ping_send()
+ * may receive one reply per host before reading any of them, so the buffer
+ * has to hold that many packets. The buffer is only ever grown, unless its
+ * size was set with PING_OPT_RECVBUF. Failing is not fatal: the socket still
+ * works, replies are just more likely to be dropped.
+ */
+static void ping_set_recvbuf (pingobj_t *obj, int fd, size_t hosts_num)
+{
+	int size = obj->recvbuf;
+
+	if (size == 0)
+	{
+		int current = 0;
+		socklen_t current_len = sizeof (current);
+		uint64_t wanted;
+
+		/* Kernel overhead per packet is accounted for by
+		 * PING_RECVBUF_PER_HOST; the payload comes on top. Large
+		 * payloads times many hosts exceed what the socket option
+		 * can express, so the size is clamped. */
+		wanted = ((uint64_t) hosts_num) * (PING_RECVBUF_PER_HOST
+				+ (uint64_t) obj->payload->len);
+		size = (wanted > INT_MAX) ? INT_MAX : (int) wanted;
+
+		/* Linux reports twice the size that was set. */
+		if ((getsockopt (fd, SOL_SOCKET, SO_RCVBUF,
+					&current, &current_len) == 0)
+				&& (current / 2 >= size))
+			return;
+	}
+
+#ifdef SO_RCVBUFFORCE
+	/* Exceeds net.core.rmem_max, but needs CAP_NET_ADMIN. */
+	if (setsockopt (fd, SOL_SOCKET, SO_RCVBUFFORCE,
+				&size, sizeof (size)) == 0)
+		return;
+#endif /* SO_RCVBUFFORCE */
+	if (setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size)) != 0)
+	{
+#if WITH_DEBUG
+		char errbuf[PING_ERRMSG_LEN];
+		dprintf ("setsockopt (SO_RCVBUF): %s\n",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+#endif
+	}
+} /* void ping_set_recvbuf */
+
+/*
+ * Let the kernel spin on the device queue for up to "obj->busy_poll"
+ * microseconds when a socket is read, instead of waiting for an interrupt.
+ * Values above net.core.busy_read need CAP_NET_ADMIN. Failing is not fatal,
+ * ping_send() then only spins in user space.
+ */
+static void ping_set_busy_poll (pingobj_t *obj, int fd)
+{
+#ifdef SO_BUSY_POLL
+	if (setsockopt (fd, SOL_SOCKET, SO_BUSY_POLL,
+				&obj->busy_poll, sizeof (obj->busy_poll)) != 0)
+	{
+#if WITH_DEBUG
+		char errbuf[PING_ERRMSG_LEN];
+		dprintf ("setsockopt (SO_BUSY_POLL): %s\n",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+#endif
+	}
+#endif /* SO_BUSY_POLL */
+#ifdef SO_PREFER_BUSY_POLL
+	setsockopt (fd, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+			&(int){obj->busy_poll > 0}, sizeof (int));
+#endif /* SO_PREFER_BUSY_POLL */
+} /* void ping_set_busy_poll */
+
+/* ping_open_socket opens, initializes and returns a new raw socket to use for
+ * ICMPv4 or ICMPv6 packets. addrfam must be either AF_INET or AF_INET6. On
+ * error, -1 is returned and obj->errmsg is set appropriately. */
+static int ping_open_socket(pingobj_t *obj, int addrfam)
+{
+	int fd;
+	if (addrfam == AF_INET6)
+	{
+		fd = socket(addrfam, SOCK_RAW, IPPROTO_ICMPV6);
+	}
+	else if (addrfam == AF_INET)
+	{
+		fd = socket(addrfam, SOCK_RAW, IPPROTO_ICMP);
+	}
+	else /* this should not happen */
+	{
+		ping_set_error (obj, "ping_open_socket", "Unknown address family");
+		dprintf ("Unknown address family: %i\n", addrfam);
+		return -1;
+	}
+
+	if (fd == -1)
+	{
+		ping_set_errno (obj, errno);
+#if WITH_DEBUG
+		char errbuf[PING_ERRMSG_LEN];
+		dprintf ("socket: %s\n",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+#endif
+		return -1;
+	}
+	else if (fd >= FD_SETSIZE)
+	{
+		ping_set_errno (obj, EMFILE);
+		dprintf ("socket(2) returned file descriptor %d, which is above the file "
+			 "descriptor limit for select(2) (FD_SETSIZE = %d)\n",
+			 fd, FD_SETSIZE);
+		close (fd);
+		return -1;
+	}
+
+	if (obj->srcaddr != NULL)
+	{
+		assert (obj->srcaddrlen > 0);
+		assert (obj->srcaddrlen <= sizeof (struct sockaddr_storage));
+
+		if (bind (fd, obj->srcaddr, obj->srcaddrlen) == -1)
+		{
+			ping_set_errno (obj, errno);
+#if WITH_DEBUG
+			char errbuf[PING_ERRMSG_LEN];
+			dprintf ("bind: %s\n",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+#endif
+			close (fd);
+			return -1;
+		}
+	}
+
+#ifdef SO_BINDTODEVICE
+	if (obj->device != NULL)
+	{
+		if (setsockopt (fd, SOL_SOCKET, SO_BINDTODEVICE,
+				obj->device, strlen (obj->device) + 1) != 0)
+		{
+			ping_set_errno (obj, errno);
+#if WITH_DEBUG
+			char errbuf[PING_ERRMSG_LEN];
+			dprintf ("setsockopt (SO_BINDTODEVICE): %s\n",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+#endif
+			close (fd);
+			return -1;
+		}
+	}
+#endif /* SO_BINDTODEVICE */
+#ifdef SO_MARK
+	if (obj->set_mark)
+	{
+		if (setsockopt(fd, SOL_SOCKET, SO_MARK,
+				&obj->mark, sizeof(obj->mark)) != 0)
+		{
+			ping_set_errno (obj, errno);
+#if WITH_DEBUG
+			char errbuf[PING_ERRMSG_LEN];
+			dprintf ("setsockopt (SO_MARK): %s\n",
+				 sstrerror (errno, errbuf, sizeof (errbuf)));
+#endif
+			close (fd);
+			return -1;
+		}
+	}
+#endif
+#ifdef SO_TIMESTAMP
+	if (1) /* {{{ */
+	{
+		int status = setsockopt (fd, SOL_SOCKET, SO_TIMESTAMP,
+		                         &(int){1}, sizeof(int));
+		if (status != 0)
+		{
+			ping_set_errno (obj, errno);
+#if WITH_DEBUG
+			char errbuf[PING_ERRMSG_LEN];
+			dprintf ("setsockopt (SO_TIMESTAMP): %s\n",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+#endif
+			close (fd);
+			return -1;
+		}
+	} /* }}} if (1) */
+#endif /* SO_TIMESTAMP */
+#ifdef SO_RXQ_OVFL
+	/* Report the number of packets dropped for lack of buffer space, see
+	 * ping_get_socket_drops(). */
+	setsockopt (fd, SOL_SOCKET, SO_RXQ_OVFL, &(int){1}, sizeof(int));
+#endif /* SO_RXQ_OVFL */
+	if (obj->busy_poll > 0)
+		ping_set_busy_poll (obj, fd);
+
+	if (addrfam == AF_INET)
+	{
+		/* Needed to send to broadcast addresses, see
+		 * PING_OPT_RESPONDERS. */
+		if (obj->broadcast)
+			setsockopt (fd, SOL_SOCKET, SO_BROADCAST,
+					&(int){1}, sizeof(int));
+
+#ifdef IP_RECVTOS
+		/* Enable receiving the TOS field */
+		setsockopt (fd, IPPROTO_IP, IP_RECVTOS, &(int){1}, sizeof(int));
+#endif /* IP_RECVTOS */
+
+		/* Enable receiving the TTL field */
+		setsockopt (fd, IPPROTO_IP, IP_RECVTTL, &(int){1}, sizeof(int));
+	}
+#if defined(IPV6_RECVHOPLIMIT) || defined(IPV6_RECVTCLASS)
+	else if (addrfam == AF_INET6)
+	{
+# if defined(IPV6_RECVHOPLIMIT)
+		/* For details see RFC 3542, section 6.3. */
+		setsockopt (fd, IPPROTO_IPV6, IPV6_RECVHOPLIMIT,
+		            &(int){1}, sizeof(int));
+# endif /* IPV6_RECVHOPLIMIT */
+
+# if defined(IPV6_RECVTCLASS)
+		/* For details see RFC 3542, section 6.5. */
+		setsockopt (fd, IPPROTO_IPV6, IPV6_RECVTCLASS,
+		            &(int){1}, sizeof(int));
+# endif /* IPV6_RECVTCLASS */
+	}
+#endif /* IPV6_RECVHOPLIMIT || IPV6_RECVTCLASS */
+
+	return fd;
+}
+
+/* ping_ident_claim claims "ident" in the transport's table for a host that
+ * is not linked into the hash table yet, or for a range. If another host of
+ * any attached object uses it, the next free one is picked and returned.
+ * Replies on shared sockets are matched by identifier, so it must be unique
+ * among all of them. Only if all identifiers are taken, "ident" is returned
+ * unclaimed. */
+static int ping_ident_claim (pingobj_t *obj, int ident)
+{
+	int tries;
+
+	if (obj->transport == NULL)
+		return (ident);
+
+	for (tries = 0; tries < 0x10000; tries++)
+	{
+		pingobj_t *expected = NULL;
+
+		if (__atomic_compare_exchange_n (obj->transport->idents + ident,
+					&expected, obj, /* weak = */ 0,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			return (ident);
+		ident = (ident + 1) & 0xFFFF;
+	}
+
+	return (ident);
+}
+
+/* ping_ident_release releases an identifier claimed by ping_ident_claim(). */
+static void ping_ident_release (pingobj_t *obj, int ident)
+{
+	pingobj_t *expected = obj;
+
+	if (obj->transport == NULL)
+		return;
+
+	__atomic_compare_exchange_n (obj->transport->idents + ident,
+			&expected, NULL, /* weak = */ 0,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+/* ping_range_unlink counts a host of "range" as removed from the list of
+ * hosts. Once none is left, the range is taken off obj->ranges and its
+ * identifier is released. */
+static void ping_range_unlink (pingobj_t *obj, struct ping_range *range)
+{
+	struct ping_range *pre = NULL;
+	struct ping_range *cur;
+
+	range->hosts_linked--;
+	if (range->hosts_linked > 0)
+		return;
+
+	for (cur = obj->ranges; cur != range; cur = cur->next)
+		pre = cur;
+
+	if (pre == NULL)
+		obj->ranges = range->next;
+	else
+		pre->next = range->next;
+	range->next = NULL;
+
+	ping_ident_release (obj, range->ident);
+}
+
+static void ping_transport_unref (ping_transport_t *t)
+{
+	if (__atomic_sub_fetch (&t->refcount, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+
+	if (t->fd4 != -1)
+		close (t->fd4);
+	if (t->fd6 != -1)
+		close (t->fd6);
+	pthread_rwlock_destroy (&t->lock);
+	free (t->idents);
+	free (t);
+}
+
+static void ping_transport_detach (pingobj_t *obj)
+{
+	ping_transport_t *t = obj->transport;
+	struct ping_range *range;
+	pinghost_t *ph;
+
+	if (t == NULL)
+		return;
+
+	/* Once the identifiers are released, no reply is forwarded to us
+	 * any more; replies being forwarded have been pushed when the write
+	 * lock is granted. */
+	pthread_rwlock_wrlock (&t->lock);
+	for (ph = obj->head; ph != NULL; ph = ph->next)
+		if (ph->range == NULL)
+			ping_ident_release (obj, ph->ident);
+	for (range = obj->ranges; range != NULL; range = range->next)
+		ping_ident_release (obj, range->ident);
+	pthread_rwlock_unlock (&t->lock);
+
+	ping_transport_replies_free (__atomic_exchange_n (&obj->replies, NULL,
+				__ATOMIC_ACQUIRE));
+	close (obj->wake_fd[0]);
+	close (obj->wake_fd[1]);
+	obj->wake_fd[0] = -1;
+	obj->wake_fd[1] = -1;
+
+	obj->transport = NULL;
+	obj->fd4 = -1;
+	obj->fd6 = -1;
+	obj->recvbuf_hosts4 = 0;
+	obj->recvbuf_hosts6 = 0;
+	obj->drops4 = 0;
+	obj->drops6 = 0;
+	obj->ring_stale = 1;
+	ping_transport_unref (t);
+}
+
+/* ping_transport_attach attaches the object to "t", or detaches it from its
+ * transport if "t" is NULL. The object's own sockets are closed either way;
+ * new ones are opened by the next ping_send() if needed. */
+static int ping_transport_attach (pingobj_t *obj, ping_transport_t *t)
+{
+	int wake_fd[2];
+	struct ping_range *range;
+	pinghost_t *ph;
+
+	if ((t != NULL) && (pipe (wake_fd) != 0))
+	{
+		ping_set_errno (obj, errno);
+		return (-1);
+	}
+	/* The reading end is watched with select(2). */
+	if ((t != NULL) && (wake_fd[0] >= FD_SETSIZE))
+	{
+		close (wake_fd[0]);
+		close (wake_fd[1]);
+		ping_set_errno (obj, EMFILE);
+		return (-1);
+	}
+
+	if (obj->transport != NULL)
+		ping_transport_detach (obj);
+	if (obj->fd4 != -1)
+		close (obj->fd4);
+	if (obj->fd6 != -1)
+		close (obj->fd6);
+	obj->fd4 = -1;
+	obj->fd6 = -1;
+
+	if (t == NULL)
+		return (0);
+
+	fcntl (wake_fd[0], F_SETFL, fcntl (wake_fd[0], F_GETFL) | O_NONBLOCK);
+	fcntl (wake_fd[1], F_SETFL, fcntl (wake_fd[1], F_GETFL) | O_NONBLOCK);
+	fcntl (wake_fd[0], F_SETFD, FD_CLOEXEC);
+	fcntl (wake_fd[1], F_SETFD, FD_CLOEXEC);
+	obj->wake_fd[0] = wake_fd[0];
+	obj->wake_fd[1] = wake_fd[1];
+
+	__atomic_add_fetch (&t->refcount, 1, __ATOMIC_RELAXED);
+	obj->transport = t;
+	obj->fd4 = __atomic_load_n (&t->fd4, __ATOMIC_ACQUIRE);
+	obj->fd6 = __atomic_load_n (&t->fd6, __ATOMIC_ACQUIRE);
+	obj->recvbuf_hosts4 = 0;
+	obj->recvbuf_hosts6 = 0;
+	obj->drops4 = 0;
+	obj->drops6 = 0;
+	obj->ring_stale = 1;
+
+	/* Rebuild the hash table, making the idents unique. */
+	memset (obj->table, 0, sizeof (obj->table));
+	for (range = obj->ranges; range != NULL; range = range->next)
+		range->ident = ping_ident_claim (obj, range->ident);
+	for (ph = obj->head; ph != NULL; ph = ph->next)
+	{
+		if (ph->range != NULL)
+		{
+			ph->ident = ph->range->ident;
+			continue;
+		}
+		ph->ident = ping_ident_claim (obj, ph->ident);
+		ph->table_next = obj->table[ph->ident % PING_TABLE_LEN];
+		obj->table[ph->ident % PING_TABLE_LEN] = ph;
+	}
+
+	return (0);
+}
+
+/*
+ * public methods
+ */
+const char *ping_get_error (pingobj_t *obj)
+{
+	if (obj == NULL)
+		return (NULL);
+	return (obj->errmsg);
+}
+
+pingobj_t *ping_construct (void)
+{
+	pingobj_t *obj;
+
+	if ((obj = malloc (sizeof (*obj))) == NULL)
+		return (NULL);
+	memset (obj, 0, sizeof (*obj));
+
+	obj->timeout    = PING_DEF_TIMEOUT;
+	obj->ttl        = PING_DEF_TTL;
+	obj->addrfamily = PING_DEF_AF;
+	/* Hosts share the object's payload, so it is never NULL. */
+	obj->payload    = ping_payload_create (PING_DEF_DATA,
+			strlen (PING_DEF_DATA));
+	if (obj->payload == NULL)
+	{
+		free (obj);
+		return (NULL);
+	}
+	obj->qos        = 0;
+	obj->fd4        = -1;
+	obj->fd6        = -1;
+	obj->ring_fd    = -1;
+	obj->wake_fd[0] = -1;
+	obj->wake_fd[1] = -1;
+	obj->sweep_rate = PING_DEF_SWEEP_RATE;
+	obj->responder_window = PING_DEF_RESPONDER_WINDOW;
+
+	return (obj);
+}
+
+ping_transport_t *ping_transport_create (void)
+{
+	ping_transport_t *t;
+
+	if ((t = calloc (1, sizeof (*t))) == NULL)
+		return (NULL);
+
+	/* One pointer per identifier; only the pages of the identifiers in
+	 * use are ever touched. */
+	if ((t->idents = calloc (0x10000, sizeof (*t->idents))) == NULL)
+	{
+		free (t);
+		return (NULL);
+	}
+
+	if (pthread_rwlock_init (&t->lock, NULL) != 0)
+	{
+		free (t->idents);
+		free (t);
+		return (NULL);
+	}
+
+	t->fd4      = -1;
+	t->fd6      = -1;
+	t->refcount = 1;
+
+	return (t);
+}
+
+void ping_transport_destroy (ping_transport_t *t)
+{
+	if (t == NULL)
+		return;
+
+	/* The sockets are closed once all objects have been destroyed. */
+	ping_transport_unref (t);
+}
+
+static void ping_retired_free (struct ping_retired *retired);
+
+void ping_destroy (pingobj_t *obj)
+{
+	pinghost_t *current;
+	int i;
+
+	if (obj == NULL)
+		return;
+
+	/* Readers must have finished by now, so everything retired can be
+	 * freed, as well as the queued hosts that were never added. */
+	free (obj->snapshot);
+	ping_retired_free (&obj->retired);
+	ping_retired_free (&obj->retired_wait);
+	while (obj->queue != NULL)
+	{
+		struct ping_queue_entry *next = obj->queue->next;
+
+		ping_free (obj->queue->add);
+		free (obj->queue->remove);
+		free (obj->queue);
+		obj->queue = next;
+	}
+
+	/* Release the identifiers of the hosts while they still exist. */
+	if (obj->transport != NULL)
+		ping_transport_detach (obj);
+
+	free (obj->names.slots);
+
+	current = obj->head;
+
+	while (current != NULL)
+	{
+		pinghost_t *next = current->next;
+		ping_free (current);
+		current = next;
+	}
+
+	for (i = 0; i < PING_TOP_NUM; i++)
+		ping_heap_free (obj->top + i);
+
+#if HAVE_SYS_MMAN_H
+	ping_shm_unmap (obj);
+#endif
+	free (obj->shm_path);
+#if HAVE_PACKET_RING
+	ping_ring_close (obj);
+#endif
+#if HAVE_XDP
+	ping_xdp_close (obj);
+#endif
+	free (obj->events);
+	ping_payload_unref (obj->payload);
+	free (obj->recv_buf);
+	free (obj->srcaddr);
+	free (obj->device);
+
+	if (obj->fd4 != -1)
+		close(obj->fd4);
+
+	if (obj->fd6 != -1)
+		close(obj->fd6);
+
+	free (obj);
+
+	return;
+}
+
+/* ping_payload_option creates a payload from the value of PING_OPT_DATA or
+ * PING_OPT_DATA_BINARY. On error, NULL is returned and the error message of
+ * "obj" is set. */
+static ping_payload_t *ping_payload_option (pingobj_t *obj,
+		const char *function, int option, const void *value)
+{
+	ping_payload_t *payload;
+	const void *data = value;
+	size_t len;
+
+	if (option == PING_OPT_DATA_BINARY)
+	{
+		data = ((const ping_data_t *) value)->data;
+		len = ((const ping_data_t *) value)->data_len;
+	}
+	else
+	{
+		len = strlen ((const char *) value);
+	}
+
+	if (len > PING_DATA_MAX)
+	{
+		ping_set_error (obj, function,
+				"Payload exceeds the maximum IP packet size");
+		return (NULL);
+	}
+
+	payload = ping_payload_create (data, len);
+	if (payload == NULL)
+		ping_set_errno (obj, errno);
+
+	return (payload);
+}
+
+int ping_setopt (pingobj_t *obj, int option, void *value)
+{
+	int ret = 0;
+
+	if (obj == NULL)
+		return (-1);
+
+	/* A NULL transport detaches the object from its transport. */
+	if ((value == NULL) && (option != PING_OPT_TRANSPORT))
+		return (-1);
+
+	switch (option)
+	{
+		case PING_OPT_QOS:
+		{
+			obj->qos = *((uint8_t *) value);
+			/* Shared sockets are left alone, see ping_sendto(). */
+			if (obj->transport == NULL)
+				ret = ping_set_qos (obj, obj->qos);
+			break;
+		}
+
+		case PING_OPT_TIMEOUT:
+			obj->timeout = *((double *) value);
+			if (obj->timeout < 0.0)
+			{
+				obj->timeout = PING_DEF_TIMEOUT;
+				ret = -1;
+			}
+			break;
+
+		case PING_OPT_TTL:
+			ret = *((int *) value);
+			if ((ret < 1) || (ret > 255))
+			{
+				obj->ttl = PING_DEF_TTL;
+				ret = -1;
+			}
+			else
+			{
+				obj->ttl = ret;
+				ret = 0;
+				/* Shared sockets are left alone, see
+				 * ping_sendto(). */
+				if (obj->transport == NULL)
+					ret = ping_set_ttl (obj, obj->ttl);
+			}
+			break;
+
+		case PING_OPT_AF:
+		{
+			int af = *((int *) value);
+
+			/* Read by ping_host_queue_add() in other threads. */
+			if ((af != AF_UNSPEC) && (af != AF_INET)
+					&& (af != AF_INET6))
+			{
+				af = PING_DEF_AF;
+				ret = -1;
+			}
+			__atomic_store_n (&obj->addrfamily, af, __ATOMIC_RELAXED);
+			if (obj->srcaddr != NULL)
+			{
+				free (obj->srcaddr);
+				obj->srcaddr = NULL;
+			}
+		} /* case PING_OPT_AF */
+		break;
+
+		case PING_OPT_DATA:
+		case PING_OPT_DATA_BINARY:
+		{
+			ping_payload_t *payload;
+
+			payload = ping_payload_option (obj, "ping_setopt",
+					option, value);
+			if (payload == NULL)
+			{
+				ret = -1;
+				break;
+			}
+			ping_payload_unref (obj->payload);
+			obj->payload = payload;
+		} /* case PING_OPT_DATA */
+		break;
+
+		case PING_OPT_SOURCE:
+		{
+			char            *hostname = (char *) value;
+			struct addrinfo  ai_hints;
+			struct addrinfo *ai_list;
+			int              status;
+#if WITH_DEBUG
+			if (obj->addrfamily != AF_UNSPEC)
+			{
+				dprintf ("Resetting obj->addrfamily to AF_UNSPEC.\n");
+			}
+#endif
+			memset ((void *) &ai_hints, '\0', sizeof (ai_hints));
+			__atomic_store_n (&obj->addrfamily, AF_UNSPEC,
+					__ATOMIC_RELAXED);
+			ai_hints.ai_family = AF_UNSPEC;
+#if defined(AI_ADDRCONFIG)
+			ai_hints.ai_flags = AI_ADDRCONFIG;
+#endif
+			status = getaddrinfo (hostname, NULL, &ai_hints, &ai_list);
+			if (status != 0)
+			{
+#if defined(EAI_SYSTEM)
+				char errbuf[PING_ERRMSG_LEN];
+#endif
+				ping_set_error (obj, "getaddrinfo",
+#if defined(EAI_SYSTEM)
+						(status == EAI_SYSTEM)
+						? sstrerror (errno, errbuf, sizeof (errbuf)) :
+#endif
+						gai_strerror (status));
+				ret = -1;
+				break;
+			}
+#if WITH_DEBUG
+			if (ai_list->ai_next != NULL)
+			{
+				dprintf ("hostname = `%s' is ambiguous.\n", hostname);
+			}
+#endif
+			if (obj->srcaddr == NULL)
+			{
+				obj->srcaddrlen = 0;
+				obj->srcaddr = malloc (sizeof (struct sockaddr_storage));
+				if (obj->srcaddr == NULL)
+				{
+					ping_set_errno (obj, errno);
+					ret = -1;
+					freeaddrinfo (ai_list);
+					break;
+				}
+			}
+			memset ((void *) obj->srcaddr, 0, sizeof (struct sockaddr_storage));
+			assert (ai_list->ai_addrlen <= sizeof (struct sockaddr_storage));
+			memcpy ((void *) obj->srcaddr, (const void *) ai_list->ai_addr,
+					ai_list->ai_addrlen);
+			obj->srcaddrlen = ai_list->ai_addrlen;
+			__atomic_store_n (&obj->addrfamily, ai_list->ai_family,
+					__ATOMIC_RELAXED);
+
+			freeaddrinfo (ai_list);
+		} /* case PING_OPT_SOURCE */
+		break;
+
+		case PING_OPT_DEVICE:
+		{
+#ifdef SO_BINDTODEVICE
+			char *device = strdup ((char *) value);
+
+			if (device == NULL)
+			{
+				ping_set_errno (obj, errno);
+				ret = -1;
+				break;
+			}
+
+			if (obj->device != NULL)
+				free (obj->device);
+			obj->device = device;
+#else /* ! SO_BINDTODEVICE */
+			ping_set_errno (obj, ENOTSUP);
+			ret = -1;
+#endif /* ! SO_BINDTODEVICE */
+		} /* case PING_OPT_DEVICE */
+		break;
+
+		case PING_OPT_MARK:
+		{
+#ifdef SO_MARK
+			obj->mark     = *(int*)(value);
+			obj->set_mark = 1;
+#else /* SO_MARK */
+			ping_set_errno (obj, ENOTSUP);
+			ret = -1;
+#endif /* !SO_MARK */
+
+		} /* case PING_OPT_MARK */
+		break;
+
+		case PING_OPT_LATENCY_THRESHOLD:
+			obj->latency_threshold = *((double *) value);
+			if (obj->latency_threshold < 0.0)
+			{
+				obj->latency_threshold = 0.0;
+				ret = -1;
+			}
+			break;
+
+		case PING_OPT_HISTORY:
+		{
+			int size = *((int *) value);
+
+			if (size < 0)
+			{
+				ping_set_error (obj, "ping_setopt",
+						"History size must not be negative");
+				ret = -1;
+				break;
+			}
+			obj->history_size = (size_t) size;
+		} /* case PING_OPT_HISTORY */
+		break;
+
+		case PING_OPT_RECVBUF:
+		{
+			int size = *((int *) value);
+
+			if (size < 0)
+			{
+				ping_set_error (obj, "ping_setopt",
+						"Receive buffer size must not be negative");
+				ret = -1;
+				break;
+			}
+			obj->recvbuf = size;
+			/* Resize the buffers with the next ping_send(). */
+			obj->recvbuf_hosts4 = 0;
+			obj->recvbuf_hosts6 = 0;
+		} /* case PING_OPT_RECVBUF */
+		break;
+
+		case PING_OPT_BUSY_POLL:
+		{
+			int usec = *((int *) value);
+
+			if (usec < 0)
+			{
+				ping_set_error (obj, "ping_setopt",
+						"Busy poll time must not be negative");
+				ret = -1;
+				break;
+			}
+			obj->busy_poll = usec;
+			if (obj->fd4 != -1)
+				ping_set_busy_poll (obj, obj->fd4);
+			if (obj->fd6 != -1)
+				ping_set_busy_poll (obj, obj->fd6);
+		} /* case PING_OPT_BUSY_POLL */
+		break;
+
+		case PING_OPT_HEADERS_ONLY:
+			obj->headers_only = (*((int *) value) != 0);
+			break;
+
+		case PING_OPT_VERIFY_PAYLOAD:
+			obj->verify_payload = (*((int *) value) != 0);
+			break;
+
+		case PING_OPT_SWEEP_RATE:
+			obj->sweep_rate = *((double *) value);
+			if (!(obj->sweep_rate > 0.0))
+			{
+				obj->sweep_rate = PING_DEF_SWEEP_RATE;
+				ret = -1;
+			}
+			break;
+
+		case PING_OPT_RESPONDER_WINDOW:
+			obj->responder_window = *((double *) value);
+			if (!(obj->responder_window >= 0.0))
+			{
+				obj->responder_window = PING_DEF_RESPONDER_WINDOW;
+				ret = -1;
+			}
+			break;
+
+		case PING_OPT_PACKET_RING:
+		{
+#if HAVE_PACKET_RING
+			ping_ring_close (obj);
+			if (((char *) value)[0] != 0)
+				ret = ping_ring_open (obj, (char *) value);
+			ping_ring_block_raw (obj);
+#else /* ! HAVE_PACKET_RING */
+			ping_set_errno (obj, ENOTSUP);
+			ret = -1;
+#endif /* ! HAVE_PACKET_RING */
+		} /* case PING_OPT_PACKET_RING */
+		break;
+
+		case PING_OPT_XDP:
+		{
+#if HAVE_XDP
+			ping_xdp_close (obj);
+			if (((char *) value)[0] != 0)
+				ret = ping_xdp_open (obj, (char *) value);
+#else /* ! HAVE_XDP */
+			ping_set_errno (obj, ENOTSUP);
+			ret = -1;
+#endif /* ! HAVE_XDP */
+		} /* case PING_OPT_XDP */
+		break;
+
+		case PING_OPT_TRANSPORT:
+			if (obj->transport != (ping_transport_t *) value)
+				ret = ping_transport_attach (obj,
+						(ping_transport_t *) value);
+			break;
+
+		case PING_OPT_SHM:
+		{
+#if HAVE_SYS_MMAN_H
+			char *path = NULL;
+
+			if (((char *) value)[0] != 0)
+			{
+				path = strdup ((char *) value);
+				if (path == NULL)
+				{
+					ping_set_errno (obj, errno);
+					ret = -1;
+					break;
+				}
+			}
+
+			/* The table is created by the next ping_send(). */
+			ping_shm_unmap (obj);
+			free (obj->shm_path);
+			obj->shm_path = path;
+#else /* ! HAVE_SYS_MMAN_H */
+			ping_set_errno (obj, ENOTSUP);
+			ret = -1;
+#endif /* ! HAVE_SYS_MMAN_H */
+		} /* case PING_OPT_SHM */
+		break;
+
+		case PING_OPT_EVENT_RING:
+		{
+			int size = *((int *) value);
+			size_t events_size = 1;
+
+			if (size < 0)
+			{
+				ping_set_error (obj, "ping_setopt",
+						"Event ring size must not be negative");
+				ret = -1;
+				break;
+			}
+
+			free (obj->events);
+			obj->events = NULL;
+			obj->events_size = 0;
+			obj->events_head = 0;
+			obj->events_tail = 0;
+			if (size == 0)
+				break;
+
+			/* Round up to a power of two, so that positions can
+			 * be mapped to slots with a mask. */
+			while (events_size < (size_t) size)
+				events_size *= 2;
+
+			obj->events = calloc (events_size, sizeof (*obj->events));
+			if (obj->events == NULL)
+			{
+				ping_set_errno (obj, errno);
+				ret = -1;
+				break;
+			}
+			obj->events_size = events_size;
+		} /* case PING_OPT_EVENT_RING */
+		break;
+
+		default:
+			ret = -2;
+	} /* switch (option) */
+
+	return (ret);
+} /* int ping_setopt */
+
+/* ping_host_sourced returns true if the host has a source address or
+ * interface of its own, see ping_host_setopt(). */
+static _Bool ping_host_sourced (const pinghost_t *ph)
+{
+	return ((ph->srcaddr != NULL) || (ph->srcif != 0));
+}
+
+/* ping_host_search returns the host named "host". A target may be added
+ * once per source, so if there are several, the one without a source of its
+ * own is preferred: that is the one the name refers to when the host is
+ * added again, see ping_host_add(). */
+static pinghost_t *ping_host_search (pinghost_t *ph, const char *host)
+{
+	pinghost_t *first = NULL;
+
+	while (ph != NULL)
+	{
+		if (strcasecmp (ping_host_name (ph), host) == 0)
+		{
+			if (!ping_host_sourced (ph))
+				return (ph);
+			if (first == NULL)
+				first = ph;
+		}
+
+		ph = ph->next;
+	}
+
+	return (first);
+}
+
+static pinghost_t ping_names_removed;
+#define PING_NAMES_REMOVED (&ping_names_removed)
+
+static size_t ping_names_hash (const char *name)
+{
+	/* FNV-1a, case insensitive like the comparison of names. */
+	uint32_t hash = 2166136261U;
+
+	while (*name != 0)
+	{
+		unsigned char c = (unsigned char) *name;
+
+		if ((c >= 'A') && (c <= 'Z'))
+			c += 'a' - 'A';
+		hash ^= c;
+		hash *= 16777619U;
+		name++;
+	}
+
+	return ((size_t) hash);
+}
+
+/* ping_names_add enters "ph" into the table. Returns -1 if that would make
+ * the table more than half full. */
+static int ping_names_add (struct ping_names *names, pinghost_t *ph)
+{
+	size_t i;
+
+	if (2 * (names->used + 1) > names->size)
+		return (-1);
+
+	i = ping_names_hash (ping_host_name (ph)) & (names->size - 1);
+	while ((names->slots[i] != NULL)
+			&& (names->slots[i] != PING_NAMES_REMOVED))
+		i = (i + 1) & (names->size - 1);
+	if (names->slots[i] == NULL)
+		names->used++;
+	names->slots[i] = ph;
+
+	return (0);
+}
+
+static pinghost_t *ping_names_find (const struct ping_names *names,
+		const char *name)
+{
+	size_t i = ping_names_hash (name) & (names->size - 1);
+
+	while (names->slots[i] != NULL)
+	{
+		if ((names->slots[i] != PING_NAMES_REMOVED)
+				&& (strcasecmp (names->slots[i]->username,
+						name) == 0))
+			return (names->slots[i]);
+		i = (i + 1) & (names->size - 1);
+	}
+
+	return (NULL);
+}
+
+static void ping_names_delete (struct ping_names *names, pinghost_t *ph)
+{
+	size_t i;
+
+	i = ping_names_hash (ph->username) & (names->size - 1);
+	while (names->slots[i] != NULL)
+	{
+		if (names->slots[i] == ph)
+		{
+			names->slots[i] = PING_NAMES_REMOVED;
+			return;
+		}
+		i = (i + 1) & (names->size - 1);
+	}
+}
+
+/* ping_names_indexed returns true if "ph" belongs into the table of names.
+ * Hosts with a source of their own are left out, since they are not
+ * duplicates of hosts added by name, see ping_host_add(). So are hosts of
+ * ranges, so that their names need not be formatted, see
+ * ping_range_search(). */
+static _Bool ping_names_indexed (const pinghost_t *ph)
+{
+	return (!ping_host_sourced (ph) && (ph->range == NULL));
+}
+
+/* ping_names_init enters the hosts of "obj" into a new table, which has room
+ * for as many hosts again. On failure, obj->names.slots is NULL. */
+static void ping_names_init (pingobj_t *obj)
+{
+	struct ping_names *names = &obj->names;
+	pinghost_t *ph;
+	size_t num = 0;
+
+	for (ph = obj->head; ph != NULL; ph = ph->next)
+		if (ping_names_indexed (ph))
+			num++;
+
+	names->size = 16;
+	while (names->size < 4 * num)
+		names->size *= 2;
+	names->used = 0;
+
+	names->slots = calloc (names->size, sizeof (names->slots[0]));
+	if (names->slots == NULL)
+		return;
+
+	for (ph = obj->head; ph != NULL; ph = ph->next)
+		if (ping_names_indexed (ph))
+			ping_names_add (names, ph);
+}
+
+/* ping_names_drop drops the table of names, to be built again when it is
+ * next used. */
+static void ping_names_drop (pingobj_t *obj)
+{
+	free (obj->names.slots);
+	obj->names.slots = NULL;
+}
+
+/* ping_names_link enters a host that has been linked into the list of hosts
+ * into the table of names, if it has been built. */
+static void ping_names_link (pingobj_t *obj, pinghost_t *ph)
+{
+	if ((obj->names.slots == NULL) || !ping_names_indexed (ph))
+		return;
+
+	if (ping_names_add (&obj->names, ph) != 0)
+		ping_names_drop (obj);
+}
+
+/* ping_names_unlink removes a host that is unlinked from the list of hosts
+ * from the table of names. */
+static void ping_names_unlink (pingobj_t *obj, pinghost_t *ph)
+{
+	if ((obj->names.slots == NULL) || !ping_names_indexed (ph))
+		return;
+
+	ping_names_delete (&obj->names, ph);
+}
+
+/* ping_range_search returns the host of a range named "host", unless it has
+ * a source of its own. Hosts of ranges are named by their numeric address,
+ * so the host is found by its address instead of by its name. */
+static pinghost_t *ping_range_search (pingobj_t *obj, const char *host)
+{
+	struct ping_range *range;
+	union
+	{
+		struct in_addr   addr4;
+		struct in6_addr  addr6;
+	} addr;
+	int family;
+
+	if (obj->ranges == NULL)
+		return (NULL);
+
+	if (inet_pton (AF_INET, host, &addr.addr4) == 1)
+		family = AF_INET;
+	else if (inet_pton (AF_INET6, host, &addr.addr6) == 1)
+		family = AF_INET6;
+	else
+		return (NULL);
+
+	for (range = obj->ranges; range != NULL; range = range->next)
+	{
+		pinghost_t *ph;
+		uint32_t index;
+
+		if ((range->network.family != family)
+				|| (ping_network_index (&range->network, &addr,
+						&index) != 0)
+				|| ping_range_removed (range, index))
+			continue;
+
+		ph = range->hosts + index;
+		if (!ping_host_sourced (ph)
+				&& (strcasecmp (ping_host_name (ph), host) == 0))
+			return (ph);
+	}
+
+	return (NULL);
+} /* pinghost_t *ping_range_search */
+
+/* ping_host_find returns the host named "host" that has no source of its
+ * own, or NULL if there is none. Instead of searching the list of hosts, the
+ * name is looked up in the table of names, which is built on first use and
+ * kept up to date from then on. Without memory for it, the list is
+ * searched. */
+static pinghost_t *ping_host_find (pingobj_t *obj, const char *host)
+{
+	pinghost_t *ph;
+
+	if (obj->names.slots == NULL)
+		ping_names_init (obj);
+
+	if (obj->names.slots == NULL)
+	{
+		ph = ping_host_search (obj->head, host);
+		return (((ph != NULL) && !ping_host_sourced (ph)) ? ph : NULL);
+	}
+
+	ph = ping_names_find (&obj->names, host);
+	if (ph == NULL)
+		ph = ping_range_search (obj, host);
+
+	return (ph);
+} /* pinghost_t *ping_host_find */
+
+/* ping_host_numeric sets the address of "ph" if "host" is a numeric IPv4 or
+ * IPv6 address of address family "addrfamily". Other names, including
+ * abbreviated IPv4 and scoped IPv6 addresses, are left to getaddrinfo().
+ * Unlike getaddrinfo() with AI_ADDRCONFIG, the address is accepted even if
+ * no address of its family is configured on this system; checking that would
+ * cost the system calls this path avoids. Sending to the host then fails. */
+static _Bool ping_host_numeric (int addrfamily, const char *host,
+		pinghost_t *ph)
+{
+	if (addrfamily != AF_INET6)
+	{
+		struct sockaddr_in *sa4 = (struct sockaddr_in *) ph->addr;
+
+		memset (sa4, 0, sizeof (*sa4));
+		if (inet_pton (AF_INET, host, &sa4->sin_addr) == 1)
+		{
+			sa4->sin_family = AF_INET;
+			ph->addrlen = sizeof (*sa4);
+			ph->addrfamily = AF_INET;
+			return (1);
+		}
+	}
+
+	if (addrfamily != AF_INET)
+	{
+		struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *) ph->addr;
+
+		memset (sa6, 0, sizeof (*sa6));
+		if (inet_pton (AF_INET6, host, &sa6->sin6_addr) == 1)
+		{
+			sa6->sin6_family = AF_INET6;
+			ph->addrlen = sizeof (*sa6);
+			ph->addrfamily = AF_INET6;
+			return (1);
+		}
+	}
+
+	return (0);
+} /* _Bool ping_host_numeric */
+
+/* ping_host_resolve allocates a host and resolves its address for address
+ * family "addrfamily". Errors are written to "errmsg", which is obj->errmsg
+ * unless the host is resolved on behalf of ping_host_queue_add(). The object
+ * is not read, so this may be called from any thread; the caller sets the
+ * payload of the host. */
+static pinghost_t *ping_host_resolve (int addrfamily, const char *host,
+		char errmsg[PING_ERRMSG_LEN])
+{
+	pinghost_t *ph;
+
+	struct addrinfo  ai_hints;
+	struct addrinfo *ai_list, *ai_ptr;
+	int              ai_return;
+	_Bool            numeric;
+
+	memset (&ai_hints, '\0', sizeof (ai_hints));
+	ai_hints.ai_flags     = 0;
+#ifdef AI_ADDRCONFIG
+	ai_hints.ai_flags    |= AI_ADDRCONFIG;
+#endif
+#ifdef AI_CANONNAME
+	ai_hints.ai_flags    |= AI_CANONNAME;
+#endif
+	ai_hints.ai_family    = addrfamily;
+	ai_hints.ai_socktype  = SOCK_RAW;
+
+	if ((ph = ping_alloc ()) == NULL)
+	{
+		dprintf ("Out of memory!\n");
+		return (NULL);
+	}
+
+	if ((ph->username = strdup (host)) == NULL)
+	{
+		dprintf ("Out of memory!\n");
+		sstrerror (errno, errmsg, PING_ERRMSG_LEN);
+		ping_free (ph);
+		return (NULL);
+	}
+
+	/* Numeric addresses are neither resolved nor looked up in reverse, so
+	 * the host name is the name passed in. */
+	numeric = ping_host_numeric (addrfamily, host, ph);
+	if (numeric)
+		ph->hostname = ph->username;
+	else if ((ph->hostname = strdup (host)) == NULL)
+	{
+		dprintf ("Out of memory!\n");
+		sstrerror (errno, errmsg, PING_ERRMSG_LEN);
+		ping_free (ph);
+		return (NULL);
+	}
+
+	if (numeric)
+		return (ph);
+
+	if ((ai_return = getaddrinfo (host, NULL, &ai_hints, &ai_list)) != 0)
+	{
+#if defined(EAI_SYSTEM)
+		char errbuf[PING_ERRMSG_LEN];
+#endif
+		dprintf ("getaddrinfo failed\n");
+		snprintf (errmsg, PING_ERRMSG_LEN, "getaddrinfo: %s",
+#if defined(EAI_SYSTEM)
+						(ai_return == EAI_SYSTEM)
+						? sstrerror (errno, errbuf, sizeof (errbuf)) :
+#endif
+				gai_strerror (ai_return));
+		errmsg[PING_ERRMSG_LEN - 1] = 0;
+		ping_free (ph);
+		return (NULL);
+	}
+
+	if (ai_list == NULL)
+		snprintf (errmsg, PING_ERRMSG_LEN, "getaddrinfo: %s",
+				"No hosts returned");
+
+	for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
+	{
+		if (ai_ptr->ai_family == AF_INET)
+		{
+			ai_ptr->ai_socktype = SOCK_RAW;
+			ai_ptr->ai_protocol = IPPROTO_ICMP;
+		}
+		else if (ai_ptr->ai_family == AF_INET6)
+		{
+			ai_ptr->ai_socktype = SOCK_RAW;
+			ai_ptr->ai_protocol = IPPROTO_ICMPV6;
+		}
+		else
+		{
+			dprintf ("Unknown `ai_family': %i", ai_ptr->ai_family);
+			snprintf (errmsg, PING_ERRMSG_LEN,
+					"getaddrinfo: Unknown `ai_family': %i",
+					ai_ptr->ai_family);
+			errmsg[PING_ERRMSG_LEN - 1] = 0;
+			continue;
+		}
+
+		assert (sizeof (struct sockaddr_storage) >= ai_ptr->ai_addrlen);
+		memset (ph->addr, '\0', sizeof (struct sockaddr_storage));
+		memcpy (ph->addr, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
+		ph->addrlen = ai_ptr->ai_addrlen;
+		ph->addrfamily = ai_ptr->ai_family;
+
+#ifdef AI_CANONNAME
+		if ((ai_ptr->ai_canonname != NULL)
+				&& (strcmp (ph->hostname, ai_ptr->ai_canonname) != 0))
+		{
+			char *old_hostname;
+
+			dprintf ("ph->hostname = %s; ai_ptr->ai_canonname = %s;\n",
+					ph->hostname, ai_ptr->ai_canonname);
+
+			old_hostname = ph->hostname;
+			if ((ph->hostname = strdup (ai_ptr->ai_canonname)) == NULL)
+			{
+				/* strdup failed, falling back to old hostname */
+				ph->hostname = old_hostname;
+			}
+			else if (old_hostname != NULL)
+			{
+				free (old_hostname);
+			}
+		}
+#endif /* AI_CANONNAME */
+	} /* for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next) */
+
+	freeaddrinfo (ai_list);
+
+	if (getnameinfo ((struct sockaddr *) ph->addr, ph->addrlen,
+				ph->addrstr, PING_ADDRSTR_LEN,
+				NULL, 0, NI_NUMERICHOST) != 0)
+		ph->addrstr[0] = 0;
+
+	return (ph);
+} /* pinghost_t *ping_host_resolve */
+
+/* ping_host_register enters a host that has been appended to the list of
+ * hosts into the lookup table and the heaps. */
+static void ping_host_register (pingobj_t *obj, pinghost_t *ph)
+{
+	ph->ident = ping_ident_claim (obj, ph->ident);
+	ph->table_next = obj->table[ph->ident % PING_TABLE_LEN];
+	obj->table[ph->ident % PING_TABLE_LEN] = ph;
+
+	ping_names_link (obj, ph);
+	ping_heap_insert (obj, ph);
+	obj->snapshot_stale = 1;
+	obj->shm_stale = 1;
+	obj->ring_stale = 1;
+} /* void ping_host_register */
+
+/* ping_host_link appends a resolved host to the list of hosts. */
+static void ping_host_link (pingobj_t *obj, pinghost_t *ph)
+{
+	/*
+	 * Adding in the front is much easier, but then the iterator will
+	 * return the host that was added last as first host. That's just not
+	 * nice. -octo
+	 */
+	if (obj->head == NULL)
+	{
+		obj->head = ph;
+	}
+	else
+	{
+		assert (obj->tail->next == NULL);
+		obj->tail->next = ph;
+	}
+	obj->tail = ph;
+
+	ping_host_register (obj, ph);
+} /* void ping_host_link */
+
+/* ping_host_result fills in the result of the last round of a host. */
+static void ping_host_result (const pinghost_t *ph, ping_result_t *r)
+{
+	r->family   = ph->addrfamily;
+	r->latency  = ph->latency;
+	r->sequence = (unsigned int) ph->sequence;
+	r->dropped  = ph->dropped;
+	r->recv_ttl = ph->recv_ttl;
+	r->recv_qos = ph->recv_qos;
+
+	/* The timer of a host is cleared when a reply is received or
+	 * sending failed, but left alone on timeout. */
+	if (ph->latency >= 0.0)
+		r->status = PING_RESULT_REPLY;
+	else if (timerisset (ph->timer))
+		r->status = PING_RESULT_TIMEOUT;
+	else
+		r->status = PING_RESULT_NONE;
+}
+
+/* ping_host_publish copies the result of the last round to the copy read by
+ * ping_snapshot_foreach(). This is the write side of a sequence lock: readers
+ * retry while the counter is odd or changed while they were reading. */
+static void ping_host_publish (pinghost_t *ph)
+{
+	unsigned int seq = ph->snap_seq;
+
+	__atomic_store_n (&ph->snap_seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+
+	ping_host_result (ph, &ph->snap);
+
+	__atomic_store_n (&ph->snap_seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* ping_host_retire frees a host that has been removed from the list. If a
+ * snapshot has been published, readers may still use the host, so it is
+ * only freed by ping_snapshot_publish() once that is no longer the case. */
+static void ping_host_retire (pingobj_t *obj, pinghost_t *ph)
+{
+	obj->snapshot_stale = 1;
+	obj->shm_stale = 1;
+	obj->ring_stale = 1;
+
+	if (obj->snapshot == NULL)
+	{
+		ping_free (ph);
+		return;
+	}
+
+	ph->next = obj->retired.hosts;
+	obj->retired.hosts = ph;
+}
+
+/* ping_snapshot_enter registers a reader of obj->snapshot and returns the
+ * counter it is registered with, to be passed to ping_snapshot_leave(). The
+ * reader is counted for the epoch it saw, and retries if the epoch changed
+ * before it was counted, see ping_snapshot_publish(). */
+static unsigned int ping_snapshot_enter (pingobj_t *obj)
+{
+	while (42)
+	{
+		unsigned int epoch = __atomic_load_n (&obj->snapshot_epoch,
+				__ATOMIC_SEQ_CST);
+		unsigned int i = epoch & 1;
+
+		__atomic_add_fetch (&obj->snapshot_readers[i], 1,
+				__ATOMIC_SEQ_CST);
+		if (__atomic_load_n (&obj->snapshot_epoch, __ATOMIC_SEQ_CST)
+				== epoch)
+			return (i);
+		__atomic_sub_fetch (&obj->snapshot_readers[i], 1,
+				__ATOMIC_SEQ_CST);
+	}
+}
+
+static void ping_snapshot_leave (pingobj_t *obj, unsigned int i)
+{
+	__atomic_sub_fetch (&obj->snapshot_readers[i], 1, __ATOMIC_SEQ_CST);
+}
+
+static void ping_retired_free (struct ping_retired *retired)
+{
+	while (retired->snapshots != NULL)
+	{
+		struct ping_snapshot *next = retired->snapshots->next;
+
+		free (retired->snapshots);
+		retired->snapshots = next;
+	}
+
+	while (retired->hosts != NULL)
+	{
+		pinghost_t *next = retired->hosts->next;
+
+		ping_free (retired->hosts);
+		retired->hosts = next;
+	}
+}
+
+/* ping_snapshot_reclaim frees what has been retired once no reader can use it
+ * any more. Readers are counted per epoch, so readers which start later do
+ * not delay this:
+ *
+ * - Advancing the epoch moves obj->retired to obj->retired_wait. Readers
+ *   counted for the new epoch loaded obj->snapshot after it was replaced, so
+ *   only readers of the previous epoch may use what is waiting.
+ * - Once the counter of the previous epoch drops to zero, obj->retired_wait
+ *   is freed. A reader incrementing that counter late sees the new epoch and
+ *   retries with the other counter.
+ *
+ * The epoch is only advanced when nothing is waiting, so the counter it
+ * switches to is not used by readers of an older epoch. */
+static void ping_snapshot_reclaim (pingobj_t *obj)
+{
+	unsigned int epoch = obj->snapshot_epoch;
+
+	if (((obj->retired_wait.snapshots != NULL)
+				|| (obj->retired_wait.hosts != NULL))
+			&& (__atomic_load_n (&obj->snapshot_readers[(epoch - 1) & 1],
+					__ATOMIC_SEQ_CST) == 0))
+		ping_retired_free (&obj->retired_wait);
+
+	if ((obj->retired_wait.snapshots != NULL)
+			|| (obj->retired_wait.hosts != NULL))
+		return;
+	if ((obj->retired.snapshots == NULL) && (obj->retired.hosts == NULL))
+		return;
+
+	obj->retired_wait = obj->retired;
+	obj->retired.snapshots = NULL;
+	obj->retired.hosts = NULL;
+	__atomic_store_n (&obj->snapshot_epoch, epoch + 1, __ATOMIC_SEQ_CST);
+
+	/* Without readers, there is nothing to wait for. */
+	if (__atomic_load_n (&obj->snapshot_readers[epoch & 1],
+				__ATOMIC_SEQ_CST) == 0)
+		ping_retired_free (&obj->retired_wait);
+}
+
+/* ping_snapshot_publish makes the current list of hosts visible to
+ * ping_snapshot_foreach(), if it changed, and frees the lists and hosts
+ * retired before, see ping_snapshot_reclaim(). */
+static void ping_snapshot_publish (pingobj_t *obj)
+{
+	if (obj->snapshot_stale || (obj->snapshot == NULL))
+	{
+		struct ping_snapshot *snap;
+		struct ping_snapshot *old;
+		pinghost_t *ph;
+		size_t num = 0;
+
+		for (ph = obj->head; ph != NULL; ph = ph->next)
+			num++;
+
+		snap = malloc (sizeof (*snap) + num * sizeof (snap->hosts[0]));
+		if (snap == NULL)
+			return;
+
+		snap->next = NULL;
+		/* Readers must not format the names of ranges. */
+		snap->hosts_num = 0;
+		for (ph = obj->head; ph != NULL; ph = ph->next)
+		{
+			ping_host_name (ph);
+			snap->hosts[snap->hosts_num++] = ph;
+		}
+
+		old = __atomic_exchange_n (&obj->snapshot, snap, __ATOMIC_SEQ_CST);
+		if (old != NULL)
+		{
+			old->next = obj->retired.snapshots;
+			obj->retired.snapshots = old;
+		}
+		obj->snapshot_stale = 0;
+	}
+
+	ping_snapshot_reclaim (obj);
+}
+
+static int ping_host_unlink (pingobj_t *obj, pinghost_t *pre,
+		pinghost_t *target);
+
+/* ping_queue_apply applies the host additions and removals queued with
+ * ping_host_queue_add() and ping_host_queue_remove(), in the order they were
+ * queued. */
+static void ping_queue_apply (pingobj_t *obj)
+{
+	struct ping_queue_entry *queue;
+	struct ping_queue_entry *fifo = NULL;
+
+	queue = __atomic_exchange_n (&obj->queue, NULL, __ATOMIC_ACQUIRE);
+
+	/* The queue is a stack, so reverse it first. */
+	while (queue != NULL)
+	{
+		struct ping_queue_entry *next = queue->next;
+
+		queue->next = fifo;
+		fifo = queue;
+		queue = next;
+	}
+
+	while (fifo != NULL)
+	{
+		struct ping_queue_entry *next = fifo->next;
+
+		if (fifo->add != NULL)
+		{
+			/* The payload is only read by this thread. */
+			if (ping_host_find (obj, fifo->add->username) != NULL)
+				ping_free (fifo->add);
+			else
+			{
+				fifo->add->payload = ping_payload_ref (obj->payload);
+				ping_host_link (obj, fifo->add);
+			}
+		}
+		else
+		{
+			pinghost_t *pre = NULL;
+			pinghost_t *cur;
+
+			for (cur = obj->head; cur != NULL; cur = cur->next)
+			{
+				if (strcasecmp (fifo->remove,
+							ping_host_name (cur)) == 0)
+					break;
+				pre = cur;
+			}
+
+			if (cur != NULL)
+				ping_host_unlink (obj, pre, cur);
+			free (fifo->remove);
+		}
+
+		free (fifo);
+		fifo = next;
+	}
+}
+
+/* ping_transport_share makes "fd" the shared socket "shared" of the
+ * transport, unless another object sharing it has opened one in the
+ * meantime. Returns the socket to use. */
+static int ping_transport_share (int *shared, int fd)
+{
+	int expected = -1;
+
+	if (__atomic_compare_exchange_n (shared, &expected, fd,
+				/* weak = */ 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return (fd);
+
+	close (fd);
+	return (expected);
+}
+
+/*
+ * ping_open_sockets prepares the sockets for sending to "ipv4_num" IPv4 and
+ * "ipv6_num" IPv6 hosts and receiving replies of up to "reply_size" bytes.
+ * Returns zero on success and -1 on error.
+ */
+static int ping_open_sockets (pingobj_t *obj, size_t ipv4_num,
+		size_t ipv6_num, size_t reply_size)
+{
+	if (obj->recv_buf_size < reply_size)
+	{
+		char *tmp = realloc (obj->recv_buf, reply_size);
+		if (tmp == NULL)
+		{
+			ping_set_errno (obj, ENOMEM);
+			return (-1);
+		}
+		obj->recv_buf = tmp;
+		obj->recv_buf_size = reply_size;
+	}
+
+	/* Sockets shared with other objects may have been opened since. */
+	if (obj->transport != NULL)
+	{
+		obj->fd4 = __atomic_load_n (&obj->transport->fd4,
+				__ATOMIC_ACQUIRE);
+		obj->fd6 = __atomic_load_n (&obj->transport->fd6,
+				__ATOMIC_ACQUIRE);
+	}
+
+	if ((ipv4_num > 0) && (obj->fd4 == -1))
+	{
+		obj->fd4 = ping_open_socket(obj, AF_INET);
+		if (obj->fd4 == -1)
+			return (-1);
+		if (obj->transport != NULL)
+			obj->fd4 = ping_transport_share (&obj->transport->fd4,
+					obj->fd4);
+		else
+		{
+			ping_set_ttl (obj, obj->ttl);
+			ping_set_qos (obj, obj->qos);
+		}
+#if HAVE_PACKET_RING
+		ping_ring_block_raw (obj);
+#endif
+	}
+	if ((ipv6_num > 0) && (obj->fd6 == -1))
+	{
+		obj->fd6 = ping_open_socket(obj, AF_INET6);
+		if (obj->fd6 == -1)
+			return (-1);
+		if (obj->transport != NULL)
+			obj->fd6 = ping_transport_share (&obj->transport->fd6,
+					obj->fd6);
+		else
+		{
+			ping_set_ttl (obj, obj->ttl);
+			ping_set_qos (obj, obj->qos);
+		}
+#if HAVE_PACKET_RING
+		ping_ring_block_raw (obj);
+#endif
+	}
+
+	if ((obj->fd4 != -1) && (ipv4_num > obj->recvbuf_hosts4))
+	{
+		ping_set_recvbuf (obj, obj->fd4, ipv4_num);
+		obj->recvbuf_hosts4 = ipv4_num;
+	}
+	if ((obj->fd6 != -1) && (ipv6_num > obj->recvbuf_hosts6))
+	{
+		ping_set_recvbuf (obj, obj->fd6, ipv6_num);
+		obj->recvbuf_hosts6 = ipv6_num;
+	}
+
+	return (0);
+} /* int ping_open_sockets */
+
+int ping_send (pingobj_t *obj)
+{
+	pinghost_t *ptr;
+
+	struct timeval endtime;
+	struct timeval nowtime;
+	struct timeval timeout;
+
+	/* Number of hosts per address family, used to number the hosts and to
+	 * size the sockets' receive buffers. */
+	int ipv4_to_ping = 0;
+	int ipv6_to_ping = 0;
+	/* Hosts without a usable address, only counted to number the hosts. */
+	int other_to_ping = 0;
+	/* Size of the largest expected reply, including the IP header. */
+	size_t reply_size = 4096;
+	/* Requests to groups are answered by any number of hosts, so replies
+	 * are waited for until the responder window after the last request
+	 * to a group has passed, see PING_OPT_RESPONDER_WINDOW. "groups" is
+	 * the number of groups still waiting. */
+	int groups = 0;
+	_Bool groups_closed = 0;
+	struct timeval group_endtime;
+	struct timeval window;
+
+	if (obj->changed_read)
+		ping_changed_clear (obj);
+
+	if (__atomic_load_n (&obj->queue, __ATOMIC_RELAXED) != NULL)
+		ping_queue_apply (obj);
+
+	for (ptr = obj->head; ptr != NULL; ptr = ptr->next)
+	{
+		ptr->latency  = -1.0;
+		ptr->recv_ttl = -1;
+		ptr->index    = ipv4_to_ping + ipv6_to_ping + other_to_ping;
+
+		if (reply_size < 60 + ICMP_MINLEN + ptr->payload->len)
+			reply_size = 60 + ICMP_MINLEN + ptr->payload->len;
+
+		if (ptr->responders != NULL)
+		{
+			ping_responders_clear (ptr->responders);
+			groups++;
+		}
+
+		if (ptr->addrfamily == AF_INET)
+			ipv4_to_ping++;
+		else if (ptr->addrfamily == AF_INET6)
+			ipv6_to_ping++;
+		else
+			other_to_ping++;
+	}
+
+	if ((ipv4_to_ping == 0) && (ipv6_to_ping == 0))
+	{
+		ping_snapshot_publish (obj);
+		ping_set_error (obj, "ping_send", "No hosts to ping");
+		return (-1);
+	}
+
+	if (ping_open_sockets (obj, ipv4_to_ping, ipv6_to_ping, reply_size) != 0)
+		return (-1);
+
+	/* Replies forwarded since the last call are late. */
+	if (obj->transport != NULL)
+	{
+		char buffer[64];
+
+		while (read (obj->wake_fd[0], buffer, sizeof (buffer)) > 0)
+			/* the pipe is non-blocking */;
+		ping_transport_replies_free (__atomic_exchange_n
+				(&obj->replies, NULL, __ATOMIC_ACQUIRE));
+	}
+
+	/* The filters of the ring and the XDP program check the identifiers
+	 * of the hosts. */
+	if (obj->ring_stale)
+	{
+#if HAVE_PACKET_RING
+		if ((obj->ring_fd != -1) && (ping_ring_filter (obj) != 0))
+			return (-1);
+#endif
+#if HAVE_XDP
+		if ((obj->xdp != NULL) && (ping_xdp_filter (obj) != 0))
+			return (-1);
+#endif
+		obj->ring_stale = 0;
+	}
+
+	if (gettimeofday (&nowtime, NULL) == -1)
+	{
+		ping_set_errno (obj, errno);
+		return (-1);
+	}
+	obj->events_round = nowtime;
+
+	/* Set up timeout */
+	timeout.tv_sec = (time_t) obj->timeout;
+	timeout.tv_usec = (suseconds_t) (1000000 * (obj->timeout - ((double) timeout.tv_sec)));
 
 	dprintf ("Set timeout to %i.%06i seconds\n",
 			(int) timeout.tv_sec,
 			(int) timeout.tv_usec);
 
-	ping_timeval_add (&nowtime, &timeout, &endtime);
+	ping_timeval_add (&nowtime, &timeout, &endtime);
+
+	window.tv_sec = (time_t) obj->responder_window;
+	window.tv_usec = (suseconds_t) (1000000 * (obj->responder_window
+				- ((double) window.tv_sec)));
+	ping_timeval_add (&nowtime, &window, &group_endtime);
+
+	/* host_to_ping points to the host to which to send the next ping. The
+	 * pointer is advanced to the next host in the linked list after the
+	 * ping has been sent. If host_to_ping is NULL, no more pings need to be
+	 * send out. */
+	pinghost_t *host_to_ping = obj->head;
+
+	/* pings_in_flight is the number of hosts we sent a "ping" to but didn't
+	 * receive a "pong" yet. */
+	int pings_in_flight = 0;
+
+	/* pongs_received is the number of echo replies received. Unless there
+	 * is an error, this is used as the return value of ping_send(). */
+	int pongs_received = 0;
+
+	int error_count = 0;
+
+	/* Set when the loop ended because the timeout has been reached. */
+	_Bool timed_out = 0;
+
+	while (pings_in_flight > 0 || host_to_ping != NULL || groups > 0)
+	{
+		fd_set read_fds;
+		fd_set write_fds;
+
+		int max_fd = -1;
+		int i;
+
+		_Bool read_ipv4;
+		_Bool read_ipv6;
+
+		FD_ZERO (&read_fds);
+		FD_ZERO (&write_fds);
+
+		/* Only the socket of the next host is polled for writing:
+		 * hosts are pinged in order, so the other socket being
+		 * writable would only wake this loop up without anything to
+		 * send. */
+		if (obj->fd4 != -1)
+		{
+			FD_SET(obj->fd4, &read_fds);
+			if ((host_to_ping != NULL)
+					&& (host_to_ping->addrfamily == AF_INET))
+				FD_SET(obj->fd4, &write_fds);
+
+			if (max_fd < obj->fd4)
+				max_fd = obj->fd4;
+		}
+
+		if (obj->fd6 != -1)
+		{
+			FD_SET(obj->fd6, &read_fds);
+			if ((host_to_ping != NULL)
+					&& (host_to_ping->addrfamily == AF_INET6))
+				FD_SET(obj->fd6, &write_fds);
+
+			if (max_fd < obj->fd6)
+				max_fd = obj->fd6;
+		}
+
+		if (obj->ring_fd != -1)
+		{
+			FD_SET(obj->ring_fd, &read_fds);
+
+			if (max_fd < obj->ring_fd)
+				max_fd = obj->ring_fd;
+		}
+
+#if HAVE_XDP
+		if (obj->xdp != NULL)
+		{
+			FD_SET(obj->xdp->fd, &read_fds);
+
+			if (max_fd < obj->xdp->fd)
+				max_fd = obj->xdp->fd;
+		}
+#endif
+
+		/* Replies read by other objects sharing the transport */
+		if (obj->transport != NULL)
+		{
+			FD_SET(obj->wake_fd[0], &read_fds);
+
+			if (max_fd < obj->wake_fd[0])
+				max_fd = obj->wake_fd[0];
+		}
+
+		assert (max_fd != -1);
+		assert (max_fd < FD_SETSIZE);
+
+		if (gettimeofday (&nowtime, NULL) == -1)
+		{
+			ping_set_errno (obj, errno);
+			return (-1);
+		}
+
+		if (ping_timeval_sub (&endtime, &nowtime, &timeout) == -1)
+		{
+			timed_out = 1;
+			break;
+		}
+
+		/* Once all requests have been sent and the responder window has
+		 * passed, groups stop accepting replies. Groups nobody replied
+		 * to are no longer waited for and count as timed out. */
+		if ((groups > 0) && (host_to_ping == NULL))
+		{
+			struct timeval group_timeout;
+
+			if (ping_timeval_sub (&group_endtime, &nowtime,
+						&group_timeout) == -1)
+			{
+				for (ptr = obj->head; ptr != NULL; ptr = ptr->next)
+				{
+					if ((ptr->responders == NULL)
+							|| !timerisset (ptr->timer))
+						continue;
+					if (ptr->latency < 0.0)
+						pings_in_flight--;
+					timerclear (ptr->timer);
+				}
+				groups = 0;
+				groups_closed = 1;
+				continue;
+			}
+
+			if (timercmp (&group_timeout, &timeout, <))
+				timeout = group_timeout;
+		}
+
+		/* When busy polling, select() only checks the sockets and
+		 * this loop spins until a reply arrives, so that no wakeup
+		 * latency is added to the measured round trip times. */
+		if (obj->busy_poll > 0)
+		{
+			timeout.tv_sec = 0;
+			timeout.tv_usec = 0;
+		}
+
+		dprintf ("Waiting on %i sockets for %u.%06u seconds\n",
+				((obj->fd4 != -1) ? 1 : 0) + ((obj->fd6 != -1) ? 1 : 0),
+				(unsigned) timeout.tv_sec,
+				(unsigned) timeout.tv_usec);
+
+		int status = select (max_fd + 1, &read_fds, &write_fds, NULL, &timeout);
+		int select_errno = errno;
+
+		if (status == -1)
+		{
+			ping_set_errno (obj, select_errno);
+			dprintf ("select: %s\n", obj->errmsg);
+			return (-1);
+		}
+		else if ((status == 0) && (obj->busy_poll > 0))
+		{
+			continue;
+		}
+		else if (status == 0)
+		{
+			dprintf ("select timed out\n");
+			timed_out = 1;
+			break;
+		}
+
+		/* First, drain the replies that are waiting on the sockets.
+		 * Reading alternates between both address families, so that
+		 * a flood of replies on one socket can not starve the other
+		 * one. */
+		read_ipv4 = (obj->fd4 != -1) && FD_ISSET (obj->fd4, &read_fds);
+		read_ipv6 = (obj->fd6 != -1) && FD_ISSET (obj->fd6, &read_fds);
+
+#if HAVE_PACKET_RING
+		/* The ring holds whole blocks of replies, read without any
+		 * system call. */
+		if ((obj->ring_fd != -1) && FD_ISSET (obj->ring_fd, &read_fds))
+		{
+			status = ping_ring_read (obj);
+			pings_in_flight -= status;
+			pongs_received += status;
+		}
+#endif
+#if HAVE_XDP
+		if ((obj->xdp != NULL) && FD_ISSET (obj->xdp->fd, &read_fds))
+		{
+			status = ping_xdp_read (obj);
+			pings_in_flight -= status;
+			pongs_received += status;
+		}
+#endif
+		if ((obj->transport != NULL)
+				&& FD_ISSET (obj->wake_fd[0], &read_fds))
+		{
+			status = ping_transport_read (obj);
+			pings_in_flight -= status;
+			pongs_received += status;
+		}
+
+		for (i = 0; (i < PING_RECV_BATCH) && (read_ipv4 || read_ipv6); i++)
+		{
+			if (read_ipv6)
+			{
+				status = ping_receive_one (obj, AF_INET6);
+				if (status < 0)
+					read_ipv6 = 0;
+				else if (status == 0)
+				{
+					pings_in_flight--;
+					pongs_received++;
+				}
+			}
+
+			if (read_ipv4)
+			{
+				status = ping_receive_one (obj, AF_INET);
+				if (status < 0)
+					read_ipv4 = 0;
+				else if (status == 0)
+				{
+					pings_in_flight--;
+					pongs_received++;
+				}
+			}
+		}
+
+		/* ... then send out the next batch of pings. The batch is
+		 * bounded so that replies arriving in the meantime are read
+		 * (and time stamped) in time. */
+		for (i = 0; (i < PING_SEND_BATCH) && (host_to_ping != NULL); i++)
+		{
+			int fd;
+
+			if (host_to_ping->addrfamily == AF_INET6)
+				fd = obj->fd6;
+			else if (host_to_ping->addrfamily == AF_INET)
+				fd = obj->fd4;
+			else /* this should not happen */
+				fd = -1;
+
+			if (fd == -1)
+				error_count++;
+#if HAVE_XDP
+			/* Hosts whose next hop is not known yet are pinged
+			 * through the raw socket. */
+			else if ((obj->xdp != NULL)
+					&& (host_to_ping->addrfamily == AF_INET)
+					&& (ping_xdp_send_one (obj, host_to_ping) == 0))
+				pings_in_flight++;
+#endif
+			else if (!FD_ISSET (fd, &write_fds))
+				break;
+			else if (ping_send_one (obj, host_to_ping, fd) == 0)
+			{
+				pings_in_flight++;
+				if ((host_to_ping->responders != NULL)
+						&& (gettimeofday (&nowtime, NULL) == 0))
+					ping_timeval_add (&nowtime, &window,
+							&group_endtime);
+			}
+			else
+				error_count++;
+
+			host_to_ping = host_to_ping->next;
+		}
+#if HAVE_XDP
+		if (obj->xdp != NULL)
+			ping_xdp_kick (obj);
+#endif
+	} /* while (1) */
+
+	if (timed_out)
+	{
+		/* Replies forwarded just before the timeout still count. */
+		if (obj->transport != NULL)
+			pongs_received += ping_transport_read (obj);
+
+		if (gettimeofday (&nowtime, NULL) == -1)
+		{
+			ping_set_errno (obj, errno);
+			return (-1);
+		}
+
+		for (ptr = obj->head; ptr != NULL; ptr = ptr->next)
+			if (ptr->latency < 0.0)
+				ping_host_timeout (obj, ptr, &nowtime);
+	}
+	else if (groups_closed)
+	{
+		if (gettimeofday (&nowtime, NULL) == -1)
+		{
+			ping_set_errno (obj, errno);
+			return (-1);
+		}
+
+		for (ptr = obj->head; ptr != NULL; ptr = ptr->next)
+			if ((ptr->responders != NULL) && (ptr->latency < 0.0))
+				ping_host_timeout (obj, ptr, &nowtime);
+	}
+
+	for (ptr = obj->head; ptr != NULL; ptr = ptr->next)
+	{
+		ping_host_history_add (obj, ptr);
+		ping_host_publish (ptr);
+	}
+#if HAVE_SYS_MMAN_H
+	if (ping_shm_publish (obj) != 0)
+		error_count++;
+#endif
+	ping_snapshot_publish (obj);
+
+	if (error_count)
+		return (-1 * error_count);
+	return (pongs_received);
+} /* int ping_send */
+
+/*
+ * ping_trace_record records the answer of "from" to the probe of "ph" with
+ * sequence number "seq". "destination" is true for echo replies of the host
+ * itself. Returns zero if the probe was not answered before.
+ */
+static int ping_trace_record (pinghost_t *ph, uint16_t seq,
+		const struct sockaddr *from, socklen_t fromlen,
+		const struct timeval *pkt_now, _Bool destination)
+{
+	struct ping_trace *trace = ph->trace;
+	struct ping_trace_hop *th;
+	struct timeval diff;
+	int index;
+
+	if (trace == NULL)
+		return (1);
+
+	index = (int) ((uint16_t) (seq - trace->sequence));
+	if (index >= trace->hops_num)
+		return (1);
+
+	th = trace->hops + index;
+	if ((th->hop.status == PING_RESULT_REPLY) || !timerisset (&th->sent))
+		return (1);
+
+	if (ping_timeval_sub ((struct timeval *) pkt_now, &th->sent, &diff) < 0)
+		return (1);
+
+	th->hop.status = PING_RESULT_REPLY;
+	th->hop.latency = (((double) diff.tv_usec) / 1000.0)
+		+ (((double) diff.tv_sec) * 1000.0);
+	th->hop.destination = destination;
+	if (getnameinfo (from, fromlen, th->hop.address,
+				sizeof (th->hop.address), NULL, 0,
+				NI_NUMERICHOST) != 0)
+		th->hop.address[0] = 0;
+
+	if (destination && ((trace->length == 0) || (index < trace->length)))
+		trace->length = index + 1;
+
+	return (0);
+} /* int ping_trace_record */
+
+/*
+ * ping_trace_match records an answer to the probe with identifier "ident" and
+ * sequence number "seq" that was sent to "dst". Identifiers are random, so
+ * several hosts may share one; the destination address tells them apart.
+ */
+static int ping_trace_match (pingobj_t *obj, int addrfam, uint16_t ident,
+		uint16_t seq, const void *dst, const struct sockaddr *from,
+		socklen_t fromlen, const struct timeval *pkt_now,
+		_Bool destination)
+{
+	pinghost_t *ph;
+
+	for (ph = obj->table[ident % PING_TABLE_LEN];
+			ph != NULL; ph = ph->table_next)
+	{
+		if ((ph->ident != ident) || (ph->addrfamily != addrfam))
+			continue;
+
+		if ((addrfam == AF_INET) && (memcmp (dst,
+						&((struct sockaddr_in *) ph->addr)->sin_addr,
+						sizeof (struct in_addr)) != 0))
+			continue;
+		if ((addrfam == AF_INET6) && (memcmp (dst,
+						&((struct sockaddr_in6 *) ph->addr)->sin6_addr,
+						sizeof (struct in6_addr)) != 0))
+			continue;
+
+		return (ping_trace_record (ph, seq, from, fromlen, pkt_now,
+					destination));
+	}
+
+	ph = ping_range_lookup (obj, addrfam, ident, dst);
+	if (ph != NULL)
+		return (ping_trace_record (ph, seq, from, fromlen, pkt_now,
+					destination));
+
+	return (1);
+}
+
+/*
+ * ping_trace_receive_ipv4 matches an ICMPv4 packet to a probe: echo replies
+ * by their own header, time exceeded messages by the quoted header of the
+ * echo request.
+ */
+static int ping_trace_receive_ipv4 (pingobj_t *obj, char *buffer,
+		size_t buffer_len, const struct sockaddr *from, socklen_t fromlen,
+		const struct timeval *pkt_now)
+{
+	struct ip *ip_hdr;
+	struct icmp *icmp_hdr;
+	size_t ip_hdr_len;
+
+	if (buffer_len < sizeof (struct ip))
+		return (1);
+
+	ip_hdr = (struct ip *) buffer;
+	ip_hdr_len = ip_hdr->ip_hl << 2;
+	if (buffer_len < ip_hdr_len + ICMP_MINLEN)
+		return (1);
+	buffer += ip_hdr_len;
+	buffer_len -= ip_hdr_len;
+
+	icmp_hdr = (struct icmp *) buffer;
+	if (icmp_hdr->icmp_type == ICMP_ECHOREPLY)
+		return (ping_trace_match (obj, AF_INET,
+					ntohs (icmp_hdr->icmp_id),
+					ntohs (icmp_hdr->icmp_seq), &ip_hdr->ip_src,
+					from, fromlen, pkt_now, 1));
+
+	if (icmp_hdr->icmp_type != ICMP_TIMXCEED)
+		return (1);
+
+	/* The time exceeded message quotes the IP header of the echo
+	 * request and the first eight bytes of its payload. */
+	buffer += ICMP_MINLEN;
+	buffer_len -= ICMP_MINLEN;
+	if (buffer_len < sizeof (struct ip))
+		return (1);
+
+	ip_hdr = (struct ip *) buffer;
+	ip_hdr_len = ip_hdr->ip_hl << 2;
+	if ((ip_hdr->ip_p != IPPROTO_ICMP)
+			|| (buffer_len < ip_hdr_len + ICMP_MINLEN))
+		return (1);
+
+	icmp_hdr = (struct icmp *) (buffer + ip_hdr_len);
+	if (icmp_hdr->icmp_type != ICMP_ECHO)
+		return (1);
+
+	return (ping_trace_match (obj, AF_INET, ntohs (icmp_hdr->icmp_id),
+				ntohs (icmp_hdr->icmp_seq), &ip_hdr->ip_dst,
+				from, fromlen, pkt_now, 0));
+} /* int ping_trace_receive_ipv4 */
+
+/* ping_trace_receive_ipv6 is the ICMPv6 version of ping_trace_receive_ipv4().
+ * Raw ICMPv6 sockets do not pass the IPv6 header. */
+static int ping_trace_receive_ipv6 (pingobj_t *obj, char *buffer,
+		size_t buffer_len, const struct sockaddr *from, socklen_t fromlen,
+		const struct timeval *pkt_now)
+{
+	struct icmp6_hdr *icmp_hdr;
+	struct ip6_hdr *ip6_hdr;
+
+	if (buffer_len < ICMP_MINLEN)
+		return (1);
+
+	icmp_hdr = (struct icmp6_hdr *) buffer;
+	if (icmp_hdr->icmp6_type == ICMP6_ECHO_REPLY)
+		return (ping_trace_match (obj, AF_INET6,
+					ntohs (icmp_hdr->icmp6_id),
+					ntohs (icmp_hdr->icmp6_seq),
+					&((struct sockaddr_in6 *) from)->sin6_addr,
+					from, fromlen, pkt_now, 1));
+
+	if (icmp_hdr->icmp6_type != ICMP6_TIME_EXCEEDED)
+		return (1);
+
+	/* Echo requests are sent without extension headers. */
+	buffer += ICMP_MINLEN;
+	buffer_len -= ICMP_MINLEN;
+	if (buffer_len < sizeof (*ip6_hdr) + ICMP_MINLEN)
+		return (1);
+
+	ip6_hdr = (struct ip6_hdr *) buffer;
+	icmp_hdr = (struct icmp6_hdr *) (buffer + sizeof (*ip6_hdr));
+	if ((ip6_hdr->ip6_nxt != IPPROTO_ICMPV6)
+			|| (icmp_hdr->icmp6_type != ICMP6_ECHO_REQUEST))
+		return (1);
+
+	return (ping_trace_match (obj, AF_INET6, ntohs (icmp_hdr->icmp6_id),
+				ntohs (icmp_hdr->icmp6_seq), &ip6_hdr->ip6_dst,
+				from, fromlen, pkt_now, 0));
+} /* int ping_trace_receive_ipv6 */
+
+/*
+ * ping_trace_receive reads one packet from the socket of the given address
+ * family. Returns zero if it answered a probe, one if it did not and -1 if
+ * there was nothing to read.
+ */
+static int ping_trace_receive (pingobj_t *obj, int addrfam)
+{
+	int fd = (addrfam == AF_INET6) ? obj->fd6 : obj->fd4;
+	struct sockaddr_storage from;
+	struct timeval pkt_now;
+	_Bool have_timestamp = 0;
+	/* Aligned for the IP headers. */
+	uint32_t buffer[PING_TRACE_RECV_LEN / sizeof (uint32_t)];
+	char control_buffer[1024];
+	struct iovec iov;
+	struct msghdr msghdr;
+	struct cmsghdr *cmsg;
+	ssize_t len;
+
+	iov.iov_base = buffer;
+	iov.iov_len = sizeof (buffer);
+
+	memset (&msghdr, 0, sizeof (msghdr));
+	msghdr.msg_name = &from;
+	msghdr.msg_namelen = sizeof (from);
+	msghdr.msg_iov = &iov;
+	msghdr.msg_iovlen = 1;
+	msghdr.msg_control = control_buffer;
+	msghdr.msg_controllen = sizeof (control_buffer);
+
+	len = recvmsg (fd, &msghdr, MSG_DONTWAIT);
+	if (len < 0)
+		return (-1);
+
+#ifdef SO_TIMESTAMP
+	for (cmsg = CMSG_FIRSTHDR (&msghdr); cmsg != NULL;
+			cmsg = CMSG_NXTHDR (&msghdr, cmsg))
+	{
+		if ((cmsg->cmsg_level == SOL_SOCKET)
+				&& (cmsg->cmsg_type == SO_TIMESTAMP))
+		{
+			memcpy (&pkt_now, CMSG_DATA (cmsg), sizeof (pkt_now));
+			have_timestamp = 1;
+		}
+	}
+#else
+	(void) cmsg;
+#endif
+	if (!have_timestamp && (gettimeofday (&pkt_now, NULL) == -1))
+		return (1);
+
+	if (addrfam == AF_INET)
+		return (ping_trace_receive_ipv4 (obj, (char *) buffer,
+					(size_t) len, (struct sockaddr *) &from,
+					msghdr.msg_namelen, &pkt_now));
+	return (ping_trace_receive_ipv6 (obj, (char *) buffer, (size_t) len,
+				(struct sockaddr *) &from, msghdr.msg_namelen,
+				&pkt_now));
+} /* int ping_trace_receive */
+
+/*
+ * ping_trace_send_one sends the probe with time to live "ttl" to "ph". The
+ * TTL is passed per packet, see ping_sendto().
+ */
+static int ping_trace_send_one (pingobj_t *obj, pinghost_t *ph, int ttl,
+		int fd)
+{
+	int saved_ttl = ph->ttl;
+	int saved_sequence = ph->sequence;
+	int status;
+
+	ph->ttl = ttl;
+	ph->sequence = ph->trace->sequence + ttl - 1;
+
+	if (ph->addrfamily == AF_INET6)
+		status = ping_send_one_ipv6 (obj, ph, fd);
+	else
+		status = ping_send_one_ipv4 (obj, ph, fd);
+
+	ph->trace->hops[ttl - 1].sent = *ph->timer;
+	timerclear (ph->timer);
+
+	ph->ttl = saved_ttl;
+	ph->sequence = saved_sequence;
+
+	return (status);
+}
+
+/* ping_trace_init prepares the path discovery state of "ph" for "max_ttl"
+ * probes. */
+static int ping_trace_init (pinghost_t *ph, int max_ttl)
+{
+	int i;
+
+	if ((ph->trace == NULL) || (ph->trace->hops_size < max_ttl))
+	{
+		struct ping_trace *tmp;
+
+		tmp = realloc (ph->trace, sizeof (*tmp)
+				+ max_ttl * sizeof (tmp->hops[0]));
+		if (tmp == NULL)
+			return (ENOMEM);
+		ph->trace = tmp;
+		ph->trace->hops_size = max_ttl;
+	}
+
+	ph->trace->sequence = ph->sequence;
+	ph->trace->hops_num = max_ttl;
+	ph->trace->length = 0;
+	for (i = 0; i < max_ttl; i++)
+	{
+		struct ping_trace_hop *th = ph->trace->hops + i;
+
+		memset (th, 0, sizeof (*th));
+		th->hop.ttl = i + 1;
+		th->hop.status = PING_RESULT_TIMEOUT;
+		th->hop.latency = -1.0;
+	}
+
+	/* The sequence numbers of the probes are not used again. */
+	ph->sequence += max_ttl;
+
+	return (0);
+}
+
+/* ping_reads_raw_sockets returns false if echo replies are taken off the raw
+ * sockets by the packet ring or AF_XDP. Path discovery and sweeps read them
+ * from the raw sockets. */
+static _Bool ping_reads_raw_sockets (const pingobj_t *obj)
+{
+	if (obj->ring_fd != -1)
+		return (0);
+#if HAVE_XDP
+	if (obj->xdp != NULL)
+		return (0);
+#endif
+	return (1);
+} /* _Bool ping_reads_raw_sockets */
+
+int ping_trace (pingobj_t *obj, int max_ttl)
+{
+	pinghost_t *ptr;
+	pinghost_t *host_to_probe;
+	int ttl_to_probe;
+
+	struct timeval endtime;
+	struct timeval nowtime;
+	struct timeval timeout;
+
+	int ipv4_num = 0;
+	int ipv6_num = 0;
+	/* Probes sent and not answered yet. */
+	int probes_in_flight = 0;
+	int reached = 0;
+
+	if (obj == NULL)
+		return (-1);
+
+	if ((max_ttl < 1) || (max_ttl > 255))
+	{
+		ping_set_error (obj, "ping_trace",
+				"Maximum TTL must be between 1 and 255");
+		return (-1);
+	}
+
+	if (!ping_reads_raw_sockets (obj))
+	{
+		ping_set_error (obj, "ping_trace", "Path discovery is not "
+				"supported with a packet ring or AF_XDP");
+		return (-1);
+	}
+
+	if (__atomic_load_n (&obj->queue, __ATOMIC_RELAXED) != NULL)
+		ping_queue_apply (obj);
+
+	for (ptr = obj->head; ptr != NULL; ptr = ptr->next)
+	{
+		if (ptr->addrfamily == AF_INET)
+			ipv4_num++;
+		else if (ptr->addrfamily == AF_INET6)
+			ipv6_num++;
+		else
+			continue;
+
+		if (ping_trace_init (ptr, max_ttl) != 0)
+		{
+			ping_set_errno (obj, ENOMEM);
+			return (-1);
+		}
+	}
+
+	if ((ipv4_num == 0) && (ipv6_num == 0))
+	{
+		ping_set_error (obj, "ping_trace", "No hosts to trace");
+		return (-1);
+	}
+
+	/* Every probe may be answered, so the receive buffers are sized for
+	 * "max_ttl" replies per host. */
+	if (ping_open_sockets (obj, ((size_t) ipv4_num) * ((size_t) max_ttl),
+				((size_t) ipv6_num) * ((size_t) max_ttl),
+				4096) != 0)
+		return (-1);
+
+	/* Probes are sent one TTL at a time to all hosts, so that the routers
+	 * near this host, which are on many paths, see them spread out. */
+	host_to_probe = obj->head;
+	ttl_to_probe = 1;
+
+	if (gettimeofday (&nowtime, NULL) == -1)
+	{
+		ping_set_errno (obj, errno);
+		return (-1);
+	}
+	timeout.tv_sec = (time_t) obj->timeout;
+	timeout.tv_usec = (suseconds_t) (1000000
+			* (obj->timeout - ((double) timeout.tv_sec)));
+	ping_timeval_add (&nowtime, &timeout, &endtime);
+
+	while ((probes_in_flight > 0) || (host_to_probe != NULL))
+	{
+		fd_set read_fds;
+		fd_set write_fds;
+		struct timeval wait;
+		int max_fd = -1;
+		int status;
+		int i;
+
+		FD_ZERO (&read_fds);
+		FD_ZERO (&write_fds);
+
+		/* Only the socket of the next probe is waited for, so that
+		 * the other one being writable does not end select(2) before
+		 * anything can be sent. */
+		if (obj->fd4 != -1)
+		{
+			FD_SET (obj->fd4, &read_fds);
+			if ((host_to_probe != NULL)
+					&& (host_to_probe->addrfamily == AF_INET))
+				FD_SET (obj->fd4, &write_fds);
+			max_fd = obj->fd4;
+		}
+		if (obj->fd6 != -1)
+		{
+			FD_SET (obj->fd6, &read_fds);
+			if ((host_to_probe != NULL)
+					&& (host_to_probe->addrfamily == AF_INET6))
+				FD_SET (obj->fd6, &write_fds);
+			if (max_fd < obj->fd6)
+				max_fd = obj->fd6;
+		}
+
+		if (gettimeofday (&nowtime, NULL) == -1)
+		{
+			ping_set_errno (obj, errno);
+			return (-1);
+		}
+		if (ping_timeval_sub (&endtime, &nowtime, &wait) == -1)
+			break;
+
+		status = select (max_fd + 1, &read_fds, &write_fds, NULL, &wait);
+		if (status == -1)
+		{
+			ping_set_errno (obj, errno);
+			return (-1);
+		}
+		else if (status == 0)
+		{
+			break;
+		}
+
+		for (i = 0; i < PING_RECV_BATCH; i++)
+		{
+			_Bool read_any = 0;
+
+			if ((obj->fd6 != -1) && FD_ISSET (obj->fd6, &read_fds))
+			{
+				status = ping_trace_receive (obj, AF_INET6);
+				if (status < 0)
+					FD_CLR (obj->fd6, &read_fds);
+				else if (status == 0)
+					probes_in_flight--;
+				read_any = 1;
+			}
+			if ((obj->fd4 != -1) && FD_ISSET (obj->fd4, &read_fds))
+			{
+				status = ping_trace_receive (obj, AF_INET);
+				if (status < 0)
+					FD_CLR (obj->fd4, &read_fds);
+				else if (status == 0)
+					probes_in_flight--;
+				read_any = 1;
+			}
+			if (!read_any)
+				break;
+		}
+
+		for (i = 0; (i < PING_SEND_BATCH) && (host_to_probe != NULL); i++)
+		{
+			int fd = -1;
+
+			if (host_to_probe->addrfamily == AF_INET6)
+				fd = obj->fd6;
+			else if (host_to_probe->addrfamily == AF_INET)
+				fd = obj->fd4;
+
+			if ((fd != -1) && !FD_ISSET (fd, &write_fds))
+				break;
+			if ((fd != -1) && (ping_trace_send_one (obj,
+							host_to_probe, ttl_to_probe,
+							fd) == 0))
+				probes_in_flight++;
+
+			host_to_probe = host_to_probe->next;
+			if ((host_to_probe == NULL) && (ttl_to_probe < max_ttl))
+			{
+				host_to_probe = obj->head;
+				ttl_to_probe++;
+			}
+		}
+
+		/* Routers get the whole timeout to answer the last probe. */
+		if (i > 0)
+			ping_timeval_add (&nowtime, &timeout, &endtime);
+	} /* while (probes_in_flight > 0 || host_to_probe != NULL) */
+
+	for (ptr = obj->head; ptr != NULL; ptr = ptr->next)
+		if ((ptr->trace != NULL) && (ptr->trace->length != 0))
+			reached++;
+
+	return (reached);
+} /* int ping_trace */
+
+/* ping_network_parse parses "network", a numeric address and a prefix length,
+ * into "net". The network may hold at most 2^host_bits addresses, host_bits
+ * being at most 32. Errors are reported on behalf of "function". */
+static int ping_network_parse (pingobj_t *obj, const char *function,
+		const char *network, int host_bits, struct ping_network *net)
+{
+	struct addrinfo  ai_hints;
+	struct addrinfo *ai_list;
+	char address[PING_ADDRSTR_LEN];
+	const char *slash;
+	char *endptr;
+	long prefix;
+	int bits;
+	int status;
+
+	slash = strchr (network, '/');
+	if ((slash == NULL) || ((size_t) (slash - network) >= sizeof (address)))
+	{
+		ping_set_error (obj, function, "Network must be given as "
+				"address/prefix length");
+		return (-1);
+	}
+	memcpy (address, network, slash - network);
+	address[slash - network] = 0;
+
+	errno = 0;
+	prefix = strtol (slash + 1, &endptr, 10);
+	if ((errno != 0) || (endptr == slash + 1) || (*endptr != 0))
+	{
+		ping_set_error (obj, function, "Invalid prefix length");
+		return (-1);
+	}
+
+	memset (&ai_hints, 0, sizeof (ai_hints));
+	ai_hints.ai_flags = AI_NUMERICHOST;
+	ai_hints.ai_family = obj->addrfamily;
+	ai_hints.ai_socktype = SOCK_RAW;
+
+	status = getaddrinfo (address, NULL, &ai_hints, &ai_list);
+	if (status != 0)
+	{
+#if defined(EAI_SYSTEM)
+		char errbuf[PING_ERRMSG_LEN];
+#endif
+
+		ping_set_error (obj, "getaddrinfo",
+#if defined(EAI_SYSTEM)
+				(status == EAI_SYSTEM)
+				? sstrerror (errno, errbuf, sizeof (errbuf)) :
+#endif
+				gai_strerror (status));
+		return (-1);
+	}
+
+	net->family = ai_list->ai_family;
+	if (net->family == AF_INET)
+	{
+		net->base.addr4 = ((struct sockaddr_in *) ai_list->ai_addr)->sin_addr;
+		bits = 32;
+	}
+	else
+	{
+		net->base.addr6 = ((struct sockaddr_in6 *) ai_list->ai_addr)->sin6_addr;
+		bits = 128;
+	}
+	freeaddrinfo (ai_list);
+
+	if ((prefix < bits - host_bits) || (prefix > bits))
+	{
+		char errmsg[PING_ERRMSG_LEN];
+
+		snprintf (errmsg, sizeof (errmsg), "Prefix length must be "
+				"between %i and %i", bits - host_bits, bits);
+		ping_set_error (obj, function, errmsg);
+		return (-1);
+	}
+	net->size = ((uint64_t) 1) << (bits - prefix);
+
+	/* Only the last four bytes of the base vary, the host bits are
+	 * cleared. */
+	if (net->family == AF_INET)
+		net->base.addr4.s_addr = htonl (ntohl (net->base.addr4.s_addr)
+				& (uint32_t) ~(net->size - 1));
+	else
+	{
+		uint32_t last;
+
+		memcpy (&last, net->base.addr6.s6_addr + 12, sizeof (last));
+		last = htonl (ntohl (last) & (uint32_t) ~(net->size - 1));
+		memcpy (net->base.addr6.s6_addr + 12, &last, sizeof (last));
+	}
+
+	return (0);
+} /* int ping_network_parse */
+
+/*
+ * Sweeps, see ping_sweep(). No state is kept per target: its index in the
+ * network is carried in the identifier and sequence number of the probe, and
+ * the payload holds the time it was sent and a keyed hash of both, so that
+ * replies are validated with nothing but their contents. Duplicated replies
+ * are filtered with a table of the targets that replied last.
+ */
+#define PING_SWEEP_RECENT 1024
+
+struct ping_sweep
+{
+	struct ping_network      net;
+	/* Key of the cookies, drawn for each sweep. */
+	uint64_t                 key[2];
+	/* recent: slot "index % PING_SWEEP_RECENT" holds
+	 * "index / PING_SWEEP_RECENT + 1" of the last target that replied,
+	 * zero if none did. */
+	uint32_t                 recent[PING_SWEEP_RECENT];
+
+	ping_sweep_callback_t    callback;
+	void                    *user_data;
+	int                      responders;
+	_Bool                    stopped;
+};
+
+/* Payload of a probe: the cookie and the time it was sent. */
+struct ping_sweep_payload
+{
+	uint64_t                 cookie;
+	uint32_t                 tv_sec;
+	uint32_t                 tv_usec;
+};
+
+#define PING_SIPROUND(v0, v1, v2, v3) do { \
+	v0 += v1; v1 = PING_ROTL64 (v1, 13); v1 ^= v0; v0 = PING_ROTL64 (v0, 32); \
+	v2 += v3; v3 = PING_ROTL64 (v3, 16); v3 ^= v2; \
+	v0 += v3; v3 = PING_ROTL64 (v3, 21); v3 ^= v0; \
+	v2 += v1; v1 = PING_ROTL64 (v1, 17); v1 ^= v2; v2 = PING_ROTL64 (v2, 32); \
+} while (0)
+#define PING_ROTL64(x, b) ((uint64_t) (((x) << (b)) | ((x) >> (64 - (b)))))
+
+/* ping_siphash24 is SipHash-2-4 of the 16 byte message "m", given as two
+ * little endian words, under "key", given the same way. */
+static uint64_t ping_siphash24 (const uint64_t key[2], const uint64_t m[2])
+{
+	uint64_t b = ((uint64_t) 16) << 56;
+	uint64_t v0 = key[0] ^ 0x736f6d6570736575ULL;
+	uint64_t v1 = key[1] ^ 0x646f72616e646f6dULL;
+	uint64_t v2 = key[0] ^ 0x6c7967656e657261ULL;
+	uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+	size_t i;
+
+	for (i = 0; i < 2; i++)
+	{
+		v3 ^= m[i];
+		PING_SIPROUND (v0, v1, v2, v3);
+		PING_SIPROUND (v0, v1, v2, v3);
+		v0 ^= m[i];
+	}
+
+	v3 ^= b;
+	PING_SIPROUND (v0, v1, v2, v3);
+	PING_SIPROUND (v0, v1, v2, v3);
+	v0 ^= b;
+
+	v2 ^= 0xff;
+	for (i = 0; i < 4; i++)
+		PING_SIPROUND (v0, v1, v2, v3);
+
+	return (v0 ^ v1 ^ v2 ^ v3);
+} /* uint64_t ping_siphash24 */
+
+/* ping_sweep_cookie is SipHash-2-4 of the index and the send time of a probe
+ * under the key of the sweep. The cookie only has to be checked by this
+ * process, so the words are hashed in host byte order. */
+static uint64_t ping_sweep_cookie (const struct ping_sweep *sw,
+		uint32_t index, uint32_t tv_sec, uint32_t tv_usec)
+{
+	uint64_t m[2] = { (uint64_t) index, (((uint64_t) tv_sec) << 32) | tv_usec };
+
+	return (ping_siphash24 (sw->key, m));
+} /* uint64_t ping_sweep_cookie */
+
+/* ping_sweep_key draws the key of the cookies. The key must not be guessed
+ * by others, so it is read from the kernel's random number generator;
+ * random() is only used if that is not available. */
+static void ping_sweep_key (uint64_t key[2])
+{
+	int fd;
+	int i;
+
+	fd = open ("/dev/urandom", O_RDONLY);
+	if (fd >= 0)
+	{
+		ssize_t status = read (fd, key, 2 * sizeof (key[0]));
+
+		close (fd);
+		if (status == (ssize_t) (2 * sizeof (key[0])))
+			return;
+	}
+
+	for (i = 0; i < 4; i++)
+		key[i / 2] = (key[i / 2] << 32) ^ (uint32_t) ping_get_ident ();
+} /* void ping_sweep_key */
+
+/*
+ * ping_sweep_send_one sends the probe to target "index". Returns zero if the
+ * probe was sent or the target cannot be reached, and -1 if the socket is out
+ * of buffer space and the probe should be sent again later.
+ */
+static int ping_sweep_send_one (const struct ping_sweep *sw, uint32_t index,
+		int fd)
+{
+	struct sockaddr_storage sa;
+	socklen_t sa_len;
+	struct ping_sweep_payload payload;
+	struct timeval now;
+	/* Only the first "raw" bytes are sent. */
+	union
+	{
+		struct icmp      icmp4;
+		struct icmp6_hdr icmp6;
+		char             raw[ICMP_MINLEN + sizeof (payload)];
+	} buf;
+	ssize_t status;
+
+	if (gettimeofday (&now, NULL) == -1)
+		return (0);
+
+	memset (&buf, 0, sizeof (buf));
+	payload.tv_sec = (uint32_t) now.tv_sec;
+	payload.tv_usec = (uint32_t) now.tv_usec;
+	payload.cookie = ping_sweep_cookie (sw, index, payload.tv_sec,
+			payload.tv_usec);
+	memcpy (buf.raw + ICMP_MINLEN, &payload, sizeof (payload));
+
+	if (sw->net.family == AF_INET)
+	{
+		buf.icmp4.icmp_type = ICMP_ECHO;
+		buf.icmp4.icmp_id = htons ((uint16_t) (index >> 16));
+		buf.icmp4.icmp_seq = htons ((uint16_t) index);
+		buf.icmp4.icmp_cksum = ping_icmp4_checksum (buf.raw,
+				sizeof (buf.raw));
+	}
+	else
+	{
+		/* The checksum is calculated by the TCP/IP stack. */
+		buf.icmp6.icmp6_type = ICMP6_ECHO_REQUEST;
+		buf.icmp6.icmp6_id = htons ((uint16_t) (index >> 16));
+		buf.icmp6.icmp6_seq = htons ((uint16_t) index);
+	}
+
+	sa_len = ping_network_address (&sw->net, index, &sa);
+	status = sendto (fd, buf.raw, sizeof (buf.raw), 0,
+			(struct sockaddr *) &sa, sa_len);
+	if ((status < 0) && ((errno == ENOBUFS) || (errno == EAGAIN)
+				|| (errno == EWOULDBLOCK) || (errno == EINTR)))
+		return (-1);
+
+#if WITH_DEBUG
+	if (status < 0)
+	{
+		char errbuf[PING_ERRMSG_LEN];
+		dprintf ("sendto: %s\n",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+	}
+#endif
+
+	return (0);
+} /* int ping_sweep_send_one */
+
+/*
+ * ping_sweep_match validates the echo reply with identifier "ident" and
+ * sequence number "seq" from "from" and hands it to the callback. "data" is
+ * the payload of the reply.
+ */
+static void ping_sweep_match (struct ping_sweep *sw, uint16_t ident,
+		uint16_t seq, const void *from, const char *data, size_t data_len,
+		const struct timeval *pkt_now)
+{
+	struct ping_sweep_payload payload;
+	struct sockaddr_storage sa;
+	socklen_t sa_len;
+	char address[PING_ADDRSTR_LEN];
+	uint32_t index = (((uint32_t) ident) << 16) | seq;
+	double latency;
+
+	if ((index >= sw->net.size) || (data_len < sizeof (payload)))
+		return;
+
+	sa_len = ping_network_address (&sw->net, index, &sa);
+	if (sw->net.family == AF_INET)
+	{
+		if (memcmp (from, &((struct sockaddr_in *) &sa)->sin_addr,
+					sizeof (struct in_addr)) != 0)
+			return;
+	}
+	else
+	{
+		if (memcmp (from, &((struct sockaddr_in6 *) &sa)->sin6_addr,
+					sizeof (struct in6_addr)) != 0)
+			return;
+	}
+
+	memcpy (&payload, data, sizeof (payload));
+	if (payload.cookie != ping_sweep_cookie (sw, index, payload.tv_sec,
+				payload.tv_usec))
+		return;
+
+	/* Targets are probed in order, so a duplicate is only missed if
+	 * PING_SWEEP_RECENT further targets replied before it arrived. */
+	if (sw->recent[index % PING_SWEEP_RECENT]
+			== (index / PING_SWEEP_RECENT) + 1)
+		return;
+	sw->recent[index % PING_SWEEP_RECENT] = (index / PING_SWEEP_RECENT) + 1;
+
+	/* Only the low bits of the seconds are sent, the difference is taken
+	 * modulo 2^32. */
+	latency = ((double) (uint32_t) (((uint32_t) pkt_now->tv_sec)
+				- payload.tv_sec)) * 1000.0
+		+ (((double) pkt_now->tv_usec) - ((double) payload.tv_usec))
+		/ 1000.0;
+
+	sw->responders++;
+	if (sw->callback == NULL)
+		return;
+
+	if (getnameinfo ((struct sockaddr *) &sa, sa_len, address,
+				sizeof (address), NULL, 0, NI_NUMERICHOST) != 0)
+		address[0] = 0;
+
+	if ((*sw->callback) (index, address, latency, sw->user_data) != 0)
+		sw->stopped = 1;
+} /* void ping_sweep_match */
+
+/*
+ * ping_sweep_receive reads one packet from the socket of the sweep. Returns
+ * -1 if there was nothing to read and zero otherwise.
+ */
+static int ping_sweep_receive (pingobj_t *obj, struct ping_sweep *sw)
+{
+	int fd = (sw->net.family == AF_INET6) ? obj->fd6 : obj->fd4;
+	struct sockaddr_storage from;
+	struct timeval pkt_now;
+	_Bool have_timestamp = 0;
+	/* Aligned for the IP headers. */
+	uint32_t buffer[PING_TRACE_RECV_LEN / sizeof (uint32_t)];
+	char control_buffer[1024];
+	char *data = (char *) buffer;
+	struct iovec iov;
+	struct msghdr msghdr;
+	struct cmsghdr *cmsg;
+	ssize_t len;
+
+	iov.iov_base = buffer;
+	iov.iov_len = sizeof (buffer);
+
+	memset (&msghdr, 0, sizeof (msghdr));
+	msghdr.msg_name = &from;
+	msghdr.msg_namelen = sizeof (from);
+	msghdr.msg_iov = &iov;
+	msghdr.msg_iovlen = 1;
+	msghdr.msg_control = control_buffer;
+	msghdr.msg_controllen = sizeof (control_buffer);
+
+	len = recvmsg (fd, &msghdr, MSG_DONTWAIT);
+	if (len < 0)
+		return (-1);
+
+#ifdef SO_TIMESTAMP
+	for (cmsg = CMSG_FIRSTHDR (&msghdr); cmsg != NULL;
+			cmsg = CMSG_NXTHDR (&msghdr, cmsg))
+	{
+		if ((cmsg->cmsg_level == SOL_SOCKET)
+				&& (cmsg->cmsg_type == SO_TIMESTAMP))
+		{
+			memcpy (&pkt_now, CMSG_DATA (cmsg), sizeof (pkt_now));
+			have_timestamp = 1;
+		}
+	}
+#else
+	(void) cmsg;
+#endif
+	if (!have_timestamp && (gettimeofday (&pkt_now, NULL) == -1))
+		return (0);
+
+	if (sw->net.family == AF_INET)
+	{
+		struct ip *ip_hdr = (struct ip *) data;
+		struct icmp *icmp_hdr;
+		size_t ip_hdr_len;
+
+		if ((size_t) len < sizeof (struct ip))
+			return (0);
+		ip_hdr_len = ip_hdr->ip_hl << 2;
+		if ((size_t) len < ip_hdr_len + ICMP_MINLEN)
+			return (0);
+
+		icmp_hdr = (struct icmp *) (data + ip_hdr_len);
+		if (icmp_hdr->icmp_type != ICMP_ECHOREPLY)
+			return (0);
+
+		ping_sweep_match (sw, ntohs (icmp_hdr->icmp_id),
+				ntohs (icmp_hdr->icmp_seq), &ip_hdr->ip_src,
+				data + ip_hdr_len + ICMP_MINLEN,
+				len - ip_hdr_len - ICMP_MINLEN, &pkt_now);
+	}
+	else
+	{
+		/* Raw ICMPv6 sockets do not pass the IPv6 header. */
+		struct icmp6_hdr *icmp_hdr = (struct icmp6_hdr *) data;
+
+		if (((size_t) len < ICMP_MINLEN)
+				|| (icmp_hdr->icmp6_type != ICMP6_ECHO_REPLY))
+			return (0);
+
+		ping_sweep_match (sw, ntohs (icmp_hdr->icmp6_id),
+				ntohs (icmp_hdr->icmp6_seq),
+				&((struct sockaddr_in6 *) &from)->sin6_addr,
+				data + ICMP_MINLEN, len - ICMP_MINLEN, &pkt_now);
+	}
+
+	return (0);
+} /* int ping_sweep_receive */
+
+/* ping_sweep_run sends the probes of the sweep "sw" and reads the replies
+ * until the timeout after the last probe, or until the callback stops it. */
+static int ping_sweep_run (pingobj_t *obj, struct ping_sweep *sw)
+{
+	uint64_t next_index = 0;
+	int fd;
+	int i;
+
+	struct timeval starttime;
+	struct timeval endtime;
+	struct timeval nowtime;
+	struct timeval timeout;
+
+	/* The receive buffer is sized for a tenth of a second of replies. */
+	i = (obj->sweep_rate < 1e6) ? (int) (obj->sweep_rate / 10.0) + 1
+		: 100000;
+	if (ping_open_sockets (obj, (sw->net.family == AF_INET) ? i : 0,
+				(sw->net.family == AF_INET6) ? i : 0, 4096) != 0)
+		return (-1);
+	fd = (sw->net.family == AF_INET) ? obj->fd4 : obj->fd6;
+
+	if (gettimeofday (&starttime, NULL) == -1)
+	{
+		ping_set_errno (obj, errno);
+		return (-1);
+	}
+	timeout.tv_sec = (time_t) obj->timeout;
+	timeout.tv_usec = (suseconds_t) (1000000
+			* (obj->timeout - ((double) timeout.tv_sec)));
+	endtime = starttime;
+
+	while (!sw->stopped)
+	{
+		fd_set read_fds;
+		fd_set write_fds;
+		struct timeval wait;
+		double elapsed;
+		uint64_t due = 0;
+		int status;
+
+		if (gettimeofday (&nowtime, NULL) == -1)
+		{
+			ping_set_errno (obj, errno);
+			return (-1);
+		}
+
+		/* Probes are paced from the start of the sweep, so that the
+		 * rate does not drift with the time spent per wakeup. */
+		if (next_index < sw->net.size)
+		{
+			ping_timeval_sub (&nowtime, &starttime, &wait);
+			elapsed = ((double) wait.tv_sec)
+				+ ((double) wait.tv_usec) / 1000000.0;
+			due = ((uint64_t) (elapsed * obj->sweep_rate)) + 1;
+			if (due > sw->net.size)
+				due = sw->net.size;
+
+			if (due > next_index)
+			{
+				wait.tv_sec = 0;
+				wait.tv_usec = 0;
+			}
+			else
+			{
+				double delay = ((double) next_index)
+					/ obj->sweep_rate - elapsed;
+
+				wait.tv_sec = (time_t) delay;
+				wait.tv_usec = (suseconds_t) (1000000
+						* (delay - ((double) wait.tv_sec)));
+			}
+		}
+		else if (ping_timeval_sub (&endtime, &nowtime, &wait) == -1)
+		{
+			break;
+		}
+
+		FD_ZERO (&read_fds);
+		FD_ZERO (&write_fds);
+		FD_SET (fd, &read_fds);
+		if (due > next_index)
+			FD_SET (fd, &write_fds);
+
+		status = select (fd + 1, &read_fds, &write_fds, NULL, &wait);
+		if (status == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			ping_set_errno (obj, errno);
+			return (-1);
+		}
+
+		if (FD_ISSET (fd, &read_fds))
+			for (i = 0; (i < PING_RECV_BATCH) && !sw->stopped; i++)
+				if (ping_sweep_receive (obj, sw) < 0)
+					break;
+
+		if (!FD_ISSET (fd, &write_fds))
+			continue;
+
+		for (i = 0; (i < PING_SEND_BATCH) && (next_index < due); i++)
+		{
+			if (ping_sweep_send_one (sw, (uint32_t) next_index,
+						fd) != 0)
+				break;
+			next_index++;
+		}
+
+		/* Targets get the whole timeout to answer the last probe. */
+		if ((i > 0) && (next_index == sw->net.size))
+		{
+			if (gettimeofday (&nowtime, NULL) == -1)
+			{
+				ping_set_errno (obj, errno);
+				return (-1);
+			}
+			ping_timeval_add (&nowtime, &timeout, &endtime);
+		}
+	} /* while (!sw->stopped) */
+
+	return (sw->responders);
+} /* int ping_sweep_run */
+
+int ping_sweep (pingobj_t *obj, const char *network,
+		ping_sweep_callback_t callback, void *user_data)
+{
+	struct ping_sweep sw;
+
+	if ((obj == NULL) || (network == NULL))
+		return (-1);
+
+	if (!ping_reads_raw_sockets (obj))
+	{
+		ping_set_error (obj, "ping_sweep", "Sweeps are not supported "
+				"with a packet ring or AF_XDP");
+		return (-1);
+	}
+
+	/* Probes carry the target's index instead of an identifier claimed
+	 * in the transport, so other objects would take their replies, and
+	 * they are sent without the object's TTL and QoS. */
+	if (obj->transport != NULL)
+	{
+		ping_set_error (obj, "ping_sweep", "Sweeps are not supported "
+				"with a shared transport");
+		return (-1);
+	}
+
+	memset (&sw, 0, sizeof (sw));
+	sw.callback = callback;
+	sw.user_data = user_data;
+	if (ping_network_parse (obj, "ping_sweep", network, 32, &sw.net) != 0)
+		return (-1);
+	ping_sweep_key (sw.key);
+
+	return (ping_sweep_run (obj, &sw));
+} /* int ping_sweep */
+
+int ping_iterator_get_responders (pingobj_iter_t *iter,
+		ping_responder_t *responders, size_t *responders_num)
+{
+	size_t num;
+	size_t i;
+
+	if ((iter == NULL) || (responders_num == NULL))
+		return (EINVAL);
+
+	num = (iter->responders != NULL) ? iter->responders->num : 0;
+	if (responders == NULL)
+	{
+		*responders_num = num;
+		return (0);
+	}
+
+	if (num > *responders_num)
+		num = *responders_num;
+	for (i = 0; i < num; i++)
+	{
+		struct ping_responder_entry *e = iter->responders->entries + i;
+		struct sockaddr_storage ss;
+		socklen_t ss_len;
+
+		memset (&ss, 0, sizeof (ss));
+		ss.ss_family = e->family;
+		if (e->family == AF_INET6)
+		{
+			memcpy (&((struct sockaddr_in6 *) &ss)->sin6_addr, e->addr,
+					sizeof (struct in6_addr));
+			ss_len = sizeof (struct sockaddr_in6);
+		}
+		else
+		{
+			memcpy (&((struct sockaddr_in *) &ss)->sin_addr, e->addr,
+					sizeof (struct in_addr));
+			ss_len = sizeof (struct sockaddr_in);
+		}
+
+		responders[i].family = e->family;
+		responders[i].latency = e->latency;
+		if (getnameinfo ((struct sockaddr *) &ss, ss_len,
+					responders[i].address,
+					sizeof (responders[i].address),
+					NULL, 0, NI_NUMERICHOST) != 0)
+			responders[i].address[0] = 0;
+	}
+
+	*responders_num = num;
+	return (0);
+} /* int ping_iterator_get_responders */
+
+int ping_iterator_get_hops (pingobj_iter_t *iter, ping_hop_t *hops,
+		size_t *hops_num)
+{
+	size_t num;
+	size_t i;
+
+	if ((iter == NULL) || (hops_num == NULL))
+		return (EINVAL);
+
+	/* The path ends at the host if it replied. */
+	num = 0;
+	if (iter->trace != NULL)
+		num = (size_t) ((iter->trace->length != 0)
+				? iter->trace->length : iter->trace->hops_num);
+
+	if (hops == NULL)
+	{
+		*hops_num = num;
+		return (0);
+	}
+
+	if (num > *hops_num)
+		num = *hops_num;
+	for (i = 0; i < num; i++)
+		hops[i] = iter->trace->hops[i].hop;
+
+	*hops_num = num;
+	return (0);
+} /* int ping_iterator_get_hops */
+
+int ping_host_add (pingobj_t *obj, const char *host)
+{
+	pinghost_t *ph;
+
+	if ((obj == NULL) || (host == NULL))
+		return (-1);
+
+	dprintf ("host = %s\n", host);
+
+	/* Hosts that have been given a source of their own do not count, so
+	 * that a target can be added once per source. */
+	if (ping_host_find (obj, host) != NULL)
+		return (0);
+
+	if ((ph = ping_host_resolve (obj->addrfamily, host,
+					obj->errmsg)) == NULL)
+		return (-1);
+
+	ph->payload = ping_payload_ref (obj->payload);
+	ping_host_link (obj, ph);
+
+	return (0);
+} /* int ping_host_add */
+
+pingobj_iter_t *ping_host_add_addr (pingobj_t *obj,
+		const struct sockaddr *addr, socklen_t addrlen,
+		const char *label)
+{
+	pinghost_t *ph;
+
+	if ((obj == NULL) || (addr == NULL))
+		return (NULL);
+
+	if (!(((addr->sa_family == AF_INET)
+				&& (addrlen >= sizeof (struct sockaddr_in)))
+			|| ((addr->sa_family == AF_INET6)
+				&& (addrlen >= sizeof (struct sockaddr_in6))))
+			|| (addrlen > sizeof (struct sockaddr_storage)))
+	{
+		ping_set_error (obj, "ping_host_add_addr",
+				"Unsupported address");
+		return (NULL);
+	}
+
+	if ((obj->addrfamily != AF_UNSPEC)
+			&& (obj->addrfamily != addr->sa_family))
+	{
+		ping_set_error (obj, "ping_host_add_addr",
+				"Address family does not match PING_OPT_AF");
+		return (NULL);
+	}
+
+	if ((ph = ping_alloc ()) == NULL)
+	{
+		ping_set_errno (obj, ENOMEM);
+		return (NULL);
+	}
+
+	memcpy (ph->addr, addr, addrlen);
+	ph->addrlen = addrlen;
+	ph->addrfamily = addr->sa_family;
+
+	if (label == NULL)
+		ph->username = ph->addrstr;
+	else if ((ph->username = strdup (label)) == NULL)
+	{
+		ping_free (ph);
+		ping_set_errno (obj, ENOMEM);
+		return (NULL);
+	}
+	ph->hostname = ph->username;
+	ph->payload = ping_payload_ref (obj->payload);
+
+	ping_host_link (obj, ph);
+
+	return (ph);
+} /* pingobj_iter_t *ping_host_add_addr */
+
+ping_range_t *ping_host_add_range (pingobj_t *obj, const char *network)
+{
+	struct ping_network net;
+	struct ping_range *range;
+	struct timeval *timers;
+	socklen_t addrlen;
+	uint32_t i;
+	int metric;
+
+	if ((obj == NULL) || (network == NULL))
+		return (NULL);
+
+	if (ping_network_parse (obj, "ping_host_add_range", network,
+				PING_RANGE_BITS, &net) != 0)
+		return (NULL);
+
+	range = calloc (1, sizeof (*range) + net.size
+			* (sizeof (range->hosts[0]) + sizeof (*timers))
+			+ (net.size + 7) / 8);
+	if (range == NULL)
+	{
+		ping_set_errno (obj, ENOMEM);
+		return (NULL);
+	}
+	/* The caller holds a reference until ping_range_release(). */
+	range->refcount = (uint32_t) net.size + 1;
+	range->hosts_num = (uint32_t) net.size;
+	range->hosts_linked = (uint32_t) net.size;
+	range->ident = ping_ident_claim (obj, ping_get_ident () & 0xFFFF);
+	range->network = net;
+	timers = (struct timeval *) (range->hosts + net.size);
+	range->removed = (uint8_t *) (timers + net.size);
+
+	addrlen = (net.family == AF_INET) ? sizeof (struct sockaddr_in)
+		: sizeof (struct sockaddr_in6);
+	for (i = 0; i < range->hosts_num; i++)
+	{
+		pinghost_t *ph = range->hosts + i;
+
+		ping_host_init (ph, timers + i, NULL);
+		ph->ident = range->ident;
+		ph->addrlen = addrlen;
+		ph->addrfamily = net.family;
+		ph->addrstr = ping_range_unnamed;
+		ph->username = ph->addrstr;
+		ph->hostname = ph->addrstr;
+		ph->payload = ping_payload_ref (obj->payload);
+		ph->range = range;
+		if (i + 1 < range->hosts_num)
+			ph->next = ph + 1;
+	}
+
+	if (obj->head == NULL)
+		obj->head = range->hosts;
+	else
+		obj->tail->next = range->hosts;
+	obj->tail = range->hosts + (range->hosts_num - 1);
+
+	range->next = obj->ranges;
+	obj->ranges = range;
+
+	/* The hosts are not entered into obj->table, see ping_range_lookup().
+	 * Heaps that have been built are built again by the next query, which
+	 * takes linear time instead of inserting the hosts one by one. */
+	for (metric = 0; metric < PING_TOP_NUM; metric++)
+		ping_heap_free (obj->top + metric);
+	obj->snapshot_stale = 1;
+	obj->shm_stale = 1;
+	obj->ring_stale = 1;
+
+	return (range);
+} /* ping_range_t *ping_host_add_range */
+
+pingobj_iter_t *ping_range_get_host (ping_range_t *range, uint32_t index)
+{
+	if ((range == NULL) || (index >= range->hosts_num))
+		return (NULL);
+
+	if (ping_range_removed (range, index))
+		return (NULL);
+
+	return (range->hosts + index);
+} /* pingobj_iter_t *ping_range_get_host */
+
+void ping_range_release (ping_range_t *range)
+{
+	if (range == NULL)
+		return;
+
+	ping_range_unref (range);
+} /* void ping_range_release */
+
+int ping_host_setopt (pingobj_t *obj, const char *host, int option,
+		void *value)
+{
+	pinghost_t *ph;
+
+	if ((obj == NULL) || (host == NULL))
+		return (-1);
+
+	/* Hosts with a source of their own are only found in the list. */
+	ph = ping_host_find (obj, host);
+	if (ph == NULL)
+		ph = ping_host_search (obj->head, host);
+	if (ph == NULL)
+	{
+		ping_set_error (obj, "ping_host_setopt", "Host not found");
+		return (-1);
+	}
+
+	/* The table of names only holds hosts without a source of their own,
+	 * so it is built again. */
+	if ((option == PING_OPT_SOURCE) || (option == PING_OPT_DEVICE))
+		ping_names_drop (obj);
+
+	switch (option)
+	{
+		case PING_OPT_TTL:
+		{
+			int ttl;
+
+			if (value == NULL)
+			{
+				ph->ttl = -1;
+				break;
+			}
+
+			ttl = *((int *) value);
+			if ((ttl < 1) || (ttl > 255))
+			{
+				ping_set_error (obj, "ping_host_setopt",
+						"TTL must be between 1 and 255");
+				return (-1);
+			}
+			ph->ttl = ttl;
+		} /* case PING_OPT_TTL */
+		break;
+
+		case PING_OPT_QOS:
+			ph->qos = (value == NULL) ? -1 : *((uint8_t *) value);
+			break;
+
+		case PING_OPT_RESPONDERS:
+		{
+			_Bool enable = (value != NULL) && (*((int *) value) != 0);
+
+			if (!enable)
+			{
+				ping_responders_free (ph->responders);
+				ph->responders = NULL;
+				break;
+			}
+
+			if (ph->responders == NULL)
+			{
+				ph->responders = ping_responders_create ();
+				if (ph->responders == NULL)
+				{
+					ping_set_errno (obj, errno);
+					return (-1);
+				}
+			}
+
+			if ((ph->addrfamily == AF_INET) && !obj->broadcast)
+			{
+				obj->broadcast = 1;
+				if ((obj->fd4 != -1) && (setsockopt (obj->fd4,
+								SOL_SOCKET, SO_BROADCAST,
+								&(int){1}, sizeof(int)) != 0))
+				{
+					ping_set_errno (obj, errno);
+					return (-1);
+				}
+			}
+		} /* case PING_OPT_RESPONDERS */
+		break;
+
+		case PING_OPT_SOURCE:
+		{
+#if defined(IP_PKTINFO) && defined(IPV6_PKTINFO)
+			struct addrinfo  ai_hints;
+			struct addrinfo *ai_list;
+			int              status;
+
+			if (value == NULL)
+			{
+				free (ph->srcaddr);
+				ph->srcaddr = NULL;
+				break;
+			}
+
+			/* The source must be of the host's address family. */
+			memset ((void *) &ai_hints, '\0', sizeof (ai_hints));
+			ai_hints.ai_family = ph->addrfamily;
+			status = getaddrinfo ((char *) value, NULL,
+					&ai_hints, &ai_list);
+			if (status != 0)
+			{
+				ping_set_error (obj, "getaddrinfo",
+						gai_strerror (status));
+				return (-1);
+			}
+
+			if (ph->srcaddr == NULL)
+				ph->srcaddr = malloc (sizeof (*ph->srcaddr));
+			if (ph->srcaddr == NULL)
+			{
+				ping_set_errno (obj, errno);
+				freeaddrinfo (ai_list);
+				return (-1);
+			}
+			memset (ph->srcaddr, 0, sizeof (*ph->srcaddr));
+			assert (ai_list->ai_addrlen <= sizeof (*ph->srcaddr));
+			memcpy (ph->srcaddr, ai_list->ai_addr, ai_list->ai_addrlen);
+
+			freeaddrinfo (ai_list);
+#else /* ! IP_PKTINFO */
+			ping_set_errno (obj, ENOTSUP);
+			return (-1);
+#endif /* ! IP_PKTINFO */
+		} /* case PING_OPT_SOURCE */
+		break;
+
+		case PING_OPT_DEVICE:
+		{
+#if defined(IP_PKTINFO) && defined(IPV6_PKTINFO) && HAVE_NET_IF_H
+			unsigned int ifindex = 0;
+
+			if (value != NULL)
+			{
+				ifindex = if_nametoindex ((char *) value);
+				if (ifindex == 0)
+				{
+					ping_set_errno (obj, errno);
+					return (-1);
+				}
+			}
+			ph->srcif = ifindex;
+#else /* ! IP_PKTINFO */
+			ping_set_errno (obj, ENOTSUP);
+			return (-1);
+#endif /* ! IP_PKTINFO */
+		} /* case PING_OPT_DEVICE */
+		break;
+
+		case PING_OPT_DATA:
+		case PING_OPT_DATA_BINARY:
+		{
+			ping_payload_t *payload;
+
+			if (value == NULL)
+				payload = ping_payload_ref (obj->payload);
+			else
+				payload = ping_payload_option (obj,
+						"ping_host_setopt", option, value);
+			if (payload == NULL)
+				return (-1);
+
+			ping_payload_unref (ph->payload);
+			ph->payload = payload;
+		} /* case PING_OPT_DATA */
+		break;
+
+		default:
+			ping_set_errno (obj, EINVAL);
+			return (-1);
+	} /* switch (option) */
+
+	return (0);
+} /* int ping_host_setopt */
+
+int ping_host_remove (pingobj_t *obj, const char *host)
+{
+	pinghost_t *pre, *cur;
+
+	if ((obj == NULL) || (host == NULL))
+		return (-1);
+
+	pre = NULL;
+	cur = obj->head;
+
+	while (cur != NULL)
+	{
+		if (strcasecmp (host, ping_host_name (cur)) == 0)
+			break;
+
+		pre = cur;
+		cur = cur->next;
+	}
+
+	if (cur == NULL)
+	{
+		ping_set_error (obj, "ping_host_remove", "Host not found");
+		return (-1);
+	}
+
+	return (ping_host_unlink (obj, pre, cur));
+}
+
+/* ping_host_unlink removes "target", which follows "pre" in the list of
+ * hosts, and retires it. */
+static int ping_host_unlink (pingobj_t *obj, pinghost_t *pre,
+		pinghost_t *target)
+{
+	pinghost_t *cur;
+
+	if (pre == NULL)
+		obj->head = target->next;
+	else
+		pre->next = target->next;
+	if (obj->tail == target)
+		obj->tail = pre;
+	/* Snapshot readers may still use the host, but it is no longer part
+	 * of its range. */
+	if (target->range != NULL)
+		ping_range_remove (target);
+
+	ping_heap_remove (obj, target);
+
+	if (target->changes != 0)
+	{
+		pre = NULL;
+		for (cur = obj->changed_head; cur != target; cur = cur->changed_next)
+			pre = cur;
+
+		if (pre == NULL)
+			obj->changed_head = target->changed_next;
+		else
+			pre->changed_next = target->changed_next;
+		if (obj->changed_tail == target)
+			obj->changed_tail = pre;
+	}
+
+	if (target->range != NULL)
+	{
+		ping_range_unlink (obj, target->range);
+		ping_host_retire (obj, target);
+		return (0);
+	}
+
+	ping_names_unlink (obj, target);
+
+	pre = NULL;
+
+	cur = obj->table[target->ident % PING_TABLE_LEN];
+
+	while (cur != NULL)
+	{
+		if (cur == target)
+			break;
+
+		pre = cur;
+		cur = cur->table_next;
+	}
+
+	if (cur == NULL)
+	{
+		ping_set_error(obj, "ping_host_remove", "Host not found (T)");
+		ping_host_retire (obj, target);
+		return (-1);
+	}
+
+	if (pre == NULL)
+		obj->table[target->ident % PING_TABLE_LEN] = cur->table_next;
+	else
+		pre->table_next = cur->table_next;
+
+	ping_ident_release (obj, cur->ident);
+	ping_host_retire (obj, cur);
+
+	return (0);
+}
+
+int ping_host_remove_range (pingobj_t *obj, ping_range_t *range)
+{
+	pinghost_t *pre = NULL;
+	pinghost_t *cur;
+	pinghost_t *next;
+	uint32_t removed = 0;
+	int metric;
+
+	if ((obj == NULL) || (range == NULL))
+		return (-1);
+
+	/* Rather than per host, the heaps are dropped, to be built again by
+	 * the next query, and the hosts are taken off the list of changed
+	 * hosts in one pass. */
+	for (metric = 0; metric < PING_TOP_NUM; metric++)
+		ping_heap_free (obj->top + metric);
+	for (cur = obj->changed_head; cur != NULL; cur = next)
+	{
+		next = cur->changed_next;
+		if (cur->range != range)
+		{
+			pre = cur;
+			continue;
+		}
+
+		if (pre == NULL)
+			obj->changed_head = next;
+		else
+			pre->changed_next = next;
+		if (obj->changed_tail == cur)
+			obj->changed_tail = pre;
+		cur->changes = 0;
+		cur->changed_next = NULL;
+	}
+
+	pre = NULL;
+	for (cur = obj->head; cur != NULL; cur = next)
+	{
+		next = cur->next;
+		if (cur->range != range)
+		{
+			pre = cur;
+			continue;
+		}
+
+		ping_host_unlink (obj, pre, cur);
+		removed++;
+	}
+
+	if (removed == 0)
+	{
+		ping_set_error (obj, "ping_host_remove_range",
+				"Range not found");
+		return (-1);
+	}
+
+	return (0);
+} /* int ping_host_remove_range */
+
+static int ping_queue_push (pingobj_t *obj, struct ping_queue_entry *entry)
+{
+	entry->next = __atomic_load_n (&obj->queue, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n (&obj->queue, &entry->next, entry,
+				/* weak = */ 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		/* entry->next has been updated, try again */;
+
+	return (0);
+}
+
+int ping_host_queue_add (pingobj_t *obj, const char *host)
+{
+	struct ping_queue_entry *entry;
+	char errmsg[PING_ERRMSG_LEN];
+
+	if ((obj == NULL) || (host == NULL))
+		return (-1);
+
+	entry = calloc (1, sizeof (*entry));
+	if (entry == NULL)
+		return (-1);
+
+	/* The name is resolved by the calling thread, so that the thread
+	 * calling ping_send() is not blocked by DNS lookups. */
+	errmsg[0] = 0;
+	entry->add = ping_host_resolve (__atomic_load_n (&obj->addrfamily,
+				__ATOMIC_RELAXED), host, errmsg);
+	if (entry->add == NULL)
+	{
+		dprintf ("%s\n", errmsg);
+		free (entry);
+		return (-1);
+	}
+
+	return (ping_queue_push (obj, entry));
+}
+
+int ping_host_queue_remove (pingobj_t *obj, const char *host)
+{
+	struct ping_queue_entry *entry;
+
+	if ((obj == NULL) || (host == NULL))
+		return (-1);
+
+	entry = calloc (1, sizeof (*entry));
+	if (entry == NULL)
+		return (-1);
+
+	if ((entry->remove = strdup (host)) == NULL)
+	{
+		free (entry);
+		return (-1);
+	}
+
+	return (ping_queue_push (obj, entry));
+}
+
+int ping_snapshot_foreach (pingobj_t *obj, ping_snapshot_callback_t callback,
+		void *user_data)
+{
+	struct ping_snapshot *snap;
+	unsigned int reader;
+	int status = 0;
+	size_t i;
+
+	if ((obj == NULL) || (callback == NULL))
+		return (EINVAL);
+
+	reader = ping_snapshot_enter (obj);
+
+	snap = __atomic_load_n (&obj->snapshot, __ATOMIC_SEQ_CST);
+	for (i = 0; (snap != NULL) && (i < snap->hosts_num); i++)
+	{
+		pinghost_t *ph = snap->hosts[i];
+		ping_result_t result;
+		unsigned int seq;
+
+		/* Read side of the sequence lock, see ping_host_publish(). */
+		while (42)
+		{
+			seq = __atomic_load_n (&ph->snap_seq, __ATOMIC_ACQUIRE);
+			if ((seq & 1) != 0)
+				continue;
+
+			memcpy (&result, &ph->snap, sizeof (result));
+			__atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+			if (__atomic_load_n (&ph->snap_seq, __ATOMIC_RELAXED) == seq)
+				break;
+		}
+		result.index = (int) i;
+
+		status = (*callback) (ph->hostname, ph->addrstr, &result,
+				user_data);
+		if (status != 0)
+			break;
+	}
+
+	ping_snapshot_leave (obj, reader);
+
+	return (status);
+}
+
+pingobj_iter_t *ping_iterator_get (pingobj_t *obj)
+{
+	if (obj == NULL)
+		return (NULL);
+	return ((pingobj_iter_t *) obj->head);
+}
+
+pingobj_iter_t *ping_iterator_next (pingobj_iter_t *iter)
+{
+	if (iter == NULL)
+		return (NULL);
+	return ((pingobj_iter_t *) iter->next);
+}
+
+pingobj_iter_t *ping_iterator_get_changed (pingobj_t *obj)
+{
+	if (obj == NULL)
+		return (NULL);
+
+	/* The list is discarded by the next call to ping_send(). */
+	obj->changed_read = 1;
+	return ((pingobj_iter_t *) obj->changed_head);
+}
+
+pingobj_iter_t *ping_iterator_next_changed (pingobj_iter_t *iter)
+{
+	if (iter == NULL)
+		return (NULL);
+	return ((pingobj_iter_t *) iter->changed_next);
+}
+
+int ping_iterator_count (pingobj_t *obj)
+{
+	if (obj == NULL)
+		return 0;
+
+	int count = 0;
+	pingobj_iter_t *iter = obj->head;
+	while (iter) {
+		count++;
+		iter = iter->next;
+	}
+	return count;
+}
+
+int ping_iterator_get_info (pingobj_iter_t *iter, int info,
+		void *buffer, size_t *buffer_len)
+{
+	int ret = EINVAL;
+	struct sockaddr_storage ss;
+
+	size_t orig_buffer_len = *buffer_len;
+
+	if ((iter == NULL) || (buffer_len == NULL))
+		return (-1);
+
+	if ((buffer == NULL) && (*buffer_len != 0 ))
+		return (-1);
+
+	ping_host_name (iter);
+
+	switch (info)
+	{
+		case PING_INFO_USERNAME:
+			ret = ENOMEM;
+			*buffer_len = strlen (iter->username) + 1;
+			if (orig_buffer_len <= *buffer_len)
+				break;
+			/* Since (orig_buffer_len > *buffer_len) `strncpy'
+			 * will copy `*buffer_len' and pad the rest of
+			 * `buffer' with null-bytes */
+			strncpy (buffer, iter->username, orig_buffer_len);
+			ret = 0;
+			break;
+
+		case PING_INFO_HOSTNAME:
+			ret = ENOMEM;
+			*buffer_len = strlen (iter->hostname) + 1;
+			if (orig_buffer_len < *buffer_len)
+				break;
+			/* Since (orig_buffer_len > *buffer_len) `strncpy'
+			 * will copy `*buffer_len' and pad the rest of
+			 * `buffer' with null-bytes */
+			strncpy (buffer, iter->hostname, orig_buffer_len);
+			ret = 0;
+			break;
+
+		case PING_INFO_ADDRESS:
+			if (iter->addrstr[0] != 0)
+			{
+				ret = ENOMEM;
+				*buffer_len = strlen (iter->addrstr) + 1;
+				if (orig_buffer_len < *buffer_len)
+					break;
+				memcpy (buffer, iter->addrstr, *buffer_len);
+				ret = 0;
+				break;
+			}
+
+			ret = getnameinfo (ping_host_addr (iter, &ss),
+					iter->addrlen,
+					(char *) buffer,
+					*buffer_len,
+					NULL, 0,
+					NI_NUMERICHOST);
+			if (ret != 0)
+			{
+				if ((ret == EAI_MEMORY)
+#ifdef EAI_OVERFLOW
+						|| (ret == EAI_OVERFLOW)
+#endif
+				   )
+					ret = ENOMEM;
+#if defined(EAI_SYSTEM)
+				else if (ret == EAI_SYSTEM)
+					ret = errno;
+#endif
+				else
+					ret = EINVAL;
+			}
+			break;
+
+		case PING_INFO_FAMILY:
+			ret = ENOMEM;
+			*buffer_len = sizeof (int);
+			if (orig_buffer_len < sizeof (int))
+				break;
+			*((int *) buffer) = iter->addrfamily;
+			ret = 0;
+			break;
+
+		case PING_INFO_LATENCY:
+			ret = ENOMEM;
+			*buffer_len = sizeof (double);
+			if (orig_buffer_len < sizeof (double))
+				break;
+			*((double *) buffer) = iter->latency;
+			ret = 0;
+			break;
+
+		case PING_INFO_DROPPED:
+			ret = ENOMEM;
+			*buffer_len = sizeof (uint32_t);
+			if (orig_buffer_len < sizeof (uint32_t))
+				break;
+			*((uint32_t *) buffer) = iter->dropped;
+			ret = 0;
+			break;
+
+		case PING_INFO_SEQUENCE:
+			ret = ENOMEM;
+			*buffer_len = sizeof (unsigned int);
+			if (orig_buffer_len < sizeof (unsigned int))
+				break;
+			*((unsigned int *) buffer) = (unsigned int) iter->sequence;
+			ret = 0;
+			break;
+
+		case PING_INFO_IDENT:
+			ret = ENOMEM;
+			*buffer_len = sizeof (uint16_t);
+			if (orig_buffer_len < sizeof (uint16_t))
+				break;
+			*((uint16_t *) buffer) = (uint16_t) iter->ident;
+			ret = 0;
+			break;
+
+		case PING_INFO_DATA:
+			ret = ENOMEM;
+			*buffer_len = iter->payload->len;
+			if (orig_buffer_len < *buffer_len)
+				break;
+			memcpy (buffer, iter->payload->data, *buffer_len);
+			/* Null terminated if there is room, as with strncpy. */
+			if (orig_buffer_len > *buffer_len)
+				((char *) buffer)[*buffer_len] = 0;
+			ret = 0;
+			break;
+
+		case PING_INFO_RECV_TTL:
+			ret = ENOMEM;
+			*buffer_len = sizeof (int);
+			if (orig_buffer_len < sizeof (int))
+				break;
+			*((int *) buffer) = iter->recv_ttl;
+			ret = 0;
+			break;
+
+		case PING_INFO_RECV_QOS:
+			ret = ENOMEM;
+			if (*buffer_len>sizeof(unsigned)) *buffer_len=sizeof(unsigned);
+			if (!*buffer_len) *buffer_len=1;
+			if (orig_buffer_len < *buffer_len)
+				break;
+			memcpy(buffer,&iter->recv_qos,*buffer_len);
+			ret = 0;
+			break;
+
+		case PING_INFO_CHANGES:
+			ret = ENOMEM;
+			*buffer_len = sizeof (uint32_t);
+			if (orig_buffer_len < sizeof (uint32_t))
+				break;
+			*((uint32_t *) buffer) = iter->changes;
+			ret = 0;
+			break;
+
+		case PING_INFO_RECEIVED:
+			ret = ENOMEM;
+			*buffer_len = sizeof (uint32_t);
+			if (orig_buffer_len < sizeof (uint32_t))
+				break;
+			*((uint32_t *) buffer) = iter->received;
+			ret = 0;
+			break;
+
+		case PING_INFO_LATENCY_MIN:
+		case PING_INFO_LATENCY_MAX:
+		case PING_INFO_LATENCY_MEAN:
+		case PING_INFO_LATENCY_STDDEV:
+		case PING_INFO_JITTER:
+		{
+			double value = -1.0;
+
+			ret = ENOMEM;
+			*buffer_len = sizeof (double);
+			if (orig_buffer_len < sizeof (double))
+				break;
+
+			if (info == PING_INFO_JITTER)
+				value = iter->jitter;
+			else if (info == PING_INFO_LATENCY_STDDEV)
+				value = (iter->received > 1)
+					? sqrt (iter->latency_m2 / ((double) (iter->received - 1)))
+					: 0.0;
+			else if (iter->received == 0)
+				value = -1.0;
+			else if (info == PING_INFO_LATENCY_MIN)
+				value = iter->latency_min;
+			else if (info == PING_INFO_LATENCY_MAX)
+				value = iter->latency_max;
+			else
+				value = iter->latency_mean;
+
+			*((double *) buffer) = value;
+			ret = 0;
+			break;
+		}
+	}
+
+	return (ret);
+} /* ping_iterator_get_info */
+
+void *ping_iterator_get_context (pingobj_iter_t *iter)
+{
+	if (iter == NULL)
+		return (NULL);
+	return (iter->context);
+}
+
+void ping_iterator_set_context (pingobj_iter_t *iter, void *context)
+{
+	if (iter == NULL)
+		return;
+	iter->context = context;
+}
+
+int ping_get_results (pingobj_t *obj, ping_result_t *results,
+		size_t *results_num)
+{
+	pinghost_t *ph;
+	size_t num = 0;
+
+	if ((obj == NULL) || (results_num == NULL)
+			|| ((results == NULL) && (*results_num != 0)))
+		return (EINVAL);
+
+	for (ph = obj->head; ph != NULL; ph = ph->next)
+	{
+		ping_result_t *r;
+
+		if (num >= *results_num)
+		{
+			num++;
+			continue;
+		}
+
+		r = results + num;
+		ping_host_result (ph, r);
+		r->index = (int) num;
+
+		num++;
+	}
+
+	if (num > *results_num)
+	{
+		*results_num = num;
+		return (ENOMEM);
+	}
 
-	/* host_to_ping points to the host to which to send the next ping. The
-	 * pointer is advanced to the next host in the linked list after the
-	 * ping has been sent. If host_to_ping is NULL, no more pings need to be
-	 * send out. */
-	pinghost_t *host_to_ping = obj->head;
+	*results_num = num;
+	return (0);
+}
 
-	/* pings_in_flight is the number of hosts we sent a "ping" to but didn't
-	 * receive a "pong" yet. */
-	int pings_in_flight = 0;
+/* ping_heap_build builds the heap of the given metric from all hosts. */
+static int ping_heap_build (pingobj_t *obj, int metric)
+{
+	ping_heap_t *heap = obj->top + metric;
+	pinghost_t *ph;
+	size_t num = 0;
+	size_t i;
 
-	/* pongs_received is the number of echo replies received. Unless there
-	 * is an error, this is used as the return value of ping_send(). */
-	int pongs_received = 0;
+	for (ph = obj->head; ph != NULL; ph = ph->next)
+		num++;
 
-	int error_count = 0;
+	heap->hosts_size = (num < 16) ? 16 : num;
+	heap->hosts = malloc (heap->hosts_size * sizeof (*heap->hosts));
+	if (heap->hosts == NULL)
+	{
+		heap->hosts_size = 0;
+		return (ENOMEM);
+	}
 
-	while (pings_in_flight > 0 || host_to_ping != NULL)
+	heap->hosts_num = 0;
+	for (ph = obj->head; ph != NULL; ph = ph->next)
 	{
-		fd_set read_fds;
-		fd_set write_fds;
+		ping_heap_set (heap, metric, heap->hosts_num, ph);
+		heap->hosts_num++;
+	}
 
-		int write_fd = -1;
-		int max_fd = -1;
+	for (i = heap->hosts_num / 2; i > 0; i--)
+		ping_heap_down (heap, metric, i - 1);
 
-		FD_ZERO (&read_fds);
-		FD_ZERO (&write_fds);
+	return (0);
+}
 
-		if (obj->fd4 != -1)
-		{
-			FD_SET(obj->fd4, &read_fds);
-			if (host_to_ping != NULL && host_to_ping->addrfamily == AF_INET)
-				write_fd = obj->fd4;
+/* The candidates of ping_get_top() are kept in a binary heap of positions
+ * in the heap of hosts. ping_candidates_down sifts the first candidate down,
+ * ping_candidates_up sifts the last one up. */
+static double ping_candidate_key (const ping_heap_t *heap, int metric,
+		const size_t *candidates, size_t i)
+{
+	return (ping_top_key (heap->hosts[candidates[i]], metric));
+}
 
-			if (max_fd < obj->fd4)
-				max_fd = obj->fd4;
-		}
+static void ping_candidates_down (const ping_heap_t *heap, int metric,
+		size_t *candidates, size_t candidates_num)
+{
+	size_t i = 0;
 
-		if (obj->fd6 != -1)
-		{
-			FD_SET(obj->fd6, &read_fds);
-			if (host_to_ping != NULL && host_to_ping->addrfamily == AF_INET6)
-				write_fd = obj->fd6;
+	while (42)
+	{
+		size_t child = (2 * i) + 1;
+		size_t tmp;
 
-			if (max_fd < obj->fd6)
-				max_fd = obj->fd6;
-		}
+		if (child >= candidates_num)
+			break;
+		if (((child + 1) < candidates_num)
+				&& (ping_candidate_key (heap, metric, candidates, child + 1)
+					> ping_candidate_key (heap, metric, candidates, child)))
+			child++;
+		if (ping_candidate_key (heap, metric, candidates, i)
+				>= ping_candidate_key (heap, metric, candidates, child))
+			break;
 
-		if (write_fd != -1)
-			FD_SET(write_fd, &write_fds);
+		tmp = candidates[i];
+		candidates[i] = candidates[child];
+		candidates[child] = tmp;
+		i = child;
+	}
+}
 
-		assert (max_fd != -1);
-		assert (max_fd < FD_SETSIZE);
+static void ping_candidates_up (const ping_heap_t *heap, int metric,
+		size_t *candidates, size_t candidates_num)
+{
+	size_t i = candidates_num - 1;
 
-		if (gettimeofday (&nowtime, NULL) == -1)
-		{
-			ping_set_errno (obj, errno);
-			return (-1);
-		}
+	while (i > 0)
+	{
+		size_t parent = (i - 1) / 2;
+		size_t tmp;
 
-		if (ping_timeval_sub (&endtime, &nowtime, &timeout) == -1)
+		if (ping_candidate_key (heap, metric, candidates, parent)
+				>= ping_candidate_key (heap, metric, candidates, i))
 			break;
 
-		dprintf ("Waiting on %i sockets for %u.%06u seconds\n",
-				((obj->fd4 != -1) ? 1 : 0) + ((obj->fd6 != -1) ? 1 : 0),
-				(unsigned) timeout.tv_sec,
-				(unsigned) timeout.tv_usec);
+		tmp = candidates[i];
+		candidates[i] = candidates[parent];
+		candidates[parent] = tmp;
+		i = parent;
+	}
+}
 
-		int status = select (max_fd + 1, &read_fds, &write_fds, NULL, &timeout);
-		int select_errno = errno;
+int ping_event_read (pingobj_t *obj, ping_event_t *events,
+		size_t events_num)
+{
+	size_t head;
+	size_t tail;
+	size_t num = 0;
 
-		if (gettimeofday (&nowtime, NULL) == -1)
-		{
-			ping_set_errno (obj, errno);
-			return (-1);
-		}
+	if ((obj == NULL) || ((events == NULL) && (events_num != 0)))
+		return (-1);
 
-		if (status == -1)
-		{
-			ping_set_errno (obj, select_errno);
-			dprintf ("select: %s\n", obj->errmsg);
-			return (-1);
-		}
-		else if (status == 0)
-		{
-			dprintf ("select timed out\n");
+	if (obj->events == NULL)
+		return (0);
 
-			pinghost_t *ph;
-			for (ph = obj->head; ph != NULL; ph = ph->next)
-				if (ph->latency < 0.0)
-					ph->dropped++;
-			break;
-		}
+	tail = obj->events_tail;
+	head = __atomic_load_n (&obj->events_head, __ATOMIC_ACQUIRE);
 
-		/* first, check if we can receive a reply ... */
-		if (obj->fd6  != -1 && FD_ISSET (obj->fd6, &read_fds))
-		{
-			if (ping_receive_one (obj, &nowtime, AF_INET6) == 0)
-			{
-				pings_in_flight--;
-				pongs_received++;
-			}
-			continue;
-		}
-		if (obj->fd4 != -1 && FD_ISSET (obj->fd4, &read_fds))
-		{
-			if (ping_receive_one (obj, &nowtime, AF_INET) == 0)
-			{
-				pings_in_flight--;
-				pongs_received++;
-			}
-			continue;
-		}
+	while ((num < events_num) && (tail != head))
+	{
+		events[num] = obj->events[tail & (obj->events_size - 1)];
+		num++;
+		tail++;
+	}
 
-		/* ... and if no reply is available to read, continue sending
-		 * out pings. */
+	__atomic_store_n (&obj->events_tail, tail, __ATOMIC_RELEASE);
 
-		/* this condition should always be true. We keep it for
-		 * consistency with the read blocks above and just to be on the
-		 * safe side. */
-		if (write_fd != -1 && FD_ISSET (write_fd, &write_fds))
-		{
-			if (ping_send_one (obj, host_to_ping, write_fd) == 0)
-				pings_in_flight++;
-			else
-				error_count++;
-			host_to_ping = host_to_ping->next;
-			continue;
-		}
-	} /* while (1) */
+	return ((int) num);
+}
 
-	if (error_count)
-		return (-1 * error_count);
-	return (pongs_received);
-} /* int ping_send */
+uint64_t ping_event_overflow (pingobj_t *obj)
+{
+	if (obj == NULL)
+		return (0);
+	return (__atomic_load_n (&obj->events_overflow, __ATOMIC_RELAXED));
+}
 
-static pinghost_t *ping_host_search (pinghost_t *ph, const char *host)
+uint64_t ping_get_socket_drops (pingobj_t *obj)
 {
-	while (ph != NULL)
+	if (obj == NULL)
+		return (0);
+	return ((uint64_t) obj->drops4 + (uint64_t) obj->drops6);
+}
+
+int ping_get_top (pingobj_t *obj, int metric, pingobj_iter_t **hosts,
+		size_t *hosts_num)
+{
+	ping_heap_t *heap;
+	size_t *candidates;
+	size_t candidates_num;
+	size_t num = 0;
+
+	if ((obj == NULL) || (hosts_num == NULL)
+			|| ((hosts == NULL) && (*hosts_num != 0))
+			|| (metric < 0) || (metric >= PING_TOP_NUM))
+		return (EINVAL);
+
+	heap = obj->top + metric;
+	if ((heap->hosts == NULL) && (ping_heap_build (obj, metric) != 0))
+		return (ENOMEM);
+
+	if ((*hosts_num == 0) || (heap->hosts_num == 0))
+	{
+		*hosts_num = 0;
+		return (0);
+	}
+
+	/* The worst hosts are found by walking the heap with a second heap
+	 * of candidates, the children of the hosts returned so far. This
+	 * takes O(k log k) time for k hosts, regardless of the total number
+	 * of hosts. */
+	candidates = malloc ((*hosts_num + 1) * sizeof (*candidates));
+	if (candidates == NULL)
+		return (ENOMEM);
+	candidates[0] = 0;
+	candidates_num = 1;
+
+	while ((num < *hosts_num) && (candidates_num > 0))
 	{
-		if (strcasecmp (ph->username, host) == 0)
+		size_t top = candidates[0];
+		size_t child;
+
+		if (ping_top_key (heap->hosts[top], metric) < 0.0)
 			break;
+		hosts[num] = (pingobj_iter_t *) heap->hosts[top];
+		num++;
 
-		ph = ph->next;
+		/* Replace the top candidate with its children. */
+		candidates_num--;
+		candidates[0] = candidates[candidates_num];
+		ping_candidates_down (heap, metric, candidates, candidates_num);
+
+		for (child = (2 * top) + 1;
+				(child <= (2 * top) + 2) && (child < heap->hosts_num);
+				child++)
+		{
+			candidates[candidates_num] = child;
+			candidates_num++;
+			ping_candidates_up (heap, metric, candidates, candidates_num);
+		}
 	}
 
-	return (ph);
+	free (candidates);
+
+	*hosts_num = num;
+	return (0);
 }
 
-int ping_host_add (pingobj_t *obj, const char *host)
+int ping_iterator_get_window (pingobj_iter_t *iter, int minutes,
+		ping_window_stats_t *stats)
 {
-	pinghost_t *ph;
-
-	struct addrinfo  ai_hints;
-	struct addrinfo *ai_list, *ai_ptr;
-	int              ai_return;
+	struct timeval now;
+	time_t slot;
+	double latency_sum = 0.0;
+	int i;
+
+	if ((iter == NULL) || (stats == NULL)
+			|| (minutes < 1)
+			|| ((minutes * 60) > (PING_WINDOW_BUCKETS * PING_WINDOW_BUCKET_SECS)))
+		return (EINVAL);
 
-	if ((obj == NULL) || (host == NULL))
-		return (-1);
+	if (gettimeofday (&now, NULL) == -1)
+		return (errno);
 
-	dprintf ("host = %s\n", host);
+	memset (stats, 0, sizeof (*stats));
+	stats->latency_mean = -1.0;
+	stats->latency_max = -1.0;
 
-	if (ping_host_search (obj->head, host) != NULL)
+	if (iter->window == NULL)
 		return (0);
 
-	memset (&ai_hints, '\0', sizeof (ai_hints));
-	ai_hints.ai_flags     = 0;
-#ifdef AI_ADDRCONFIG
-	ai_hints.ai_flags    |= AI_ADDRCONFIG;
-#endif
-#ifdef AI_CANONNAME
-	ai_hints.ai_flags    |= AI_CANONNAME;
-#endif
-	ai_hints.ai_family    = obj->addrfamily;
-	ai_hints.ai_socktype  = SOCK_RAW;
-
-	if ((ph = ping_alloc ()) == NULL)
+	/* The bucket of the current time slot is only partially filled, so
+	 * the window covers between (minutes - 1) and minutes minutes. */
+	slot = now.tv_sec / PING_WINDOW_BUCKET_SECS;
+	for (i = 0; i < PING_WINDOW_BUCKETS; i++)
 	{
-		dprintf ("Out of memory!\n");
-		return (-1);
-	}
+		ping_window_bucket_t *b = iter->window + i;
 
-	if ((ph->username = strdup (host)) == NULL)
-	{
-		dprintf ("Out of memory!\n");
-		ping_set_errno (obj, errno);
-		ping_free (ph);
-		return (-1);
-	}
+		if ((b->slot > slot)
+				|| ((slot - b->slot) * PING_WINDOW_BUCKET_SECS
+					>= minutes * 60))
+			continue;
 
-	if ((ph->hostname = strdup (host)) == NULL)
-	{
-		dprintf ("Out of memory!\n");
-		ping_set_errno (obj, errno);
-		ping_free (ph);
-		return (-1);
+		stats->received += b->received;
+		stats->dropped += b->dropped;
+		latency_sum += b->latency_sum;
+		if ((b->received > 0) && (stats->latency_max < b->latency_max))
+			stats->latency_max = b->latency_max;
 	}
 
-	/* obj->data is not garuanteed to be != NULL */
-	if ((ph->data = strdup (obj->data == NULL ? PING_DEF_DATA : obj->data)) == NULL)
+	if (stats->received > 0)
+		stats->latency_mean = latency_sum / ((double) stats->received);
+
+	return (0);
+}
+
+int ping_iterator_get_history (pingobj_iter_t *iter, double *latencies,
+		size_t *latencies_num)
+{
+	const struct ping_history *h;
+	size_t num;
+	size_t index;
+	size_t i;
+
+	if ((iter == NULL) || (latencies_num == NULL))
+		return (EINVAL);
+
+	h = iter->history;
+	if (latencies == NULL)
 	{
-		dprintf ("Out of memory!\n");
-		ping_set_errno (obj, errno);
-		ping_free (ph);
-		return (-1);
+		*latencies_num = (h != NULL) ? h->num : 0;
+		return (0);
 	}
 
-	if ((ai_return = getaddrinfo (host, NULL, &ai_hints, &ai_list)) != 0)
+	if (h == NULL)
 	{
-#if defined(EAI_SYSTEM)
-		char errbuf[PING_ERRMSG_LEN];
-#endif
-		dprintf ("getaddrinfo failed\n");
-		ping_set_error (obj, "getaddrinfo",
-#if defined(EAI_SYSTEM)
-						(ai_return == EAI_SYSTEM)
-						? sstrerror (errno, errbuf, sizeof (errbuf)) :
-#endif
-				gai_strerror (ai_return));
-		ping_free (ph);
-		return (-1);
+		*latencies_num = 0;
+		return (0);
 	}
 
-	if (ai_list == NULL)
-		ping_set_error (obj, "getaddrinfo", "No hosts returned");
+	/* Copy the newest entries, starting with the oldest of them. */
+	num = *latencies_num;
+	if (num > h->num)
+		num = h->num;
 
-	for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
-	{
-		if (ai_ptr->ai_family == AF_INET)
-		{
-			ai_ptr->ai_socktype = SOCK_RAW;
-			ai_ptr->ai_protocol = IPPROTO_ICMP;
-		}
-		else if (ai_ptr->ai_family == AF_INET6)
-		{
-			ai_ptr->ai_socktype = SOCK_RAW;
-			ai_ptr->ai_protocol = IPPROTO_ICMPV6;
-		}
-		else
-		{
-			char errmsg[PING_ERRMSG_LEN];
+	index = h->index + h->size - num;
+	for (i = 0; i < num; i++)
+		latencies[i] = ping_history_decode (
+				h->codes[(index + i) % h->size]);
 
-			snprintf (errmsg, PING_ERRMSG_LEN, "Unknown `ai_family': %i", ai_ptr->ai_family);
-			errmsg[PING_ERRMSG_LEN - 1] = '\0';
+	*latencies_num = num;
+	return (0);
+}
 
-			dprintf ("%s", errmsg);
-			ping_set_error (obj, "getaddrinfo", errmsg);
-			continue;
-		}
+const ping_sketch_t *ping_iterator_get_sketch (pingobj_iter_t *iter)
+{
+	if (iter == NULL)
+		return (NULL);
+	return (iter->sketch);
+}
 
-		assert (sizeof (struct sockaddr_storage) >= ai_ptr->ai_addrlen);
-		memset (ph->addr, '\0', sizeof (struct sockaddr_storage));
-		memcpy (ph->addr, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
-		ph->addrlen = ai_ptr->ai_addrlen;
-		ph->addrfamily = ai_ptr->ai_family;
+ping_sketch_t *ping_sketch_create (void)
+{
+	ping_sketch_t *sk;
 
-#ifdef AI_CANONNAME
-		if ((ai_ptr->ai_canonname != NULL)
-				&& (strcmp (ph->hostname, ai_ptr->ai_canonname) != 0))
-		{
-			char *old_hostname;
+	sk = calloc (1, sizeof (*sk));
+	if (sk == NULL)
+		return (NULL);
 
-			dprintf ("ph->hostname = %s; ai_ptr->ai_canonname = %s;\n",
-					ph->hostname, ai_ptr->ai_canonname);
+	sk->counts = NULL;
+	sk->counts_num = 0;
 
-			old_hostname = ph->hostname;
-			if ((ph->hostname = strdup (ai_ptr->ai_canonname)) == NULL)
-			{
-				/* strdup failed, falling back to old hostname */
-				ph->hostname = old_hostname;
-			}
-			else if (old_hostname != NULL)
-			{
-				free (old_hostname);
-			}
-		}
-#endif /* AI_CANONNAME */
-	} /* for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next) */
+	return (sk);
+}
+
+void ping_sketch_destroy (ping_sketch_t *sk)
+{
+	if (sk == NULL)
+		return;
+
+	free (sk->counts);
+	free (sk);
+}
 
-	freeaddrinfo (ai_list);
+int ping_sketch_add (ping_sketch_t *sk, double latency)
+{
+	int index;
 
-	/*
-	 * Adding in the front is much easier, but then the iterator will
-	 * return the host that was added last as first host. That's just not
-	 * nice. -octo
-	 */
-	if (obj->head == NULL)
+	if ((sk == NULL) || !(latency >= 0.0))
+		return (EINVAL);
+
+	if (latency <= PING_SKETCH_MIN_VALUE)
 	{
-		obj->head = ph;
+		sk->zero_count++;
 	}
 	else
 	{
-		pinghost_t *hptr;
+		index = ping_sketch_index (latency);
+		if (ping_sketch_grow (sk, index, index) != 0)
+			return (ENOMEM);
 
-		hptr = obj->head;
-		while (hptr->next != NULL)
-			hptr = hptr->next;
-
-		assert ((hptr != NULL) && (hptr->next == NULL));
-		hptr->next = ph;
+		if (index < sk->offset)
+			index = sk->offset;
+		sk->counts[index - sk->offset]++;
 	}
 
-	ph->table_next = obj->table[ph->ident % PING_TABLE_LEN];
-	obj->table[ph->ident % PING_TABLE_LEN] = ph;
+	if ((sk->count == 0) || (sk->min > latency))
+		sk->min = latency;
+	if ((sk->count == 0) || (sk->max < latency))
+		sk->max = latency;
+	sk->count++;
 
 	return (0);
-} /* int ping_host_add */
+}
 
-int ping_host_remove (pingobj_t *obj, const char *host)
+int ping_sketch_merge (ping_sketch_t *dst, const ping_sketch_t *src)
 {
-	pinghost_t *pre, *cur, *target;
+	int i;
 
-	if ((obj == NULL) || (host == NULL))
-		return (-1);
+	if ((dst == NULL) || (src == NULL))
+		return (EINVAL);
 
-	pre = NULL;
-	cur = obj->head;
+	if (src->count == 0)
+		return (0);
 
-	while (cur != NULL)
+	if (src->counts_num > 0)
 	{
-		if (strcasecmp (host, cur->username) == 0)
-			break;
+		if (ping_sketch_grow (dst, src->offset,
+					src->offset + src->counts_num - 1) != 0)
+			return (ENOMEM);
 
-		pre = cur;
-		cur = cur->next;
-	}
+		for (i = 0; i < src->counts_num; i++)
+		{
+			int index = src->offset + i;
 
-	if (cur == NULL)
-	{
-		ping_set_error (obj, "ping_host_remove", "Host not found");
-		return (-1);
+			if (index < dst->offset)
+				index = dst->offset;
+			dst->counts[index - dst->offset] += src->counts[i];
+		}
 	}
 
-	if (pre == NULL)
-		obj->head = cur->next;
-	else
-		pre->next = cur->next;
+	if ((dst->count == 0) || (dst->min > src->min))
+		dst->min = src->min;
+	if ((dst->count == 0) || (dst->max < src->max))
+		dst->max = src->max;
+	dst->zero_count += src->zero_count;
+	dst->count += src->count;
 
-	target = cur;
-	pre = NULL;
+	return (0);
+}
 
-	cur = obj->table[target->ident % PING_TABLE_LEN];
+uint64_t ping_sketch_count (const ping_sketch_t *sk)
+{
+	if (sk == NULL)
+		return (0);
+	return (sk->count);
+}
 
-	while (cur != NULL)
-	{
-		if (cur == target)
-			break;
+double ping_sketch_quantile (const ping_sketch_t *sk, double quantile)
+{
+	double rank;
+	uint64_t seen;
+	int i;
 
-		pre = cur;
-		cur = cur->table_next;
-	}
+	if ((sk == NULL) || (sk->count == 0) || isnan (quantile))
+		return (-1.0);
 
-	if (cur == NULL)
+	if (quantile <= 0.0)
+		return (sk->min);
+	else if (quantile >= 1.0)
+		return (sk->max);
+
+	rank = quantile * ((double) (sk->count - 1));
+
+	seen = sk->zero_count;
+	if (((double) seen) > rank)
+		return (sk->min);
+
+	for (i = 0; i < sk->counts_num; i++)
 	{
-		ping_set_error(obj, "ping_host_remove", "Host not found (T)");
-		ping_free(target);
-		return (-1);
-	}
+		double value;
 
-	if (pre == NULL)
-		obj->table[target->ident % PING_TABLE_LEN] = cur->table_next;
-	else
-		pre->table_next = cur->table_next;
+		seen += sk->counts[i];
+		if (((double) seen) <= rank)
+			continue;
 
-	ping_free (cur);
+		value = ping_sketch_value (sk->offset + i);
+		if (value < sk->min)
+			value = sk->min;
+		else if (value > sk->max)
+			value = sk->max;
+		return (value);
+	}
 
-	return (0);
+	return (sk->max);
 }
 
-pingobj_iter_t *ping_iterator_get (pingobj_t *obj)
+double ping_sketch_rank (const ping_sketch_t *sk, double latency)
 {
-	if (obj == NULL)
-		return (NULL);
-	return ((pingobj_iter_t *) obj->head);
+	uint64_t seen;
+	int index;
+	int i;
+
+	if ((sk == NULL) || (sk->count == 0) || isnan (latency))
+		return (-1.0);
+
+	if (latency < sk->min)
+		return (0.0);
+	else if (latency >= sk->max)
+		return (1.0);
+
+	seen = sk->zero_count;
+	if (latency > PING_SKETCH_MIN_VALUE)
+	{
+		index = ping_sketch_index (latency);
+		for (i = 0; (i < sk->counts_num) && (sk->offset + i <= index); i++)
+			seen += sk->counts[i];
+	}
+
+	return (((double) seen) / ((double) sk->count));
 }
 
-pingobj_iter_t *ping_iterator_next (pingobj_iter_t *iter)
+#if HAVE_SYS_MMAN_H
+struct ping_shm
 {
-	if (iter == NULL)
-		return (NULL);
-	return ((pingobj_iter_t *) iter->next);
-}
+	ping_shm_header_t *header;
+	size_t             size;
+};
 
-int ping_iterator_count (pingobj_t *obj)
+ping_shm_t *ping_shm_attach (const char *path)
 {
-	if (obj == NULL)
-		return 0;
+	ping_shm_t *shm;
+	struct stat statbuf;
+	int fd;
 
-	int count = 0;
-	pingobj_iter_t *iter = obj->head;
-	while (iter) {
-		count++;
-		iter = iter->next;
+	if (path == NULL)
+	{
+		errno = EINVAL;
+		return (NULL);
 	}
-	return count;
-}
 
-int ping_iterator_get_info (pingobj_iter_t *iter, int info,
-		void *buffer, size_t *buffer_len)
-{
-	int ret = EINVAL;
+	fd = open (path, O_RDONLY);
+	if (fd < 0)
+		return (NULL);
 
-	size_t orig_buffer_len = *buffer_len;
+	if (fstat (fd, &statbuf) != 0)
+	{
+		close (fd);
+		return (NULL);
+	}
 
-	if ((iter == NULL) || (buffer_len == NULL))
-		return (-1);
+	if ((shm = calloc (1, sizeof (*shm))) == NULL)
+	{
+		close (fd);
+		return (NULL);
+	}
 
-	if ((buffer == NULL) && (*buffer_len != 0 ))
-		return (-1);
+	shm->size = (size_t) statbuf.st_size;
+	if (shm->size >= sizeof (ping_shm_header_t))
+		shm->header = mmap (NULL, shm->size, PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
 
-	switch (info)
+	if ((shm->header == NULL) || (shm->header == MAP_FAILED))
 	{
-		case PING_INFO_USERNAME:
-			ret = ENOMEM;
-			*buffer_len = strlen (iter->username) + 1;
-			if (orig_buffer_len <= *buffer_len)
-				break;
-			/* Since (orig_buffer_len > *buffer_len) `strncpy'
-			 * will copy `*buffer_len' and pad the rest of
-			 * `buffer' with null-bytes */
-			strncpy (buffer, iter->username, orig_buffer_len);
-			ret = 0;
-			break;
+		free (shm);
+		errno = EINVAL;
+		return (NULL);
+	}
 
-		case PING_INFO_HOSTNAME:
-			ret = ENOMEM;
-			*buffer_len = strlen (iter->hostname) + 1;
-			if (orig_buffer_len < *buffer_len)
-				break;
-			/* Since (orig_buffer_len > *buffer_len) `strncpy'
-			 * will copy `*buffer_len' and pad the rest of
-			 * `buffer' with null-bytes */
-			strncpy (buffer, iter->hostname, orig_buffer_len);
-			ret = 0;
-			break;
+	/* The size of records may only grow in later versions. */
+	if ((shm->header->magic != PING_SHM_MAGIC)
+			|| (shm->header->version != PING_SHM_VERSION)
+			|| (shm->header->record_size < sizeof (ping_shm_record_t))
+			|| (shm->size < ((size_t) shm->header->header_size)
+				+ ((size_t) shm->header->records_size)
+				* ((size_t) shm->header->record_size)))
+	{
+		munmap (shm->header, shm->size);
+		free (shm);
+		errno = EINVAL;
+		return (NULL);
+	}
 
-		case PING_INFO_ADDRESS:
-			ret = getnameinfo ((struct sockaddr *) iter->addr,
-					iter->addrlen,
-					(char *) buffer,
-					*buffer_len,
-					NULL, 0,
-					NI_NUMERICHOST);
-			if (ret != 0)
-			{
-				if ((ret == EAI_MEMORY)
-#ifdef EAI_OVERFLOW
-						|| (ret == EAI_OVERFLOW)
-#endif
-				   )
-					ret = ENOMEM;
-#if defined(EAI_SYSTEM)
-				else if (ret == EAI_SYSTEM)
-					ret = errno;
-#endif
-				else
-					ret = EINVAL;
-			}
-			break;
+	return (shm);
+}
 
-		case PING_INFO_FAMILY:
-			ret = ENOMEM;
-			*buffer_len = sizeof (int);
-			if (orig_buffer_len < sizeof (int))
-				break;
-			*((int *) buffer) = iter->addrfamily;
-			ret = 0;
-			break;
+void ping_shm_detach (ping_shm_t *shm)
+{
+	if (shm == NULL)
+		return;
 
-		case PING_INFO_LATENCY:
-			ret = ENOMEM;
-			*buffer_len = sizeof (double);
-			if (orig_buffer_len < sizeof (double))
-				break;
-			*((double *) buffer) = iter->latency;
-			ret = 0;
-			break;
+	munmap (shm->header, shm->size);
+	free (shm);
+}
 
-		case PING_INFO_DROPPED:
-			ret = ENOMEM;
-			*buffer_len = sizeof (uint32_t);
-			if (orig_buffer_len < sizeof (uint32_t))
-				break;
-			*((uint32_t *) buffer) = iter->dropped;
-			ret = 0;
-			break;
+int ping_shm_count (const ping_shm_t *shm)
+{
+	if (shm == NULL)
+		return (-1);
 
-		case PING_INFO_SEQUENCE:
-			ret = ENOMEM;
-			*buffer_len = sizeof (unsigned int);
-			if (orig_buffer_len < sizeof (unsigned int))
-				break;
-			*((unsigned int *) buffer) = (unsigned int) iter->sequence;
-			ret = 0;
-			break;
+	return ((int) __atomic_load_n (&shm->header->records_num,
+				__ATOMIC_ACQUIRE));
+}
 
-		case PING_INFO_IDENT:
-			ret = ENOMEM;
-			*buffer_len = sizeof (uint16_t);
-			if (orig_buffer_len < sizeof (uint16_t))
-				break;
-			*((uint16_t *) buffer) = (uint16_t) iter->ident;
-			ret = 0;
-			break;
+int ping_shm_read (const ping_shm_t *shm, int index,
+		ping_shm_record_t *record)
+{
+	const ping_shm_record_t *r;
+	uint32_t seq;
+	int tries;
 
-		case PING_INFO_DATA:
-			ret = ENOMEM;
-			*buffer_len = strlen (iter->data);
-			if (orig_buffer_len < *buffer_len)
-				break;
-			strncpy ((char *) buffer, iter->data, orig_buffer_len);
-			ret = 0;
-			break;
+	if ((shm == NULL) || (record == NULL) || (index < 0))
+		return (EINVAL);
 
-		case PING_INFO_RECV_TTL:
-			ret = ENOMEM;
-			*buffer_len = sizeof (int);
-			if (orig_buffer_len < sizeof (int))
-				break;
-			*((int *) buffer) = iter->recv_ttl;
-			ret = 0;
-			break;
+	if (__atomic_load_n (&shm->header->obsolete, __ATOMIC_ACQUIRE))
+		return (ESTALE);
 
-		case PING_INFO_RECV_QOS:
-			ret = ENOMEM;
-			if (*buffer_len>sizeof(unsigned)) *buffer_len=sizeof(unsigned);
-			if (!*buffer_len) *buffer_len=1;
-			if (orig_buffer_len < *buffer_len)
-				break;
-			memcpy(buffer,&iter->recv_qos,*buffer_len);
-			ret = 0;
-			break;
-	}
+	if (((uint32_t) index) >= __atomic_load_n (&shm->header->records_num,
+				__ATOMIC_ACQUIRE))
+		return (EINVAL);
 
-	return (ret);
-} /* ping_iterator_get_info */
+	r = (const ping_shm_record_t *) (((const char *) shm->header)
+			+ shm->header->header_size
+			+ ((size_t) index) * shm->header->record_size);
 
-void *ping_iterator_get_context (pingobj_iter_t *iter)
-{
-	if (iter == NULL)
-		return (NULL);
-	return (iter->context);
-}
+	/* Read side of the sequence lock, see ping_shm_publish(). The writer
+	 * may have died in the middle of an update, leaving the counter odd,
+	 * so give up after a number of attempts. */
+	for (tries = 0; tries < PING_SHM_READ_TRIES; tries++)
+	{
+		seq = __atomic_load_n (&r->seq, __ATOMIC_ACQUIRE);
+		if ((seq & 1) != 0)
+			continue;
 
-void ping_iterator_set_context (pingobj_iter_t *iter, void *context)
-{
-	if (iter == NULL)
-		return;
-	iter->context = context;
+		memcpy (record, r, sizeof (*record));
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+		if (__atomic_load_n (&r->seq, __ATOMIC_RELAXED) == seq)
+			return (0);
+	}
+
+	return (EAGAIN);
 }
+#endif /* HAVE_SYS_MMAN_H */
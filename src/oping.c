@@ -174,26 +174,10 @@ typedef struct ping_context
 #ifndef HISTORY_SIZE_MAX
 # define HISTORY_SIZE_MAX 900
 #endif
-	/* The last n RTTs in the order they were sent. */
-	double history_by_time[HISTORY_SIZE_MAX];
-
-	/* Current number of entries in the history. This is a value between 0
-	 * and HISTORY_SIZE_MAX. */
-	size_t history_size;
-
-	/* Total number of reponses received. */
-	size_t history_received;
-
-	/* Index of the next RTT to be written to history_by_time. This wraps
-	 * around to 0 once the histroty has grown to HISTORY_SIZE_MAX. */
-	size_t history_index;
-
-	/* The last history_size RTTs sorted by value. timed out packets (NAN
-	 * entries) are sorted to the back. */
-	double history_by_value[HISTORY_SIZE_MAX];
-
-	/* If set to true, history_by_value has to be re-calculated. */
-	_Bool history_dirty;
+	/* Number of rounds that passed before this host was added. The graph
+	 * of such a host is padded so that it lines up with the other hosts.
+	 * The RTTs themselves are kept by liboping, see PING_OPT_HISTORY. */
+	size_t history_padding;
 
 #if USE_NCURSES
 	WINDOW *window;
@@ -219,13 +203,30 @@ static int     opt_box_height = MAX_BOX_HEIGHT;
 static int     opt_utf8       = 0;
 #endif
 static char   *opt_outfile    = NULL;
+static char   *opt_shmfile    = NULL;
 static int     opt_bell       = 0;
+/* Microseconds to busy poll the sockets for, see PING_OPT_BUSY_POLL. If
+ * non-zero, oping also spins instead of sleeping between pings. */
+static int     opt_busy_poll  = 0;
+
+/* Shortest interval accepted, and accepted without busy polling. */
+#define OPING_MIN_INTERVAL      0.00001
+#define OPING_MIN_INTERVAL_IDLE 0.001
 
 static int host_num  = 0;
 static FILE *outfile = NULL;
 
 #if USE_NCURSES
 static WINDOW *main_win = NULL;
+
+/* Sorted view: zero shows all hosts in the order they were given, otherwise
+ * one of PING_TOP_* plus one. The worst hosts are shown in sort_windows, see
+ * update_sorted_windows(). */
+static int opt_sort = 0;
+static WINDOW **sort_windows = NULL;
+static size_t sort_windows_num = 0;
+static pingobj_iter_t **sort_hosts = NULL;
+static size_t sort_hosts_num = 0;
 #endif
 
 static void sigint_handler (int signal) /* {{{ */
@@ -265,6 +266,7 @@ static void context_destroy (ping_context_t *context) /* {{{ */
 	free (context);
 } /* }}} void context_destroy */
 
+#if USE_NCURSES
 static int compare_double (void const *arg0, void const *arg1) /* {{{ */
 {
 	double dbl0 = *((double *) arg0);
@@ -287,107 +289,53 @@ static int compare_double (void const *arg0, void const *arg1) /* {{{ */
 		return 0;
 } /* }}} int compare_double */
 
-static void clean_history (ping_context_t *ctx) /* {{{ */
+/* Copies the RTTs in the history of a host to "values", sorted by value.
+ * Timed out packets are skipped. Returns the number of RTTs copied. */
+static size_t history_by_value (pingobj_iter_t *iter, /* {{{ */
+		double *values, size_t values_num)
 {
+	size_t num = values_num;
+	size_t received = 0;
 	size_t i;
 
-	if (!ctx->history_dirty)
-		return;
-
-	/* Copy all values from by_time to by_value. */
-	memcpy (ctx->history_by_value, ctx->history_by_time,
-			sizeof (ctx->history_by_time));
-
-	/* Remove impossible values caused by adding a new host */
-	for (i = 0; i < ctx->history_size; i++)
-		if (ctx->history_by_value[i] < 0)
-			ctx->history_by_value[i] = NAN;
+	if (ping_iterator_get_history (iter, values, &num) != 0)
+		return (0);
 
-	/* Sort all RTTs. */
-	qsort (ctx->history_by_value, ctx->history_size, sizeof
-			(ctx->history_by_value[0]), compare_double);
+	for (i = 0; i < num; i++)
+		if (values[i] >= 0.0)
+			values[received++] = values[i];
 
-	/* Update the number of received RTTs. */
-	ctx->history_received = 0;
-	for (i = 0; i < ctx->history_size; i++)
-		if (!isnan (ctx->history_by_value[i]))
-			ctx->history_received++;
+	qsort (values, received, sizeof (values[0]), compare_double);
 
-	/* Mark as clean. */
-	ctx->history_dirty = 0;
-} /* }}} void clean_history */
+	return (received);
+} /* }}} size_t history_by_value */
+#endif
 
-static double percentile_to_latency (ping_context_t *ctx, /* {{{ */
+/* Percentiles and ratios are calculated from the latency sketch maintained by
+ * liboping, so no sorting of the history is required. */
+static double percentile_to_latency (pingobj_iter_t *iter, /* {{{ */
 		double percentile)
 {
-	size_t index;
-
-	clean_history (ctx);
+	const ping_sketch_t *sketch = ping_iterator_get_sketch (iter);
 
 	/* Not a single packet was received successfully. */
-	if (ctx->history_received == 0)
+	if (ping_sketch_count (sketch) == 0)
 		return NAN;
 
-	if (percentile <= 0.0)
-		index = 0;
-	else if (percentile >= 100.0)
-		index = ctx->history_received - 1;
-	else
-	{
-		index = (size_t) ceil ((percentile / 100.0) * ((double) ctx->history_received));
-		assert (index > 0);
-		index--;
-	}
-
-	return (ctx->history_by_value[index]);
+	return (ping_sketch_quantile (sketch, percentile / 100.0));
 } /* }}} double percentile_to_latency */
 
 #if USE_NCURSES
-static double latency_to_ratio (ping_context_t *ctx, /* {{{ */
+static double latency_to_ratio (pingobj_iter_t *iter, /* {{{ */
 		double latency)
 {
-	size_t low;
-	size_t high;
-	size_t index;
-
-	clean_history (ctx);
+	const ping_sketch_t *sketch = ping_iterator_get_sketch (iter);
 
 	/* Not a single packet was received successfully. */
-	if (ctx->history_received == 0)
+	if (ping_sketch_count (sketch) == 0)
 		return NAN;
 
-	low = 0;
-	high = ctx->history_received - 1;
-
-	if (latency < ctx->history_by_value[low])
-		return 0.0;
-	else if (latency >= ctx->history_by_value[high])
-		return 100.0;
-
-	/* Do a binary search for the latency. This will work even when the
-	 * exact latency is not in the array. If the latency is in the array
-	 * multiple times, "low" will be set to the index of the last
-	 * occurrence. The value at index "high" will be larger than the
-	 * searched for latency (assured by the above "if" block. */
-	while ((high - low) > 1)
-	{
-		index = (high + low) / 2;
-
-		if (ctx->history_by_value[index] > latency)
-			high = index;
-		else
-			low = index;
-	}
-
-	assert (ctx->history_by_value[high] > latency);
-	assert (ctx->history_by_value[low] <= latency);
-
-	if (ctx->history_by_value[low] == latency)
-		index = low;
-	else
-		index = high;
-
-	return (((double) (index + 1)) / ((double) ctx->history_received));
+	return (ping_sketch_rank (sketch, latency));
 } /* }}} double latency_to_ratio */
 #endif
 
@@ -407,7 +355,7 @@ static int ping_initialize_contexts (pingobj_t *ping) /* {{{ */
 {
 	pingobj_iter_t *iter;
 	int index;
-	size_t history_size = 0;
+	size_t history_padding = 0;
 
 	if (ping == NULL)
 		return (EINVAL);
@@ -419,14 +367,14 @@ static int ping_initialize_contexts (pingobj_t *ping) /* {{{ */
 	{
 		ping_context_t *context;
 		size_t buffer_size;
-		int i;
 
 		context = ping_iterator_get_context(iter);
 
 		/* if this is a previously existing host, do not recreate it */
 		if (context != NULL)
 		{
-			history_size = context->history_size;
+			history_padding = context->history_padding
+				+ (size_t) context->req_sent;
 			context->index = index++;
 			continue;
 		}
@@ -435,10 +383,7 @@ static int ping_initialize_contexts (pingobj_t *ping) /* {{{ */
 		context->index = index;
 
 		/* start new hosts at the same graph point as old hosts */
-		context->history_size = history_size;
-		context->history_index = history_size;
-		for (i = 0; i < history_size; i++)
-			context->history_by_time[i] = -1;
+		context->history_padding = history_padding;
 
 		buffer_size = sizeof (context->host);
 		ping_iterator_get_info (iter, PING_INFO_HOSTNAME, context->host, &buffer_size);
@@ -463,6 +408,8 @@ static void usage_exit (const char *name, int status) /* {{{ */
 			"  -4|-6        force the use of IPv4 or IPv6\n"
 			"  -c count     number of ICMP packets to send\n"
 			"  -i interval  interval with which to send ICMP packets\n"
+			"  -B usec      busy poll for replies instead of sleeping; allows\n"
+			"               intervals below 0.001 seconds\n"
 			"  -w timeout   time to wait for replies, in seconds\n"
 			"  -t ttl       time to live for each ICMP packet\n"
 			"  -Q qos       Quality of Service (QoS) of outgoing packets\n"
@@ -472,6 +419,7 @@ static void usage_exit (const char *name, int status) /* {{{ */
 			"  -m mark      mark to set on outgoing packets\n"
 			"  -f filename  read hosts from <filename>\n"
 			"  -O filename  write RTT measurements to <filename>\n"
+			"  -S filename  publish results in the shared memory file <filename>\n"
 #if USE_NCURSES
 			"  -u / -U      force / disable UTF-8 output\n"
 			"  -g graph     graph type to draw\n"
@@ -682,7 +630,7 @@ static int read_options (int argc, char **argv) /* {{{ */
 
 	while (1)
 	{
-		optchar = getopt (argc, argv, "46c:hi:I:t:Q:f:D:Z:O:P:m:w:b"
+		optchar = getopt (argc, argv, "46c:hi:I:t:Q:f:D:Z:O:S:P:m:w:bB:"
 #if USE_NCURSES
 				"uUg:H:"
 #endif
@@ -727,7 +675,7 @@ static int read_options (int argc, char **argv) /* {{{ */
 				{
 					double new_interval;
 					new_interval = atof (optarg);
-					if (new_interval < 0.001)
+					if (!(new_interval >= OPING_MIN_INTERVAL))
 						fprintf (stderr, "Ignoring invalid interval: %s\n",
 								optarg);
 					else
@@ -786,6 +734,13 @@ static int read_options (int argc, char **argv) /* {{{ */
 				}
 				break;
 
+			case 'S':
+				{
+					free (opt_shmfile);
+					opt_shmfile = strdup (optarg);
+				}
+				break;
+
 			case 'P':
 				{
 					double new_percentile;
@@ -837,6 +792,18 @@ static int read_options (int argc, char **argv) /* {{{ */
 				opt_bell = 1;
 				break;
 
+			case 'B':
+				{
+					int new_busy_poll;
+					new_busy_poll = atoi (optarg);
+					if (new_busy_poll > 0)
+						opt_busy_poll = new_busy_poll;
+					else
+						fprintf (stderr, "Ignoring invalid busy poll time: %s\n",
+								optarg);
+				}
+				break;
+
 			case 'Z':
 			{
 				char *endptr = NULL;
@@ -867,6 +834,15 @@ static int read_options (int argc, char **argv) /* {{{ */
 	if (opt_percentile <= 0.0)
 		opt_percentile = OPING_DEFAULT_PERCENTILE;
 
+	/* Sleeping for less than a millisecond is not precise enough. */
+	if ((opt_busy_poll == 0) && (opt_interval < OPING_MIN_INTERVAL_IDLE))
+	{
+		fprintf (stderr, "Intervals below %g seconds require -B, "
+				"using %g seconds.\n",
+				OPING_MIN_INTERVAL_IDLE, OPING_MIN_INTERVAL_IDLE);
+		opt_interval = OPING_MIN_INTERVAL_IDLE;
+	}
+
 	return (optind);
 } /* }}} read_options */
 
@@ -917,6 +893,35 @@ static void time_calc (struct timespec *ts_dest, /* {{{ */
 	time_normalize (ts_dest);
 } /* }}} void time_calc */
 
+/* Waits for "ts_wait" by spinning on the monotonic clock, which avoids the
+ * wakeup latency of nanosleep(2). Used with -B. */
+static void time_spin (const struct timespec *ts_wait) /* {{{ */
+{
+	struct timespec ts_end;
+	struct timespec ts_now;
+
+	if (clock_gettime (CLOCK_MONOTONIC, &ts_end) != 0)
+	{
+		perror ("clock_gettime");
+		return;
+	}
+	ts_end.tv_sec  += ts_wait->tv_sec;
+	ts_end.tv_nsec += ts_wait->tv_nsec;
+	time_normalize (&ts_end);
+
+	do
+	{
+		if (clock_gettime (CLOCK_MONOTONIC, &ts_now) != 0)
+		{
+			perror ("clock_gettime");
+			return;
+		}
+	}
+	while ((ts_now.tv_sec < ts_end.tv_sec)
+			|| ((ts_now.tv_sec == ts_end.tv_sec)
+				&& (ts_now.tv_nsec < ts_end.tv_nsec)));
+} /* }}} void time_spin */
+
 #if USE_NCURSES
 static _Bool has_utf8() /* {{{ */
 {
@@ -935,7 +940,8 @@ static _Bool has_utf8() /* {{{ */
 # endif
 } /* }}} _Bool has_utf8 */
 
-static int update_graph_boxplot (ping_context_t *ctx) /* {{{ */
+static int update_graph_boxplot (ping_context_t *ctx, /* {{{ */
+		pingobj_iter_t *iter)
 {
 	uint32_t *counters;
 	double *ratios;
@@ -943,10 +949,11 @@ static int update_graph_boxplot (ping_context_t *ctx) /* {{{ */
         size_t y_max;
 	size_t x_max;
 	size_t x;
+	double history[HISTORY_SIZE_MAX];
+	size_t history_received;
 
-	clean_history (ctx);
-
-	if (ctx->history_received == 0)
+	history_received = history_by_value (iter, history, HISTORY_SIZE_MAX);
+	if (history_received == 0)
 		return (ENOENT);
 
         y_max = (size_t) getmaxy (ctx->window);
@@ -964,9 +971,9 @@ static int update_graph_boxplot (ping_context_t *ctx) /* {{{ */
 	ratios = calloc (x_max, sizeof (*ratios));
 
 	/* Bucketize */
-	for (i = 0; i < ctx->history_received; i++)
+	for (i = 0; i < history_received; i++)
 	{
-		double latency = ctx->history_by_value[i] / 1000.0;
+		double latency = history[i] / 1000.0;
 		size_t index = (size_t) (((double) x_max) * latency / opt_interval);
 
 		if (index >= x_max)
@@ -976,11 +983,11 @@ static int update_graph_boxplot (ping_context_t *ctx) /* {{{ */
 	}
 
 	/* Sum and calc ratios */
-	ratios[0] = ((double) counters[0]) / ((double) ctx->history_received);
+	ratios[0] = ((double) counters[0]) / ((double) history_received);
 	for (x = 1; x < x_max; x++)
 	{
 		counters[x] += counters[x - 1];
-		ratios[x] = ((double) counters[x]) / ((double) ctx->history_received);
+		ratios[x] = ((double) counters[x]) / ((double) history_received);
 	}
 
 	for (x = 0; x < x_max; x++)
@@ -1047,11 +1054,14 @@ static int update_graph_boxplot (ping_context_t *ctx) /* {{{ */
 } /* }}} int update_graph_boxplot */
 
 static int update_graph_prettyping (ping_context_t *ctx, /* {{{ */
-		double latency)
+		pingobj_iter_t *iter)
 {
 	size_t x;
 	size_t x_max;
         size_t y_max;
+	double history[HISTORY_SIZE_MAX];
+	size_t history_num;
+	size_t history_size;
 	size_t history_offset;
 
         y_max = (size_t) getmaxy (ctx->window);
@@ -1065,23 +1075,17 @@ static int update_graph_prettyping (ping_context_t *ctx, /* {{{ */
 		return (EINVAL);
 	x_max -= 4;
 
-	/* Determine the first index in the history we need to draw
-	 * the graph. */
-	history_offset = 0;
-	if (((size_t) x_max) < ctx->history_size) /* window is smaller than history */
-	{
-		if (ctx->history_index > x_max)
-			history_offset = ctx->history_index - x_max;
-		else /* wrap around */
-			history_offset = ctx->history_index + ctx->history_size - x_max;
-	}
-	else /* window is larger than history */
-	{
-		if (ctx->history_index != ctx->history_size) /* no longer growing. */
-			history_offset = ctx->history_index;
-		else /* start-up */
-			history_offset = 0;
-	}
+	/* The graph consists of the padding of hosts added later, followed
+	 * by the host's own history. Only the last x_max entries are drawn. */
+	history_num = HISTORY_SIZE_MAX;
+	if (history_num > x_max)
+		history_num = x_max;
+	ping_iterator_get_history (iter, history, &history_num);
+
+	history_size = ctx->history_padding + history_num;
+	if (history_size > x_max)
+		history_size = x_max;
+	history_offset = ctx->history_padding + history_num - history_size;
 
 	for (x = 0; x < x_max; x++)
 	{
@@ -1092,18 +1096,19 @@ static int update_graph_prettyping (ping_context_t *ctx, /* {{{ */
 		char const *symbol = "!";
 		int symbolc = '!';
 
-		if (x >= ctx->history_size)
+		if (x >= history_size)
 		{
 			mvwaddch (ctx->window, /* y = */ y_max, /* x = */ x + 2, ' ');
 			continue;
 		}
 
-		index = (history_offset + x) % ctx->history_size;
-		latency = ctx->history_by_time[index];
-
-		if (latency < 0) {
+		index = history_offset + x;
+		if (index < ctx->history_padding)
 			continue;
-		}
+
+		latency = history[index - ctx->history_padding];
+		if (latency < 0.0)
+			latency = NAN;
 
 		if (latency >= 0.0)
 		{
@@ -1171,7 +1176,8 @@ static int update_graph_prettyping (ping_context_t *ctx, /* {{{ */
 	return (0);
 } /* }}} int update_graph_prettyping */
 
-static int update_graph_histogram (ping_context_t *ctx) /* {{{ */
+static int update_graph_histogram (ping_context_t *ctx, /* {{{ */
+		pingobj_iter_t *iter)
 {
 	uint32_t *counters;
 	uint32_t *accumulated;
@@ -1183,9 +1189,11 @@ static int update_graph_histogram (ping_context_t *ctx) /* {{{ */
 
 	size_t symbols_num = hist_symbols_acs_num;
 
-	clean_history (ctx);
+	double history[HISTORY_SIZE_MAX];
+	size_t history_received;
 
-	if (ctx->history_received == 0)
+	history_received = history_by_value (iter, history, HISTORY_SIZE_MAX);
+	if (history_received == 0)
 		return (ENOENT);
 
 	if (has_utf8 ())
@@ -1208,9 +1216,9 @@ static int update_graph_histogram (ping_context_t *ctx) /* {{{ */
 
 	/* Bucketize */
 	max = 0;
-	for (i = 0; i < ctx->history_received; i++)
+	for (i = 0; i < history_received; i++)
 	{
-		double latency = ctx->history_by_value[i] / 1000.0;
+		double latency = history[i] / 1000.0;
 		size_t index = (size_t) (((double) x_max) * latency / opt_interval);
 
 		if (index >= x_max)
@@ -1230,7 +1238,7 @@ static int update_graph_histogram (ping_context_t *ctx) /* {{{ */
 	for (x = 0; x < x_max; x++)
 	{
 		double height = ((double) counters[x]) / ((double) max);
-		double ratio_this = ((double) accumulated[x]) / ((double) ctx->history_received);
+		double ratio_this = ((double) accumulated[x]) / ((double) history_received);
 		double ratio_prev = 0.0;
 		size_t index;
 		int color = 0;
@@ -1240,7 +1248,7 @@ static int update_graph_histogram (ping_context_t *ctx) /* {{{ */
 			index = symbols_num - 1;
 
 		if (x > 0)
-			ratio_prev = ((double) accumulated[x - 1]) / ((double) ctx->history_received);
+			ratio_prev = ((double) accumulated[x - 1]) / ((double) history_received);
 
 		if (has_colors () == TRUE)
 		{
@@ -1278,12 +1286,6 @@ static int update_graph_histogram (ping_context_t *ctx) /* {{{ */
 
 static int update_stats_from_context (ping_context_t *ctx, pingobj_iter_t *iter) /* {{{ */
 {
-	double latency = -1.0;
-	size_t buffer_len = sizeof (latency);
-
-	ping_iterator_get_info (iter, PING_INFO_LATENCY,
-			&latency, &buffer_len);
-
 	if ((ctx == NULL) || (ctx->window == NULL))
 		return (EINVAL);
 
@@ -1318,10 +1320,10 @@ static int update_stats_from_context (ping_context_t *ctx, pingobj_iter_t *iter)
                     double max;
                     double percentile;
 
-                    min = percentile_to_latency (ctx, 0.0);
-                    median = percentile_to_latency (ctx, 50.0);
-                    max = percentile_to_latency (ctx, 100.0);
-                    percentile = percentile_to_latency (ctx, opt_percentile);
+                    min = percentile_to_latency (iter, 0.0);
+                    median = percentile_to_latency (iter, 50.0);
+                    max = percentile_to_latency (iter, 100.0);
+                    percentile = percentile_to_latency (iter, opt_percentile);
 
                     mvwprintw (ctx->window, /* y = */ 2, /* x = */ 2,
                                     "RTT[ms]: min = %.0f, median = %.0f, p(%.0f) = %.0f, max = %.0f  ",
@@ -1330,17 +1332,67 @@ static int update_stats_from_context (ping_context_t *ctx, pingobj_iter_t *iter)
         }
 
 	if (opt_show_graph == 1)
-		update_graph_prettyping (ctx, latency);
+		update_graph_prettyping (ctx, iter);
 	else if (opt_show_graph == 2)
-		update_graph_histogram (ctx);
+		update_graph_histogram (ctx, iter);
 	else if (opt_show_graph == 3)
-		update_graph_boxplot (ctx);
+		update_graph_boxplot (ctx, iter);
 
 	wrefresh (ctx->window);
 
 	return (0);
 } /* }}} int update_stats_from_context */
 
+/* Detaches the windows of the sorted view from the hosts shown in them. */
+static void release_sorted_windows (void) /* {{{ */
+{
+	size_t i;
+
+	for (i = 0; i < sort_hosts_num; i++)
+	{
+		ping_context_t *context;
+
+		context = ping_iterator_get_context (sort_hosts[i]);
+		if (context != NULL)
+			context->window = NULL;
+	}
+	sort_hosts_num = 0;
+} /* }}} void release_sorted_windows */
+
+/* Assigns the windows of the sorted view to the worst hosts. Only the
+ * hosts shown are touched, so this is cheap even with many hosts. */
+static void update_sorted_windows (pingobj_t *ping) /* {{{ */
+{
+	size_t i;
+
+	if ((opt_sort == 0) || (sort_windows_num == 0))
+		return;
+
+	release_sorted_windows ();
+
+	sort_hosts_num = sort_windows_num;
+	if (ping_get_top (ping, opt_sort - 1, sort_hosts, &sort_hosts_num) != 0)
+		sort_hosts_num = 0;
+
+	for (i = 0; i < sort_hosts_num; i++)
+	{
+		ping_context_t *context;
+
+		context = ping_iterator_get_context (sort_hosts[i]);
+		if (context == NULL)
+			continue;
+
+		werase (sort_windows[i]);
+		context->window = sort_windows[i];
+	}
+
+	for (; i < sort_windows_num; i++)
+	{
+		werase (sort_windows[i]);
+		wrefresh (sort_windows[i]);
+	}
+} /* }}} void update_sorted_windows */
+
 static int create_windows (pingobj_t *ping) /* {{{ */
 {
 	pingobj_iter_t *iter;
@@ -1348,6 +1400,8 @@ static int create_windows (pingobj_t *ping) /* {{{ */
 	int height = 0;
 	int main_win_height;
 	int box_height = opt_box_height;
+	int box_num = host_num;
+	size_t i;
 
         if (opt_show_graph == 0) {
             box_height--;
@@ -1357,7 +1411,22 @@ static int create_windows (pingobj_t *ping) /* {{{ */
 	if ((height < 1) || (width < 1))
 		return (EINVAL);
 
-	main_win_height = height - (box_height * host_num);
+	release_sorted_windows ();
+	for (i = 0; i < sort_windows_num; i++)
+		delwin (sort_windows[i]);
+	free (sort_windows);
+	free (sort_hosts);
+	sort_windows = NULL;
+	sort_hosts = NULL;
+	sort_windows_num = 0;
+
+	/* In the sorted view only as many hosts as fit on the screen are
+	 * shown, leaving at least one line for the main window. */
+	if ((opt_sort != 0) && (box_height > 0)
+			&& (box_num > (height - 1) / box_height))
+		box_num = (height - 1) / box_height;
+
+	main_win_height = height - (box_height * box_num);
         if (main_win != NULL )
         {
             delwin(main_win);
@@ -1393,12 +1462,43 @@ static int create_windows (pingobj_t *ping) /* {{{ */
 			delwin (context->window);
 			context->window = NULL;
 		}
+
+		if (opt_sort != 0)
+			continue;
+
 		context->window = newwin (/* height = */ box_height,
 				/* width = */ width,
 				/* y = */ main_win_height + (box_height * context->index),
 				/* x = */ 0);
 	}
 
+	if ((opt_sort != 0) && (box_num > 0))
+	{
+		sort_windows = calloc ((size_t) box_num, sizeof (*sort_windows));
+		sort_hosts = calloc ((size_t) box_num, sizeof (*sort_hosts));
+		if ((sort_windows == NULL) || (sort_hosts == NULL))
+		{
+			free (sort_windows);
+			free (sort_hosts);
+			sort_windows = NULL;
+			sort_hosts = NULL;
+			return (ENOMEM);
+		}
+
+		for (i = 0; i < (size_t) box_num; i++)
+		{
+			sort_windows[i] = newwin (/* height = */ box_height,
+					/* width = */ width,
+					/* y = */ main_win_height + (box_height * (int) i),
+					/* x = */ 0);
+			if (sort_windows[i] == NULL)
+				break;
+		}
+		sort_windows_num = i;
+
+		update_sorted_windows (ping);
+	}
+
 	return (0);
 } /* }}} */
 
@@ -1420,6 +1520,14 @@ static int check_resize (pingobj_t *ping) /* {{{ */
 			else if (opt_show_graph > 0)
 				opt_show_graph++;
 		}
+		else if (key == 's')
+		{
+			if (opt_sort == 3)
+				opt_sort = 0;
+			else
+				opt_sort++;
+			need_resize = 1;
+		}
 		else if (key == '+')
 		{
 			opt_box_height++;
@@ -1560,19 +1668,6 @@ static void update_context (ping_context_t *ctx, double latency) /* {{{ */
 		ctx->req_rcvd++;
 		ctx->latency_total += latency;
 	}
-	else
-	{
-		latency = NAN;
-	}
-
-	ctx->history_by_time[ctx->history_index] = latency;
-
-	ctx->history_dirty = 1;
-
-	/* Update index and size. */
-	ctx->history_index = (ctx->history_index + 1) % HISTORY_SIZE_MAX;
-	if (ctx->history_size < HISTORY_SIZE_MAX)
-		ctx->history_size++;
 } /* }}} void update_context */
 
 static void update_host_hook (pingobj_iter_t *iter, /* {{{ */
@@ -1629,7 +1724,7 @@ static void update_host_hook (pingobj_iter_t *iter, /* {{{ */
 			double ratio;
 			int color = OPING_GREEN;
 
-			ratio = latency_to_ratio (context, latency);
+			ratio = latency_to_ratio (iter, latency);
 			if (ratio < threshold_green)
 				color = OPING_GREEN;
 			else if (ratio < threshold_yellow)
@@ -1730,6 +1825,8 @@ static int post_loop_hook (pingobj_t *ping) /* {{{ */
 
 #if USE_NCURSES
 	endwin ();
+	/* The windows of the sorted view are not owned by the contexts. */
+	release_sorted_windows ();
 #endif
 
 	for (iter = ping_iterator_get (ping);
@@ -1760,15 +1857,36 @@ static int post_loop_hook (pingobj_t *ping) /* {{{ */
 			double max;
 			double percentile;
 
-			min = percentile_to_latency (context, 0.0);
-			median = percentile_to_latency (context, 50.0);
-			max = percentile_to_latency (context, 100.0);
-			percentile = percentile_to_latency (context, opt_percentile);
+			min = percentile_to_latency (iter, 0.0);
+			median = percentile_to_latency (iter, 50.0);
+			max = percentile_to_latency (iter, 100.0);
+			percentile = percentile_to_latency (iter, opt_percentile);
 
 			printf ("RTT[ms]: min = %.0f, median = %.0f, p(%.0f) = %.0f, max = %.0f\n",
 					min, median, opt_percentile, percentile, max);
 		}
 
+		if (context->req_rcvd != 0)
+		{
+			double mean = NAN;
+			double stddev = NAN;
+			double jitter = NAN;
+			size_t buffer_len;
+
+			buffer_len = sizeof (mean);
+			ping_iterator_get_info (iter, PING_INFO_LATENCY_MEAN,
+					&mean, &buffer_len);
+			buffer_len = sizeof (stddev);
+			ping_iterator_get_info (iter, PING_INFO_LATENCY_STDDEV,
+					&stddev, &buffer_len);
+			buffer_len = sizeof (jitter);
+			ping_iterator_get_info (iter, PING_INFO_JITTER,
+					&jitter, &buffer_len);
+
+			printf ("RTT[ms]: mean = %.2f, stddev = %.2f, jitter = %.2f\n",
+					mean, stddev, jitter);
+		}
+
 		ping_iterator_set_context (iter, NULL);
 		context_destroy (context);
 	}
@@ -1903,6 +2021,37 @@ int main (int argc, char **argv) /* {{{ */
 		}
 	}
 
+	if (opt_busy_poll > 0)
+	{
+		if (ping_setopt (ping, PING_OPT_BUSY_POLL, &opt_busy_poll) != 0)
+		{
+			fprintf (stderr, "Enabling busy polling failed: %s\n",
+					ping_get_error (ping));
+		}
+	}
+
+	if (opt_shmfile != NULL)
+	{
+		if (ping_setopt (ping, PING_OPT_SHM, (void *) opt_shmfile) != 0)
+		{
+			fprintf (stderr, "Setting shared memory file failed: %s\n",
+					ping_get_error (ping));
+		}
+	}
+
+#if USE_NCURSES
+	{
+		/* The graphs are drawn from the history kept by liboping. */
+		int history_size = HISTORY_SIZE_MAX;
+
+		if (ping_setopt (ping, PING_OPT_HISTORY, &history_size) != 0)
+		{
+			fprintf (stderr, "Setting history size failed: %s\n",
+					ping_get_error (ping));
+		}
+	}
+#endif
+
 	if (opt_filename != NULL)
 	{
 		FILE *infile;
@@ -2056,6 +2205,10 @@ int main (int argc, char **argv) /* {{{ */
 			continue;
 		}
 
+#if USE_NCURSES
+		update_sorted_windows (ping);
+#endif
+
 		index = 0;
 		for (iter = ping_iterator_get (ping);
 				iter != NULL;
@@ -2080,16 +2233,21 @@ int main (int argc, char **argv) /* {{{ */
 		time_calc (&ts_wait, &ts_int, &tv_begin, &tv_end);
 
 		/* printf ("Sleeping for %i.%09li seconds\n", (int) ts_wait.tv_sec, ts_wait.tv_nsec); */
-		while (nanosleep (&ts_wait, &ts_wait) != 0)
+		if (opt_busy_poll > 0)
+			time_spin (&ts_wait);
+		else
 		{
-			if (errno == EINTR)
+			while (nanosleep (&ts_wait, &ts_wait) != 0)
 			{
-				continue;
-			}
-			else
-			{
-				perror ("nanosleep");
-				break;
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				else
+				{
+					perror ("nanosleep");
+					break;
+				}
 			}
 		}
 
@@ -25,8 +25,10 @@
 #endif
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/time.h>
 #include <sys/socket.h>
 
 #ifdef __cplusplus
@@ -46,6 +48,118 @@ typedef pinghost_t pingobj_iter_t;
 struct pingobj;
 typedef struct pingobj pingobj_t;
 
+struct ping_sketch;
+typedef struct ping_sketch ping_sketch_t;
+
+struct ping_range;
+typedef struct ping_range ping_range_t;
+
+#define PING_RESULT_REPLY   0
+#define PING_RESULT_TIMEOUT 1
+#define PING_RESULT_NONE    2
+
+struct ping_result
+{
+	int          index;
+	int          family;
+	int          status;
+	double       latency;
+	unsigned int sequence;
+	uint32_t     dropped;
+	int          recv_ttl;
+	uint8_t      recv_qos;
+};
+typedef struct ping_result ping_result_t;
+
+/* One hop of a path found by ping_trace(). "destination" is non-zero if
+ * the host itself replied. */
+struct ping_hop
+{
+	int    ttl;
+	int    status;
+	double latency;
+	int    destination;
+	char   address[64];
+};
+typedef struct ping_hop ping_hop_t;
+
+/* Source of a reply to an echo request to a multicast or broadcast group,
+ * see PING_OPT_RESPONDERS. */
+struct ping_responder
+{
+	int    family;
+	double latency;
+	char   address[64];
+};
+typedef struct ping_responder ping_responder_t;
+
+struct ping_window_stats
+{
+	uint32_t received;
+	uint32_t dropped;
+	double   latency_mean;
+	double   latency_max;
+};
+typedef struct ping_window_stats ping_window_stats_t;
+
+struct ping_event
+{
+	int            index;
+	unsigned int   sequence;
+	struct timeval send_time;
+	double         latency;
+	void          *context;
+};
+typedef struct ping_event ping_event_t;
+
+/* Layout of the shared memory table written with PING_OPT_SHM. The header is
+ * followed by records_size records of record_size bytes each, of which the
+ * first records_num are in use. */
+#define PING_SHM_MAGIC   0x474e504fU /* "OPNG" */
+#define PING_SHM_VERSION 1
+struct ping_shm_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t record_size;
+	uint32_t records_size;
+	uint32_t records_num;
+	uint32_t obsolete;
+	uint32_t reserved;
+};
+typedef struct ping_shm_header ping_shm_header_t;
+
+struct ping_shm_record
+{
+	uint32_t seq;
+	int32_t  status;
+	uint32_t sequence;
+	uint32_t received;
+	uint32_t dropped;
+	int32_t  family;
+	double   latency;
+	double   latency_mean;
+	double   time;
+	char     hostname[128];
+	char     address[64];
+};
+typedef struct ping_shm_record ping_shm_record_t;
+
+struct ping_shm;
+typedef struct ping_shm ping_shm_t;
+
+struct ping_transport;
+typedef struct ping_transport ping_transport_t;
+
+/* Argument of PING_OPT_DATA_BINARY. */
+struct ping_data
+{
+	const void *data;
+	size_t      data_len;
+};
+typedef struct ping_data ping_data_t;
+
 #define PING_OPT_TIMEOUT 0x01
 #define PING_OPT_TTL     0x02
 #define PING_OPT_AF      0x04
@@ -54,11 +168,30 @@ typedef struct pingobj pingobj_t;
 #define PING_OPT_DEVICE  0x20
 #define PING_OPT_QOS     0x40
 #define PING_OPT_MARK    0x80
+#define PING_OPT_HISTORY 0x0100
+#define PING_OPT_LATENCY_THRESHOLD 0x0200
+#define PING_OPT_EVENT_RING 0x0400
+#define PING_OPT_SHM     0x0800
+#define PING_OPT_TRANSPORT 0x1000
+#define PING_OPT_RECVBUF 0x2000
+#define PING_OPT_BUSY_POLL 0x4000
+#define PING_OPT_PACKET_RING 0x8000
+#define PING_OPT_XDP     0x10000
+#define PING_OPT_DATA_BINARY 0x20000
+#define PING_OPT_HEADERS_ONLY 0x40000
+#define PING_OPT_VERIFY_PAYLOAD 0x80000
+#define PING_OPT_RESPONDERS 0x100000
+#define PING_OPT_SWEEP_RATE 0x200000
+#define PING_OPT_RESPONDER_WINDOW 0x400000
 
 #define PING_DEF_TIMEOUT 1.0
 #define PING_DEF_TTL     255
 #define PING_DEF_AF      AF_UNSPEC
+#define PING_DEF_SWEEP_RATE 1000.0
+#define PING_DEF_RESPONDER_WINDOW 0.5
 #define PING_DEF_DATA    "liboping -- ICMP ping library <http://octo.it/liboping/>"
+/* 65535 minus the IPv4 and ICMP headers. */
+#define PING_DATA_MAX    65507
 
 /*
  * Method definitions
@@ -66,17 +199,56 @@ typedef struct pingobj pingobj_t;
 pingobj_t *ping_construct (void);
 void ping_destroy (pingobj_t *obj);
 
+ping_transport_t *ping_transport_create (void);
+void ping_transport_destroy (ping_transport_t *t);
+
 int ping_setopt (pingobj_t *obj, int option, void *value);
 
 int ping_send (pingobj_t *obj);
 
+int ping_trace (pingobj_t *obj, int max_ttl);
+int ping_iterator_get_hops (pingobj_iter_t *iter, ping_hop_t *hops,
+		size_t *hops_num);
+
+typedef int (*ping_sweep_callback_t) (uint32_t index, const char *address,
+		double latency, void *user_data);
+int ping_sweep (pingobj_t *obj, const char *network,
+		ping_sweep_callback_t callback, void *user_data);
+
 int ping_host_add (pingobj_t *obj, const char *host);
 int ping_host_remove (pingobj_t *obj, const char *host);
 
+pingobj_iter_t *ping_host_add_addr (pingobj_t *obj,
+		const struct sockaddr *addr, socklen_t addrlen,
+		const char *label);
+
+ping_range_t *ping_host_add_range (pingobj_t *obj, const char *network);
+pingobj_iter_t *ping_range_get_host (ping_range_t *range, uint32_t index);
+int ping_host_remove_range (pingobj_t *obj, ping_range_t *range);
+void ping_range_release (ping_range_t *range);
+int ping_host_setopt (pingobj_t *obj, const char *host, int option,
+		void *value);
+
+int ping_host_queue_add (pingobj_t *obj, const char *host);
+int ping_host_queue_remove (pingobj_t *obj, const char *host);
+
+typedef int (*ping_snapshot_callback_t) (const char *hostname,
+		const char *address, const ping_result_t *result,
+		void *user_data);
+int ping_snapshot_foreach (pingobj_t *obj, ping_snapshot_callback_t callback,
+		void *user_data);
+
 pingobj_iter_t *ping_iterator_get (pingobj_t *obj);
 pingobj_iter_t *ping_iterator_next (pingobj_iter_t *iter);
 int ping_iterator_count (pingobj_t *obj);
 
+#define PING_CHANGE_UP      0x01
+#define PING_CHANGE_DOWN    0x02
+#define PING_CHANGE_TIMEOUT 0x04
+#define PING_CHANGE_LATENCY 0x08
+pingobj_iter_t *ping_iterator_get_changed (pingobj_t *obj);
+pingobj_iter_t *ping_iterator_next_changed (pingobj_iter_t *iter);
+
 #define PING_INFO_HOSTNAME  1
 #define PING_INFO_ADDRESS   2
 #define PING_INFO_FAMILY    3
@@ -88,6 +260,13 @@ int ping_iterator_count (pingobj_t *obj);
 #define PING_INFO_DROPPED   9
 #define PING_INFO_RECV_TTL 10
 #define PING_INFO_RECV_QOS 11
+#define PING_INFO_RECEIVED       12
+#define PING_INFO_LATENCY_MIN    13
+#define PING_INFO_LATENCY_MAX    14
+#define PING_INFO_LATENCY_MEAN   15
+#define PING_INFO_LATENCY_STDDEV 16
+#define PING_INFO_JITTER         17
+#define PING_INFO_CHANGES        18
 int ping_iterator_get_info (pingobj_iter_t *iter, int info,
 		void *buffer, size_t *buffer_len);
 
@@ -96,6 +275,46 @@ const char *ping_get_error (pingobj_t *obj);
 void *ping_iterator_get_context (pingobj_iter_t *iter);
 void  ping_iterator_set_context (pingobj_iter_t *iter, void *context);
 
+int ping_get_results (pingobj_t *obj, ping_result_t *results,
+		size_t *results_num);
+
+int ping_event_read (pingobj_t *obj, ping_event_t *events,
+		size_t events_num);
+uint64_t ping_event_overflow (pingobj_t *obj);
+
+uint64_t ping_get_socket_drops (pingobj_t *obj);
+
+ping_shm_t *ping_shm_attach (const char *path);
+void ping_shm_detach (ping_shm_t *shm);
+int ping_shm_count (const ping_shm_t *shm);
+int ping_shm_read (const ping_shm_t *shm, int index,
+		ping_shm_record_t *record);
+
+#define PING_TOP_LATENCY 0
+#define PING_TOP_LOSS    1
+#define PING_TOP_JITTER  2
+int ping_get_top (pingobj_t *obj, int metric, pingobj_iter_t **hosts,
+		size_t *hosts_num);
+
+int ping_iterator_get_window (pingobj_iter_t *iter, int minutes,
+		ping_window_stats_t *stats);
+
+int ping_iterator_get_history (pingobj_iter_t *iter, double *latencies,
+		size_t *latencies_num);
+
+int ping_iterator_get_responders (pingobj_iter_t *iter,
+		ping_responder_t *responders, size_t *responders_num);
+
+const ping_sketch_t *ping_iterator_get_sketch (pingobj_iter_t *iter);
+
+ping_sketch_t *ping_sketch_create (void);
+void ping_sketch_destroy (ping_sketch_t *sk);
+int ping_sketch_add (ping_sketch_t *sk, double latency);
+int ping_sketch_merge (ping_sketch_t *dst, const ping_sketch_t *src);
+uint64_t ping_sketch_count (const ping_sketch_t *sk);
+double ping_sketch_quantile (const ping_sketch_t *sk, double quantile);
+double ping_sketch_rank (const ping_sketch_t *sk, double latency);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,1693 @@
+/**
+ * Object oriented C module to send ICMP and ICMPv6 `echo's.
+ * Copyright (C) 2006-2017  Florian octo Forster <ff at octo.it>
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Tests of the parts of liboping that work without raw sockets, so that they
+ * can be run by "make check" without privileges. The library is included,
+ * so that static functions can be tested as well.
+ */
+#include "liboping.c"
+
+#include <pthread.h>
+
+static int failures = 0;
+
+#define CHECK(expr) do { \
+	if (!(expr)) \
+	{ \
+		fprintf (stderr, "%s:%i: Check failed: %s\n", \
+				__FILE__, __LINE__, #expr); \
+		failures++; \
+	} \
+} while (0)
+
+/* CHECK_CLOSE checks that "value" is within "error" of "expected", relative
+ * to "expected". */
+#define CHECK_CLOSE(value, expected, error) \
+	CHECK (fabs ((value) - (expected)) <= (error) * fabs (expected))
+
+/* test_host_add adds 127.0.0.<n> to "obj". Adding hosts by address needs
+ * neither name resolution nor sockets. */
+static pinghost_t *test_host_add (pingobj_t *obj, int n)
+{
+	struct sockaddr_in sa;
+	pinghost_t *ph;
+
+	memset (&sa, 0, sizeof (sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl (0x7f000000 | (uint32_t) n);
+
+	ph = ping_host_add_addr (obj, (struct sockaddr *) &sa, sizeof (sa),
+			NULL);
+	CHECK (ph != NULL);
+	return (ph);
+} /* pinghost_t *test_host_add */
+
+/*
+ * Sketches, see ping_sketch_create(3).
+ */
+static void test_sketch (void)
+{
+	ping_sketch_t *a = ping_sketch_create ();
+	ping_sketch_t *b = ping_sketch_create ();
+	ping_sketch_t *all = ping_sketch_create ();
+	double q;
+	int i;
+
+	CHECK ((a != NULL) && (b != NULL) && (all != NULL));
+
+	/* Empty sketches and invalid values */
+	CHECK (ping_sketch_count (a) == 0);
+	CHECK (ping_sketch_quantile (a, 0.5) == -1.0);
+	CHECK (ping_sketch_rank (a, 1.0) == -1.0);
+	CHECK (ping_sketch_add (a, -1.0) == EINVAL);
+	CHECK (ping_sketch_add (a, NAN) == EINVAL);
+	CHECK (ping_sketch_add (NULL, 1.0) == EINVAL);
+	CHECK (ping_sketch_count (a) == 0);
+
+	/* 1 to 10000 ms, odd values in "a" and even ones in "b". */
+	for (i = 1; i <= 10000; i++)
+	{
+		CHECK (ping_sketch_add ((i % 2) ? a : b, (double) i) == 0);
+		CHECK (ping_sketch_add (all, (double) i) == 0);
+	}
+	CHECK (ping_sketch_count (all) == 10000);
+
+	/* The estimate of the value with rank q * (n - 1) is within the
+	 * relative accuracy of the sketch. */
+	for (q = 0.05; q < 1.0; q += 0.05)
+	{
+		double expected = 1.0 + q * 9999.0;
+
+		CHECK_CLOSE (ping_sketch_quantile (all, q), expected,
+				PING_SKETCH_ACCURACY + 0.0005);
+	}
+	CHECK (ping_sketch_quantile (all, 0.0) == 1.0);
+	CHECK (ping_sketch_quantile (all, 1.0) == 10000.0);
+
+	/* The rank includes the whole bucket of the latency, which is up to
+	 * twice the accuracy wide. */
+	CHECK (ping_sketch_rank (all, 5000.0) >= 0.5);
+	CHECK (ping_sketch_rank (all, 5000.0)
+			<= 0.5 * (1.0 + 2.0 * PING_SKETCH_ACCURACY));
+	CHECK (ping_sketch_rank (all, 9000.0) >= 0.9);
+	CHECK (ping_sketch_rank (all, 9000.0)
+			<= 0.9 * (1.0 + 2.0 * PING_SKETCH_ACCURACY));
+	CHECK (ping_sketch_rank (all, 0.5) == 0.0);
+	CHECK (ping_sketch_rank (all, 10000.0) == 1.0);
+
+	/* Merging is exact: the buckets are added up. */
+	CHECK (ping_sketch_merge (a, b) == 0);
+	CHECK (ping_sketch_count (a) == 10000);
+	for (q = 0.0; q <= 1.0; q += 0.01)
+		CHECK (ping_sketch_quantile (a, q)
+				== ping_sketch_quantile (all, q));
+	CHECK (ping_sketch_merge (a, NULL) == EINVAL);
+
+	/* Values at or below the smallest bucket are counted as zero. */
+	ping_sketch_destroy (b);
+	b = ping_sketch_create ();
+	CHECK (ping_sketch_add (b, 0.0) == 0);
+	CHECK (ping_sketch_add (b, PING_SKETCH_MIN_VALUE / 2.0) == 0);
+	CHECK (ping_sketch_add (b, 100.0) == 0);
+	CHECK (ping_sketch_add (b, 200.0) == 0);
+	CHECK (ping_sketch_quantile (b, 0.6) == 0.0);
+	CHECK_CLOSE (ping_sketch_quantile (b, 0.7), 100.0, PING_SKETCH_ACCURACY);
+	CHECK (ping_sketch_rank (b, 1.0) == 0.5);
+
+	ping_sketch_destroy (a);
+	ping_sketch_destroy (b);
+	ping_sketch_destroy (all);
+} /* void test_sketch */
+
+/*
+ * History encoding, see ping_iterator_get_history(3).
+ */
+static void test_history (void)
+{
+	pingobj_t *obj;
+	pinghost_t *ph;
+	double latencies[4];
+	size_t latencies_num;
+	double latency;
+	uint8_t prev;
+	int size = 3;
+	int i;
+
+	/* Timeouts and values outside of the scale */
+	CHECK (ping_history_encode (-1.0) == PING_HISTORY_TIMEOUT);
+	CHECK (ping_history_decode (PING_HISTORY_TIMEOUT) == -1.0);
+	CHECK (ping_history_encode (0.0) == 1);
+	CHECK (ping_history_encode (PING_HISTORY_MIN_VALUE) == 1);
+	CHECK_CLOSE (ping_history_decode (1), PING_HISTORY_MIN_VALUE, 1e-9);
+	CHECK (ping_history_encode (PING_HISTORY_MAX_VALUE * 10.0) == PING_HISTORY_CODE_MAX);
+	CHECK_CLOSE (ping_history_decode (PING_HISTORY_CODE_MAX), PING_HISTORY_MAX_VALUE, 1e-9);
+
+	/* Codes grow with the latency, and decoding a code is within half a
+	 * step of the encoded latency. */
+	prev = 1;
+	for (latency = PING_HISTORY_MIN_VALUE; latency <= PING_HISTORY_MAX_VALUE;
+			latency *= 1.01)
+	{
+		uint8_t code = ping_history_encode (latency);
+
+		CHECK (code >= prev);
+		CHECK_CLOSE (ping_history_decode (code), latency, 0.037);
+		prev = code;
+	}
+
+	/* The history of a host keeps the newest entries. */
+	obj = ping_construct ();
+	CHECK (obj != NULL);
+	CHECK (ping_setopt (obj, PING_OPT_HISTORY, &size) == 0);
+	ph = test_host_add (obj, 1);
+
+	/* No memory is used before the first result. */
+	latencies_num = 4;
+	CHECK (ping_iterator_get_history (ph, latencies, &latencies_num) == 0);
+	CHECK (latencies_num == 0);
+	CHECK (ph->history == NULL);
+
+	for (i = 1; i <= 4; i++)
+	{
+		ph->latency = (i == 3) ? -1.0 : (double) i;
+		ping_host_history_add (obj, ph);
+	}
+
+	latencies_num = 4;
+	CHECK (ping_iterator_get_history (ph, latencies, &latencies_num) == 0);
+	CHECK (latencies_num == 3);
+	CHECK_CLOSE (latencies[0], 2.0, 0.037);
+	CHECK (latencies[1] == -1.0);
+	CHECK_CLOSE (latencies[2], 4.0, 0.037);
+
+	latencies_num = 1;
+	CHECK (ping_iterator_get_history (ph, latencies, &latencies_num) == 0);
+	CHECK (latencies_num == 1);
+	CHECK_CLOSE (latencies[0], 4.0, 0.037);
+
+	/* Changing the size discards the old history. */
+	size = 2;
+	CHECK (ping_setopt (obj, PING_OPT_HISTORY, &size) == 0);
+	ph->latency = 5.0;
+	ping_host_history_add (obj, ph);
+	latencies_num = 4;
+	CHECK (ping_iterator_get_history (ph, latencies, &latencies_num) == 0);
+	CHECK (latencies_num == 1);
+	CHECK_CLOSE (latencies[0], 5.0, 0.037);
+
+	ping_destroy (obj);
+} /* void test_history */
+
+/*
+ * Heaps of the worst hosts, see ping_get_top(3).
+ */
+#define TEST_TOP_HOSTS 200
+
+/* test_top_check checks that ping_get_top() returns the hosts with the
+ * highest latencies in "latencies", highest first. */
+static void test_top_check (pingobj_t *obj, pinghost_t **hosts,
+		const double *latencies, size_t num)
+{
+	pingobj_iter_t *top[TEST_TOP_HOSTS];
+	size_t top_num = num;
+	size_t i;
+	size_t j;
+
+	CHECK (ping_get_top (obj, PING_TOP_LATENCY, top, &top_num) == 0);
+	CHECK (top_num == num);
+
+	for (i = 0; i < top_num; i++)
+	{
+		size_t higher = 0;
+		size_t index = 0;
+
+		for (j = 0; j < TEST_TOP_HOSTS; j++)
+			if (hosts[j] == top[i])
+				index = j;
+		for (j = 0; j < TEST_TOP_HOSTS; j++)
+			if (latencies[j] > latencies[index])
+				higher++;
+		CHECK (higher == i);
+	}
+} /* void test_top_check */
+
+static void test_top (void)
+{
+	pingobj_t *obj;
+	pinghost_t *hosts[TEST_TOP_HOSTS];
+	double latencies[TEST_TOP_HOSTS];
+	pingobj_iter_t *top[3];
+	size_t top_num;
+	struct timeval now;
+	int i;
+
+	obj = ping_construct ();
+	CHECK (obj != NULL);
+	gettimeofday (&now, NULL);
+
+	for (i = 0; i < TEST_TOP_HOSTS; i++)
+		hosts[i] = test_host_add (obj, i + 1);
+
+	/* Hosts without results are not returned. */
+	top_num = 3;
+	CHECK (ping_get_top (obj, PING_TOP_LATENCY, top, &top_num) == 0);
+	CHECK (top_num == 0);
+	CHECK (ping_get_top (obj, PING_TOP_NUM, top, &top_num) == EINVAL);
+
+	/* Distinct latencies in a scrambled order. The heap has been built
+	 * above, so these go through ping_heap_update(). */
+	for (i = 0; i < TEST_TOP_HOSTS; i++)
+	{
+		latencies[i] = (double) ((i * 37) % TEST_TOP_HOSTS) + 1.0;
+		ping_host_reply (obj, hosts[i], latencies[i], &now);
+	}
+	test_top_check (obj, hosts, latencies, 10);
+	test_top_check (obj, hosts, latencies, TEST_TOP_HOSTS);
+
+	/* Hosts moving down and up the heap */
+	for (i = 0; i < TEST_TOP_HOSTS; i += 3)
+	{
+		latencies[i] = (double) TEST_TOP_HOSTS + 1.0 - latencies[i] + 0.5;
+		ping_host_reply (obj, hosts[i], latencies[i], &now);
+	}
+	test_top_check (obj, hosts, latencies, 10);
+	test_top_check (obj, hosts, latencies, TEST_TOP_HOSTS);
+
+	/* A host whose last echo request timed out is the worst one, and
+	 * the only one with a loss. */
+	ping_host_timeout (obj, hosts[42], &now);
+	top_num = 2;
+	CHECK (ping_get_top (obj, PING_TOP_LATENCY, top, &top_num) == 0);
+	CHECK ((top_num == 2) && (top[0] == hosts[42]));
+	top_num = 3;
+	CHECK (ping_get_top (obj, PING_TOP_LOSS, top, &top_num) == 0);
+	CHECK (top_num == 3);
+	CHECK (top[0] == hosts[42]);
+
+	/* ... until it replies again. */
+	latencies[42] = 0.25;
+	ping_host_reply (obj, hosts[42], latencies[42], &now);
+	test_top_check (obj, hosts, latencies, 10);
+
+	ping_destroy (obj);
+} /* void test_top */
+
+/*
+ * Changed hosts, see ping_iterator_get_changed(3).
+ */
+static uint32_t test_changed_get (pingobj_t *obj, pinghost_t *ph)
+{
+	pingobj_iter_t *iter;
+	uint32_t changes = 0;
+	size_t changes_size = sizeof (changes);
+
+	for (iter = ping_iterator_get_changed (obj); iter != NULL;
+			iter = ping_iterator_next_changed (iter))
+		if (iter == ph)
+			CHECK (ping_iterator_get_info (iter, PING_INFO_CHANGES,
+						&changes, &changes_size) == 0);
+
+	return (changes);
+}
+
+static void test_changed (void)
+{
+	pingobj_t *obj;
+	pinghost_t *up;
+	pinghost_t *down;
+	struct timeval now;
+
+	obj = ping_construct ();
+	CHECK (obj != NULL);
+	gettimeofday (&now, NULL);
+	up = test_host_add (obj, 1);
+	down = test_host_add (obj, 2);
+
+	/* The first result is always a change, but a host which never
+	 * replied did not time out after a reply. */
+	ping_host_reply (obj, up, 1.0, &now);
+	ping_host_timeout (obj, down, &now);
+	CHECK (test_changed_get (obj, up) == PING_CHANGE_UP);
+	CHECK (test_changed_get (obj, down) == PING_CHANGE_DOWN);
+	ping_changed_clear (obj);
+
+	/* Steady hosts are not changes, neither are hosts which stay down. */
+	ping_host_reply (obj, up, 1.0, &now);
+	ping_host_timeout (obj, down, &now);
+	CHECK (ping_iterator_get_changed (obj) == NULL);
+	ping_changed_clear (obj);
+
+	/* A host which stops replying is flagged once ... */
+	ping_host_timeout (obj, up, &now);
+	CHECK (test_changed_get (obj, up)
+			== (PING_CHANGE_DOWN | PING_CHANGE_TIMEOUT));
+	ping_changed_clear (obj);
+
+	/* ... and further timeouts are only counted. */
+	ping_host_timeout (obj, up, &now);
+	ping_host_timeout (obj, up, &now);
+	CHECK (ping_iterator_get_changed (obj) == NULL);
+	CHECK (up->dropped == 3);
+	ping_changed_clear (obj);
+
+	ping_host_reply (obj, down, 1.0, &now);
+	CHECK (test_changed_get (obj, down) == PING_CHANGE_UP);
+
+	ping_destroy (obj);
+} /* void test_changed */
+
+/*
+ * Sequence locks, see ping_snapshot_foreach(3).
+ */
+#define TEST_SNAPSHOT_HOSTS  16
+#define TEST_SNAPSHOT_ROUNDS 20000
+
+struct test_snapshot
+{
+	pingobj_t *obj;
+	pinghost_t *hosts[TEST_SNAPSHOT_HOSTS];
+	int done;
+	double last[TEST_SNAPSHOT_HOSTS];
+};
+
+/* The writer sets the latency, sequence and number of dropped packets of
+ * each host to the number of the round, and adds and removes a host in
+ * every round, so that the list and the removed host are replaced while the
+ * reader uses them. */
+static void *test_snapshot_writer (void *arg)
+{
+	struct test_snapshot *ts = arg;
+	int round;
+	int i;
+
+	for (round = 1; round <= TEST_SNAPSHOT_ROUNDS; round++)
+	{
+		for (i = 0; i < TEST_SNAPSHOT_HOSTS; i++)
+		{
+			pinghost_t *ph = ts->hosts[i];
+
+			ph->latency = (double) round;
+			ph->sequence = round;
+			ph->dropped = (uint32_t) round;
+			ping_host_publish (ph);
+		}
+
+		if ((round % 2) == 0)
+			CHECK (ping_host_remove (ts->obj, "127.0.0.200") == 0);
+		else
+			test_host_add (ts->obj, 200);
+		ping_snapshot_publish (ts->obj);
+	}
+
+	__atomic_store_n (&ts->done, 1, __ATOMIC_RELEASE);
+	return (NULL);
+} /* void *test_snapshot_writer */
+
+/* The reader checks that each result is from a single round, and that
+ * results do not go back to earlier rounds. */
+static int test_snapshot_read (const char *hostname, const char *address,
+		const ping_result_t *result, void *user_data)
+{
+	struct test_snapshot *ts = user_data;
+
+	/* The host added and removed by the writer is the last one. */
+	if (result->index >= TEST_SNAPSHOT_HOSTS)
+	{
+		CHECK (strcmp (hostname, "127.0.0.200") == 0);
+		return (0);
+	}
+
+	CHECK (strcmp (address, "127.0.0.200") != 0);
+	CHECK (result->status == PING_RESULT_REPLY);
+	CHECK (result->sequence == (unsigned int) result->latency);
+	CHECK (result->dropped == (uint32_t) result->latency);
+	CHECK (result->latency >= ts->last[result->index]);
+	ts->last[result->index] = result->latency;
+
+	return (0);
+} /* int test_snapshot_read */
+
+static void test_snapshot (void)
+{
+	struct test_snapshot ts;
+	pthread_t writer;
+	unsigned int first;
+	unsigned int second;
+	int i;
+
+	memset (&ts, 0, sizeof (ts));
+	ts.obj = ping_construct ();
+	CHECK (ts.obj != NULL);
+
+	for (i = 0; i < TEST_SNAPSHOT_HOSTS; i++)
+	{
+		ts.hosts[i] = test_host_add (ts.obj, i + 1);
+		ts.hosts[i]->latency = 0.0;
+		ping_host_publish (ts.hosts[i]);
+	}
+	ping_snapshot_publish (ts.obj);
+
+	CHECK (pthread_create (&writer, NULL, test_snapshot_writer, &ts) == 0);
+	while (!__atomic_load_n (&ts.done, __ATOMIC_ACQUIRE))
+		CHECK (ping_snapshot_foreach (ts.obj, test_snapshot_read,
+					&ts) == 0);
+	pthread_join (writer, NULL);
+
+	CHECK (ping_snapshot_foreach (ts.obj, test_snapshot_read, &ts) == 0);
+	for (i = 0; i < TEST_SNAPSHOT_HOSTS; i++)
+		CHECK (ts.last[i] == (double) TEST_SNAPSHOT_ROUNDS);
+
+	/* Removed hosts are freed once the readers that started before they
+	 * were removed are done. Readers that started later, while the
+	 * others were still reading, do not delay this. */
+	first = ping_snapshot_enter (ts.obj);
+	CHECK (ping_host_remove (ts.obj, "127.0.0.1") == 0);
+	ping_snapshot_publish (ts.obj);
+	CHECK (ts.obj->retired_wait.hosts == ts.hosts[0]);
+
+	second = ping_snapshot_enter (ts.obj);
+	CHECK (second != first);
+	ping_snapshot_leave (ts.obj, first);
+	CHECK (ping_host_remove (ts.obj, "127.0.0.2") == 0);
+	ping_snapshot_publish (ts.obj);
+	CHECK (ts.obj->retired_wait.hosts == ts.hosts[1]);
+	CHECK (ts.obj->retired.hosts == NULL);
+
+	ping_snapshot_leave (ts.obj, second);
+	ping_snapshot_publish (ts.obj);
+	CHECK (ts.obj->retired_wait.hosts == NULL);
+	CHECK (ts.obj->retired_wait.snapshots == NULL);
+
+	/* Without readers, everything is freed right away. */
+	CHECK (ping_host_remove (ts.obj, "127.0.0.3") == 0);
+	ping_snapshot_publish (ts.obj);
+	CHECK (ts.obj->retired_wait.hosts == NULL);
+	CHECK (ts.obj->retired.hosts == NULL);
+
+	ping_destroy (ts.obj);
+} /* void test_snapshot */
+
+/*
+ * Event ring, see ping_event_read(3).
+ */
+#define TEST_EVENT_NUM 100000
+
+struct test_event
+{
+	pingobj_t *obj;
+	pinghost_t *ph;
+};
+
+/* The producer pushes events with increasing sequence numbers. */
+static void *test_event_producer (void *arg)
+{
+	struct test_event *te = arg;
+	int i;
+
+	for (i = 1; i <= TEST_EVENT_NUM; i++)
+	{
+		te->ph->sequence = i;
+		ping_event_push (te->obj, te->ph, (double) i);
+	}
+
+	return (NULL);
+} /* void *test_event_producer */
+
+static void test_event (void)
+{
+	pingobj_t *obj;
+	pinghost_t *ph;
+	struct timeval now;
+	ping_event_t events[8];
+	struct test_event te;
+	pthread_t producer;
+	uint64_t read_num;
+	unsigned int last;
+	int context;
+	int size;
+	int i;
+
+	obj = ping_construct ();
+	CHECK (obj != NULL);
+	gettimeofday (&now, NULL);
+
+	/* Without a ring, nothing is recorded. */
+	CHECK (ping_event_read (obj, events, 8) == 0);
+	CHECK (ping_event_read (NULL, events, 8) == -1);
+	size = -1;
+	CHECK (ping_setopt (obj, PING_OPT_EVENT_RING, &size) == -1);
+
+	/* The size is rounded up to four. */
+	size = 3;
+	CHECK (ping_setopt (obj, PING_OPT_EVENT_RING, &size) == 0);
+	CHECK (obj->events_size == 4);
+
+	ph = test_host_add (obj, 1);
+	test_host_add (obj, 2);
+	ping_iterator_set_context (ph, &context);
+	*ph->timer = now;
+
+	/* Two events fit after the first four have been read. */
+	for (i = 1; i <= 6; i++)
+	{
+		ph->sequence = i;
+		if (i == 3)
+			ping_host_timeout (obj, ph, &now);
+		else
+			ping_host_reply (obj, ph, (double) i, &now);
+	}
+	CHECK (ping_event_overflow (obj) == 2);
+
+	CHECK (ping_event_read (obj, events, 3) == 3);
+	CHECK (ping_event_read (obj, events + 3, 8) == 1);
+	for (i = 0; i < 4; i++)
+	{
+		CHECK (events[i].index == ph->index);
+		CHECK (events[i].sequence == (unsigned int) i + 1);
+		CHECK (events[i].context == &context);
+		CHECK (timercmp (&events[i].send_time, &now, ==));
+		CHECK (events[i].latency == ((i == 2) ? -1.0 : (double) i + 1));
+	}
+
+	for (i = 7; i <= 9; i++)
+	{
+		ph->sequence = i;
+		ping_host_reply (obj, ph, (double) i, &now);
+	}
+	CHECK (ping_event_read (obj, events, 8) == 3);
+	CHECK ((events[0].sequence == 7) && (events[2].sequence == 9));
+	CHECK (ping_event_read (obj, events, 8) == 0);
+	CHECK (ping_event_overflow (obj) == 2);
+
+	/* Requests which could not be sent have no timer, so their timeout
+	 * is reported at the start of the round. */
+	obj->events_round = now;
+	obj->events_round.tv_sec -= 1;
+	timerclear (ph->timer);
+	ping_host_timeout (obj, ph, &now);
+	CHECK (ping_event_read (obj, events, 8) == 1);
+	CHECK (timercmp (&events[0].send_time, &obj->events_round, ==));
+	CHECK (events[0].latency == -1.0);
+
+	/* With a concurrent producer, events are read in order and each one
+	 * is either read or counted as an overflow. */
+	size = 64;
+	CHECK (ping_setopt (obj, PING_OPT_EVENT_RING, &size) == 0);
+	te.obj = obj;
+	te.ph = ph;
+	read_num = 0;
+	last = 0;
+
+	CHECK (pthread_create (&producer, NULL, test_event_producer, &te) == 0);
+	while (last < TEST_EVENT_NUM)
+	{
+		int num = ping_event_read (obj, events, 8);
+
+		for (i = 0; i < num; i++)
+		{
+			CHECK (events[i].sequence > last);
+			CHECK (events[i].latency == (double) events[i].sequence);
+			last = events[i].sequence;
+		}
+		read_num += (uint64_t) num;
+
+		/* The last event may have been dropped. */
+		if ((num == 0) && ((read_num + ping_event_overflow (obj) - 2)
+					== TEST_EVENT_NUM))
+			break;
+	}
+	pthread_join (producer, NULL);
+
+	read_num += (uint64_t) ping_event_read (obj, events, 8);
+	CHECK (read_num + ping_event_overflow (obj) - 2 == TEST_EVENT_NUM);
+
+	ping_destroy (obj);
+} /* void test_event */
+
+/*
+ * Networks, see ping_host_add_range(3) and ping_sweep(3).
+ */
+/* test_network_address checks that address "index" of "network" is
+ * "expected". */
+static void test_network_address (pingobj_t *obj, const char *network,
+		uint32_t index, const char *expected)
+{
+	struct ping_network net;
+	struct sockaddr_storage sa;
+	socklen_t sa_len;
+	char buffer[PING_ADDRSTR_LEN];
+
+	CHECK (ping_network_parse (obj, "test", network, 32, &net) == 0);
+	sa_len = ping_network_address (&net, index, &sa);
+	CHECK (getnameinfo ((struct sockaddr *) &sa, sa_len,
+				buffer, sizeof (buffer), NULL, 0,
+				NI_NUMERICHOST) == 0);
+	CHECK (strcmp (buffer, expected) == 0);
+} /* void test_network_address */
+
+static void test_network (void)
+{
+	struct ping_network net;
+	pingobj_t *obj;
+	int af;
+
+	obj = ping_construct ();
+	CHECK (obj != NULL);
+
+	/* Host bits of the base are cleared. */
+	CHECK (ping_network_parse (obj, "test", "192.0.2.77/24", 24, &net) == 0);
+	CHECK (net.family == AF_INET);
+	CHECK (net.base.addr4.s_addr == htonl (0xc0000200));
+	CHECK (net.size == 256);
+
+	CHECK (ping_network_parse (obj, "test", "10.1.2.3/8", 24, &net) == 0);
+	CHECK (net.size == (((uint64_t) 1) << 24));
+	CHECK (ping_network_parse (obj, "test", "0.0.0.0/0", 32, &net) == 0);
+	CHECK (net.size == (((uint64_t) 1) << 32));
+	CHECK (net.base.addr4.s_addr == 0);
+	CHECK (ping_network_parse (obj, "test", "192.0.2.1/32", 24, &net) == 0);
+	CHECK (net.size == 1);
+
+	/* Only the last 32 bits of IPv6 addresses vary. */
+	CHECK (ping_network_parse (obj, "test", "2001:db8::1234:5678/112", 24,
+				&net) == 0);
+	CHECK (net.family == AF_INET6);
+	CHECK (net.size == 65536);
+	CHECK ((net.base.addr6.s6_addr[13] == 0x34)
+			&& (net.base.addr6.s6_addr[14] == 0)
+			&& (net.base.addr6.s6_addr[15] == 0));
+	CHECK (ping_network_parse (obj, "test", "2001:db8::/96", 32, &net) == 0);
+	CHECK (net.size == (((uint64_t) 1) << 32));
+	CHECK (ping_network_parse (obj, "test", "2001:db8::/128", 24, &net) == 0);
+	CHECK (net.size == 1);
+
+	/* Invalid networks */
+	CHECK (ping_network_parse (obj, "test", "10.0.0.0/7", 24, &net) == -1);
+	CHECK (strcmp (ping_get_error (obj),
+				"test: Prefix length must be between 8 and 32") == 0);
+	CHECK (ping_network_parse (obj, "test", "2001:db8::/95", 32, &net) == -1);
+	CHECK (ping_network_parse (obj, "test", "192.0.2.0/33", 24, &net) == -1);
+	CHECK (ping_network_parse (obj, "test", "192.0.2.0/-1", 24, &net) == -1);
+	CHECK (ping_network_parse (obj, "test", "192.0.2.0", 24, &net) == -1);
+	CHECK (ping_network_parse (obj, "test", "192.0.2.0/", 24, &net) == -1);
+	CHECK (ping_network_parse (obj, "test", "192.0.2.0/24x", 24, &net) == -1);
+	CHECK (ping_network_parse (obj, "test", "localhost/24", 24, &net) == -1);
+
+	/* Addresses in the network */
+	test_network_address (obj, "192.0.2.0/24", 0, "192.0.2.0");
+	test_network_address (obj, "192.0.2.0/24", 255, "192.0.2.255");
+	test_network_address (obj, "10.0.0.0/8", 0x010203, "10.1.2.3");
+	test_network_address (obj, "2001:db8::1234:0/112", 0xffff,
+			"2001:db8::1234:ffff");
+	test_network_address (obj, "2001:db8::/96", 0x01020304,
+			"2001:db8::102:304");
+
+	/* The address family must match PING_OPT_AF. */
+	af = AF_INET6;
+	CHECK (ping_setopt (obj, PING_OPT_AF, &af) == 0);
+	CHECK (ping_network_parse (obj, "test", "192.0.2.0/24", 24, &net) == -1);
+	CHECK (ping_network_parse (obj, "test", "2001:db8::/120", 24, &net) == 0);
+
+	ping_destroy (obj);
+} /* void test_network */
+
+/*
+ * Adding hosts by address and by numeric name, see ping_host_add(3).
+ */
+static void test_host (void)
+{
+	struct sockaddr_in sa;
+	ping_range_t *range;
+	pinghost_t *ph;
+	pingobj_t *obj;
+	char name[32];
+	int af;
+	int i;
+
+	obj = ping_construct ();
+	CHECK (obj != NULL);
+
+	/* Numeric addresses are recognized without getaddrinfo(). */
+	ph = ping_alloc ();
+	CHECK (ph != NULL);
+	CHECK (ping_host_numeric (AF_UNSPEC, "192.0.2.1", ph));
+	CHECK ((ph->addrfamily == AF_INET)
+			&& (ph->addrlen == sizeof (struct sockaddr_in)));
+	CHECK (ping_host_numeric (AF_UNSPEC, "2001:db8::1", ph));
+	CHECK ((ph->addrfamily == AF_INET6)
+			&& (ph->addrlen == sizeof (struct sockaddr_in6)));
+	CHECK (!ping_host_numeric (AF_INET6, "192.0.2.1", ph));
+	CHECK (!ping_host_numeric (AF_INET, "2001:db8::1", ph));
+	CHECK (!ping_host_numeric (AF_UNSPEC, "127.1", ph));
+	CHECK (!ping_host_numeric (AF_UNSPEC, "fe80::1%lo", ph));
+	CHECK (!ping_host_numeric (AF_UNSPEC, "localhost", ph));
+	ping_free (ph);
+
+	/* Addresses must be complete and of the family set with
+	 * PING_OPT_AF. */
+	memset (&sa, 0, sizeof (sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl (0x7f000001);
+	CHECK (ping_host_add_addr (obj, (struct sockaddr *) &sa,
+				sizeof (sa) - 1, NULL) == NULL);
+	sa.sin_family = AF_UNIX;
+	CHECK (ping_host_add_addr (obj, (struct sockaddr *) &sa,
+				sizeof (sa), NULL) == NULL);
+	sa.sin_family = AF_INET;
+	af = AF_INET6;
+	CHECK (ping_setopt (obj, PING_OPT_AF, &af) == 0);
+	CHECK (ping_host_add_addr (obj, (struct sockaddr *) &sa,
+				sizeof (sa), NULL) == NULL);
+	af = AF_UNSPEC;
+	CHECK (ping_setopt (obj, PING_OPT_AF, &af) == 0);
+	CHECK (ping_iterator_count (obj) == 0);
+
+	/* Hosts added by address are named by it or by their label, and
+	 * adding them again by name does nothing. */
+	ph = ping_host_add_addr (obj, (struct sockaddr *) &sa, sizeof (sa),
+			"label");
+	CHECK ((ph != NULL) && (strcmp (ph->username, "label") == 0));
+	for (i = 1; i <= 100; i++)
+		test_host_add (obj, i);
+	CHECK (obj->names.slots == NULL);
+	CHECK (ping_host_add (obj, "LABEL") == 0);
+	CHECK (obj->names.slots != NULL);
+	for (i = 1; i <= 100; i++)
+	{
+		snprintf (name, sizeof (name), "127.0.0.%i", i);
+		CHECK (ping_host_add (obj, name) == 0);
+	}
+	CHECK (ping_iterator_count (obj) == 101);
+
+	/* The table of names grows and follows removals. */
+	for (i = 101; i <= 200; i++)
+	{
+		snprintf (name, sizeof (name), "127.0.0.%i", i);
+		CHECK (ping_host_add (obj, name) == 0);
+	}
+	for (i = 1; i <= 200; i += 2)
+	{
+		snprintf (name, sizeof (name), "127.0.0.%i", i);
+		CHECK (ping_host_remove (obj, name) == 0);
+	}
+	CHECK (ping_iterator_count (obj) == 101);
+	for (i = 1; i <= 200; i++)
+	{
+		snprintf (name, sizeof (name), "127.0.0.%i", i);
+		CHECK (ping_host_add (obj, name) == 0);
+	}
+	CHECK (ping_iterator_count (obj) == 201);
+	CHECK (2 * obj->names.used <= obj->names.size);
+
+	/* A target may be added once more per source. */
+	CHECK (ping_host_setopt (obj, "127.0.0.7", PING_OPT_SOURCE,
+				"127.0.0.1") == 0);
+	CHECK (ping_host_add (obj, "127.0.0.7") == 0);
+	CHECK (ping_host_add (obj, "127.0.0.7") == 0);
+	CHECK (ping_iterator_count (obj) == 202);
+
+	/* Hosts of ranges are found by their address. */
+	range = ping_host_add_range (obj, "127.1.0.0/30");
+	CHECK (range != NULL);
+	CHECK (ping_host_add (obj, "127.1.0.2") == 0);
+	CHECK (ping_iterator_count (obj) == 206);
+	CHECK (ping_range_get_host (range, 1)->addrstr == ping_range_unnamed);
+	CHECK (ping_host_remove (obj, "127.1.0.2") == 0);
+	CHECK (ping_host_add (obj, "127.1.0.2") == 0);
+	CHECK (ping_iterator_count (obj) == 206);
+	ping_range_release (range);
+
+	ping_destroy (obj);
+} /* void test_host */
+
+/* test_range_reply passes an echo reply with identifier "ident" and sequence
+ * number "seq" from "src", an IPv4 address in host byte order, to
+ * ping_receive_ipv4(). */
+static pinghost_t *test_range_reply (pingobj_t *obj, uint32_t src,
+		uint16_t ident, uint16_t seq)
+{
+	union
+	{
+		struct ip ip_hdr;
+		char      raw[sizeof (struct ip) + ICMP_MINLEN];
+	} buf;
+	struct icmp *icmp_hdr = (struct icmp *) (buf.raw + sizeof (struct ip));
+
+	memset (&buf, 0, sizeof (buf));
+	buf.ip_hdr.ip_v = 4;
+	buf.ip_hdr.ip_hl = sizeof (struct ip) >> 2;
+	buf.ip_hdr.ip_src.s_addr = htonl (src);
+	icmp_hdr->icmp_type = ICMP_ECHOREPLY;
+	icmp_hdr->icmp_id = htons (ident);
+	icmp_hdr->icmp_seq = htons (seq);
+	icmp_hdr->icmp_cksum = ping_icmp4_checksum ((char *) icmp_hdr,
+			ICMP_MINLEN);
+
+	return (ping_receive_ipv4 (obj, buf.raw, sizeof (buf), sizeof (buf),
+				NULL));
+} /* pinghost_t *test_range_reply */
+
+/*
+ * Ranges, see ping_host_add_range(3).
+ */
+static void test_range (void)
+{
+	ping_range_t *range4;
+	ping_range_t *range6;
+	pinghost_t *ph;
+	struct in6_addr addr6;
+	char buffer[PING_ADDRSTR_LEN];
+	size_t buffer_len;
+	uint16_t ident;
+	pingobj_t *obj;
+
+	obj = ping_construct ();
+	CHECK (obj != NULL);
+
+	CHECK (ping_host_add_range (obj, "10.0.0.0/11") == NULL);
+	CHECK (strcmp (ping_get_error (obj), "ping_host_add_range: "
+				"Prefix length must be between 12 and 32") == 0);
+
+	test_host_add (obj, 1);
+	range4 = ping_host_add_range (obj, "127.1.0.0/28");
+	CHECK (range4 != NULL);
+	range6 = ping_host_add_range (obj, "2001:db8::100/120");
+	CHECK (range6 != NULL);
+	CHECK (ping_iterator_count (obj) == 1 + 16 + 256);
+	CHECK (ping_range_get_host (range4, 16) == NULL);
+
+	/* Addresses are derived from the index, names formatted lazily. */
+	ph = ping_range_get_host (range4, 3);
+	CHECK ((ph != NULL) && (ph->addr == NULL));
+	CHECK ((ph != NULL) && (ph->addrstr[0] == 0));
+	buffer_len = sizeof (buffer);
+	CHECK (ping_iterator_get_info (ph, PING_INFO_ADDRESS, buffer,
+				&buffer_len) == 0);
+	CHECK (strcmp (buffer, "127.1.0.3") == 0);
+	buffer_len = sizeof (buffer);
+	CHECK (ping_iterator_get_info (ph, PING_INFO_USERNAME, buffer,
+				&buffer_len) == 0);
+	CHECK (strcmp (buffer, "127.1.0.3") == 0);
+	CHECK (strcmp (ping_host_name (ping_range_get_host (range6, 0xab)),
+				"2001:db8::1ab") == 0);
+
+	/* Hosts of a range share its identifier and are matched by their
+	 * address instead of being entered into the hash table. */
+	ident = (uint16_t) range4->ident;
+	CHECK (range4->hosts[15].ident == range4->ident);
+	for (ph = obj->table[ident % PING_TABLE_LEN]; ph != NULL;
+			ph = ph->table_next)
+		CHECK (ph->range == NULL);
+	CHECK (ping_range_lookup (obj, AF_INET, ident,
+				&(struct in_addr) { htonl (0x7f01000f) })
+			== range4->hosts + 15);
+	CHECK (ping_range_lookup (obj, AF_INET, ident,
+				&(struct in_addr) { htonl (0x7f010010) }) == NULL);
+	CHECK (ping_range_lookup (obj, AF_INET, ident,
+				&(struct in_addr) { htonl (0x7f00000f) }) == NULL);
+	CHECK (ping_range_lookup (obj, AF_INET, (uint16_t) (ident + 1),
+				&(struct in_addr) { htonl (0x7f01000f) }) == NULL);
+	CHECK (ping_range_lookup (obj, AF_INET6, ident,
+				&(struct in_addr) { htonl (0x7f01000f) }) == NULL);
+
+	inet_pton (AF_INET6, "2001:db8::1ff", &addr6);
+	CHECK (ping_range_lookup (obj, AF_INET6, (uint16_t) range6->ident,
+				&addr6) == range6->hosts + 255);
+	inet_pton (AF_INET6, "2001:db9::1ff", &addr6);
+	CHECK (ping_range_lookup (obj, AF_INET6, (uint16_t) range6->ident,
+				&addr6) == NULL);
+
+	/* Only replies to the last echo request are matched. */
+	ph = range4->hosts + 9;
+	ph->sequence = 5;
+	gettimeofday (ph->timer, NULL);
+	CHECK (test_range_reply (obj, 0x7f010009, ident, 4) == ph);
+	CHECK (test_range_reply (obj, 0x7f010009, ident, 3) == NULL);
+	CHECK (test_range_reply (obj, 0x7f010008, ident, 4) == NULL);
+	timerclear (ph->timer);
+	CHECK (test_range_reply (obj, 0x7f010009, ident, 4) == NULL);
+
+	/* Removed hosts are neither returned nor matched. */
+	gettimeofday (ph->timer, NULL);
+	CHECK (ping_host_remove (obj, "127.1.0.9") == 0);
+	CHECK (ping_range_get_host (range4, 9) == NULL);
+	CHECK (ping_range_get_host (range4, 8) != NULL);
+	CHECK (test_range_reply (obj, 0x7f010009, ident, 4) == NULL);
+	CHECK (ping_iterator_count (obj) == 1 + 15 + 256);
+
+	CHECK (ping_host_remove_range (obj, range4) == 0);
+	CHECK (ping_range_get_host (range4, 8) == NULL);
+	CHECK (ping_iterator_count (obj) == 1 + 256);
+	CHECK ((obj->ranges == range6) && (range6->next == NULL));
+	CHECK (ping_host_remove_range (obj, range4) == -1);
+	ping_range_release (range4);
+
+	/* The hosts outlive the handle. */
+	ping_range_release (range6);
+	CHECK (ping_iterator_count (obj) == 1 + 256);
+
+	ping_destroy (obj);
+} /* void test_range */
+
+/*
+ * Responders of groups, see PING_OPT_RESPONDERS in ping_host_setopt(3).
+ */
+#define TEST_RESPONDERS_NUM 1000
+
+static void test_responders (void)
+{
+	pingobj_t *obj;
+	pinghost_t *ph;
+	ping_responder_t responders[3];
+	size_t responders_num;
+	struct in_addr addr4;
+	struct in6_addr addr6;
+	struct timeval now;
+	int enable = 1;
+	uint32_t i;
+
+	obj = ping_construct ();
+	CHECK (obj != NULL);
+	ph = test_host_add (obj, 255);
+	CHECK (ping_host_setopt (obj, "127.0.0.255", PING_OPT_RESPONDERS,
+				&enable) == 0);
+	CHECK (ph->responders != NULL);
+
+	/* The first reply is the host's, the others only add responders,
+	 * each of them once. */
+	ph->latency = -1.0;
+	gettimeofday (ph->timer, NULL);
+	now = *ph->timer;
+	addr4.s_addr = htonl (0x0a000001);
+	CHECK (ping_receive_match (obj, ph, &now, AF_INET, &addr4) == 0);
+	CHECK (ping_receive_match (obj, ph, &now, AF_INET, &addr4) == 1);
+	now.tv_sec++;
+	for (i = 1; i <= TEST_RESPONDERS_NUM; i++)
+	{
+		addr4.s_addr = htonl (0x0a000000 | i);
+		CHECK (ping_receive_match (obj, ph, &now, AF_INET, &addr4) == 1);
+		CHECK (ping_receive_match (obj, ph, &now, AF_INET, &addr4) == 1);
+	}
+	CHECK (ph->responders->num == TEST_RESPONDERS_NUM);
+	CHECK (2 * ph->responders->num <= ph->responders->index_size);
+	CHECK (ph->received == 1);
+
+	/* Addresses of different families differ, even if their bytes do
+	 * not. Unknown sources are not recorded. */
+	memset (&addr6, 0, sizeof (addr6));
+	addr4.s_addr = htonl (0x0a000001);
+	memcpy (&addr6, &addr4, sizeof (addr4));
+	ping_responders_add (ph, AF_INET6, &addr6, 1.0);
+	ping_responders_add (ph, AF_INET6, &addr6, 2.0);
+	ping_responders_add (ph, AF_INET, NULL, 1.0);
+	CHECK (ph->responders->num == TEST_RESPONDERS_NUM + 1);
+
+	/* Responders are returned in the order of their first reply, with
+	 * the latency of that reply. */
+	CHECK (ping_iterator_get_responders (ph, NULL, &responders_num) == 0);
+	CHECK (responders_num == TEST_RESPONDERS_NUM + 1);
+	responders_num = 3;
+	CHECK (ping_iterator_get_responders (ph, responders,
+				&responders_num) == 0);
+	CHECK (responders_num == 3);
+	CHECK ((responders[0].family == AF_INET)
+			&& (strcmp (responders[0].address, "10.0.0.1") == 0)
+			&& (responders[0].latency == 0.0));
+	CHECK ((strcmp (responders[1].address, "10.0.0.2") == 0)
+			&& (responders[1].latency == 1000.0));
+
+	/* Each round starts over. */
+	ping_responders_clear (ph->responders);
+	CHECK (ping_iterator_get_responders (ph, NULL, &responders_num) == 0);
+	CHECK (responders_num == 0);
+	addr4.s_addr = htonl (0x0a000002);
+	ping_responders_add (ph, AF_INET, &addr4, 3.0);
+	ping_responders_add (ph, AF_INET, &addr4, 4.0);
+	CHECK (ph->responders->num == 1);
+	CHECK (ph->responders->entries[0].latency == 3.0);
+
+	enable = 0;
+	CHECK (ping_host_setopt (obj, "127.0.0.255", PING_OPT_RESPONDERS,
+				&enable) == 0);
+	CHECK (ph->responders == NULL);
+
+	ping_destroy (obj);
+} /* void test_responders */
+
+/*
+ * Payloads, see PING_OPT_DATA in ping_setopt(3).
+ */
+/* test_payload_valid checks the ICMP checksum of "buf" the way RFC 1071
+ * describes it, byte by byte. */
+static int test_payload_valid (const unsigned char *buf, size_t len)
+{
+	uint32_t sum = 0;
+	size_t i;
+
+	for (i = 0; i + 1 < len; i += 2)
+		sum += (uint32_t) ((buf[i] << 8) | buf[i + 1]);
+	if ((len % 2) != 0)
+		sum += (uint32_t) (buf[len - 1] << 8);
+	while ((sum >> 16) != 0)
+		sum = (sum >> 16) + (sum & 0xFFFF);
+
+	return (sum == 0xFFFF);
+} /* int test_payload_valid */
+
+/* test_payload_checksum checks that an echo request of the object's payload,
+ * whose checksum is completed from the sum computed when the payload was set,
+ * is valid. */
+static void test_payload_checksum (pingobj_t *obj, const char *data,
+		size_t len)
+{
+	ping_data_t binary = { data, len };
+	struct icmp *icmp4;
+	char *buf;
+
+	CHECK (ping_setopt (obj, PING_OPT_DATA_BINARY, &binary) == 0);
+	CHECK (obj->payload->len == len);
+
+	buf = calloc (1, ICMP_MINLEN + len);
+	CHECK (buf != NULL);
+	if (buf == NULL)
+		return;
+
+	icmp4 = (struct icmp *) buf;
+	icmp4->icmp_type = ICMP_ECHO;
+	icmp4->icmp_id = htons (0x1234);
+	icmp4->icmp_seq = htons (0xfedc);
+	memcpy (buf + ICMP_MINLEN, obj->payload->data, len);
+	icmp4->icmp_cksum = ping_checksum_fold (ping_checksum_add (
+				obj->payload->sum, buf, ICMP_MINLEN));
+	CHECK (test_payload_valid ((unsigned char *) buf, ICMP_MINLEN + len));
+
+	free (buf);
+} /* void test_payload_checksum */
+
+static void test_payload (void)
+{
+	pingobj_t *obj;
+	pinghost_t *ph1;
+	pinghost_t *ph2;
+	ping_payload_t *payload;
+	ping_data_t binary;
+	char *data;
+	size_t i;
+
+	obj = ping_construct ();
+	CHECK (obj != NULL);
+
+	/* Hosts share the payload of the object ... */
+	ph1 = test_host_add (obj, 1);
+	ph2 = test_host_add (obj, 2);
+	CHECK ((ph1->payload == obj->payload) && (ph2->payload == obj->payload));
+	CHECK (obj->payload->refcount == 3);
+
+	/* ... which outlives it, until the hosts get another one. */
+	payload = obj->payload;
+	CHECK (ping_setopt (obj, PING_OPT_DATA, "other") == 0);
+	CHECK (payload->refcount == 2);
+	CHECK (strcmp (obj->payload->data, "other") == 0);
+	CHECK (ping_host_setopt (obj, "127.0.0.1", PING_OPT_DATA, NULL) == 0);
+	CHECK (ph1->payload == obj->payload);
+	CHECK (ping_host_setopt (obj, "127.0.0.2", PING_OPT_DATA,
+				"own") == 0);
+	CHECK (strcmp (ph2->payload->data, "own") == 0);
+	CHECK (obj->payload->refcount == 2);
+
+	/* Payloads up to the maximum IP packet size are sent. */
+	data = malloc (PING_DATA_MAX + 1);
+	CHECK (data != NULL);
+	if (data == NULL)
+	{
+		ping_destroy (obj);
+		return;
+	}
+
+	/* All ones give the largest partial sum. */
+	memset (data, 0xFF, PING_DATA_MAX + 1);
+	test_payload_checksum (obj, data, PING_DATA_MAX);
+	for (i = 0; i < PING_DATA_MAX + 1; i++)
+		data[i] = (char) (i * 7 + 3);
+	test_payload_checksum (obj, data, 0);
+	test_payload_checksum (obj, data, 1);
+	test_payload_checksum (obj, data, 56);
+	test_payload_checksum (obj, data, 1473);
+	test_payload_checksum (obj, data, PING_DATA_MAX);
+
+	/* Larger ones are rejected. */
+	payload = obj->payload;
+	binary.data = data;
+	binary.data_len = PING_DATA_MAX + 1;
+	CHECK (ping_setopt (obj, PING_OPT_DATA_BINARY, &binary) == -1);
+	CHECK (strcmp (ping_get_error (obj), "ping_setopt: Payload "
+				"exceeds the maximum IP packet size") == 0);
+	CHECK (obj->payload == payload);
+
+	free (data);
+	ping_destroy (obj);
+} /* void test_payload */
+
+/*
+ * Control messages, see PING_OPT_TTL and PING_OPT_QOS in ping_setopt(3) and
+ * ping_host_setopt(3).
+ */
+/* test_control_find returns the data of the control message of "msghdr" with
+ * the given level and type, or NULL if there is none. */
+static const void *test_control_find (struct msghdr *msghdr, int level,
+		int type)
+{
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR (msghdr); cmsg != NULL;
+			cmsg = CMSG_NXTHDR (msghdr, cmsg))
+		if ((cmsg->cmsg_level == level) && (cmsg->cmsg_type == type))
+			return (CMSG_DATA (cmsg));
+
+	return (NULL);
+} /* const void *test_control_find */
+
+/* test_control_int checks that "msghdr" holds the int "expected" as control
+ * message of the given level and type. */
+static void test_control_int (struct msghdr *msghdr, int level, int type,
+		int expected)
+{
+	const void *data = test_control_find (msghdr, level, type);
+	int value;
+
+	CHECK (data != NULL);
+	if (data == NULL)
+		return;
+	memcpy (&value, data, sizeof (value));
+	CHECK (value == expected);
+} /* void test_control_int */
+
+static void test_control (void)
+{
+	pingobj_t *obj;
+	ping_transport_t *t;
+	pinghost_t *ph4;
+	pinghost_t *ph6;
+	struct sockaddr_in6 sa6;
+	struct msghdr msghdr;
+	union ping_sendto_buffer control;
+	char buffer[256];
+	struct timeval tv;
+	struct timeval pkt_now;
+	_Bool have_timestamp;
+	int recv_ttl;
+	uint8_t recv_qos;
+	uint8_t tos;
+	uint32_t drops;
+	int value;
+
+	obj = ping_construct ();
+	CHECK (obj != NULL);
+	ph4 = test_host_add (obj, 1);
+	memset (&sa6, 0, sizeof (sa6));
+	sa6.sin6_family = AF_INET6;
+	sa6.sin6_addr = in6addr_loopback;
+	ph6 = ping_host_add_addr (obj, (struct sockaddr *) &sa6, sizeof (sa6),
+			NULL);
+	CHECK (ph6 != NULL);
+
+	/* Without per-host settings, the options of the sockets apply. */
+	memset (&msghdr, 0, sizeof (msghdr));
+	ping_sendto_control (obj, ph4, &msghdr, &control);
+	CHECK (msghdr.msg_control == NULL);
+
+	/* Per-host settings are passed with each packet. */
+	value = 7;
+	CHECK (ping_host_setopt (obj, "127.0.0.1", PING_OPT_TTL, &value) == 0);
+	value = 0x28;
+	CHECK (ping_host_setopt (obj, "127.0.0.1", PING_OPT_QOS, &value) == 0);
+	ping_sendto_control (obj, ph4, &msghdr, &control);
+	CHECK (msghdr.msg_controllen == 2 * CMSG_SPACE (sizeof (int)));
+	test_control_int (&msghdr, IPPROTO_IP, IP_TTL, 7);
+	test_control_int (&msghdr, IPPROTO_IP, IP_TOS, 0x28);
+	CHECK (test_control_find (&msghdr, IPPROTO_IP, IP_PKTINFO) == NULL);
+
+	/* Shared sockets are left alone, so the object's TTL and QoS are
+	 * passed with each packet, too. */
+	t = ping_transport_create ();
+	CHECK (t != NULL);
+	CHECK (ping_setopt (obj, PING_OPT_TRANSPORT, t) == 0);
+	value = 3;
+	CHECK (ping_setopt (obj, PING_OPT_TTL, &value) == 0);
+	value = 0x10;
+	CHECK (ping_setopt (obj, PING_OPT_QOS, &value) == 0);
+	CHECK (ping_host_setopt (obj, "127.0.0.1", PING_OPT_TTL, NULL) == 0);
+	memset (&msghdr, 0, sizeof (msghdr));
+	ping_sendto_control (obj, ph4, &msghdr, &control);
+	test_control_int (&msghdr, IPPROTO_IP, IP_TTL, 3);
+	test_control_int (&msghdr, IPPROTO_IP, IP_TOS, 0x28);
+
+	memset (&msghdr, 0, sizeof (msghdr));
+	ping_sendto_control (obj, ph6, &msghdr, &control);
+	test_control_int (&msghdr, IPPROTO_IPV6, IPV6_HOPLIMIT, 3);
+	test_control_int (&msghdr, IPPROTO_IPV6, IPV6_TCLASS, 0x10);
+	CHECK (test_control_find (&msghdr, IPPROTO_IP, IP_TTL) == NULL);
+
+	/* The hop limit set for IPv6 hosts is read back from replies. */
+	ping_receive_control (obj, &msghdr, AF_INET6, &pkt_now,
+			&have_timestamp, &recv_ttl, &recv_qos);
+	CHECK ((recv_ttl == 3) && (recv_qos == 0x10));
+
+#if defined(IP_PKTINFO) && defined(IPV6_PKTINFO)
+	/* The interface of a host is passed as packet info. */
+	ph4->srcif = 2;
+	memset (&msghdr, 0, sizeof (msghdr));
+	ping_sendto_control (obj, ph4, &msghdr, &control);
+	CHECK (msghdr.msg_controllen <= sizeof (control));
+	CHECK (test_control_find (&msghdr, IPPROTO_IP, IP_PKTINFO) != NULL);
+	if (test_control_find (&msghdr, IPPROTO_IP, IP_PKTINFO) != NULL)
+	{
+		struct in_pktinfo pi;
+
+		memcpy (&pi, test_control_find (&msghdr, IPPROTO_IP,
+					IP_PKTINFO), sizeof (pi));
+		CHECK (pi.ipi_ifindex == 2);
+	}
+	ph4->srcif = 0;
+#endif
+
+	/* Control messages of replies: The TOS of IPv4 replies is a single
+	 * byte, the rest are ints. */
+	gettimeofday (&tv, NULL);
+	memset (buffer, 0, sizeof (buffer));
+	memset (&msghdr, 0, sizeof (msghdr));
+	msghdr.msg_control = buffer;
+	value = 42;
+	tos = 0xb8;
+	drops = 17;
+#ifdef SO_TIMESTAMP
+	ping_sendto_cmsg (&msghdr, SOL_SOCKET, SO_TIMESTAMP, &tv, sizeof (tv));
+#endif
+#ifdef SO_RXQ_OVFL
+	ping_sendto_cmsg (&msghdr, SOL_SOCKET, SO_RXQ_OVFL, &drops,
+			sizeof (drops));
+#endif
+	ping_sendto_cmsg (&msghdr, IPPROTO_IP, IP_TTL, &value, sizeof (value));
+	ping_sendto_cmsg (&msghdr, IPPROTO_IP, IP_TOS, &tos, sizeof (tos));
+	CHECK (msghdr.msg_controllen <= sizeof (buffer));
+
+	have_timestamp = 0;
+	ping_receive_control (obj, &msghdr, AF_INET, &pkt_now,
+			&have_timestamp, &recv_ttl, &recv_qos);
+	CHECK ((recv_ttl == 42) && (recv_qos == 0xb8));
+#ifdef SO_TIMESTAMP
+	CHECK (have_timestamp && timercmp (&pkt_now, &tv, ==));
+#endif
+#ifdef SO_RXQ_OVFL
+	CHECK ((obj->drops4 == 17) && (obj->drops6 == 0));
+#endif
+
+	/* Messages of the other protocol are ignored. */
+	ping_receive_control (obj, &msghdr, AF_INET6, &pkt_now,
+			&have_timestamp, &recv_ttl, &recv_qos);
+	CHECK ((recv_ttl == -1) && (recv_qos == 0));
+#ifdef SO_RXQ_OVFL
+	CHECK (obj->drops6 == 17);
+#endif
+
+	/* Without control messages, the TTL is unknown. */
+	msghdr.msg_control = NULL;
+	msghdr.msg_controllen = 0;
+	have_timestamp = 0;
+	ping_receive_control (obj, &msghdr, AF_INET, &pkt_now,
+			&have_timestamp, &recv_ttl, &recv_qos);
+	CHECK ((recv_ttl == -1) && (recv_qos == 0) && !have_timestamp);
+
+	ping_destroy (obj);
+	ping_transport_destroy (t);
+} /* void test_control */
+
+#if HAVE_XDP
+/*
+ * AF_XDP frames, see PING_OPT_XDP in ping_setopt(3).
+ */
+static void test_xdp (void)
+{
+	static const unsigned char host_mac[ETH_ALEN] = { 2, 0, 0, 0, 0, 1 };
+	static const unsigned char src_mac[ETH_ALEN] = { 2, 0, 0, 0, 0, 2 };
+	struct ping_xdp xdp;
+	pingobj_t *obj;
+	pinghost_t *ph;
+	/* The IP header is aligned like in the UMEM with NET_IP_ALIGN. */
+	union
+	{
+		char buf[2 + 128];
+		uint32_t align;
+	} buffer;
+	char *frame = buffer.buf + 2;
+	struct ip *ip_hdr = (struct ip *) (frame + ETH_HLEN);
+	struct icmp *icmp4 = (struct icmp *) (ip_hdr + 1);
+	struct in_addr addr;
+	struct timeval now;
+	size_t len;
+	int value;
+
+	obj = ping_construct ();
+	CHECK (obj != NULL);
+	CHECK (ping_setopt (obj, PING_OPT_DATA, "xdp") == 0);
+	ph = test_host_add (obj, 9);
+	value = 0x28;
+	CHECK (ping_host_setopt (obj, "127.0.0.9", PING_OPT_QOS, &value) == 0);
+	memcpy (ph->xdp_mac, host_mac, ETH_ALEN);
+	ph->sequence = 5;
+
+	memset (&xdp, 0, sizeof (xdp));
+	memcpy (xdp.src_mac, src_mac, ETH_ALEN);
+	xdp.src_addr.s_addr = htonl (0x7f000002);
+	obj->xdp = &xdp;
+
+	/* An echo request with valid checksums, TTL and QoS set in the
+	 * header */
+	len = ETH_HLEN + sizeof (struct ip) + ICMP_MINLEN + 3;
+	memset (&buffer, 0xAA, sizeof (buffer));
+	ping_xdp_frame (obj, ph, frame, len);
+	CHECK (memcmp (frame, host_mac, ETH_ALEN) == 0);
+	CHECK (memcmp (frame + ETH_ALEN, src_mac, ETH_ALEN) == 0);
+	CHECK ((frame[12] == 0x08) && (frame[13] == 0x00));
+	CHECK ((ip_hdr->ip_v == 4) && (ip_hdr->ip_hl == 5));
+	CHECK (ntohs (ip_hdr->ip_len) == len - ETH_HLEN);
+	CHECK (ip_hdr->ip_ttl == PING_DEF_TTL);
+	CHECK (ip_hdr->ip_tos == 0x28);
+	CHECK (ip_hdr->ip_p == IPPROTO_ICMP);
+	CHECK (ip_hdr->ip_src.s_addr == htonl (0x7f000002));
+	CHECK (ip_hdr->ip_dst.s_addr == htonl (0x7f000009));
+	CHECK (test_payload_valid ((unsigned char *) ip_hdr, sizeof (*ip_hdr)));
+	CHECK (icmp4->icmp_type == ICMP_ECHO);
+	CHECK (ntohs (icmp4->icmp_id) == ph->ident);
+	CHECK (ntohs (icmp4->icmp_seq) == 5);
+	CHECK (memcmp (icmp4->icmp_data, "xdp", 3) == 0);
+	CHECK (test_payload_valid ((unsigned char *) icmp4,
+				ICMP_MINLEN + 3));
+
+	/* The reply to it, as the program passes it on, is matched. */
+	ph->sequence++;
+	gettimeofday (ph->timer, NULL);
+	now = *ph->timer;
+	addr = ip_hdr->ip_src;
+	ip_hdr->ip_src = ip_hdr->ip_dst;
+	ip_hdr->ip_dst = addr;
+	ip_hdr->ip_ttl = 61;
+	icmp4->icmp_type = ICMP_ECHOREPLY;
+
+	/* ... unless it is cut short or corrupted, ... */
+	CHECK (ping_xdp_receive (obj, frame, ETH_HLEN, &now) == 1);
+	CHECK (ping_xdp_receive (obj, frame, ETH_HLEN + sizeof (struct ip),
+				&now) == 1);
+	/* Verifying the checksum overwrites it. */
+	icmp4->icmp_cksum = 0;
+	icmp4->icmp_cksum = ping_icmp4_checksum ((char *) icmp4,
+			ICMP_MINLEN + 3) ^ 1;
+	CHECK (ping_xdp_receive (obj, frame, len, &now) == 1);
+	CHECK (ph->latency < 0.0);
+
+	icmp4->icmp_cksum = ping_icmp4_checksum ((char *) icmp4,
+			ICMP_MINLEN + 3);
+	CHECK (ping_xdp_receive (obj, frame, len, &now) == 0);
+	CHECK (ph->latency == 0.0);
+	CHECK (ph->recv_ttl == 61);
+	CHECK (ph->recv_qos == 0x28);
+
+	/* ... and only once. */
+	icmp4->icmp_cksum = ping_icmp4_checksum ((char *) icmp4,
+			ICMP_MINLEN + 3);
+	CHECK (ping_xdp_receive (obj, frame, len, &now) == 1);
+
+	obj->xdp = NULL;
+	ping_destroy (obj);
+} /* void test_xdp */
+#endif /* HAVE_XDP */
+
+/*
+ * Shared sockets, see PING_OPT_TRANSPORT in ping_setopt(3).
+ */
+#define TEST_TRANSPORT_ROUNDS 1000
+
+struct test_transport
+{
+	pingobj_t *obj;
+	struct ping_reply reply;
+	int done;
+};
+
+/* The forwarder passes replies on while the owner attaches and detaches. */
+static void *test_transport_forwarder (void *arg)
+{
+	struct test_transport *tt = arg;
+
+	while (!__atomic_load_n (&tt->done, __ATOMIC_ACQUIRE))
+		ping_transport_forward (tt->obj, &tt->reply);
+
+	return (NULL);
+} /* void *test_transport_forwarder */
+
+static void test_transport (void)
+{
+	ping_transport_t *t;
+	pingobj_t *obj1;
+	pingobj_t *obj2;
+	pinghost_t *ph1;
+	pinghost_t *ph2;
+	struct ping_reply reply;
+	struct test_transport tt;
+	pthread_t forwarder;
+	int ident;
+	int i;
+
+	t = ping_transport_create ();
+	CHECK (t != NULL);
+	obj1 = ping_construct ();
+	obj2 = ping_construct ();
+	CHECK ((obj1 != NULL) && (obj2 != NULL));
+
+	/* Identifiers are unique among the objects sharing the transport,
+	 * and taken by the first claim. */
+	ph1 = test_host_add (obj1, 1);
+	ph2 = test_host_add (obj2, 2);
+	ph2->ident = ph1->ident;
+	CHECK (ping_setopt (obj1, PING_OPT_TRANSPORT, t) == 0);
+	CHECK (ping_setopt (obj2, PING_OPT_TRANSPORT, t) == 0);
+	CHECK (ph1->ident != ph2->ident);
+	CHECK (t->idents[ph1->ident] == obj1);
+	CHECK (t->idents[ph2->ident] == obj2);
+	CHECK (ping_ident_claim (obj2, ph1->ident) != ph1->ident);
+
+	/* Only the owner releases an identifier. */
+	ident = ping_ident_claim (obj2, 0x1234);
+	ping_ident_release (obj1, ident);
+	CHECK (t->idents[ident] == obj2);
+	ping_ident_release (obj2, ident);
+	CHECK (t->idents[ident] == NULL);
+
+	/* Replies are forwarded to the owner of their identifier only. */
+	memset (&reply, 0, sizeof (reply));
+	reply.family = AF_INET;
+	reply.ident = (uint16_t) ph1->ident;
+	reply.recv_ttl = 42;
+	reply.data = "payload";
+	reply.data_len = reply.payload_len = 7;
+	ping_transport_forward (obj1, &reply);
+	CHECK (obj1->replies == NULL);
+	reply.ident = (uint16_t) ph2->ident;
+	ping_transport_forward (obj2, &reply);
+	CHECK (obj2->replies == NULL);
+	reply.ident = 0x4321;
+	ping_transport_forward (obj1, &reply);
+	CHECK (obj2->replies == NULL);
+
+	/* ... who matches them like its own. */
+	ph2->latency = -1.0;
+	ph2->sequence = 8;
+	gettimeofday (ph2->timer, NULL);
+	reply.time = *ph2->timer;
+	reply.ident = (uint16_t) ph2->ident;
+	reply.seq = 7;
+	memcpy (reply.from, &((struct sockaddr_in *) ph2->addr)->sin_addr, 4);
+	ping_transport_forward (obj1, &reply);
+	reply.seq = 6;
+	ping_transport_forward (obj1, &reply);
+	CHECK ((obj2->replies != NULL) && (obj2->replies->data != reply.data)
+			&& (memcmp (obj2->replies->data, "payload", 7) == 0));
+	CHECK (ping_transport_read (obj2) == 1);
+	CHECK (obj2->replies == NULL);
+	CHECK (ph2->latency == 0.0);
+	CHECK (ph2->recv_ttl == 42);
+
+	/* Detaching releases the identifiers, so no more replies are
+	 * forwarded. */
+	ident = ph2->ident;
+	CHECK (ping_setopt (obj2, PING_OPT_TRANSPORT, NULL) == 0);
+	CHECK (t->idents[ident] == NULL);
+	CHECK (obj2->wake_fd[0] == -1);
+	ping_transport_forward (obj1, &reply);
+	CHECK (obj2->replies == NULL);
+
+	/* An object may detach while replies are being forwarded to it. */
+	tt.obj = obj1;
+	tt.reply = reply;
+	tt.done = 0;
+	CHECK (pthread_create (&forwarder, NULL, test_transport_forwarder,
+				&tt) == 0);
+	for (i = 0; i < TEST_TRANSPORT_ROUNDS; i++)
+	{
+		CHECK (ping_setopt (obj2, PING_OPT_TRANSPORT, t) == 0);
+		CHECK (ping_setopt (obj2, PING_OPT_TRANSPORT, NULL) == 0);
+	}
+	__atomic_store_n (&tt.done, 1, __ATOMIC_RELEASE);
+	pthread_join (forwarder, NULL);
+
+	/* The transport outlives the handle. */
+	CHECK (ping_setopt (obj2, PING_OPT_TRANSPORT, t) == 0);
+	ping_transport_destroy (t);
+	CHECK (t->refcount == 2);
+	ping_destroy (obj1);
+	ping_destroy (obj2);
+} /* void test_transport */
+
+/*
+ * SipHash, see ping_sweep(3).
+ */
+static void test_siphash (void)
+{
+	/* The key and message are the bytes 0 to 15; the expected value is
+	 * that of the reference implementation for these bytes. */
+	uint64_t key[2] = { 0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL };
+	uint64_t m[2] = { 0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL };
+	struct ping_sweep sw;
+
+	CHECK (ping_siphash24 (key, m) == 0x3f2acc7f57c29bdbULL);
+
+	/* Cookies depend on the key, the index and the send time. */
+	memset (&sw, 0, sizeof (sw));
+	sw.key[0] = key[0];
+	sw.key[1] = key[1];
+	m[0] = 42;
+	m[1] = (((uint64_t) 1000) << 32) | 500;
+	CHECK (ping_sweep_cookie (&sw, 42, 1000, 500) == ping_siphash24 (key, m));
+	CHECK (ping_sweep_cookie (&sw, 42, 1000, 500)
+			!= ping_sweep_cookie (&sw, 43, 1000, 500));
+	CHECK (ping_sweep_cookie (&sw, 42, 1000, 500)
+			!= ping_sweep_cookie (&sw, 42, 1000, 501));
+	sw.key[1] ^= 1;
+	CHECK (ping_sweep_cookie (&sw, 42, 1000, 500) != ping_siphash24 (key, m));
+} /* void test_siphash */
+
+/* test_sweep_reply passes a reply to the probe of target "index" of "sw",
+ * sent by target "from", to ping_sweep_match(). */
+static void test_sweep_reply_from (struct ping_sweep *sw, uint32_t index,
+		uint32_t from)
+{
+	struct ping_sweep_payload payload;
+	struct sockaddr_storage sa;
+	struct timeval now;
+
+	gettimeofday (&now, NULL);
+	payload.tv_sec = (uint32_t) now.tv_sec;
+	payload.tv_usec = (uint32_t) now.tv_usec;
+	payload.cookie = ping_sweep_cookie (sw, index, payload.tv_sec,
+			payload.tv_usec);
+
+	ping_network_address (&sw->net, from, &sa);
+	ping_sweep_match (sw, (uint16_t) (index >> 16), (uint16_t) index,
+			&((struct sockaddr_in *) &sa)->sin_addr,
+			(const char *) &payload, sizeof (payload), &now);
+} /* void test_sweep_reply_from */
+
+static void test_sweep_reply (struct ping_sweep *sw, uint32_t index)
+{
+	test_sweep_reply_from (sw, index, index);
+} /* void test_sweep_reply */
+
+/*
+ * Sweeps, see ping_sweep(3).
+ */
+static void test_sweep (void)
+{
+	struct ping_sweep sw;
+	pingobj_t *obj;
+	uint32_t i;
+
+	obj = ping_construct ();
+	CHECK (obj != NULL);
+
+	memset (&sw, 0, sizeof (sw));
+	CHECK (ping_network_parse (obj, "test", "10.0.0.0/8", 32, &sw.net) == 0);
+	ping_sweep_key (sw.key);
+
+	/* Duplicates are dropped as long as they are recent. */
+	test_sweep_reply (&sw, 5);
+	test_sweep_reply (&sw, 5);
+	test_sweep_reply (&sw, 6);
+	CHECK (sw.responders == 2);
+
+	for (i = 7; i < 7 + PING_SWEEP_RECENT; i++)
+		test_sweep_reply (&sw, i);
+	test_sweep_reply (&sw, 7 + PING_SWEEP_RECENT - 1);
+	CHECK (sw.responders == 2 + PING_SWEEP_RECENT);
+
+	/* Indexes beyond the slots of the table are told apart. */
+	test_sweep_reply (&sw, 0xABCDEF);
+	test_sweep_reply (&sw, 0xABCDEF - PING_SWEEP_RECENT);
+	test_sweep_reply (&sw, 0xABCDEF);
+	CHECK (sw.responders == 5 + PING_SWEEP_RECENT);
+
+	/* Replies with a bad cookie or from another address are dropped. */
+	i = (uint32_t) sw.responders;
+	test_sweep_reply_from (&sw, 1, 2);
+	ping_sweep_match (&sw, 0, 2, &(struct in_addr) { htonl (0x0a000002) },
+			"12345678abcdefgh", 16, &(struct timeval) { 0, 0 });
+	CHECK (sw.responders == (int) i);
+
+	ping_destroy (obj);
+} /* void test_sweep */
+
+int main (void)
+{
+	test_sketch ();
+	test_history ();
+	test_top ();
+	test_changed ();
+	test_snapshot ();
+	test_event ();
+	test_network ();
+	test_host ();
+	test_range ();
+	test_responders ();
+	test_payload ();
+	test_control ();
+#if HAVE_XDP
+	test_xdp ();
+#endif
+	test_transport ();
+	test_siphash ();
+	test_sweep ();
+
+	if (failures > 0)
+	{
+		fprintf (stderr, "%i checks failed.\n", failures);
+		return (1);
+	}
+
+	return (0);
+} /* int main */